@@ -0,0 +1,237 @@
+#include "CardinalityTracker.h"
+#include "Log.h"
+#include "ShardMerger.h"
+
+#include <string.h>
+#include <math.h>
+
+const uint32_t CARD_SLOT_NUM = CARD_KEY_CAPACITY * 2;
+
+static uint64_t mix64(uint64_t x){
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// 2^-k for every possible register value, filled before main so shard threads only read it
+struct InvPow2Table{
+    InvPow2Table(){
+        for(int i = 0; i < 65; i++){
+            table[i] = ldexp(1.0, -i);
+        }
+    }
+    double table[65];
+};
+static InvPow2Table gInvPow2;
+
+static const double *invPow2(){
+    return gInvPow2.table;
+}
+
+void HllEntry::clear(uint32_t k){
+    key = k;
+    zeros = HLL_REGISTERS;
+    invSum = HLL_REGISTERS;
+    alerted = false;
+    memset(reg, 0, sizeof(reg));
+}
+
+bool HllEntry::add(uint64_t valueHash){
+    uint32_t idx = valueHash >> (64 - HLL_PRECISION);
+    // leading zeros of the remaining bits, the sentinel bit bounds the rank
+    uint64_t w = (valueHash << HLL_PRECISION) | (1ULL << (HLL_PRECISION - 1));
+    uint8_t rank = __builtin_clzll(w) + 1;
+    uint8_t old = reg[idx];
+    if(rank <= old){
+        return false;
+    }
+    const double *inv = invPow2();
+    invSum += inv[rank] - inv[old];
+    if(old == 0){
+        zeros--;
+    }
+    reg[idx] = rank;
+    return true;
+}
+
+void HllEntry::merge(const HllEntry &other){
+    const double *inv = invPow2();
+    for(uint32_t i = 0; i < HLL_REGISTERS; i++){
+        if(other.reg[i] > reg[i]){
+            invSum += inv[other.reg[i]] - inv[reg[i]];
+            if(reg[i] == 0){
+                zeros--;
+            }
+            reg[i] = other.reg[i];
+        }
+    }
+}
+
+double HllEntry::estimate() const{
+    const double m = HLL_REGISTERS;
+    const double alpha = 0.7213 / (1 + 1.079 / m);
+    double e = alpha * m * m / invSum;
+    // small range correction, linear counting
+    if(e <= 2.5 * m && zeros > 0){
+        e = m * log(m / zeros);
+    }
+    return e;
+}
+
+//=================================================================================
+CardinalityTracker::CardinalityTracker(const char *name, uint32_t threshold){
+    this->name = name;
+    this->threshold = threshold;
+    slotKey = new uint32_t[CARD_SLOT_NUM];
+    slotIdx = new uint32_t[CARD_SLOT_NUM];
+    entries = new HllEntry[CARD_KEY_CAPACITY];
+    used = 0;
+    windowStartUs = 0;
+    merger = NULL;
+    shard = 0;
+    slot = 0;
+    dropped = 0;
+    alerts = 0;
+    fd = NULL;
+    memset(slotIdx, 0, sizeof(uint32_t) * CARD_SLOT_NUM);
+}
+
+CardinalityTracker::~CardinalityTracker(){
+    if(merger || alerts || dropped){
+        LOG_DEBUG("cardinality %s alerts %lu dropped %lu\n", name, alerts, dropped);
+    }
+    if(fd){
+        fclose(fd);
+    }
+    delete []slotKey;
+    delete []slotIdx;
+    delete []entries;
+}
+
+HllEntry *CardinalityTracker::find(uint32_t key) const{
+    uint32_t mask = CARD_SLOT_NUM - 1;
+    uint32_t i = (uint32_t)mix64(key) & mask;
+    while(slotIdx[i] != 0){
+        if(slotKey[i] == key){
+            return &entries[slotIdx[i] - 1];
+        }
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+HllEntry *CardinalityTracker::findOrInsert(uint32_t key){
+    uint32_t mask = CARD_SLOT_NUM - 1;
+    uint32_t i = (uint32_t)mix64(key) & mask;
+    while(slotIdx[i] != 0){
+        if(slotKey[i] == key){
+            return &entries[slotIdx[i] - 1];
+        }
+        i = (i + 1) & mask;
+    }
+    // table is full for this window, new keys are not tracked
+    if(used >= CARD_KEY_CAPACITY){
+        return NULL;
+    }
+    HllEntry *entry = &entries[used++];
+    entry->clear(key);
+    slotKey[i] = key;
+    slotIdx[i] = used;
+    return entry;
+}
+
+void CardinalityTracker::setMerger(ShardMerger *merger, uint32_t shard, uint32_t slot){
+    this->merger = merger;
+    this->shard = shard;
+    this->slot = slot;
+}
+
+void CardinalityTracker::update(uint32_t key, uint64_t value, uint64_t tsUs){
+    // windows are aligned so that shards agree on them
+    uint64_t start = tsUs - tsUs % CARD_WINDOW_US;
+    if(windowStartUs == 0){
+        windowStartUs = start;
+    }else if(start > windowStartUs){
+        endWindow();
+        windowStartUs = start;
+    }
+
+    HllEntry *entry = findOrInsert(key);
+    if(entry == NULL){
+        dropped++;
+        return;
+    }
+    // the estimate only moves when a register grows
+    if(entry->add(mix64(value)) && !entry->alerted && entry->estimate() >= threshold){
+        entry->alerted = true;
+        alert(*entry, tsUs);
+    }
+}
+
+double CardinalityTracker::estimate(uint32_t key) const{
+    HllEntry *entry = find(key);
+    return entry ? entry->estimate() : 0;
+}
+
+void CardinalityTracker::merge(const CardinalityTracker &other){
+    if(windowStartUs == 0){
+        windowStartUs = other.windowStartUs;
+    }
+    for(uint32_t i = 0; i < other.used; i++){
+        const HllEntry &o = other.entries[i];
+        HllEntry *entry = findOrInsert(o.key);
+        if(entry == NULL){
+            dropped++;
+            continue;
+        }
+        entry->merge(o);
+        entry->alerted = entry->alerted || o.alerted;
+    }
+}
+
+// a key spread over shards may only cross the threshold once merged
+void CardinalityTracker::checkAlerts(){
+    for(uint32_t i = 0; i < used; i++){
+        if(!entries[i].alerted && entries[i].estimate() >= threshold){
+            entries[i].alerted = true;
+            alert(entries[i], windowStartUs);
+        }
+    }
+}
+
+void CardinalityTracker::endWindow(){
+    if(merger){
+        merger->addCardinality(shard, slot, windowStartUs, *this);
+    }
+    reset();
+}
+
+void CardinalityTracker::close(){
+    if(windowStartUs != 0){
+        endWindow();
+    }
+}
+
+void CardinalityTracker::reset(){
+    memset(slotIdx, 0, sizeof(uint32_t) * CARD_SLOT_NUM);
+    used = 0;
+}
+
+void CardinalityTracker::alert(const HllEntry &entry, uint64_t tsUs){
+    alerts++;
+    LOG_WARN("cardinality alert %s %s distinct %.0f threshold %u\n", name, TransferToIp(entry.key).c_str(), entry.estimate(), threshold);
+    if(fd == NULL){
+        fd = fopen(CARD_ALERT_FILE, "a");
+        if(fd == NULL){
+            LOG_DEBUG("fd create fail\n");
+            return;
+        }
+        // shards append to the same file, keep lines whole
+        setvbuf(fd, NULL, _IOLBF, 0);
+    }
+    fprintf(fd, "%lu %s %s distinct %.0f threshold %u\n", tsUs / 1000000, name, TransferToIp(entry.key).c_str(), entry.estimate(), threshold);
+    fflush(fd);
+}
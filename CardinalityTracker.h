@@ -0,0 +1,108 @@
+#ifndef CARDINALITY_TRACKER_H
+#define CARDINALITY_TRACKER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// 基数统计: 每个 key 一组 HyperLogLog 寄存器, 用于 SYN flood / 端口扫描检测
+// key 表大小固定, 按窗口清空, 攻击流量下内存和每包开销都有上限
+
+const uint32_t HLL_PRECISION = 8;
+const uint32_t HLL_REGISTERS = 1 << HLL_PRECISION;     // ~6.5% standard error
+const uint32_t CARD_KEY_CAPACITY = 4096;                // keys per window, must be power of 2
+const uint64_t CARD_WINDOW_US = 10000000;
+const uint32_t CARD_DST_ALERT = 1000;                   // distinct sources per destination
+const uint32_t CARD_SRC_ALERT = 500;                    // distinct destination endpoints per source
+
+class ShardMerger;
+
+#define CARD_ALERT_FILE "output/alerts.out"
+
+/*
+ *@brief 单个 key 的 HLL, 倒数和与零寄存器数增量维护, 估计为 O(1)
+ */
+struct HllEntry{
+    uint32_t key;
+    uint32_t zeros;
+    double invSum;              // sum of 2^-register
+    bool alerted;
+    uint8_t reg[HLL_REGISTERS];
+
+    void clear(uint32_t k);
+
+    // true when a register grew
+    bool add(uint64_t valueHash);
+
+    void merge(const HllEntry &other);
+
+    double estimate() const;
+};
+
+class CardinalityTracker{
+public:
+    // name is used in alerts, threshold is the estimate that fires one
+    CardinalityTracker(const char *name, uint32_t threshold);
+
+    ~CardinalityTracker();
+
+    // count value as seen under key
+    void update(uint32_t key, uint64_t value, uint64_t tsUs);
+
+    // current window estimate, 0 for unknown keys
+    double estimate(uint32_t key) const;
+
+    // fold in another shard's tracker of the same window
+    void merge(const CardinalityTracker &other);
+
+    // hand finished windows to the merger, slot tells the trackers of a shard apart
+    void setMerger(ShardMerger *merger, uint32_t shard, uint32_t slot);
+
+    // alert keys over the threshold that have not fired yet
+    void checkAlerts();
+
+    // finish the current window
+    void endWindow();
+
+    void close();
+
+    void reset();
+
+    const char *getName() const{
+        return name;
+    }
+
+    uint32_t getThreshold() const{
+        return threshold;
+    }
+
+    uint64_t getDropped() const{
+        return dropped;
+    }
+
+private:
+    HllEntry *find(uint32_t key) const;
+
+    HllEntry *findOrInsert(uint32_t key);
+
+    void alert(const HllEntry &entry, uint64_t tsUs);
+
+    const char *name;
+    uint32_t threshold;
+
+    // compact open addressing table, key -> entry index + 1
+    uint32_t *slotKey;
+    uint32_t *slotIdx;
+    // register blocks handed out in insertion order
+    HllEntry *entries;
+    uint32_t used;
+
+    uint64_t windowStartUs;
+    ShardMerger *merger;
+    uint32_t shard;
+    uint32_t slot;
+    uint64_t dropped;           // updates for keys that did not fit
+    uint64_t alerts;
+    FILE *fd;
+};
+
+#endif //CARDINALITY_TRACKER_H
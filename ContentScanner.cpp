@@ -0,0 +1,58 @@
+#include "ContentScanner.h"
+#include "Log.h"
+#include "Tool.h"
+
+ContentScanner::ContentScanner(const PatternMatcher *matcher, const RegexSet *rules, const char *filename){
+    pMatcher = matcher;
+    pRules = rules;
+    pDfa = rules ? new LazyDfa(rules) : NULL;
+    path = filename;
+    fd = NULL;
+    scanned = 0;
+    matches = 0;
+}
+
+ContentScanner::~ContentScanner(){
+    if(fd){
+        fclose(fd);
+    }
+    LOG_INFO("%s: scanned %lu bytes, %lu matches\n", path.c_str(), scanned, matches);
+    if(pDfa){
+        pDfa->report();
+        delete pDfa;
+    }
+}
+
+void ContentScanner::write(const NetTuple5 &tuple, Direct direct, uint64_t offset, const char *kind, const std::string &name){
+    if(fd == NULL){
+        fd = fopen(path.c_str(), "a");
+        if(fd == NULL){
+            LOG_ERROR("%s open fail\n", path.c_str());
+            return;
+        }
+    }
+    fprintf(fd, "%s:%u %s %s:%u offset %lu %s %s\n",
+        TransferToIp(tuple.saddr).c_str(), tuple.sport, direct == Cli2Ser ? "===>" : "<===",
+        TransferToIp(tuple.daddr).c_str(), tuple.dport, offset, kind, name.c_str());
+    matches++;
+}
+
+void ContentScanner::scan(const NetTuple5 &tuple, Direct direct, AssemableInfo *stream, uint64_t streamOff, const u_char *data, uint32_t len){
+    scanned += len;
+    if(pMatcher){
+        // a match spanning segments starts before data, so its offset can be below streamOff
+        stream->matchState = pMatcher->scan(stream->matchState, data, len, [&](uint32_t id, uint32_t end){
+            const PatternInfo &info = pMatcher->getPattern(id);
+            write(tuple, direct, streamOff + end - info.len, "pattern", info.name);
+        });
+    }
+    if(pDfa){
+        if(stream->pRegex == NULL){
+            stream->pRegex = new RegexCursor();
+        }
+        // a regex has no fixed length, the offset is where the first match ends
+        pDfa->scan(*stream->pRegex, data, len, [&](uint32_t rule, uint32_t end){
+            write(tuple, direct, streamOff + end, "rule", pRules->getName(rule));
+        });
+    }
+}
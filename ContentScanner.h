@@ -0,0 +1,41 @@
+#ifndef CONTENT_SCANNER_H
+#define CONTENT_SCANNER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#include "Packet.h"
+#include "PatternMatcher.h"
+#include "RegexEngine.h"
+
+// 重组流的内容检测: 固定模式 (PatternMatcher) 和正则规则 (RegexSet) 都在这里跑,
+// 每个 SessMgr 一个, 命中写到自己的文件里
+
+#define MATCH_REPORT_FILE "output/matches.out"
+
+class ContentScanner{
+public:
+    // either may be NULL, both are shared read only
+    ContentScanner(const PatternMatcher *matcher, const RegexSet *rules, const char *path);
+
+    ~ContentScanner();
+
+    // new in order bytes of one direction, streamOff is where data starts in the stream,
+    // stream carries the matcher state between segments
+    void scan(const NetTuple5 &tuple, Direct direct, AssemableInfo *stream, uint64_t streamOff, const u_char *data, uint32_t len);
+
+private:
+    // one line per hit, offset counted from the start of the direction's stream
+    void write(const NetTuple5 &tuple, Direct direct, uint64_t offset, const char *kind, const std::string &name);
+
+    const PatternMatcher *pMatcher;
+    LazyDfa *pDfa;              // own cache over the shared rules
+    const RegexSet *pRules;
+    std::string path;
+    FILE *fd;                   // opened with the first match
+    uint64_t scanned;
+    uint64_t matches;
+};
+
+#endif //CONTENT_SCANNER_H
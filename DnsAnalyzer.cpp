@@ -0,0 +1,411 @@
+#include "DnsAnalyzer.h"
+#include "HugeMem.h"
+#include "Log.h"
+
+#include <string.h>
+#include <ctype.h>
+
+static uint32_t dnsKeyHash(uint32_t client, uint16_t cport, uint32_t resolver, uint16_t txid){
+    uint64_t h = ((uint64_t)client << 32) | resolver;
+    h ^= ((uint64_t)cport << 16 | txid) * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return (uint32_t)h;
+}
+
+// skip a (possibly compressed) name, return offset after it or -1
+static int skipName(const Byte *buf, uint32_t len, uint32_t off){
+    while(off < len){
+        uint8_t l = buf[off];
+        if(l == 0){
+            return off + 1;
+        }
+        if((l & 0xC0) == 0xC0){
+            return (off + 2 <= len) ? (int)(off + 2) : -1;
+        }
+        off += l + 1;
+    }
+    return -1;
+}
+
+static uint16_t readU16(const Byte *p){
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t readU32(const Byte *p){
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+DnsAnalyzer::DnsAnalyzer(int numaNode){
+    // zeroed by hugeAlloc
+    inflight = (DnsInflight *)hugeAlloc(sizeof(DnsInflight) * DNS_INFLIGHT_SIZE, numaNode);
+    inflightNum = 0;
+    resolvers = (DnsResolverStat *)hugeAlloc(sizeof(DnsResolverStat) * DNS_RESOLVER_SIZE, numaNode);
+    resolverNum = 0;
+
+    lastFlushUs = 0;
+    lastExpireUs = 0;
+    fd = NULL;
+
+    totalQuery = 0;
+    totalResponse = 0;
+    totalTimeout = 0;
+    inflightFull = 0;
+    resolverFull = 0;
+    malformed = 0;
+}
+
+DnsAnalyzer::~DnsAnalyzer(){
+    // remaining queries never got an answer
+    for(uint32_t i = 0; i < DNS_INFLIGHT_SIZE; i++){
+        if(inflight[i].used){
+            DnsResolverStat *stat = getResolver(inflight[i].resolver);
+            if(stat){
+                stat->timeouts++;
+            }
+            totalTimeout++;
+        }
+    }
+    flush(lastExpireUs);
+    LOG_DEBUG("dns query %lu\ndns response %lu\ndns timeout %lu\ndns inflight full %lu\ndns resolver full %lu\ndns malformed %lu\n",
+        totalQuery,totalResponse,totalTimeout,inflightFull,resolverFull,malformed);
+
+    if(fd){
+        fclose(fd);
+    }
+    hugeFree(inflight, sizeof(DnsInflight) * DNS_INFLIGHT_SIZE);
+    hugeFree(resolvers, sizeof(DnsResolverStat) * DNS_RESOLVER_SIZE);
+}
+
+bool DnsAnalyzer::decode(const Byte *buf, uint32_t len, DnsMessage &msg){
+    if(len < DNS_HEADER_LENGTH){
+        return false;
+    }
+    msg.txid = readU16(buf);
+    uint16_t flags = readU16(buf + 2);
+    msg.isResponse = (flags & 0x8000) != 0;
+    msg.opcode = (flags >> 11) & 0x0F;
+    msg.rcode = flags & 0x0F;
+    msg.qdcount = readU16(buf + 4);
+    msg.ancount = readU16(buf + 6);
+    msg.qtype = 0;
+    msg.qclass = 0;
+    msg.qnameHash = 0;
+    msg.minTtl = 0;
+    msg.answerA = 0;
+    msg.answerAAAA = 0;
+    msg.answerCNAME = 0;
+    msg.qname[0] = '\0';
+
+    uint32_t off = DNS_HEADER_LENGTH;
+    if(msg.qdcount > 0){
+        // first question, labels are copied into the fixed qname buffer
+        uint32_t namelen = 0;
+        while(true){
+            if(off >= len){
+                return false;
+            }
+            uint8_t l = buf[off];
+            if(l == 0){
+                off++;
+                break;
+            }
+            if((l & 0xC0) != 0 || off + 1 + l > len){
+                return false;
+            }
+            for(uint32_t i = 0; i <= l && namelen < sizeof(msg.qname) - 1; i++){
+                char c = (i == 0) ? '.' : (char)tolower(buf[off + i]);
+                if(i == 0 && namelen == 0){
+                    continue;
+                }
+                msg.qname[namelen++] = c;
+                msg.qnameHash = msg.qnameHash * 131 + (uint8_t)c;
+            }
+            off += l + 1;
+        }
+        msg.qname[namelen] = '\0';
+        if(off + 4 > len){
+            return false;
+        }
+        msg.qtype = readU16(buf + off);
+        msg.qclass = readU16(buf + off + 2);
+        off += 4;
+
+        // further questions are rare, just skip them
+        for(uint16_t q = 1; q < msg.qdcount; q++){
+            int next = skipName(buf, len, off);
+            if(next < 0 || (uint32_t)next + 4 > len){
+                return false;
+            }
+            off = next + 4;
+        }
+    }
+
+    if(!msg.isResponse){
+        return true;
+    }
+
+    for(uint16_t a = 0; a < msg.ancount; a++){
+        int next = skipName(buf, len, off);
+        if(next < 0 || (uint32_t)next + 10 > len){
+            // truncated answer section still counts as a response
+            break;
+        }
+        off = next;
+        uint16_t type = readU16(buf + off);
+        uint32_t ttl = readU32(buf + off + 4);
+        uint16_t rdlen = readU16(buf + off + 8);
+        off += 10 + rdlen;
+
+        if(type == 1){
+            msg.answerA++;
+        }else if(type == 28){
+            msg.answerAAAA++;
+        }else if(type == 5){
+            msg.answerCNAME++;
+        }
+        if(a == 0 || ttl < msg.minTtl){
+            msg.minTtl = ttl;
+        }
+        if(off > len){
+            break;
+        }
+    }
+    return true;
+}
+
+void DnsAnalyzer::process(Packet *pkt){
+    assert(pkt->udp);
+    uint64_t nowUs = pkt->getTsUs();
+    if(lastFlushUs == 0){
+        lastFlushUs = lastExpireUs = nowUs;
+    }
+
+    DnsMessage msg;
+    if(!decode(pkt->getUdpData(), pkt->getUdpDatalen(), msg)){
+        malformed++;
+    }else{
+        uint32_t saddr = ntohl(*(uint32_t *)pkt->ip->sourceIP);
+        uint32_t daddr = ntohl(*(uint32_t *)pkt->ip->destIP);
+        if(msg.isResponse){
+            onResponse(daddr, ntohs(pkt->udp->dport), saddr, msg, nowUs);
+        }else{
+            onQuery(saddr, ntohs(pkt->udp->sport), daddr, msg, nowUs);
+        }
+    }
+
+    if(nowUs >= lastExpireUs + DNS_EXPIRE_INTERVAL_US){
+        expire(nowUs);
+    }
+    if(nowUs >= lastFlushUs + DNS_FLUSH_INTERVAL_US){
+        flush(nowUs);
+    }
+}
+
+// linear probing, returns the matching slot, the first free slot or DNS_INFLIGHT_SIZE when full
+uint32_t DnsAnalyzer::inflightIndex(uint32_t client, uint16_t cport, uint32_t resolver, uint16_t txid){
+    uint32_t mask = DNS_INFLIGHT_SIZE - 1;
+    uint32_t idx = dnsKeyHash(client, cport, resolver, txid) & mask;
+    for(uint32_t n = 0; n < DNS_INFLIGHT_SIZE; n++){
+        DnsInflight &e = inflight[idx];
+        if(!e.used){
+            return idx;
+        }
+        if(e.txid == txid && e.client == client && e.cport == cport && e.resolver == resolver){
+            return idx;
+        }
+        idx = (idx + 1) & mask;
+    }
+    return DNS_INFLIGHT_SIZE;
+}
+
+// backward shift deletion, keeps probe chains intact without tombstones
+void DnsAnalyzer::inflightErase(uint32_t idx){
+    uint32_t mask = DNS_INFLIGHT_SIZE - 1;
+    uint32_t hole = idx;
+    uint32_t j = idx;
+    while(true){
+        j = (j + 1) & mask;
+        DnsInflight &e = inflight[j];
+        if(!e.used){
+            break;
+        }
+        uint32_t home = dnsKeyHash(e.client, e.cport, e.resolver, e.txid) & mask;
+        bool stay = (hole <= j) ? (hole < home && home <= j) : (hole < home || home <= j);
+        if(stay){
+            continue;
+        }
+        inflight[hole] = e;
+        hole = j;
+    }
+    inflight[hole].used = 0;
+    inflightNum--;
+}
+
+void DnsAnalyzer::onQuery(uint32_t client, uint16_t cport, uint32_t resolver, const DnsMessage &msg, uint64_t nowUs){
+    totalQuery++;
+    DnsResolverStat *stat = getResolver(resolver);
+    if(stat){
+        stat->queries++;
+    }
+
+    // keep load factor below 3/4 so probe chains stay short
+    if(inflightNum >= DNS_INFLIGHT_SIZE / 4 * 3){
+        inflightFull++;
+        return;
+    }
+    uint32_t idx = inflightIndex(client, cport, resolver, msg.txid);
+    if(idx == DNS_INFLIGHT_SIZE){
+        inflightFull++;
+        return;
+    }
+    DnsInflight &e = inflight[idx];
+    if(e.used){
+        // client retransmission, latency is measured from the first query
+        return;
+    }
+    e.client = client;
+    e.cport = cport;
+    e.resolver = resolver;
+    e.txid = msg.txid;
+    e.qtype = msg.qtype;
+    e.tsUs = nowUs;
+    e.used = 1;
+    inflightNum++;
+}
+
+void DnsAnalyzer::onResponse(uint32_t client, uint16_t cport, uint32_t resolver, const DnsMessage &msg, uint64_t nowUs){
+    totalResponse++;
+    DnsResolverStat *stat = getResolver(resolver);
+    if(stat){
+        stat->responses++;
+        stat->rcode[msg.rcode & (DNS_RCODE_NUM - 1)]++;
+    }
+
+    uint32_t idx = inflightIndex(client, cport, resolver, msg.txid);
+    if(idx == DNS_INFLIGHT_SIZE || !inflight[idx].used){
+        if(stat){
+            stat->unmatched++;
+        }
+        return;
+    }
+
+    uint64_t latency = (nowUs > inflight[idx].tsUs) ? nowUs - inflight[idx].tsUs : 0;
+    inflightErase(idx);
+    if(!stat){
+        return;
+    }
+    if(latency > 0xFFFFFFFFULL){
+        latency = 0xFFFFFFFFULL;
+    }
+    uint32_t lat = (uint32_t)latency;
+    uint32_t bucket = 31 - __builtin_clz(lat | 1);
+    if(bucket >= DNS_LATENCY_BUCKETS){
+        bucket = DNS_LATENCY_BUCKETS - 1;
+    }
+    stat->latency[bucket]++;
+    stat->latencySumUs += lat;
+    if(stat->responses - stat->unmatched == 1 || lat < stat->latencyMinUs){
+        stat->latencyMinUs = lat;
+    }
+    if(lat > stat->latencyMaxUs){
+        stat->latencyMaxUs = lat;
+    }
+}
+
+void DnsAnalyzer::expire(uint64_t nowUs){
+    uint32_t i = 0;
+    while(i < DNS_INFLIGHT_SIZE){
+        DnsInflight &e = inflight[i];
+        if(e.used && nowUs > e.tsUs + DNS_QUERY_TIMEOUT_US){
+            DnsResolverStat *stat = getResolver(e.resolver);
+            if(stat){
+                stat->timeouts++;
+            }
+            totalTimeout++;
+            // erase may shift the next entry into slot i, look at it again
+            inflightErase(i);
+            continue;
+        }
+        i++;
+    }
+    lastExpireUs = nowUs;
+}
+
+DnsResolverStat *DnsAnalyzer::getResolver(uint32_t resolver){
+    uint32_t mask = DNS_RESOLVER_SIZE - 1;
+    uint32_t idx = (resolver * 2654435761U) & mask;
+    for(uint32_t n = 0; n < DNS_RESOLVER_SIZE; n++){
+        DnsResolverStat &stat = resolvers[idx];
+        if(stat.used && stat.resolver == resolver){
+            return &stat;
+        }
+        if(!stat.used){
+            if(resolverNum >= DNS_RESOLVER_SIZE / 4 * 3){
+                break;
+            }
+            stat.used = 1;
+            stat.resolver = resolver;
+            resolverNum++;
+            return &stat;
+        }
+        idx = (idx + 1) & mask;
+    }
+    resolverFull++;
+    return NULL;
+}
+
+// upper bound of the histogram bucket holding the given percentile
+static uint32_t latencyPercentile(const DnsResolverStat &stat, uint32_t percent){
+    uint32_t total = 0;
+    for(uint32_t i = 0; i < DNS_LATENCY_BUCKETS; i++){
+        total += stat.latency[i];
+    }
+    if(total == 0){
+        return 0;
+    }
+    uint32_t want = (total * percent + 99) / 100;
+    uint32_t seen = 0;
+    for(uint32_t i = 0; i < DNS_LATENCY_BUCKETS; i++){
+        seen += stat.latency[i];
+        if(seen >= want){
+            return (2U << i) - 1;
+        }
+    }
+    return stat.latencyMaxUs;
+}
+
+// write one batch with a line per active resolver, then start a new period
+void DnsAnalyzer::flush(uint64_t nowUs){
+    if(resolverNum > 0){
+        if(fd == NULL){
+            fd = fopen(DNS_STATS_FILE, "a");
+            if(fd == NULL){
+                LOG_DEBUG("fd create fail\n");
+            }else{
+                // shards append to the same file, keep lines whole
+                setvbuf(fd, NULL, _IOLBF, 0);
+            }
+        }
+        if(fd){
+            for(uint32_t i = 0; i < DNS_RESOLVER_SIZE; i++){
+                const DnsResolverStat &stat = resolvers[i];
+                if(!stat.used){
+                    continue;
+                }
+                uint32_t matched = stat.responses - stat.unmatched;
+                fprintf(fd, "%lu %s query %u response %u timeout %u unmatched %u latency_us avg %lu min %u p50 %u p99 %u max %u"
+                    " noerror %u servfail %u nxdomain %u refused %u\n",
+                    nowUs / 1000000, TransferToIp(stat.resolver).c_str(), stat.queries, stat.responses, stat.timeouts, stat.unmatched,
+                    matched ? stat.latencySumUs / matched : 0, stat.latencyMinUs, latencyPercentile(stat, 50),
+                    latencyPercentile(stat, 99), stat.latencyMaxUs,
+                    stat.rcode[0], stat.rcode[2], stat.rcode[3], stat.rcode[5]);
+            }
+            fflush(fd);
+        }
+    }
+    memset(resolvers, 0, sizeof(DnsResolverStat) * DNS_RESOLVER_SIZE);
+    resolverNum = 0;
+    lastFlushUs = nowUs;
+}
@@ -0,0 +1,138 @@
+#ifndef DNS_ANALYZER_H
+#define DNS_ANALYZER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "Packet.h"
+#include "StructDefine.h"
+
+// DNS 事务匹配: query/response 按 (client ip:port, resolver, txid) 配对
+// 所有状态都在固定大小的数组里, 每个查询不做堆分配
+
+const uint16_t DNS_PORT = 53;
+const uint32_t DNS_INFLIGHT_SIZE = 65536;           // must be power of 2
+const uint32_t DNS_RESOLVER_SIZE = 1024;            // must be power of 2
+const uint64_t DNS_QUERY_TIMEOUT_US = 5000000;      // 5s without response -> timeout
+const uint64_t DNS_EXPIRE_INTERVAL_US = 1000000;     // inflight sweep period
+const uint64_t DNS_FLUSH_INTERVAL_US = 10000000;    // aggregates batch period
+const uint32_t DNS_LATENCY_BUCKETS = 20;            // log2(us) histogram
+const uint32_t DNS_RCODE_NUM = 16;
+
+#define DNS_STATS_FILE "output/dns_stats.out"
+
+#pragma pack(1)
+struct dns_hdr{
+    u_short id;
+    u_short flags;
+    u_short qdcount;
+    u_short ancount;
+    u_short nscount;
+    u_short arcount;
+}__attribute__((packed));
+#pragma pack()
+
+const u_int DNS_HEADER_LENGTH = sizeof(struct dns_hdr);
+
+/*
+ *@brief 解码后的 DNS 报文, 指向原始数据, 不拥有内存
+ */
+struct DnsMessage{
+    uint16_t txid;
+    bool isResponse;
+    uint8_t opcode;
+    uint8_t rcode;
+    uint16_t qdcount;
+    uint16_t ancount;
+    uint16_t qtype;
+    uint16_t qclass;
+    uint32_t qnameHash;
+    uint32_t minTtl;                // smallest answer TTL
+    uint16_t answerA;               // A / AAAA / CNAME answers seen
+    uint16_t answerAAAA;
+    uint16_t answerCNAME;
+    char qname[256];                // dotted question name, truncated
+};
+
+/*
+ *@brief 等待响应的查询, open-addressing 表中的一项
+ */
+struct DnsInflight{
+    uint32_t client;
+    uint32_t resolver;
+    uint16_t cport;
+    uint16_t txid;
+    uint16_t qtype;
+    uint16_t used;
+    uint64_t tsUs;                  // query capture time
+};
+
+/*
+ *@brief 每个 resolver 在一个统计周期内的聚合
+ */
+struct DnsResolverStat{
+    uint32_t resolver;
+    uint32_t used;
+    uint32_t queries;
+    uint32_t responses;
+    uint32_t timeouts;
+    uint32_t unmatched;             // response without query
+    uint64_t latencySumUs;
+    uint32_t latencyMinUs;
+    uint32_t latencyMaxUs;
+    uint32_t latency[DNS_LATENCY_BUCKETS];
+    uint32_t rcode[DNS_RCODE_NUM];
+};
+
+class DnsAnalyzer{
+public:
+    // tables placed on numaNode, -1 for anywhere
+    DnsAnalyzer(int numaNode = -1);
+
+    ~DnsAnalyzer();
+
+    static bool isDns(Packet *pkt){
+        return pkt->udp && (ntohs(pkt->udp->sport) == DNS_PORT || ntohs(pkt->udp->dport) == DNS_PORT);
+    }
+
+    // udp packet to or from port 53
+    void process(Packet *pkt);
+
+    // decode header, first question and answer section in place
+    static bool decode(const Byte *buf, uint32_t len, DnsMessage &msg);
+
+private:
+    void onQuery(uint32_t client, uint16_t cport, uint32_t resolver, const DnsMessage &msg, uint64_t nowUs);
+
+    void onResponse(uint32_t client, uint16_t cport, uint32_t resolver, const DnsMessage &msg, uint64_t nowUs);
+
+    uint32_t inflightIndex(uint32_t client, uint16_t cport, uint32_t resolver, uint16_t txid);
+
+    void inflightErase(uint32_t idx);
+
+    void expire(uint64_t nowUs);
+
+    DnsResolverStat *getResolver(uint32_t resolver);
+
+    void flush(uint64_t nowUs);
+
+    DnsInflight *inflight;
+    uint32_t inflightNum;
+    DnsResolverStat *resolvers;
+    uint32_t resolverNum;
+
+    uint64_t lastFlushUs;
+    uint64_t lastExpireUs;
+    FILE *fd;
+
+    // totals over the whole run
+    uint64_t totalQuery;
+    uint64_t totalResponse;
+    uint64_t totalTimeout;
+    uint64_t inflightFull;
+    uint64_t resolverFull;
+    uint64_t malformed;
+};
+
+#endif //DNS_ANALYZER_H
@@ -0,0 +1,536 @@
+#include "FlowColumn.h"
+#include "Log.h"
+
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <lz4.h>
+
+static const char FLOWCOL_MAGIC[8] = {'F', 'L', 'O', 'W', 'C', 'O', 'L', '1'};
+
+struct FlowColDef{
+    const char *name;
+    uint8_t type;
+    uint16_t offset;            // field in FlowRecord
+};
+
+static const FlowColDef FLOW_COLUMNS[FC_COLUMN_NUM] = {
+    {"saddr",       FLOWCOL_U32,  offsetof(FlowRecord, saddr)},
+    {"daddr",       FLOWCOL_U32,  offsetof(FlowRecord, daddr)},
+    {"sport",       FLOWCOL_U16,  offsetof(FlowRecord, sport)},
+    {"dport",       FLOWCOL_U16,  offsetof(FlowRecord, dport)},
+    {"proto",       FLOWCOL_U8,   offsetof(FlowRecord, proto)},
+    {"tcp_flags",   FLOWCOL_U8,   offsetof(FlowRecord, tcpFlags)},
+    {"first_us",    FLOWCOL_U64,  offsetof(FlowRecord, firstUs)},
+    {"last_us",     FLOWCOL_U64,  offsetof(FlowRecord, lastUs)},
+    {"cli_pkts",    FLOWCOL_U32,  offsetof(FlowRecord, cliPkts)},
+    {"ser_pkts",    FLOWCOL_U32,  offsetof(FlowRecord, serPkts)},
+    {"cli_bytes",   FLOWCOL_U64,  offsetof(FlowRecord, cliBytes)},
+    {"ser_bytes",   FLOWCOL_U64,  offsetof(FlowRecord, serBytes)},
+    {"retrans",     FLOWCOL_U32,  offsetof(FlowRecord, retrans)},
+    {"rtt_us",      FLOWCOL_U32,  offsetof(FlowRecord, rttUs)},
+    {"sample_rate", FLOWCOL_U32,  offsetof(FlowRecord, sampleRate)},
+    {"app",         FLOWCOL_DICT, offsetof(FlowRecord, app)},
+};
+
+static uint32_t typeWidth(uint8_t type){
+    switch(type){
+    case FLOWCOL_U8:
+        return 1;
+    case FLOWCOL_U16:
+        return 2;
+    case FLOWCOL_U32:
+    case FLOWCOL_DICT:
+        return 4;
+    default:
+        return 8;
+    }
+}
+
+static uint64_t typeMax(uint8_t type){
+    uint32_t width = typeWidth(type);
+    return (width == 8) ? UINT64_MAX : ((uint64_t)1 << (width * 8)) - 1;
+}
+
+static uint64_t loadValue(const void *p, uint32_t width){
+    switch(width){
+    case 1:{
+        return *(const uint8_t *)p;
+    }
+    case 2:{
+        uint16_t v;
+        memcpy(&v, p, 2);
+        return v;
+    }
+    case 4:{
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+    default:{
+        uint64_t v;
+        memcpy(&v, p, 8);
+        return v;
+    }
+    }
+}
+
+uint64_t FlowColBatch::value(uint32_t column, uint32_t row) const{
+    uint32_t width = typeWidth(FLOW_COLUMNS[column].type);
+    return loadValue((const uint8_t *)col[column] + (uint64_t)row * width, width);
+}
+
+// ===============================================================
+FlowColumnWriter::FlowColumnWriter(){
+    fd = NULL;
+    fileOff = 0;
+    rows = 0;
+    totalRows = 0;
+    rawBytes = 0;
+    packedBytes = 0;
+}
+
+FlowColumnWriter::~FlowColumnWriter(){
+    close();
+}
+
+int FlowColumnWriter::open(const char *filename){
+    fd = fopen(filename, "wb");
+    if(fd == NULL){
+        LOG_ERROR("create %s fail\n", filename);
+        return -1;
+    }
+    path = filename;
+
+    FlowColFileHeader header;
+    memcpy(header.magic, FLOWCOL_MAGIC, sizeof(header.magic));
+    header.version = FLOWCOL_VERSION;
+    header.columnNum = FC_COLUMN_NUM;
+    fwrite(&header, sizeof(header), 1, fd);
+    for(uint32_t c = 0; c < FC_COLUMN_NUM; c++){
+        FlowColSchema schema;
+        memset(&schema, 0, sizeof(schema));
+        strncpy(schema.name, FLOW_COLUMNS[c].name, FLOWCOL_NAME_LEN - 1);
+        schema.type = FLOW_COLUMNS[c].type;
+        fwrite(&schema, sizeof(schema), 1, fd);
+    }
+    fileOff = sizeof(header) + FC_COLUMN_NUM * sizeof(FlowColSchema);
+
+    for(uint32_t c = 0; c < FC_COLUMN_NUM; c++){
+        cols[c].reserve(FLOWCOL_BLOCK_ROWS * typeWidth(FLOW_COLUMNS[c].type));
+    }
+    packBuf.resize(LZ4_compressBound(FLOWCOL_BLOCK_ROWS * 8));
+    return 0;
+}
+
+uint32_t FlowColumnWriter::dictId(const char *str){
+    if(str == NULL){
+        str = "";
+    }
+    std::unordered_map<std::string, uint32_t>::iterator it = dict.find(str);
+    if(it != dict.end()){
+        return it->second;
+    }
+    uint32_t id = dictStrs.size();
+    dict[str] = id;
+    dictStrs.push_back(str);
+    return id;
+}
+
+void FlowColumnWriter::append(const FlowRecord &rec){
+    if(fd == NULL){
+        return;
+    }
+    const uint8_t *p = (const uint8_t *)&rec;
+    for(uint32_t c = 0; c < FC_COLUMN_NUM; c++){
+        const FlowColDef &def = FLOW_COLUMNS[c];
+        uint32_t width = typeWidth(def.type);
+        uint64_t v;
+        if(def.type == FLOWCOL_DICT){
+            const char *str;
+            memcpy(&str, p + def.offset, sizeof(str));
+            v = dictId(str);
+        }else{
+            v = loadValue(p + def.offset, width);
+        }
+        // little endian, the low bytes are the value
+        cols[c].insert(cols[c].end(), (const uint8_t *)&v, (const uint8_t *)&v + width);
+        if(rows == 0 || v < colMin[c]){
+            colMin[c] = v;
+        }
+        if(rows == 0 || v > colMax[c]){
+            colMax[c] = v;
+        }
+    }
+    rows++;
+    totalRows++;
+    if(rows >= FLOWCOL_BLOCK_ROWS){
+        flushBlock();
+    }
+}
+
+void FlowColumnWriter::flushBlock(){
+    if(rows == 0){
+        return;
+    }
+    for(uint32_t c = 0; c < FC_COLUMN_NUM; c++){
+        FlowColChunk chunk;
+        chunk.off = fileOff;
+        chunk.rawSize = cols[c].size();
+        chunk.min = colMin[c];
+        chunk.max = colMax[c];
+
+        int packed = LZ4_compress_default((const char *)&cols[c][0], &packBuf[0], chunk.rawSize, packBuf.size());
+        if(packed > 0 && (uint32_t)packed < chunk.rawSize){
+            chunk.packedSize = packed;
+            fwrite(&packBuf[0], 1, packed, fd);
+        }else{
+            // incompressible, stored as is
+            chunk.packedSize = chunk.rawSize;
+            fwrite(&cols[c][0], 1, chunk.rawSize, fd);
+        }
+        fileOff += chunk.packedSize;
+        rawBytes += chunk.rawSize;
+        packedBytes += chunk.packedSize;
+        chunks.push_back(chunk);
+        cols[c].clear();
+    }
+    blockRows.push_back(rows);
+    rows = 0;
+}
+
+void FlowColumnWriter::close(){
+    if(fd == NULL){
+        return;
+    }
+    flushBlock();
+
+    FlowColTrailer trailer;
+    trailer.footerOff = fileOff;
+    trailer.blockNum = blockRows.size();
+    trailer.rows = totalRows;
+    memcpy(trailer.magic, FLOWCOL_MAGIC, sizeof(trailer.magic));
+
+    for(uint32_t b = 0; b < blockRows.size(); b++){
+        fwrite(&blockRows[b], sizeof(uint32_t), 1, fd);
+        fwrite(&chunks[b * FC_COLUMN_NUM], sizeof(FlowColChunk), FC_COLUMN_NUM, fd);
+    }
+    uint32_t dictNum = dictStrs.size();
+    fwrite(&dictNum, sizeof(dictNum), 1, fd);
+    for(auto &str : dictStrs){
+        uint16_t len = (str.size() < 0xFFFF) ? str.size() : 0xFFFF;
+        fwrite(&len, sizeof(len), 1, fd);
+        fwrite(str.data(), 1, len, fd);
+    }
+    fwrite(&trailer, sizeof(trailer), 1, fd);
+
+    if(ferror(fd)){
+        LOG_ERROR("write %s fail\n", path.c_str());
+    }
+    fclose(fd);
+    fd = NULL;
+    LOG_INFO("flow records %s rows %lu blocks %lu raw %lu packed %lu\n", path.c_str(), totalRows,
+        blockRows.size(), rawBytes, packedBytes);
+}
+
+// ===============================================================
+FlowColumnReader::FlowColumnReader(){
+    fd = -1;
+    base = NULL;
+    size = 0;
+    columnNum = 0;
+    schema = NULL;
+    blockNum = 0;
+    totalRows = 0;
+    skippedBlocks = 0;
+}
+
+FlowColumnReader::~FlowColumnReader(){
+    close();
+}
+
+int FlowColumnReader::open(const char *filename){
+    fd = ::open(filename, O_RDONLY);
+    if(fd < 0){
+        LOG_ERROR("open %s fail\n", filename);
+        return -1;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(FlowColFileHeader) + sizeof(FlowColTrailer)){
+        LOG_ERROR("%s is not a flow record file\n", filename);
+        close();
+        return -1;
+    }
+    size = st.st_size;
+    void *addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if(addr == MAP_FAILED){
+        LOG_ERROR("mmap %s fail\n", filename);
+        close();
+        return -1;
+    }
+    base = (const uint8_t *)addr;
+
+    const FlowColFileHeader *header = (const FlowColFileHeader *)base;
+    const FlowColTrailer *trailer = (const FlowColTrailer *)(base + size - sizeof(FlowColTrailer));
+    if(memcmp(header->magic, FLOWCOL_MAGIC, 8) != 0 || memcmp(trailer->magic, FLOWCOL_MAGIC, 8) != 0){
+        // a writer that did not close leaves no trailer
+        LOG_ERROR("%s is not a complete flow record file\n", filename);
+        close();
+        return -1;
+    }
+    columnNum = header->columnNum;
+    if(header->version != FLOWCOL_VERSION || columnNum != FC_COLUMN_NUM){
+        LOG_ERROR("%s version %u columns %u not supported\n", filename, header->version, columnNum);
+        close();
+        return -1;
+    }
+    uint64_t dataOff = sizeof(FlowColFileHeader) + columnNum * sizeof(FlowColSchema);
+    if(size < dataOff + sizeof(FlowColTrailer)){
+        LOG_ERROR("%s schema is truncated\n", filename);
+        close();
+        return -1;
+    }
+    schema = (const FlowColSchema *)(base + sizeof(FlowColFileHeader));
+    for(uint32_t c = 0; c < columnNum; c++){
+        if(schema[c].type != FLOW_COLUMNS[c].type){
+            LOG_ERROR("%s column %u type mismatch\n", filename, c);
+            close();
+            return -1;
+        }
+    }
+
+    blockNum = trailer->blockNum;
+    totalRows = trailer->rows;
+    // the footer lies between the schema and the trailer; compare sizes before forming pointers,
+    // a footerOff inside the trailer would make end - p negative
+    uint64_t footerEnd = size - sizeof(FlowColTrailer);
+    uint64_t entrySize = sizeof(uint32_t) + columnNum * sizeof(FlowColChunk);
+    if(trailer->footerOff < dataOff || trailer->footerOff > footerEnd
+        || footerEnd - trailer->footerOff < sizeof(uint32_t)
+        || (footerEnd - trailer->footerOff - sizeof(uint32_t)) / entrySize < blockNum){
+        LOG_ERROR("%s footer is truncated\n", filename);
+        close();
+        return -1;
+    }
+    const uint8_t *p = base + trailer->footerOff;
+    const uint8_t *end = base + footerEnd;
+    for(uint64_t b = 0; b < blockNum; b++){
+        blockIndex.push_back(p);
+        p += entrySize;
+    }
+    uint32_t dictNum;
+    memcpy(&dictNum, p, sizeof(dictNum));
+    p += sizeof(dictNum);
+    for(uint32_t i = 0; i < dictNum; i++){
+        uint16_t len;
+        if(end - p < (long)sizeof(len)){
+            break;
+        }
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        if(end - p < len){
+            break;
+        }
+        dictStrs.push_back((const char *)p);
+        dictLens.push_back(len);
+        p += len;
+    }
+    if(dictStrs.size() != dictNum){
+        LOG_ERROR("%s dictionary is truncated\n", filename);
+        close();
+        return -1;
+    }
+
+    for(uint32_t c = 0; c < columnNum; c++){
+        colBuf[c].resize(FLOWCOL_BLOCK_ROWS * typeWidth(FLOW_COLUMNS[c].type));
+    }
+    mask.resize(FLOWCOL_BLOCK_ROWS);
+    sel.resize(FLOWCOL_BLOCK_ROWS);
+    return 0;
+}
+
+void FlowColumnReader::close(){
+    if(base){
+        munmap((void *)base, size);
+        base = NULL;
+    }
+    if(fd >= 0){
+        ::close(fd);
+        fd = -1;
+    }
+    blockIndex.clear();
+    dictStrs.clear();
+    dictLens.clear();
+    blockNum = 0;
+    totalRows = 0;
+}
+
+int FlowColumnReader::findColumn(const char *name) const{
+    for(uint32_t c = 0; c < columnNum; c++){
+        if(strncmp(schema[c].name, name, FLOWCOL_NAME_LEN) == 0){
+            return c;
+        }
+    }
+    return -1;
+}
+
+int64_t FlowColumnReader::findString(const char *str) const{
+    size_t len = strlen(str);
+    for(uint32_t i = 0; i < dictStrs.size(); i++){
+        if(dictLens[i] == len && memcmp(dictStrs[i], str, len) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *FlowColumnReader::getString(uint32_t id) const{
+    static thread_local std::string str;
+    if(id >= dictStrs.size()){
+        return "";
+    }
+    str.assign(dictStrs[id], dictLens[id]);
+    return str.c_str();
+}
+
+bool FlowColumnReader::decode(uint64_t block, uint32_t column){
+    const FlowColChunk *chunk = getChunk(block, column);
+    uint32_t rows = getBlockRows(block);
+    if(chunk->rawSize != rows * typeWidth(FLOW_COLUMNS[column].type) || chunk->rawSize > colBuf[column].size()
+        || chunk->off > size || chunk->packedSize > size - chunk->off){
+        return false;
+    }
+    if(chunk->packedSize == chunk->rawSize){
+        memcpy(&colBuf[column][0], base + chunk->off, chunk->rawSize);
+        return true;
+    }
+    int n = LZ4_decompress_safe((const char *)base + chunk->off, (char *)&colBuf[column][0], chunk->packedSize, chunk->rawSize);
+    return n == (int)chunk->rawSize;
+}
+
+// range test as one unsigned compare, the loops vectorize
+template<typename T>
+static void rangeMask(const T *v, uint32_t n, uint64_t lo, uint64_t hi, uint8_t *mask){
+    T low = (T)lo;
+    T span = (T)(hi - lo);
+    for(uint32_t i = 0; i < n; i++){
+        mask[i] &= (uint8_t)((T)(v[i] - low) <= span);
+    }
+}
+
+static uint32_t compact(const uint8_t *mask, uint32_t n, uint32_t *sel){
+    uint32_t k = 0;
+    for(uint32_t i = 0; i < n; i++){
+        sel[k] = i;
+        k += mask[i];
+    }
+    return k;
+}
+
+uint64_t FlowColumnReader::scan(const std::vector<FlowColFilter> &filters, const std::vector<uint32_t> &columns, const Visitor &visit){
+    uint64_t matched = 0;
+    skippedBlocks = 0;
+    for(auto &f : filters){
+        if(f.column >= columnNum || f.lo > f.hi){
+            return 0;
+        }
+    }
+
+    for(uint64_t b = 0; b < blockNum; b++){
+        uint32_t rows = getBlockRows(b);
+        if(rows > FLOWCOL_BLOCK_ROWS){
+            LOG_ERROR("block %lu has %u rows\n", b, rows);
+            return matched;
+        }
+
+        // block statistics first: skip the block, or skip filters every row passes
+        bool skip = false;
+        std::vector<const FlowColFilter *> active;
+        for(auto &f : filters){
+            const FlowColChunk *chunk = getChunk(b, f.column);
+            if(f.hi < chunk->min || f.lo > chunk->max){
+                skip = true;
+                break;
+            }
+            if(!(f.lo <= chunk->min && f.hi >= chunk->max)){
+                active.push_back(&f);
+            }
+        }
+        if(skip){
+            skippedBlocks++;
+            continue;
+        }
+
+        bool decoded[FC_COLUMN_NUM] = {false};
+        memset(&mask[0], 1, rows);
+        bool corrupt = false;
+        for(auto f : active){
+            if(!decoded[f->column]){
+                if(!decode(b, f->column)){
+                    corrupt = true;
+                    break;
+                }
+                decoded[f->column] = true;
+            }
+            uint64_t hi = (f->hi < typeMax(FLOW_COLUMNS[f->column].type)) ? f->hi : typeMax(FLOW_COLUMNS[f->column].type);
+            const uint8_t *v = &colBuf[f->column][0];
+            if(f->lo > hi){
+                memset(&mask[0], 0, rows);
+                break;
+            }
+            switch(typeWidth(FLOW_COLUMNS[f->column].type)){
+            case 1:
+                rangeMask((const uint8_t *)v, rows, f->lo, hi, &mask[0]);
+                break;
+            case 2:
+                rangeMask((const uint16_t *)v, rows, f->lo, hi, &mask[0]);
+                break;
+            case 4:
+                rangeMask((const uint32_t *)v, rows, f->lo, hi, &mask[0]);
+                break;
+            default:
+                rangeMask((const uint64_t *)v, rows, f->lo, hi, &mask[0]);
+                break;
+            }
+        }
+        if(corrupt){
+            LOG_ERROR("block %lu is corrupt\n", b);
+            return matched;
+        }
+
+        uint32_t selected = compact(&mask[0], rows, &sel[0]);
+        if(selected == 0){
+            continue;
+        }
+        matched += selected;
+        if(!visit){
+            continue;
+        }
+
+        FlowColBatch batch;
+        batch.rows = rows;
+        batch.selected = selected;
+        batch.sel = &sel[0];
+        for(uint32_t c = 0; c < FC_COLUMN_NUM; c++){
+            batch.col[c] = NULL;
+        }
+        for(auto c : columns){
+            if(c >= columnNum){
+                continue;
+            }
+            if(!decoded[c]){
+                if(!decode(b, c)){
+                    LOG_ERROR("block %lu is corrupt\n", b);
+                    return matched;
+                }
+                decoded[c] = true;
+            }
+            batch.col[c] = &colBuf[c][0];
+        }
+        visit(batch);
+    }
+    return matched;
+}
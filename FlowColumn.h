@@ -0,0 +1,263 @@
+#ifndef FLOW_COLUMN_H
+#define FLOW_COLUMN_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
+// 列式流记录文件 (.fcol): 会话结束时每个会话一行
+//   定长列, 字符串列用字典编码成 id
+//   每 FLOWCOL_BLOCK_ROWS 行一个 block, 每列单独 LZ4 压缩, 记录 min/max
+//   文件尾部是 block 索引和字典, reader mmap 后按统计跳过 block, 对列做批量过滤
+//
+//   header | schema[columnNum] | block0 col0..colN | block1 ... | footer | trailer
+
+#define FLOW_RECORD_FILE "output/flows.fcol"
+
+const uint32_t FLOWCOL_VERSION = 2;
+const uint32_t FLOWCOL_BLOCK_ROWS = 65536;
+const uint32_t FLOWCOL_NAME_LEN = 16;
+
+enum FlowColType{
+    FLOWCOL_U8 = 0,
+    FLOWCOL_U16,
+    FLOWCOL_U32,
+    FLOWCOL_U64,
+    FLOWCOL_DICT,               // uint32 id into the file dictionary
+};
+
+// column numbers, order of the schema
+enum FlowColId{
+    FC_SADDR = 0,
+    FC_DADDR,
+    FC_SPORT,
+    FC_DPORT,
+    FC_PROTO,
+    FC_TCP_FLAGS,
+    FC_FIRST_US,
+    FC_LAST_US,
+    FC_CLI_PKTS,
+    FC_SER_PKTS,
+    FC_CLI_BYTES,
+    FC_SER_BYTES,
+    FC_RETRANS,
+    FC_RTT_US,
+    FC_SAMPLE_RATE,
+    FC_APP,
+    FC_COLUMN_NUM
+};
+
+/*
+ *@brief 一行流记录, 地址端口为主机序, s 为客户端, d 为服务端
+ */
+struct FlowRecord{
+    FlowRecord(){
+        memset(this, 0, sizeof(*this));
+    }
+
+    uint32_t saddr;
+    uint32_t daddr;
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t proto;
+    uint8_t tcpFlags;           // or of the flags seen in both directions
+    uint64_t firstUs;
+    uint64_t lastUs;
+    uint32_t cliPkts;
+    uint32_t serPkts;
+    uint64_t cliBytes;          // wire bytes
+    uint64_t serBytes;
+    uint32_t retrans;
+    uint32_t rttUs;             // handshake rtt, 0 when not seen
+    uint32_t sampleRate;        // flow sampled 1 in this many, scale sums by it
+    const char *app;            // dictionary encoded
+};
+
+#pragma pack(1)
+
+struct FlowColFileHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t columnNum;
+};
+
+struct FlowColSchema{
+    char name[FLOWCOL_NAME_LEN];
+    uint8_t type;
+    uint8_t pad[7];
+};
+
+/*
+ *@brief 一个 block 中的一列, packedSize == rawSize 表示未压缩
+ */
+struct FlowColChunk{
+    uint64_t off;
+    uint32_t rawSize;
+    uint32_t packedSize;
+    uint64_t min;
+    uint64_t max;
+};
+
+struct FlowColTrailer{
+    uint64_t footerOff;
+    uint64_t blockNum;
+    uint64_t rows;
+    char magic[8];
+};
+
+#pragma pack()
+
+// footer: blockNum x (uint32 rows, FlowColChunk[columnNum]), uint32 dictNum, dictNum x (uint16 len, bytes)
+
+/*
+ *@brief 单线程写入, 每个 SessMgr 一个文件
+ */
+class FlowColumnWriter{
+public:
+    FlowColumnWriter();
+
+    ~FlowColumnWriter();
+
+    // 0 on success
+    int open(const char *path);
+
+    void append(const FlowRecord &rec);
+
+    // flush the last block and write the footer
+    void close();
+
+    bool isOpen() const{
+        return fd != NULL;
+    }
+
+    uint64_t getRows() const{
+        return totalRows;
+    }
+
+private:
+    void flushBlock();
+
+    uint32_t dictId(const char *str);
+
+    FILE *fd;
+    std::string path;
+    uint64_t fileOff;
+
+    std::vector<uint8_t> cols[FC_COLUMN_NUM];
+    uint64_t colMin[FC_COLUMN_NUM];
+    uint64_t colMax[FC_COLUMN_NUM];
+    uint32_t rows;
+    std::vector<char> packBuf;
+
+    std::vector<uint32_t> blockRows;
+    std::vector<FlowColChunk> chunks;          // blockNum x FC_COLUMN_NUM
+
+    std::unordered_map<std::string, uint32_t> dict;
+    std::vector<std::string> dictStrs;
+
+    uint64_t totalRows;
+    uint64_t rawBytes;
+    uint64_t packedBytes;
+};
+
+/*
+ *@brief 闭区间 [lo, hi] 过滤, 字典列用 id
+ */
+struct FlowColFilter{
+    uint32_t column;
+    uint64_t lo;
+    uint64_t hi;
+};
+
+/*
+ *@brief 一个 block 解码后的结果, sel 是通过过滤的行号
+ */
+struct FlowColBatch{
+    uint32_t rows;
+    uint32_t selected;
+    const uint32_t *sel;
+    const void *col[FC_COLUMN_NUM];         // NULL for columns not decoded
+
+    template<typename T>
+    const T *get(uint32_t column) const{
+        return (const T *)col[column];
+    }
+
+    // any fixed width column widened to 64 bits
+    uint64_t value(uint32_t column, uint32_t row) const;
+};
+
+class FlowColumnReader{
+public:
+    typedef std::function<void(const FlowColBatch &)> Visitor;
+
+    FlowColumnReader();
+
+    ~FlowColumnReader();
+
+    // 0 on success
+    int open(const char *path);
+
+    void close();
+
+    // -1 when there is no such column
+    int findColumn(const char *name) const;
+
+    // dictionary id of str, -1 when no row has it
+    int64_t findString(const char *str) const;
+
+    const char *getString(uint32_t id) const;
+
+    uint64_t getRows() const{
+        return totalRows;
+    }
+
+    uint64_t getBlockNum() const{
+        return blockNum;
+    }
+
+    uint64_t getSkippedBlocks() const{
+        return skippedBlocks;
+    }
+
+    // visit every block with rows matching all filters, columns lists what to decode
+    // for the visitor, returns the number of matching rows
+    uint64_t scan(const std::vector<FlowColFilter> &filters, const std::vector<uint32_t> &columns, const Visitor &visit);
+
+private:
+    // decode column of block into colBuf, false on a corrupt chunk
+    bool decode(uint64_t block, uint32_t column);
+
+    const FlowColChunk *getChunk(uint64_t block, uint32_t column) const{
+        return (const FlowColChunk *)(blockIndex[block] + sizeof(uint32_t)) + column;
+    }
+
+    uint32_t getBlockRows(uint64_t block) const{
+        uint32_t n;
+        memcpy(&n, blockIndex[block], sizeof(n));
+        return n;
+    }
+
+    int fd;
+    const uint8_t *base;
+    uint64_t size;
+
+    uint32_t columnNum;
+    const FlowColSchema *schema;
+    uint64_t blockNum;
+    uint64_t totalRows;
+    std::vector<const uint8_t *> blockIndex;
+    std::vector<const char *> dictStrs;
+    std::vector<uint16_t> dictLens;
+
+    std::vector<uint8_t> colBuf[FC_COLUMN_NUM];
+    std::vector<uint8_t> mask;
+    std::vector<uint32_t> sel;
+    uint64_t skippedBlocks;
+};
+
+#endif //FLOW_COLUMN_H
@@ -0,0 +1,481 @@
+#include "FlowIndex.h"
+#include "PcapChunk.h"
+#include "Log.h"
+#include "StructDefine.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <queue>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char FLOW_INDEX_MAGIC[8] = {'P', 'C', 'A', 'P', 'F', 'I', 'D', 'X'};
+
+static void makeKey(FlowIdxKey &key, uint32_t saddr, uint16_t sport, uint32_t daddr, uint16_t dport, uint8_t proto){
+    memset(&key, 0, sizeof(key));
+    key.proto = proto;
+    uint64_t a = ((uint64_t)ntohl(saddr) << 16) | ntohs(sport);
+    uint64_t b = ((uint64_t)ntohl(daddr) << 16) | ntohs(dport);
+    if(a <= b){
+        key.ipLo = saddr;
+        key.portLo = sport;
+        key.ipHi = daddr;
+        key.portHi = dport;
+    }else{
+        key.ipLo = daddr;
+        key.portLo = dport;
+        key.ipHi = saddr;
+        key.portHi = sport;
+    }
+}
+
+bool flowIdxKeyOf(const u_char *data, uint32_t caplen, FlowIdxKey &key){
+    if(caplen < ETH_HEADER_LENGTH + IP_HEADER_LENGTH){
+        return false;
+    }
+    if(((data[12] << 8) | data[13]) != 0x0800){
+        return false;
+    }
+    const u_char *ip = data + ETH_HEADER_LENGTH;
+    uint32_t ihl = (ip[0] & 0x0F) * 4;
+    uint32_t saddr, daddr;
+    uint16_t sport = 0, dport = 0;
+    memcpy(&saddr, ip + 12, 4);
+    memcpy(&daddr, ip + 16, 4);
+    uint8_t proto = ip[9];
+    if((proto == TCP_PROTOCOL_ID || proto == UDP_PROTOCOL_ID) && caplen >= ETH_HEADER_LENGTH + ihl + 4){
+        memcpy(&sport, ip + ihl, 2);
+        memcpy(&dport, ip + ihl + 2, 2);
+    }
+
+    makeKey(key, saddr, sport, daddr, dport, proto);
+    return true;
+}
+
+int flowIdxKeyCmp(const FlowIdxKey &a, const FlowIdxKey &b){
+    if(a.ipLo != b.ipLo) return a.ipLo < b.ipLo ? -1 : 1;
+    if(a.ipHi != b.ipHi) return a.ipHi < b.ipHi ? -1 : 1;
+    if(a.portLo != b.portLo) return a.portLo < b.portLo ? -1 : 1;
+    if(a.portHi != b.portHi) return a.portHi < b.portHi ? -1 : 1;
+    if(a.proto != b.proto) return a.proto < b.proto ? -1 : 1;
+    return 0;
+}
+
+static bool entryLess(const FlowIdxEntry &a, const FlowIdxEntry &b){
+    int c = flowIdxKeyCmp(a.key, b.key);
+    if(c != 0){
+        return c < 0;
+    }
+    return a.offset < b.offset;
+}
+
+static bool parseEndpoint(const std::string &text, uint32_t &ip, uint16_t &port){
+    std::string addr = text;
+    port = 0;
+    size_t colon = text.find(':');
+    if(colon != std::string::npos){
+        addr = text.substr(0, colon);
+        port = htons((uint16_t)atoi(text.c_str() + colon + 1));
+    }
+    return inet_pton(AF_INET, addr.c_str(), &ip) == 1;
+}
+
+bool flowIdxKeyParse(const char *text, FlowIdxKey &key){
+    std::string s = text;
+    uint8_t proto = 0;
+    size_t slash = s.find('/');
+    if(slash != std::string::npos){
+        proto = (uint8_t)atoi(s.c_str() + slash + 1);
+        s = s.substr(0, slash);
+    }
+    size_t dash = s.find('-');
+    if(dash == std::string::npos){
+        return false;
+    }
+    uint32_t saddr, daddr;
+    uint16_t sport, dport;
+    if(!parseEndpoint(s.substr(0, dash), saddr, sport) || !parseEndpoint(s.substr(dash + 1), daddr, dport)){
+        return false;
+    }
+
+    makeKey(key, saddr, sport, daddr, dport, proto);
+    return true;
+}
+
+std::string flowIdxKeyStr(const FlowIdxKey &key){
+    char lo[INET_ADDRSTRLEN], hi[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &key.ipLo, lo, sizeof(lo));
+    inet_ntop(AF_INET, &key.ipHi, hi, sizeof(hi));
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%s:%u-%s:%u/%u", lo, ntohs(key.portLo), hi, ntohs(key.portHi), key.proto);
+    return buf;
+}
+
+FlowIndexBuilder::FlowIndexBuilder(){
+    pcapSize = 0;
+    tmpFd = NULL;
+    tmpSize = 0;
+    nonIp = 0;
+}
+
+FlowIndexBuilder::~FlowIndexBuilder(){
+    if(tmpFd){
+        fclose(tmpFd);
+        unlink(tmpPath.c_str());
+    }
+}
+
+int FlowIndexBuilder::init(const char *pcapname, uint32_t laneNum){
+    struct stat st;
+    if(stat(pcapname, &st) != 0){
+        LOG_ERROR("index: stat %s fail\n", pcapname);
+        return -1;
+    }
+    FILE *fp = fopen(pcapname, "rb");
+    uint32_t magic = 0;
+    if(fp == NULL || fread(&magic, 4, 1, fp) != 1){
+        LOG_ERROR("index: read %s fail\n", pcapname);
+        if(fp){
+            fclose(fp);
+        }
+        return -1;
+    }
+    fclose(fp);
+    uint32_t m = magic;
+    if(m != 0xa1b2c3d4 && m != 0xa1b23c4d){
+        m = __builtin_bswap32(magic);
+    }
+    if(m != 0xa1b2c3d4 && m != 0xa1b23c4d){
+        LOG_WARN("index: %s is not a classic pcap, no index\n", pcapname);
+        return -1;
+    }
+
+    pcapPath = pcapname;
+    indexPath = pcapPath + FLOW_INDEX_SUFFIX;
+    tmpPath = indexPath + ".tmp";
+    pcapSize = st.st_size;
+    lanes.resize(laneNum > 0 ? laneNum : 1);
+    return 0;
+}
+
+void FlowIndexBuilder::add(uint32_t lane, const u_char *data, uint32_t caplen, uint64_t tsUs, uint64_t offset){
+    Lane &l = lanes[lane];
+
+    uint64_t start = tsUs - tsUs % FLOW_INDEX_BUCKET_US;
+    uint64_t end = offset + PCAP_RECORD_HEADER_LENGTH + caplen;
+    std::map<uint64_t, FlowIdxBucket>::iterator it = l.buckets.find(start);
+    if(it == l.buckets.end()){
+        FlowIdxBucket bucket;
+        bucket.startUs = start;
+        bucket.begin = offset;
+        bucket.end = end;
+        l.buckets[start] = bucket;
+    }else{
+        if(offset < it->second.begin){
+            it->second.begin = offset;
+        }
+        if(end > it->second.end){
+            it->second.end = end;
+        }
+    }
+
+    FlowIdxEntry entry;
+    if(!flowIdxKeyOf(data, caplen, entry.key)){
+        l.nonIp++;
+        return;
+    }
+    entry.offset = offset;
+    if(l.buf.empty()){
+        l.buf.reserve(FLOW_INDEX_LANE_ENTRIES);
+    }
+    l.buf.push_back(entry);
+    if(l.buf.size() >= FLOW_INDEX_LANE_ENTRIES){
+        spill(l);
+    }
+}
+
+void FlowIndexBuilder::spill(Lane &lane){
+    std::sort(lane.buf.begin(), lane.buf.end(), entryLess);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(tmpFd == NULL){
+        tmpFd = fopen(tmpPath.c_str(), "w+b");
+        if(tmpFd == NULL){
+            LOG_ERROR("index: create %s fail\n", tmpPath.c_str());
+            lane.buf.clear();
+            return;
+        }
+    }
+    Run run;
+    run.off = tmpSize;
+    run.count = lane.buf.size();
+    if(fwrite(&lane.buf[0], sizeof(FlowIdxEntry), run.count, tmpFd) != run.count){
+        LOG_ERROR("index: write %s fail\n", tmpPath.c_str());
+    }else{
+        runs.push_back(run);
+        tmpSize += run.count * sizeof(FlowIdxEntry);
+    }
+    lane.buf.clear();
+}
+
+int FlowIndexBuilder::finish(){
+    std::map<uint64_t, FlowIdxBucket> buckets;
+    for(auto &lane : lanes){
+        if(!lane.buf.empty()){
+            spill(lane);
+        }
+        for(auto &kv : lane.buckets){
+            std::map<uint64_t, FlowIdxBucket>::iterator it = buckets.find(kv.first);
+            if(it == buckets.end()){
+                buckets[kv.first] = kv.second;
+            }else{
+                if(kv.second.begin < it->second.begin){
+                    it->second.begin = kv.second.begin;
+                }
+                if(kv.second.end > it->second.end){
+                    it->second.end = kv.second.end;
+                }
+            }
+        }
+        nonIp += lane.nonIp;
+        lane.buckets.clear();
+    }
+
+    const FlowIdxEntry *entries = NULL;
+    if(tmpFd){
+        fflush(tmpFd);
+        if(tmpSize > 0){
+            void *addr = mmap(NULL, tmpSize, PROT_READ, MAP_PRIVATE, fileno(tmpFd), 0);
+            if(addr == MAP_FAILED){
+                LOG_ERROR("index: mmap %s fail\n", tmpPath.c_str());
+                return -1;
+            }
+            entries = (const FlowIdxEntry *)addr;
+        }
+    }
+
+    std::string partPath = indexPath + ".part";
+    FILE *out = fopen(partPath.c_str(), "wb");
+    if(out == NULL){
+        LOG_ERROR("index: create %s fail\n", partPath.c_str());
+        if(entries){
+            munmap((void *)entries, tmpSize);
+        }
+        return -1;
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+    FlowIdxHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FLOW_INDEX_MAGIC, sizeof(header.magic));
+    header.version = FLOW_INDEX_VERSION;
+    header.pcapSize = pcapSize;
+    header.bucketUs = FLOW_INDEX_BUCKET_US;
+    header.offsetsOff = sizeof(header);
+    fwrite(&header, sizeof(header), 1, out);
+
+    // k-way merge of the sorted runs, heap of (run head, run)
+    typedef std::pair<FlowIdxEntry, uint32_t> Head;
+    auto headGreater = [](const Head &a, const Head &b){
+        return entryLess(b.first, a.first);
+    };
+    std::priority_queue<Head, std::vector<Head>, decltype(headGreater)> heap(headGreater);
+    std::vector<uint64_t> pos(runs.size(), 0);
+    for(uint32_t r = 0; r < runs.size(); r++){
+        if(runs[r].count > 0){
+            heap.push(Head(entries[runs[r].off / sizeof(FlowIdxEntry)], r));
+        }
+    }
+
+    std::vector<FlowIdxFlow> flows;
+    uint64_t num = 0;
+    while(!heap.empty()){
+        Head head = heap.top();
+        heap.pop();
+        uint32_t r = head.second;
+        if(++pos[r] < runs[r].count){
+            heap.push(Head(entries[runs[r].off / sizeof(FlowIdxEntry) + pos[r]], r));
+        }
+
+        if(flows.empty() || flowIdxKeyCmp(flows.back().key, head.first.key) != 0){
+            FlowIdxFlow flow;
+            flow.key = head.first.key;
+            flow.first = num;
+            flow.count = 0;
+            flows.push_back(flow);
+        }
+        flows.back().count++;
+        uint64_t offset = head.first.offset;
+        fwrite(&offset, sizeof(offset), 1, out);
+        num++;
+    }
+
+    header.offsetNum = num;
+    header.flowNum = flows.size();
+    header.flowsOff = header.offsetsOff + num * sizeof(uint64_t);
+    if(!flows.empty()){
+        fwrite(&flows[0], sizeof(FlowIdxFlow), flows.size(), out);
+    }
+    header.bucketNum = buckets.size();
+    header.bucketsOff = header.flowsOff + flows.size() * sizeof(FlowIdxFlow);
+    for(auto &kv : buckets){
+        fwrite(&kv.second, sizeof(FlowIdxBucket), 1, out);
+    }
+    fseek(out, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, out);
+
+    int ret = 0;
+    if(ferror(out)){
+        LOG_ERROR("index: write %s fail\n", partPath.c_str());
+        ret = -1;
+    }
+    fclose(out);
+
+    if(entries){
+        munmap((void *)entries, tmpSize);
+    }
+    if(tmpFd){
+        fclose(tmpFd);
+        tmpFd = NULL;
+        unlink(tmpPath.c_str());
+    }
+    runs.clear();
+    tmpSize = 0;
+
+    if(ret == 0 && rename(partPath.c_str(), indexPath.c_str()) != 0){
+        LOG_ERROR("index: rename %s fail\n", partPath.c_str());
+        ret = -1;
+    }
+    if(ret != 0){
+        unlink(partPath.c_str());
+        return ret;
+    }
+    LOG_INFO("index %s flows %lu packets %lu buckets %lu non-ip %lu\n", indexPath.c_str(),
+        header.flowNum, header.offsetNum, header.bucketNum, nonIp);
+    return 0;
+}
+
+FlowIndexReader::FlowIndexReader(){
+    header = NULL;
+    flows = NULL;
+    buckets = NULL;
+    offsets = NULL;
+    fd = -1;
+    base = NULL;
+    size = 0;
+}
+
+FlowIndexReader::~FlowIndexReader(){
+    close();
+}
+
+int FlowIndexReader::open(const char *indexname, uint64_t pcapSize){
+    fd = ::open(indexname, O_RDONLY);
+    if(fd < 0){
+        LOG_ERROR("open %s fail\n", indexname);
+        return -1;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(FlowIdxHeader)){
+        LOG_ERROR("%s is not a flow index\n", indexname);
+        close();
+        return -1;
+    }
+    size = st.st_size;
+    void *addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if(addr == MAP_FAILED){
+        LOG_ERROR("mmap %s fail\n", indexname);
+        close();
+        return -1;
+    }
+    base = (const u_char *)addr;
+    header = (const FlowIdxHeader *)base;
+
+    if(memcmp(header->magic, FLOW_INDEX_MAGIC, sizeof(header->magic)) != 0 || header->version != FLOW_INDEX_VERSION){
+        LOG_ERROR("%s is not a flow index\n", indexname);
+        close();
+        return -1;
+    }
+    if(header->pcapSize != pcapSize){
+        LOG_ERROR("%s is stale, pcap size %lu indexed %lu\n", indexname, pcapSize, header->pcapSize);
+        close();
+        return -1;
+    }
+    if(header->offsetsOff + header->offsetNum * sizeof(uint64_t) > size
+        || header->flowsOff + header->flowNum * sizeof(FlowIdxFlow) > size
+        || header->bucketsOff + header->bucketNum * sizeof(FlowIdxBucket) > size){
+        LOG_ERROR("%s is truncated\n", indexname);
+        close();
+        return -1;
+    }
+    offsets = (const uint64_t *)(base + header->offsetsOff);
+    flows = (const FlowIdxFlow *)(base + header->flowsOff);
+    buckets = (const FlowIdxBucket *)(base + header->bucketsOff);
+    madvise(addr, size, MADV_RANDOM);
+    return 0;
+}
+
+void FlowIndexReader::close(){
+    if(base){
+        munmap((void *)base, size);
+        base = NULL;
+    }
+    if(fd >= 0){
+        ::close(fd);
+        fd = -1;
+    }
+    header = NULL;
+    flows = NULL;
+    buckets = NULL;
+    offsets = NULL;
+}
+
+const FlowIdxFlow *FlowIndexReader::findFlow(const FlowIdxKey &key) const{
+    uint64_t lo = 0, hi = header->flowNum;
+    while(lo < hi){
+        uint64_t mid = lo + (hi - lo) / 2;
+        int c = flowIdxKeyCmp(flows[mid].key, key);
+        if(c == 0){
+            return &flows[mid];
+        }
+        if(c < 0){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+bool FlowIndexReader::timeRange(uint64_t startUs, uint64_t endUs, uint64_t &begin, uint64_t &end) const{
+    uint64_t first = startUs - startUs % header->bucketUs;
+    uint64_t lo = 0, hi = header->bucketNum;
+    while(lo < hi){
+        uint64_t mid = lo + (hi - lo) / 2;
+        if(buckets[mid].startUs < first){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    bool found = false;
+    for(uint64_t i = lo; i < header->bucketNum && buckets[i].startUs < endUs; i++){
+        if(!found){
+            begin = buckets[i].begin;
+            end = buckets[i].end;
+            found = true;
+        }else{
+            if(buckets[i].begin < begin){
+                begin = buckets[i].begin;
+            }
+            if(buckets[i].end > end){
+                end = buckets[i].end;
+            }
+        }
+    }
+    return found;
+}
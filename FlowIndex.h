@@ -0,0 +1,166 @@
+#ifndef FLOW_INDEX_H
+#define FLOW_INDEX_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <pcap.h>
+
+// pcap 旁路索引文件 <file>.fidx, 在正常处理的同一遍中生成:
+//   flow key -> 该流所有包的记录偏移 (按 key 排序, 可二分)
+//   时间桶   -> 桶内记录的偏移范围
+// 文件可直接 mmap, 查询工具据此只读需要的记录
+//
+//   header | offsets[offsetNum] | flows[flowNum] | buckets[bucketNum]
+
+#define FLOW_INDEX_SUFFIX ".fidx"
+
+const uint32_t FLOW_INDEX_VERSION = 1;
+const uint64_t FLOW_INDEX_BUCKET_US = 1000000;
+const uint32_t FLOW_INDEX_LANE_ENTRIES = 1 << 20;   // buffered entries per lane before a sorted run is spilled
+
+#pragma pack(1)
+
+/*
+ *@brief 方向无关的流 key, 较小的 (ip, port) 端点在前, 地址和端口都是网络字节序
+ */
+struct FlowIdxKey{
+    uint32_t ipLo;
+    uint32_t ipHi;
+    uint16_t portLo;
+    uint16_t portHi;
+    uint8_t proto;
+    uint8_t pad[3];
+};
+
+struct FlowIdxEntry{
+    FlowIdxKey key;
+    uint64_t offset;
+};
+
+struct FlowIdxHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t pcapSize;          // index is stale when the pcap size differs
+    uint64_t bucketUs;
+    uint64_t offsetNum;
+    uint64_t flowNum;
+    uint64_t bucketNum;
+    uint64_t offsetsOff;
+    uint64_t flowsOff;
+    uint64_t bucketsOff;
+};
+
+struct FlowIdxFlow{
+    FlowIdxKey key;
+    uint64_t first;             // position in the offsets array
+    uint64_t count;
+};
+
+struct FlowIdxBucket{
+    uint64_t startUs;
+    uint64_t begin;             // lowest record offset in the bucket
+    uint64_t end;               // end of the highest record in the bucket
+};
+
+#pragma pack()
+
+// canonical key of an ethernet frame, false for non ip
+bool flowIdxKeyOf(const u_char *data, uint32_t caplen, FlowIdxKey &key);
+
+int flowIdxKeyCmp(const FlowIdxKey &a, const FlowIdxKey &b);
+
+// "1.2.3.4:80-5.6.7.8:1234/6", ports and proto optional
+bool flowIdxKeyParse(const char *text, FlowIdxKey &key);
+
+std::string flowIdxKeyStr(const FlowIdxKey &key);
+
+/*
+ *@brief 索引生成, 每个线程一条 lane, lane 内无锁; 缓冲满了排序后写入临时 run 文件,
+ *       finish() 时多路归并写出最终索引, 内存占用与 pcap 大小无关
+ */
+class FlowIndexBuilder{
+public:
+    FlowIndexBuilder();
+
+    ~FlowIndexBuilder();
+
+    // 0 on success, classic pcap only since offsets come from the record layout
+    int init(const char *pcapname, uint32_t lanes);
+
+    // record at offset, caplen bytes of frame data
+    void add(uint32_t lane, const u_char *data, uint32_t caplen, uint64_t tsUs, uint64_t offset);
+
+    // merge runs and write the index, 0 on success
+    int finish();
+
+private:
+    struct Run{
+        uint64_t off;           // in the temp file
+        uint64_t count;
+    };
+
+    struct Lane{
+        std::vector<FlowIdxEntry> buf;
+        std::map<uint64_t, FlowIdxBucket> buckets;
+        uint64_t nonIp;
+
+        Lane() : nonIp(0){}
+    };
+
+    void spill(Lane &lane);
+
+    std::string pcapPath;
+    std::string indexPath;
+    std::string tmpPath;
+    uint64_t pcapSize;
+
+    std::vector<Lane> lanes;
+
+    std::mutex mutex_;
+    FILE *tmpFd;
+    uint64_t tmpSize;
+    std::vector<Run> runs;
+    uint64_t nonIp;
+};
+
+/*
+ *@brief 只读 mmap 索引
+ */
+class FlowIndexReader{
+public:
+    FlowIndexReader();
+
+    ~FlowIndexReader();
+
+    // pcapSize checks the index still matches its pcap, 0 on success
+    int open(const char *indexname, uint64_t pcapSize);
+
+    void close();
+
+    // NULL when the flow is not in the capture
+    const FlowIdxFlow *findFlow(const FlowIdxKey &key) const;
+
+    const uint64_t *getOffsets(const FlowIdxFlow *flow) const{
+        return offsets + flow->first;
+    }
+
+    // byte range holding every record of [startUs, endUs), false when empty
+    bool timeRange(uint64_t startUs, uint64_t endUs, uint64_t &begin, uint64_t &end) const;
+
+    const FlowIdxHeader *header;
+    const FlowIdxFlow *flows;
+    const FlowIdxBucket *buckets;
+    const uint64_t *offsets;
+
+private:
+    int fd;
+    const u_char *base;
+    uint64_t size;
+};
+
+#endif //FLOW_INDEX_H
@@ -0,0 +1,370 @@
+#include "FlowPcap.h"
+#include "HugeMem.h"
+#include "Log.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#pragma pack(1)
+// the libpcap file format, microsecond timestamps
+struct PcapFileHeader{
+    uint32_t magic;
+    uint16_t major;
+    uint16_t minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct PcapRecordHeader{
+    uint32_t sec;
+    uint32_t usec;
+    uint32_t caplen;
+    uint32_t len;
+};
+#pragma pack()
+
+static uint32_t roundPow2(uint32_t n){
+    uint32_t size = 1;
+    while(size < n){
+        size <<= 1;
+    }
+    return size;
+}
+
+PcapFlusher::PcapFlusher(uint32_t producers, uint32_t bufNum){
+    producerNum = producers;
+    // every buffer fits both rings, a close without data takes a slot too
+    uint32_t size = roundPow2(bufNum * 2);
+    for(uint32_t p = 0; p < producerNum; p++){
+        full.push_back(new SpscRing<PcapJob>(size));
+        empty.push_back(new SpscRing<char *>(size));
+    }
+    running.store(false);
+    pThreads = NULL;
+    writes = 0;
+    bytes = 0;
+    errors = 0;
+}
+
+PcapFlusher::~PcapFlusher(){
+    stop();
+    for(uint32_t p = 0; p < producerNum; p++){
+        delete full[p];
+        delete empty[p];
+    }
+}
+
+void PcapFlusher::start(){
+    running.store(true);
+    worker = std::thread(&PcapFlusher::run, this);
+}
+
+void PcapFlusher::stop(){
+    if(!running.load()){
+        return;
+    }
+    running.store(false);
+    worker.join();
+    LOG_INFO("flow pcap %lu writes %lu bytes to %s, %lu errors\n", writes, bytes, FLOW_PCAP_DIR, errors);
+}
+
+void PcapFlusher::submit(uint32_t producer, const PcapJob &job){
+    full[producer]->pushWait(job);
+}
+
+char *PcapFlusher::reclaim(uint32_t producer){
+    char *buf = NULL;
+    empty[producer]->pop(buf);
+    return buf;
+}
+
+char *PcapFlusher::reclaimWait(uint32_t producer){
+    char *buf = NULL;
+    empty[producer]->popWait(buf);
+    return buf;
+}
+
+uint32_t PcapFlusher::drain(){
+    uint32_t n = 0;
+    for(uint32_t p = 0; p < producerNum; p++){
+        PcapJob job;
+        while(full[p]->pop(job)){
+            n++;
+            uint32_t done = 0;
+            while(done < job.len){
+                ssize_t ret = ::write(job.fd, job.buf + done, job.len - done);
+                if(ret < 0 && errno == EINTR){
+                    continue;
+                }
+                if(ret <= 0){
+                    // disk full or the like, the rest of this buffer is lost
+                    errors++;
+                    break;
+                }
+                done += ret;
+            }
+            if(job.len){
+                writes++;
+                bytes += done;
+            }
+            if(job.buf){
+                empty[p]->push(job.buf);
+            }
+            if(job.close){
+                ::close(job.fd);
+            }
+        }
+    }
+    return n;
+}
+
+void PcapFlusher::run(){
+    uint32_t tid = pThreads ? pThreads->attach(THREAD_EXPORT, 2, "pcap") : 0;
+    while(true){
+        // read the flag first so jobs submitted before stop() are written
+        bool stopping = !running.load();
+        uint32_t n = drain();
+        if(stopping){
+            break;
+        }
+        if(n == 0){
+            usleep(1000);
+        }
+    }
+    if(pThreads){
+        pThreads->detach(tid);
+    }
+}
+
+//=================================================================================
+FlowPcapWriter::FlowPcapWriter(uint32_t maxOpen, PcapFlusher *flusher, uint32_t producer, int node){
+    this->maxOpen = (maxOpen > PCAP_MIN_OPEN) ? maxOpen : PCAP_MIN_OPEN;
+    this->producer = producer;
+    this->node = node;
+    openNum = 0;
+    ownFlusher = (flusher == NULL);
+    if(ownFlusher){
+        pFlusher = new PcapFlusher(1, bufNum(this->maxOpen));
+        pFlusher->start();
+        this->producer = 0;
+    }else{
+        pFlusher = flusher;
+    }
+    // hugetlbfs pages are taken from the pool here, other pages only as files fill
+    uint32_t num = bufNum(this->maxOpen);
+    bufMem = (char *)hugeAlloc((size_t)num * PCAP_FILE_BUF, node);
+    for(uint32_t i = 0; i < num; i++){
+        spare.push_back(bufMem + (size_t)i * PCAP_FILE_BUF);
+    }
+    FlowFile head;
+    memset(&head, 0, sizeof(head));
+    head.fd = -1;
+    files.push_back(head);
+    lastFlushUs = 0;
+    closed = false;
+    pkts = 0;
+    opens = 0;
+    reopens = 0;
+    evictions = 0;
+    failed = 0;
+    mkdir(FLOW_PCAP_DIR, 0755);
+}
+
+FlowPcapWriter::~FlowPcapWriter(){
+    close();
+    hugeFree(bufMem, (size_t)bufNum(maxOpen) * PCAP_FILE_BUF);
+}
+
+void FlowPcapWriter::close(){
+    if(closed){
+        return;
+    }
+    closed = true;
+    while(files[0].next != 0){
+        evict();
+    }
+    // every buffer back means every byte is written, the memory can go with the writer
+    while(spare.size() < bufNum(maxOpen)){
+        spare.push_back(pFlusher->reclaimWait(producer));
+    }
+    if(ownFlusher){
+        delete pFlusher;
+    }
+    pFlusher = NULL;
+    LOG_INFO("flow pcap %lu packets into %lu files, %lu reopened, %lu closed for room, %lu not opened\n",
+        pkts, opens, reopens, evictions, failed);
+}
+
+void FlowPcapWriter::unlink(uint32_t file){
+    FlowFile &f = files[file];
+    files[f.prev].next = f.next;
+    files[f.next].prev = f.prev;
+}
+
+void FlowPcapWriter::pushFront(uint32_t file){
+    FlowFile &f = files[file];
+    f.prev = 0;
+    f.next = files[0].next;
+    files[f.next].prev = file;
+    files[0].next = file;
+}
+
+char *FlowPcapWriter::takeBuffer(){
+    if(spare.empty()){
+        char *buf;
+        while((buf = pFlusher->reclaim(producer)) != NULL){
+            spare.push_back(buf);
+        }
+    }
+    if(spare.empty()){
+        // the flusher is behind, wait for it rather than grow
+        return pFlusher->reclaimWait(producer);
+    }
+    char *buf = spare.back();
+    spare.pop_back();
+    return buf;
+}
+
+void FlowPcapWriter::submit(FlowFile &f, bool closeFd){
+    if(f.used == 0 && !closeFd){
+        return;
+    }
+    PcapJob job;
+    job.fd = f.fd;
+    job.buf = f.buf;
+    job.len = f.used;
+    job.close = closeFd;
+    pFlusher->submit(producer, job);
+    f.buf = NULL;
+    f.used = 0;
+}
+
+void FlowPcapWriter::evict(){
+    // the list head's prev is the least recently written
+    uint32_t file = files[0].prev;
+    FlowFile &f = files[file];
+    unlink(file);
+    submit(f, true);
+    f.fd = -1;
+    openNum--;
+}
+
+bool FlowPcapWriter::openFile(uint32_t file, const NetTuple5 &tuple, bool first){
+    if(openNum >= maxOpen){
+        evictions++;
+        evict();
+    }
+    char path[160];
+    snprintf(path, sizeof(path), FLOW_PCAP_DIR "/%s_%s_%s_%d_%d_%d.pcap", tuple.tranType == TranType_TCP ? "TCP" : "UDP",
+        TransferToIp(tuple.saddr).c_str(), TransferToIp(tuple.daddr).c_str(), tuple.sport, tuple.dport, tuple.iHashValue);
+    // append: reopened after an eviction, or the session came back from a checkpoint
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    FlowFile &f = files[file];
+    if(fd < 0){
+        LOG_DEBUG("fd create fail\n");
+        f.fd = PCAP_FD_FAILED;
+        failed++;
+        return false;
+    }
+    // a reopened file may still be empty on disk while its first buffer is queued
+    struct stat st;
+    bool fresh = first && fstat(fd, &st) == 0 && st.st_size == 0;
+    f.fd = fd;
+    f.used = 0;
+    f.buf = takeBuffer();
+    if(fresh){
+        PcapFileHeader header;
+        header.magic = 0xa1b2c3d4;
+        header.major = 2;
+        header.minor = 4;
+        header.thiszone = 0;
+        header.sigfigs = 0;
+        header.snaplen = FLOW_PCAP_SNAPLEN;
+        header.linktype = DLT_EN10MB;
+        memcpy(f.buf, &header, sizeof(header));
+        f.used = sizeof(header);
+    }
+    pushFront(file);
+    openNum++;
+    return true;
+}
+
+void FlowPcapWriter::finish(uint32_t file){
+    if(closed || file == 0 || file >= files.size() || files[file].fd < 0){
+        return;
+    }
+    FlowFile &f = files[file];
+    unlink(file);
+    submit(f, true);
+    f.fd = -1;
+    openNum--;
+}
+
+void FlowPcapWriter::flushAll(){
+    for(uint32_t file = files[0].next; file != 0; file = files[file].next){
+        submit(files[file], false);
+    }
+}
+
+void FlowPcapWriter::write(uint32_t &file, const NetTuple5 &tuple, const struct pcap_pkthdr *hdr, const u_char *data,
+    uint32_t snaplen){
+    if(closed){
+        return;
+    }
+    bool fresh = (file == 0);
+    if(fresh){
+        FlowFile f;
+        memset(&f, 0, sizeof(f));
+        f.fd = -1;
+        files.push_back(f);
+        file = files.size() - 1;
+    }
+    if(files[file].fd == PCAP_FD_FAILED){
+        return;
+    }
+    if(files[file].fd < 0){
+        if(!openFile(file, tuple, fresh)){
+            return;
+        }
+        if(fresh){
+            opens++;
+        }else{
+            reopens++;
+        }
+    }else if(files[0].next != file){
+        unlink(file);
+        pushFront(file);
+    }
+
+    FlowFile &f = files[file];
+    PcapRecordHeader rec;
+    rec.sec = hdr->ts.tv_sec;
+    rec.usec = hdr->ts.tv_usec;
+    rec.caplen = (hdr->caplen < FLOW_PCAP_SNAPLEN) ? hdr->caplen : FLOW_PCAP_SNAPLEN;
+    rec.caplen = (rec.caplen < snaplen) ? rec.caplen : snaplen;
+    rec.len = hdr->len;
+    if(f.buf == NULL){
+        f.buf = takeBuffer();
+    }else if(f.used + sizeof(rec) + rec.caplen > PCAP_FILE_BUF){
+        submit(f, false);
+        f.buf = takeBuffer();
+    }
+    memcpy(f.buf + f.used, &rec, sizeof(rec));
+    memcpy(f.buf + f.used + sizeof(rec), data, rec.caplen);
+    f.used += sizeof(rec) + rec.caplen;
+    pkts++;
+
+    // quiet sessions do not sit in memory for long, and their buffers come back
+    uint64_t tsUs = (uint64_t)hdr->ts.tv_sec * 1000000 + hdr->ts.tv_usec;
+    if(tsUs > lastFlushUs + PCAP_FLUSH_US){
+        if(lastFlushUs != 0){
+            flushAll();
+        }
+        lastFlushUs = tsUs;
+    }
+}
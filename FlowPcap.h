@@ -0,0 +1,169 @@
+#ifndef FLOW_PCAP_H
+#define FLOW_PCAP_H
+
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <pcap.h>
+
+#include "SpscRing.h"
+#include "ThreadManager.h"
+#include "StructDefine.h"
+
+// 每个会话一个 pcap, 存原始报文, 给应急响应按会话取证用
+//   同时打开的文件数有上限, 按 LRU 关闭最久没有包的文件, 之后再来包时以追加方式重新打开
+//   每个打开的文件一块写缓存, 满了才交给后台刷盘线程, 不会每个包一次系统调用
+//   抓包/shard 线程只做内存拷贝和偶尔的 open, write 和 close 都在刷盘线程里
+//
+//   SessMgr 0 (FlowPcapWriter) --full 0-->                 --empty 0--> SessMgr 0
+//   SessMgr 1 (FlowPcapWriter) --full 1--> PcapFlusher     --empty 1--> SessMgr 1
+//
+// 同一个文件的写入都经过同一条队列, 关闭后重新打开也不会乱序
+
+const uint32_t PCAP_MAX_OPEN = 512;             // default open files of all shards together
+const uint32_t PCAP_MIN_OPEN = 16;              // per shard
+const uint32_t PCAP_FILE_BUF = 65536;           // write buffer per open file
+const uint32_t PCAP_SPARE_BUFS = 64;            // buffers in flight to the flusher
+const uint32_t FLOW_PCAP_SNAPLEN = PCAP_FILE_BUF - 24 - 16;    // a record always fits a buffer
+const uint64_t PCAP_FLUSH_US = 1000000;         // quiet files are flushed after this, packet time
+
+#define FLOW_PCAP_DIR "output/pcap"
+
+/*
+ *@brief 交给刷盘线程的一次写, buf 写完后还给生产者, close 表示写完关闭 fd
+ */
+struct PcapJob{
+    int fd;
+    char *buf;                  // NULL for a close without data
+    uint32_t len;
+    bool close;
+};
+
+/*
+ *@brief 后台刷盘线程, 每个 FlowPcapWriter 一对单生产者单消费者队列
+ */
+class PcapFlusher{
+public:
+    // producers writers, each with at most bufNum buffers
+    PcapFlusher(uint32_t producers, uint32_t bufNum);
+
+    // stops when still running
+    ~PcapFlusher();
+
+    // the flusher thread attaches to manager as an export thread, call before start
+    void setThreads(ThreadManager *manager){
+        pThreads = manager;
+    }
+
+    void start();
+
+    // write what is queued and join, the writers must be closed
+    void stop();
+
+    // producer side
+    void submit(uint32_t producer, const PcapJob &job);
+
+    // producer side: a buffer back from the flusher, NULL when none is back yet
+    char *reclaim(uint32_t producer);
+
+    // producer side: wait for a buffer
+    char *reclaimWait(uint32_t producer);
+
+private:
+    void run();
+
+    // jobs waiting in the rings, returns the number done
+    uint32_t drain();
+
+    uint32_t producerNum;
+    std::vector<SpscRing<PcapJob> *> full;      // writer -> flusher
+    std::vector<SpscRing<char *> *> empty;      // flusher -> writer
+
+    std::thread worker;
+    std::atomic<bool> running;
+    ThreadManager *pThreads;
+
+    // flusher thread only
+    uint64_t writes;
+    uint64_t bytes;
+    uint64_t errors;
+};
+
+/*
+ *@brief 每个 SessMgr 一个, 在 feedPkt 里写入, 单线程使用
+ */
+class FlowPcapWriter{
+public:
+    // maxOpen files of this writer at once; without a flusher the writer starts its own
+    FlowPcapWriter(uint32_t maxOpen, PcapFlusher *flusher = NULL, uint32_t producer = 0, int node = -1);
+
+    // close() first
+    ~FlowPcapWriter();
+
+    // file is the session's id, 0 before its first packet; written as the session's name;
+    // at most snaplen bytes of the frame are kept, the wire length stays
+    void write(uint32_t &file, const NetTuple5 &tuple, const struct pcap_pkthdr *hdr, const u_char *data,
+        uint32_t snaplen = UINT32_MAX);
+
+    // the session of file ended, its buffer goes to the flusher and the file is closed
+    void finish(uint32_t file);
+
+    // every open file goes to the flusher and is closed, an own flusher stops
+    void close();
+
+    // buffers a writer of maxOpen files needs
+    static uint32_t bufNum(uint32_t maxOpen){
+        return maxOpen + PCAP_SPARE_BUFS;
+    }
+
+private:
+    struct FlowFile{
+        int fd;                 // -1 closed, PCAP_FD_FAILED when it could not be opened
+        uint32_t used;
+        char *buf;              // NULL until data arrives while open
+        uint32_t prev;          // lru, 0 is the list head
+        uint32_t next;
+    };
+
+    static const int PCAP_FD_FAILED = -2;
+
+    // false when the file cannot be opened, the session is not written then;
+    // first: the session's first open, the pcap header goes in when the file is new
+    bool openFile(uint32_t file, const NetTuple5 &tuple, bool first);
+
+    // the least recently written file, to make room
+    void evict();
+
+    // hand the buffered bytes over, close afterwards
+    void submit(FlowFile &f, bool closeFd);
+
+    char *takeBuffer();
+
+    void unlink(uint32_t file);
+
+    void pushFront(uint32_t file);
+
+    // every open file with buffered data, the files stay open
+    void flushAll();
+
+    uint32_t maxOpen;
+    uint32_t openNum;
+    PcapFlusher *pFlusher;
+    bool ownFlusher;
+    uint32_t producer;
+    int node;
+    std::vector<FlowFile> files;                // [0] is the lru head
+    char *bufMem;
+    std::vector<char *> spare;
+    uint64_t lastFlushUs;
+    bool closed;
+
+    uint64_t pkts;
+    uint64_t opens;
+    uint64_t reopens;
+    uint64_t evictions;
+    uint64_t failed;            // sessions whose file could not be opened
+};
+
+#endif //FLOW_PCAP_H
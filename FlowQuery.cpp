@@ -0,0 +1,184 @@
+#include "FlowIndex.h"
+#include "PcapChunk.h"
+#include "Log.h"
+#include "StructDefine.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <algorithm>
+
+// 用 demo -x 生成的 .fidx 从大 pcap 中直接取出一条流或一个时间段
+//   flowquery -l file.pcap
+//   flowquery -f 1.2.3.4:80-5.6.7.8:1234/6 [-t start,end] -o out.pcap file.pcap
+//   flowquery -t start,end -o out.pcap file.pcap
+
+static void usage(const char *prog){
+    fprintf(stderr, "usage: %s [-l] [-f ip:port-ip:port[/proto]] [-t start,end] [-o out.pcap] file.pcap\n", prog);
+    fprintf(stderr, "  times are unix seconds, fractions allowed\n");
+}
+
+static uint64_t nowUs(){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static uint64_t recordTsUs(const struct pcap_pkthdr &hdr){
+    return (uint64_t)hdr.ts.tv_sec * 1000000 + hdr.ts.tv_usec;
+}
+
+// raw copy keeps the source byte order and time resolution
+static bool writeRecord(FILE *out, const PcapFile &file, uint64_t off, uint64_t next){
+    return fwrite(file.base + off, 1, next - off, out) == next - off;
+}
+
+static void listFlows(const FlowIndexReader &index){
+    std::vector<const FlowIdxFlow *> flows;
+    for(uint64_t i = 0; i < index.header->flowNum; i++){
+        flows.push_back(&index.flows[i]);
+    }
+    std::sort(flows.begin(), flows.end(), [](const FlowIdxFlow *a, const FlowIdxFlow *b){
+        return a->count > b->count;
+    });
+    for(auto flow : flows){
+        printf("%s packets %lu\n", flowIdxKeyStr(flow->key).c_str(), (uint64_t)flow->count);
+    }
+}
+
+int main(int argc, char *argv[]){
+    const char *flowText = NULL;
+    const char *timeText = NULL;
+    const char *outName = NULL;
+    bool list = false;
+    int opt;
+    while((opt = getopt(argc, argv, "lf:t:o:")) != -1){
+        switch(opt){
+        case 'l':
+            list = true;
+            break;
+        case 'f':
+            flowText = optarg;
+            break;
+        case 't':
+            timeText = optarg;
+            break;
+        case 'o':
+            outName = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(optind >= argc || (!list && outName == NULL) || (!list && flowText == NULL && timeText == NULL)){
+        usage(argv[0]);
+        return 1;
+    }
+    const char *pcapName = argv[optind];
+
+    uint64_t startUs = 0, endUs = UINT64_MAX;
+    if(timeText){
+        const char *comma = strchr(timeText, ',');
+        startUs = (uint64_t)(atof(timeText) * 1000000);
+        if(comma){
+            endUs = (uint64_t)(atof(comma + 1) * 1000000);
+        }
+    }
+
+    uint64_t begin = nowUs();
+    PcapFile file;
+    if(file.open(pcapName) != 0){
+        fprintf(stderr, "open %s fail\n", pcapName);
+        return 1;
+    }
+    std::string indexName = std::string(pcapName) + FLOW_INDEX_SUFFIX;
+    FlowIndexReader index;
+    if(index.open(indexName.c_str(), file.size) != 0){
+        fprintf(stderr, "no usable index %s, build it with demo -x\n", indexName.c_str());
+        return 1;
+    }
+    madvise((void *)file.base, file.size, MADV_RANDOM);
+
+    if(list){
+        listFlows(index);
+        return 0;
+    }
+
+    FILE *out = fopen(outName, "wb");
+    if(out == NULL){
+        fprintf(stderr, "create %s fail\n", outName);
+        return 1;
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+    fwrite(file.base, 1, PCAP_FILE_HEADER_LENGTH, out);
+
+    struct pcap_pkthdr hdr;
+    const u_char *data;
+    uint64_t next;
+    uint64_t written = 0;
+    bool ok = true;
+
+    if(flowText){
+        FlowIdxKey key;
+        if(!flowIdxKeyParse(flowText, key)){
+            fprintf(stderr, "bad flow %s\n", flowText);
+            fclose(out);
+            return 1;
+        }
+        const FlowIdxFlow *flow = NULL;
+        if(key.proto != 0){
+            flow = index.findFlow(key);
+        }else{
+            // proto not given, tcp first
+            key.proto = TCP_PROTOCOL_ID;
+            flow = index.findFlow(key);
+            if(flow == NULL){
+                key.proto = UDP_PROTOCOL_ID;
+                flow = index.findFlow(key);
+            }
+        }
+        if(flow){
+            const uint64_t *offsets = index.getOffsets(flow);
+            for(uint64_t i = 0; i < flow->count && ok; i++){
+                if(!file.readRecord(offsets[i], hdr, data, next)){
+                    fprintf(stderr, "bad record at %lu\n", offsets[i]);
+                    ok = false;
+                    break;
+                }
+                uint64_t ts = recordTsUs(hdr);
+                if(ts < startUs || ts >= endUs){
+                    continue;
+                }
+                ok = writeRecord(out, file, offsets[i], next);
+                written++;
+            }
+        }else{
+            fprintf(stderr, "flow %s not in %s\n", flowText, pcapName);
+        }
+    }else{
+        uint64_t off, end;
+        if(index.timeRange(startUs, endUs, off, end)){
+            while(off < end && ok && file.readRecord(off, hdr, data, next)){
+                uint64_t ts = recordTsUs(hdr);
+                if(ts >= startUs && ts < endUs){
+                    ok = writeRecord(out, file, off, next);
+                    written++;
+                }
+                off = next;
+            }
+        }
+    }
+
+    if(fclose(out) != 0){
+        ok = false;
+    }
+    if(!ok){
+        fprintf(stderr, "write %s fail\n", outName);
+        return 1;
+    }
+    printf("%lu packets written to %s in %lu ms\n", written, outName, (nowUs() - begin) / 1000);
+    return 0;
+}
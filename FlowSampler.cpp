@@ -0,0 +1,177 @@
+#include "FlowSampler.h"
+#include "HugeMem.h"
+#include "Log.h"
+#include "StructDefine.h"
+
+#include <string.h>
+#include <sys/time.h>
+
+static const uint8_t SAMPLER_DROPPED = 0xff;
+
+static uint64_t mix64(uint64_t x){
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t nowUs(){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// same for both directions, false for a non ip frame
+static bool rawFlowHash(const u_char *data, uint32_t caplen, uint64_t &hash){
+    uint32_t off = ipv4Offset(data, caplen);
+    if(off == 0){
+        return false;
+    }
+    const u_char *ip = data + off;
+    uint32_t ihl = (ip[0] & 0x0F) * 4;
+    uint8_t proto = ip[9];
+    uint32_t saddr, daddr;
+    memcpy(&saddr, ip + 12, 4);
+    memcpy(&daddr, ip + 16, 4);
+    uint64_t ports = 0;
+    if((proto == TCP_PROTOCOL_ID || proto == UDP_PROTOCOL_ID) && caplen >= off + ihl + 4){
+        uint16_t sport, dport;
+        memcpy(&sport, ip + ihl, 2);
+        memcpy(&dport, ip + ihl + 2, 2);
+        ports = sport ^ dport;
+    }
+    // xor and sum of the addresses are both symmetric
+    uint64_t h = mix64(((uint64_t)(saddr ^ daddr) << 32) | (uint32_t)(saddr + daddr));
+    hash = mix64(h ^ (ports << 8) ^ proto);
+    return true;
+}
+
+FlowSampler::FlowSampler(uint64_t maxLagUs){
+    maxLag = maxLagUs;
+    level = 0;
+    decided = (SamplerSlot *)hugeAlloc(SAMPLER_TABLE_SIZE * sizeof(SamplerSlot));
+    gen = 0;
+    pkts = 0;
+    startWallUs = 0;
+    startPktUs = 0;
+    lastLagUs = 0;
+    lowSinceUs = 0;
+    keptPkts = 0;
+    droppedPkts = 0;
+    unstored = 0;
+    maxLevelSeen = 0;
+    changes = 0;
+}
+
+FlowSampler::~FlowSampler(){
+    hugeFree(decided, SAMPLER_TABLE_SIZE * sizeof(SamplerSlot));
+}
+
+bool FlowSampler::admit(const struct pcap_pkthdr *hdr, const u_char *data, uint32_t &rate){
+    if(pkts++ % SAMPLER_CHECK_PKTS == 0){
+        adjust((uint64_t)hdr->ts.tv_sec * 1000000 + hdr->ts.tv_usec);
+    }
+
+    uint64_t h;
+    if(!rawFlowHash(data, hdr->caplen, h)){
+        // no flow to keep whole, and all of them would share one slot
+        rate = 1;
+        keptPkts++;
+        return true;
+    }
+    // high bits decide, independent of the slot; kept at level k+1 implies kept at level k
+    bool keep = ((h >> 40) & ((1u << level) - 1)) == 0;
+    SamplerSlot *slot = lookup(h, hdr->ts.tv_sec);
+    if(slot == NULL){
+        unstored++;
+    }else if(slot->decision == 0 || (slot->decision == SAMPLER_DROPPED && slot->gen != gen)){
+        slot->gen = gen;
+        slot->decision = keep ? level + 1 : SAMPLER_DROPPED;
+    }
+    uint8_t decision = slot ? slot->decision : (keep ? level + 1 : SAMPLER_DROPPED);
+    if(decision == SAMPLER_DROPPED){
+        droppedPkts++;
+        return false;
+    }
+    rate = 1u << (decision - 1);
+    keptPkts++;
+    return true;
+}
+
+SamplerSlot *FlowSampler::lookup(uint64_t hash, uint32_t sec){
+    SamplerSlot *bucket = decided + (hash & (SAMPLER_TABLE_SIZE / SAMPLER_WAYS - 1)) * SAMPLER_WAYS;
+    uint32_t tag = hash >> 32;
+    SamplerSlot *spare = NULL;
+    for(uint32_t w = 0; w < SAMPLER_WAYS; w++){
+        SamplerSlot &slot = bucket[w];
+        bool idle = slot.decision == 0 || sec > slot.lastSec + SAMPLER_IDLE_SEC;
+        if(!idle && slot.tag == tag){
+            slot.lastSec = sec;
+            return &slot;
+        }
+        // a void drop decision holds nothing a live flow depends on
+        if(spare == NULL && (idle || (slot.decision == SAMPLER_DROPPED && slot.gen != gen))){
+            spare = &slot;
+        }
+    }
+    if(spare){
+        spare->tag = tag;
+        spare->lastSec = sec;
+        spare->decision = 0;
+    }
+    return spare;
+}
+
+void FlowSampler::adjust(uint64_t pktUs){
+    uint64_t wall = nowUs();
+    if(startWallUs == 0){
+        startWallUs = wall;
+        startPktUs = pktUs;
+        return;
+    }
+    // > 0: more wall time went by than packet time, the backlog grows
+    int64_t lag = (int64_t)(wall - startWallUs) - (int64_t)(pktUs - startPktUs);
+
+    uint32_t old = level;
+    if(lag > (int64_t)maxLag){
+        lowSinceUs = 0;
+        // raise only while still falling behind, the backlog itself takes a while to drain
+        if(lag > lastLagUs && level < SAMPLER_MAX_LEVEL){
+            level++;
+        }
+    }else if(lag < (int64_t)maxLag / 4){
+        if(lowSinceUs == 0){
+            lowSinceUs = wall;
+        }else if(wall - lowSinceUs >= SAMPLER_HOLD_US && level > 0){
+            level--;
+            lowSinceUs = wall;
+        }
+    }else{
+        lowSinceUs = 0;
+    }
+    lastLagUs = lag;
+
+    // a faster than real time replay must not bank credit for a later burst
+    if(lag < 0){
+        startWallUs = wall;
+        startPktUs = pktUs;
+        lastLagUs = 0;
+    }
+
+    if(level != old){
+        // drop decisions of the old level are void, kept flows stay whole
+        gen++;
+        changes++;
+        if(level > maxLevelSeen){
+            maxLevelSeen = level;
+        }
+        LOG_WARN("sampler lag %ld ms, keeping 1 in %u new flows\n", lag / 1000, 1u << level);
+    }
+}
+
+void FlowSampler::report() const{
+    LOG_INFO("sampler kept %lu dropped %lu packets, rate now 1/%u lowest 1/%u, %u changes, %lu unstored\n",
+        keptPkts, droppedPkts, 1u << level, 1u << maxLevelSeen, changes, unstored);
+}
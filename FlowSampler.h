@@ -0,0 +1,76 @@
+#ifndef FLOW_SAMPLER_H
+#define FLOW_SAMPLER_H
+
+#include <stdint.h>
+#include <pcap.h>
+
+// 过载时按流采样: 处理落后于包时间时提高采样级别, 按流哈希整条保留或丢弃,
+// 而不是让 libpcap 随机丢包把每条流都弄残
+//   level k 保留 1/2^k 的流, level k+1 保留的流是 level k 的子集
+//   一条流第一次出现时决定去留, 之后的包沿用, 级别变化不会切断已保留的流;
+//   丢弃的决定只在当前级别内有效, 级别一变就作废, 降级后这些流重新决定
+//   决定存在组相联表里, 按流哈希的标签查找; 只有空闲超过 SAMPLER_IDLE_SEC 的槽位
+//   (或作废的丢弃决定) 才会被新流替换, 一条还在传的流不会因为冲突被重新决定
+//   一组全是活跃流时新流不入表, 按当前级别逐包决定, 计入 unstored
+//   非 ip 帧不采样
+//   每条会话记下进入时的采样率, 统计量乘以它即可还原
+
+const uint32_t SAMPLER_MAX_LEVEL = 7;               // 1 flow in 128 at most
+const uint32_t SAMPLER_TABLE_SIZE = 1 << 20;        // decided flows, power of 2
+const uint32_t SAMPLER_WAYS = 4;                    // slots per bucket
+const uint32_t SAMPLER_CHECK_PKTS = 1024;           // lag is measured every this many packets
+const uint64_t SAMPLER_HOLD_US = 1000000;           // lag stays low this long before the level drops
+const uint32_t SAMPLER_IDLE_SEC = 60;               // a decision unused this long, packet time, is forgotten
+
+/*
+ *@brief 一个流的去留, 空闲过期后槽位才让给别的流
+ */
+struct SamplerSlot{
+    uint32_t tag;                   // high bits of the flow hash
+    uint32_t lastSec;               // packet time of the flow's last frame
+    uint16_t gen;                   // sampler generation the decision was made in
+    uint8_t decision;               // 0 unseen, level + 1 kept, SAMPLER_DROPPED dropped
+};
+
+class FlowSampler{
+public:
+    // shed load once processing is more than maxLagUs behind the packet clock
+    FlowSampler(uint64_t maxLagUs);
+
+    ~FlowSampler();
+
+    // true when the flow of the frame is kept, rate is then 1 in how many flows it stands for
+    bool admit(const struct pcap_pkthdr *hdr, const u_char *data, uint32_t &rate);
+
+    uint32_t getRate() const{
+        return 1 << level;
+    }
+
+    // log the counters
+    void report() const;
+
+private:
+    void adjust(uint64_t pktUs);
+
+    // the flow's slot, a free one claimed for it, NULL when its bucket is all live flows
+    SamplerSlot *lookup(uint64_t hash, uint32_t sec);
+
+    uint64_t maxLag;
+    uint32_t level;
+    SamplerSlot *decided;
+    uint16_t gen;                   // bumped on every level change, older drop decisions are void
+
+    uint64_t pkts;
+    uint64_t startWallUs;
+    uint64_t startPktUs;
+    int64_t lastLagUs;
+    uint64_t lowSinceUs;            // wall time the lag went under the low mark, 0 when above
+
+    uint64_t keptPkts;
+    uint64_t droppedPkts;
+    uint64_t unstored;              // packets of flows that found no free slot
+    uint32_t maxLevelSeen;
+    uint32_t changes;
+};
+
+#endif //FLOW_SAMPLER_H
@@ -0,0 +1,396 @@
+#include "FlowSketch.h"
+#include "Log.h"
+#include "ShardMerger.h"
+
+#include <string.h>
+#include <algorithm>
+
+static uint64_t mix64(uint64_t x){
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static bool entryGreater(const SketchEntry &a, const SketchEntry &b){
+    return a.count > b.count;
+}
+
+SketchKey::SketchKey(const NetTuple5 &tuple, SketchDim dim){
+    saddr = 0;
+    daddr = 0;
+    sport = 0;
+    dport = 0;
+    proto = tuple.tranType;
+    pad[0] = pad[1] = pad[2] = 0;
+    // tuple is normalized, daddr:dport is the server side
+    switch(dim){
+    case SKETCH_FLOW:
+        saddr = tuple.saddr;
+        sport = tuple.sport;
+        daddr = tuple.daddr;
+        dport = tuple.dport;
+        break;
+    case SKETCH_SERVER:
+        daddr = tuple.daddr;
+        dport = tuple.dport;
+        break;
+    case SKETCH_CLIENT:
+        saddr = tuple.saddr;
+        proto = 0;
+        break;
+    default:
+        break;
+    }
+}
+
+uint64_t SketchKey::hash() const{
+    uint64_t h = mix64(((uint64_t)saddr << 32) | daddr);
+    return mix64(h ^ (((uint64_t)sport << 24) | ((uint64_t)dport << 8) | proto));
+}
+
+std::string SketchKey::toString() const{
+    char buf[64];
+    if(sport != 0){
+        snprintf(buf, sizeof(buf), "%s:%u-%s:%u/%u", TransferToIp(saddr).c_str(), sport,
+            TransferToIp(daddr).c_str(), dport, proto);
+    }else if(daddr != 0){
+        snprintf(buf, sizeof(buf), "%s:%u/%u", TransferToIp(daddr).c_str(), dport, proto);
+    }else{
+        snprintf(buf, sizeof(buf), "%s", TransferToIp(saddr).c_str());
+    }
+    return std::string(buf);
+}
+
+//=================================================================================
+CountMinSketch::CountMinSketch(){
+    clear();
+}
+
+void CountMinSketch::add(uint64_t keyHash, uint64_t weight){
+    uint32_t h1 = (uint32_t)keyHash;
+    uint32_t h2 = (uint32_t)(keyHash >> 32) | 1;
+    for(uint32_t i = 0; i < CMS_DEPTH; i++){
+        counter[i][(h1 + i * h2) & (CMS_WIDTH - 1)] += weight;
+    }
+}
+
+uint64_t CountMinSketch::estimate(uint64_t keyHash) const{
+    uint32_t h1 = (uint32_t)keyHash;
+    uint32_t h2 = (uint32_t)(keyHash >> 32) | 1;
+    uint64_t est = counter[0][h1 & (CMS_WIDTH - 1)];
+    for(uint32_t i = 1; i < CMS_DEPTH; i++){
+        uint64_t c = counter[i][(h1 + i * h2) & (CMS_WIDTH - 1)];
+        if(c < est){
+            est = c;
+        }
+    }
+    return est;
+}
+
+void CountMinSketch::merge(const CountMinSketch &other){
+    for(uint32_t i = 0; i < CMS_DEPTH; i++){
+        for(uint32_t j = 0; j < CMS_WIDTH; j++){
+            counter[i][j] += other.counter[i][j];
+        }
+    }
+}
+
+void CountMinSketch::clear(){
+    memset(counter, 0, sizeof(counter));
+}
+
+//=================================================================================
+SpaceSaving::SpaceSaving(){
+    clear();
+}
+
+void SpaceSaving::clear(){
+    size = 0;
+    memset(index, 0, sizeof(index));
+}
+
+uint32_t SpaceSaving::indexFind(const SketchKey &key, uint64_t keyHash) const{
+    uint32_t mask = TOPK_CAPACITY * 2 - 1;
+    uint32_t i = keyHash & mask;
+    while(index[i] != 0){
+        uint32_t pos = index[i] - 1;
+        if(heapHash[pos] == keyHash && heap[pos].key == key){
+            return i;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+void SpaceSaving::indexInsert(uint64_t keyHash, uint32_t pos){
+    uint32_t mask = TOPK_CAPACITY * 2 - 1;
+    uint32_t i = keyHash & mask;
+    while(index[i] != 0){
+        i = (i + 1) & mask;
+    }
+    index[i] = pos + 1;
+}
+
+void SpaceSaving::indexErase(const SketchKey &key, uint64_t keyHash){
+    uint32_t mask = TOPK_CAPACITY * 2 - 1;
+    uint32_t hole = indexFind(key, keyHash);
+    if(index[hole] == 0){
+        return;
+    }
+    uint32_t j = hole;
+    while(true){
+        j = (j + 1) & mask;
+        if(index[j] == 0){
+            break;
+        }
+        uint32_t home = heapHash[index[j] - 1] & mask;
+        bool stay = (hole <= j) ? (hole < home && home <= j) : (hole < home || home <= j);
+        if(stay){
+            continue;
+        }
+        index[hole] = index[j];
+        hole = j;
+    }
+    index[hole] = 0;
+}
+
+void SpaceSaving::swapEntry(uint32_t a, uint32_t b){
+    uint32_t sa = indexFind(heap[a].key, heapHash[a]);
+    uint32_t sb = indexFind(heap[b].key, heapHash[b]);
+    std::swap(heap[a], heap[b]);
+    std::swap(heapHash[a], heapHash[b]);
+    index[sa] = b + 1;
+    index[sb] = a + 1;
+}
+
+void SpaceSaving::siftDown(uint32_t pos){
+    while(true){
+        uint32_t l = pos * 2 + 1;
+        uint32_t r = l + 1;
+        uint32_t smallest = pos;
+        if(l < size && heap[l].count < heap[smallest].count){
+            smallest = l;
+        }
+        if(r < size && heap[r].count < heap[smallest].count){
+            smallest = r;
+        }
+        if(smallest == pos){
+            return;
+        }
+        swapEntry(pos, smallest);
+        pos = smallest;
+    }
+}
+
+void SpaceSaving::add(const SketchKey &key, uint64_t keyHash, uint64_t weight){
+    uint32_t slot = indexFind(key, keyHash);
+    if(index[slot] != 0){
+        uint32_t pos = index[slot] - 1;
+        heap[pos].count += weight;
+        siftDown(pos);
+        return;
+    }
+
+    if(size < TOPK_CAPACITY){
+        uint32_t pos = size++;
+        heap[pos].key = key;
+        heap[pos].count = weight;
+        heap[pos].error = 0;
+        heapHash[pos] = keyHash;
+        index[slot] = pos + 1;
+        // sift up
+        while(pos > 0 && heap[(pos - 1) / 2].count > heap[pos].count){
+            swapEntry(pos, (pos - 1) / 2);
+            pos = (pos - 1) / 2;
+        }
+        return;
+    }
+
+    // evict the minimum, the newcomer inherits its count as error
+    uint64_t minCount = heap[0].count;
+    indexErase(heap[0].key, heapHash[0]);
+    heap[0].key = key;
+    heap[0].count = minCount + weight;
+    heap[0].error = minCount;
+    heapHash[0] = keyHash;
+    indexInsert(keyHash, 0);
+    siftDown(0);
+}
+
+void SpaceSaving::topN(uint32_t n, std::vector<SketchEntry> &out) const{
+    out.assign(heap, heap + size);
+    std::sort(out.begin(), out.end(), entryGreater);
+    if(out.size() > n){
+        out.resize(n);
+    }
+}
+
+// mergeable summaries: a key missing on one side may have had up to that side's minimum
+void SpaceSaving::merge(const SpaceSaving &other){
+    std::vector<SketchEntry> all;
+    std::vector<uint64_t> hashes;
+    uint64_t minSelf = getMinCount();
+    uint64_t minOther = other.getMinCount();
+
+    for(uint32_t i = 0; i < size; i++){
+        SketchEntry e = heap[i];
+        uint32_t slot = other.indexFind(e.key, heapHash[i]);
+        if(other.index[slot] != 0){
+            const SketchEntry &o = other.heap[other.index[slot] - 1];
+            e.count += o.count;
+            e.error += o.error;
+        }else{
+            e.count += minOther;
+            e.error += minOther;
+        }
+        all.push_back(e);
+        hashes.push_back(heapHash[i]);
+    }
+    for(uint32_t i = 0; i < other.size; i++){
+        if(index[indexFind(other.heap[i].key, other.heapHash[i])] != 0){
+            continue;
+        }
+        SketchEntry e = other.heap[i];
+        e.count += minSelf;
+        e.error += minSelf;
+        all.push_back(e);
+        hashes.push_back(other.heapHash[i]);
+    }
+
+    // keep the largest TOPK_CAPACITY
+    std::vector<uint32_t> order(all.size());
+    for(uint32_t i = 0; i < order.size(); i++){
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&all](uint32_t a, uint32_t b){
+        return all[a].count > all[b].count;
+    });
+
+    clear();
+    for(uint32_t i = 0; i < order.size() && size < TOPK_CAPACITY; i++){
+        heap[size] = all[order[i]];
+        heapHash[size] = hashes[order[i]];
+        indexInsert(heapHash[size], size);
+        size++;
+    }
+    // descending order is a valid max heap, rebuild as min heap
+    for(int32_t i = (int32_t)size / 2 - 1; i >= 0; i--){
+        siftDown(i);
+    }
+}
+
+//=================================================================================
+FlowSketch::FlowSketch(){
+    intervalStartUs = 0;
+    lastTsUs = 0;
+    totalBytes = 0;
+    fd = NULL;
+    merger = NULL;
+    shard = 0;
+}
+
+void FlowSketch::setMerger(ShardMerger *merger, uint32_t shard){
+    this->merger = merger;
+    this->shard = shard;
+}
+
+void FlowSketch::update(const NetTuple5 &tuple, uint32_t bytes, uint64_t tsUs){
+    // intervals are aligned so that shards agree on them
+    uint64_t start = tsUs - tsUs % SKETCH_REPORT_INTERVAL_US;
+    if(intervalStartUs == 0){
+        intervalStartUs = start;
+    }else if(start > intervalStartUs){
+        report();
+        intervalStartUs = start;
+    }
+    lastTsUs = tsUs;
+    totalBytes += bytes;
+
+    for(int dim = 0; dim < SKETCH_DIM_NUM; dim++){
+        SketchKey key(tuple, (SketchDim)dim);
+        uint64_t h = key.hash();
+        cms[dim].add(h, bytes);
+        topk[dim].add(key, h, bytes);
+    }
+}
+
+uint64_t FlowSketch::estimate(SketchDim dim, const SketchKey &key) const{
+    return cms[dim].estimate(key.hash());
+}
+
+void FlowSketch::topN(SketchDim dim, uint32_t n, std::vector<SketchEntry> &out) const{
+    topk[dim].topN(n, out);
+}
+
+void FlowSketch::merge(const FlowSketch &other){
+    for(int dim = 0; dim < SKETCH_DIM_NUM; dim++){
+        cms[dim].merge(other.cms[dim]);
+        topk[dim].merge(other.topk[dim]);
+    }
+    totalBytes += other.totalBytes;
+    if(intervalStartUs == 0){
+        intervalStartUs = other.intervalStartUs;
+    }
+    if(other.lastTsUs > lastTsUs){
+        lastTsUs = other.lastTsUs;
+    }
+}
+
+// end of the current interval, sharded sketches are reported by the merger
+void FlowSketch::report(){
+    if(merger){
+        merger->addSketch(shard, intervalStartUs, *this);
+    }else if(totalBytes > 0){
+        if(fd == NULL){
+            fd = fopen(SKETCH_REPORT_FILE, "a");
+            if(fd == NULL){
+                LOG_DEBUG("fd create fail\n");
+            }
+        }
+        if(fd){
+            write(fd);
+        }
+    }
+    clear();
+}
+
+void FlowSketch::write(FILE *out) const{
+    static const char *dimName[SKETCH_DIM_NUM] = {"flow", "server", "client"};
+    if(totalBytes == 0){
+        return;
+    }
+
+    std::vector<SketchEntry> top;
+    for(int dim = 0; dim < SKETCH_DIM_NUM; dim++){
+        topN((SketchDim)dim, TOPK_REPORT_NUM, top);
+        for(uint32_t i = 0; i < top.size(); i++){
+            // the cms bound is usually tighter than the space-saving one
+            uint64_t bytes = std::min(top[i].count, estimate((SketchDim)dim, top[i].key));
+            fprintf(out, "%lu %s %u %s bytes %lu min %lu share %.1f%%\n", intervalStartUs / 1000000, dimName[dim], i + 1,
+                top[i].key.toString().c_str(), bytes, top[i].count - top[i].error, bytes * 100.0 / totalBytes);
+        }
+    }
+    fflush(out);
+}
+
+void FlowSketch::clear(){
+    for(int dim = 0; dim < SKETCH_DIM_NUM; dim++){
+        cms[dim].clear();
+        topk[dim].clear();
+    }
+    totalBytes = 0;
+}
+
+// last, partial interval
+void FlowSketch::close(){
+    if(intervalStartUs != 0){
+        report();
+    }
+    if(fd){
+        fclose(fd);
+        fd = NULL;
+    }
+}
@@ -0,0 +1,164 @@
+#ifndef FLOW_SKETCH_H
+#define FLOW_SKETCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "StructDefine.h"
+
+class ShardMerger;
+
+// 大流/top talker 检测: count-min sketch + space-saving top-K
+// 内存固定, 种子固定, 不同 shard 的同维度 sketch 可以直接合并
+
+const uint32_t CMS_DEPTH = 4;
+const uint32_t CMS_WIDTH = 4096;                    // must be power of 2
+const uint32_t TOPK_CAPACITY = 256;                 // entries kept by space-saving
+const uint32_t TOPK_REPORT_NUM = 10;
+const uint64_t SKETCH_REPORT_INTERVAL_US = 1000000;
+
+#define SKETCH_REPORT_FILE "output/topk.out"
+
+enum SketchDim{
+    SKETCH_FLOW,                // client ip:port <-> server ip:port
+    SKETCH_SERVER,              // server ip:port
+    SKETCH_CLIENT,              // client ip
+    SKETCH_DIM_NUM
+};
+
+/*
+ *@brief sketch 的键, 不用的字段为 0
+ */
+struct SketchKey{
+    SketchKey(){
+        saddr = 0;
+        daddr = 0;
+        sport = 0;
+        dport = 0;
+        proto = 0;
+        pad[0] = pad[1] = pad[2] = 0;
+    }
+
+    SketchKey(const NetTuple5 &tuple, SketchDim dim);
+
+    bool operator==(const SketchKey &x) const{
+        return saddr == x.saddr && daddr == x.daddr && sport == x.sport && dport == x.dport && proto == x.proto;
+    }
+
+    uint64_t hash() const;
+
+    std::string toString() const;
+
+    uint32_t saddr;
+    uint32_t daddr;
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t proto;
+    uint8_t pad[3];
+};
+
+struct SketchEntry{
+    SketchKey key;
+    uint64_t count;             // upper bound of the true count
+    uint64_t error;             // count - error is a lower bound
+};
+
+class CountMinSketch{
+public:
+    CountMinSketch();
+
+    void add(uint64_t keyHash, uint64_t weight);
+
+    uint64_t estimate(uint64_t keyHash) const;
+
+    void merge(const CountMinSketch &other);
+
+    void clear();
+
+private:
+    uint64_t counter[CMS_DEPTH][CMS_WIDTH];
+};
+
+/*
+ *@brief space-saving, 最小堆 + 开放寻址索引, 更新 O(log k)
+ */
+class SpaceSaving{
+public:
+    SpaceSaving();
+
+    void add(const SketchKey &key, uint64_t keyHash, uint64_t weight);
+
+    // entries sorted by count, at most n
+    void topN(uint32_t n, std::vector<SketchEntry> &out) const;
+
+    void merge(const SpaceSaving &other);
+
+    void clear();
+
+    uint64_t getMinCount() const{
+        return (size < TOPK_CAPACITY) ? 0 : heap[0].count;
+    }
+
+private:
+    uint32_t indexFind(const SketchKey &key, uint64_t keyHash) const;
+
+    void indexInsert(uint64_t keyHash, uint32_t pos);
+
+    void indexErase(const SketchKey &key, uint64_t keyHash);
+
+    void swapEntry(uint32_t a, uint32_t b);
+
+    void siftDown(uint32_t pos);
+
+    SketchEntry heap[TOPK_CAPACITY];
+    uint64_t heapHash[TOPK_CAPACITY];
+    uint32_t size;
+
+    // key hash -> heap position + 1, 0 is empty
+    uint32_t index[TOPK_CAPACITY * 2];
+};
+
+class FlowSketch{
+public:
+    FlowSketch();
+
+    // called for every parsed packet, bytes on the wire
+    void update(const NetTuple5 &tuple, uint32_t bytes, uint64_t tsUs);
+
+    uint64_t estimate(SketchDim dim, const SketchKey &key) const;
+
+    void topN(SketchDim dim, uint32_t n, std::vector<SketchEntry> &out) const;
+
+    // fold in another shard's sketch covering the same interval
+    void merge(const FlowSketch &other);
+
+    // hand finished intervals to the merger instead of writing them
+    void setMerger(ShardMerger *merger, uint32_t shard);
+
+    // finish the current interval: write top-N of every dimension and clear
+    void report();
+
+    void write(FILE *out) const;
+
+    void clear();
+
+    void close();
+
+    uint64_t getIntervalStart() const{
+        return intervalStartUs;
+    }
+
+private:
+    CountMinSketch cms[SKETCH_DIM_NUM];
+    SpaceSaving topk[SKETCH_DIM_NUM];
+    uint64_t intervalStartUs;
+    uint64_t lastTsUs;
+    uint64_t totalBytes;
+    FILE *fd;
+    ShardMerger *merger;
+    uint32_t shard;
+};
+
+#endif //FLOW_SKETCH_H
@@ -54,6 +54,21 @@ public:
 		}	
 		return hash;
 	}
+
+	/*
+	 *@brief 随机密钥, 会话快照恢复后同一条流的哈希值不变
+	 */
+	void GetKey(uint8_t key[24]) const
+	{
+		memcpy(key, xorr, 12);
+		memcpy(key + 12, perm, 12);
+	}
+
+	void SetKey(const uint8_t key[24])
+	{
+		memcpy(xorr, key, 12);
+		memcpy(perm, key + 12, 12);
+	}
 	
 private:
 	
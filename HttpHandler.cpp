@@ -0,0 +1,103 @@
+#include "HttpHandler.h"
+#include "Log.h"
+
+#include <string.h>
+
+static const char *HTTP_METHODS[] = {"GET ", "POST ", "PUT ", "HEAD ", "DELETE ", "OPTIONS ", "PATCH ", "CONNECT ", "TRACE "};
+
+HttpHandler::HttpHandler(){
+    sessions = 0;
+    requests = 0;
+    responses = 0;
+    clientErrors = 0;
+    serverErrors = 0;
+}
+
+void HttpHandler::scan(State &state, Direct direct, const u_char *data, uint32_t len){
+    uint8_t &headLen = state.headLen[direct];
+    char *head = state.head[direct];
+    const u_char *p = data;
+    const u_char *end = data + len;
+    while(p < end){
+        if(headLen == HTTP_HEAD_SKIP){
+            p = (const u_char *)memchr(p, '\n', end - p);
+            if(p == NULL){
+                return;
+            }
+            p++;
+            headLen = 0;
+            continue;
+        }
+        u_char c = *p++;
+        if(c == '\n'){
+            classify(state, direct);
+            headLen = 0;
+            continue;
+        }
+        head[headLen++] = c;
+        if(headLen == HTTP_HEAD_LEN){
+            classify(state, direct);
+            headLen = HTTP_HEAD_SKIP;
+        }
+        if(state.kind == HTTP_NO){
+            return;
+        }
+    }
+}
+
+void HttpHandler::classify(State &state, Direct direct){
+    uint32_t n = state.headLen[direct];
+    const char *head = state.head[direct];
+    if(direct == Cli2Ser){
+        bool request = false;
+        for(auto method : HTTP_METHODS){
+            uint32_t m = strlen(method);
+            if(n >= m && memcmp(head, method, m) == 0){
+                request = true;
+                break;
+            }
+        }
+        if(request){
+            state.requests++;
+            requests++;
+        }
+        if(state.kind == HTTP_UNKNOWN){
+            // the first client line decides
+            state.kind = request ? HTTP_YES : HTTP_NO;
+            sessions += request;
+        }
+        return;
+    }
+
+    if(n >= 12 && memcmp(head, "HTTP/1.", 7) == 0 && head[8] == ' '){
+        uint16_t status = 0;
+        for(uint32_t i = 9; i < 12 && head[i] >= '0' && head[i] <= '9'; i++){
+            status = status * 10 + (head[i] - '0');
+        }
+        state.responses++;
+        state.lastStatus = status;
+        responses++;
+        clientErrors += (status >= 400 && status < 500);
+        serverErrors += (status >= 500);
+        if(state.kind == HTTP_UNKNOWN){
+            state.kind = HTTP_YES;
+            sessions++;
+        }
+    }
+}
+
+void HttpHandler::onEnd(State &state, const NetTuple5 &tuple){
+    if(state.kind != HTTP_YES){
+        return;
+    }
+    LOG_INFO("http %s requests %u responses %u last status %u\n", tuple.getName().c_str(),
+        state.requests, state.responses, state.lastStatus);
+}
+
+void HttpHandler::report(const char *name) const{
+    if(sessions == 0){
+        return;
+    }
+    LOG_INFO("%s http sessions %lu requests %lu responses %lu 4xx %lu 5xx %lu\n", name,
+        sessions, requests, responses, clientErrors, serverErrors);
+}
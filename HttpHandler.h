@@ -0,0 +1,64 @@
+#ifndef HTTP_HANDLER_H
+#define HTTP_HANDLER_H
+
+#include "ProtoHandler.h"
+
+// HTTP/1.x 请求和响应计数, 看重组后的流里每一行的行首
+//   客户端方向第一行是请求行才认为是 HTTP, 否则这条会话之后不再看
+//   只保存每个方向当前行的前 HTTP_HEAD_LEN 个字节, 行的其余部分用 memchr 跳过
+
+const uint32_t HTTP_HEAD_LEN = 12;      // "HTTP/1.1 200"
+const uint8_t HTTP_HEAD_SKIP = 0xff;    // rest of the line is not looked at
+
+class HttpHandler : public ProtoHandler<HttpHandler>{
+public:
+    enum Kind{
+        HTTP_UNKNOWN = 0,
+        HTTP_YES,
+        HTTP_NO,
+    };
+
+    struct State{
+        uint8_t kind;
+        uint8_t headLen[2];             // bytes of head, HTTP_HEAD_SKIP until the next line
+        char head[2][HTTP_HEAD_LEN];    // start of the current line, indexed by Direct
+        uint32_t requests;
+        uint32_t responses;
+        uint16_t lastStatus;
+    };
+
+    HttpHandler();
+
+    static bool wants(const NetTuple5 &tuple){
+        return tuple.tranType == TranType_TCP;
+    }
+
+    void onData(State &state, const NetTuple5 &tuple, Direct direct, const u_char *data, uint32_t len){
+        // one compare per segment for everything that is not http
+        if(state.kind != HTTP_NO){
+            scan(state, direct, data, len);
+        }
+    }
+
+    void onEnd(State &state, const NetTuple5 &tuple);
+
+    const char *app(const State &state) const{
+        return (state.kind == HTTP_YES) ? "http" : NULL;
+    }
+
+    void report(const char *name) const;
+
+private:
+    void scan(State &state, Direct direct, const u_char *data, uint32_t len);
+
+    // a line start is complete, count it
+    void classify(State &state, Direct direct);
+
+    uint64_t sessions;
+    uint64_t requests;
+    uint64_t responses;
+    uint64_t clientErrors;          // 4xx
+    uint64_t serverErrors;          // 5xx
+};
+
+#endif //HTTP_HANDLER_H
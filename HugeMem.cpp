@@ -0,0 +1,206 @@
+#include "HugeMem.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+
+// linux/mempolicy.h, no libnuma needed
+static const int NUMA_MPOL_PREFERRED = 1;
+static const uint32_t NUMA_MAX_NODES = 64;
+
+static std::atomic<uint64_t> hugetlbBytes(0);   // reserved hugepages
+static std::atomic<uint64_t> thpBytes(0);       // advised transparent hugepages
+static std::atomic<uint64_t> smallBytes(0);     // mmap without hugepages, or heap
+static std::atomic<uint64_t> boundBytes(0);     // placed on a numa node
+static std::atomic<uint32_t> hugetlbFail(0);
+static std::atomic<bool> hugetlbOn(true);
+
+static size_t roundUp(size_t bytes){
+    return (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+static uint32_t readNodeNum(){
+    // "0" or "0-3", holes are not expected on real machines
+    uint32_t last = 0;
+    FILE *fp = fopen("/sys/devices/system/node/online", "r");
+    if(fp){
+        char line[64] = {0};
+        if(fgets(line, sizeof(line), fp)){
+            const char *dash = strrchr(line, '-');
+            last = atoi(dash ? dash + 1 : line);
+        }
+        fclose(fp);
+    }
+    return (last + 1 < NUMA_MAX_NODES) ? last + 1 : NUMA_MAX_NODES;
+}
+
+uint32_t numaNodeNum(){
+    static uint32_t num = readNodeNum();
+    return num;
+}
+
+int numaNodeOfCpu(int cpu){
+    // cpuN/nodeM links, one per cpu
+    char path[64];
+    for(uint32_t node = 0; node < numaNodeNum(); node++){
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%u", cpu, node);
+        if(access(path, F_OK) == 0){
+            return node;
+        }
+    }
+    return -1;
+}
+
+static void bindNode(void *p, size_t bytes, int node){
+    if(node < 0 || numaNodeNum() <= 1){
+        return;
+    }
+    // preferred, not bound: a full node spills instead of failing the page fault
+    unsigned long mask = 1UL << (node % numaNodeNum());
+    if(syscall(SYS_mbind, p, bytes, NUMA_MPOL_PREFERRED, &mask, NUMA_MAX_NODES, 0) == 0){
+        boundBytes += bytes;
+    }
+}
+
+void *hugeAlloc(size_t bytes, int node){
+    if(bytes < HUGE_MIN_BYTES){
+        void *p = calloc(1, bytes ? bytes : 1);
+        if(p == NULL){
+            throw std::bad_alloc();
+        }
+        smallBytes += bytes;
+        return p;
+    }
+
+    size_t len = roundUp(bytes);
+    void *p;
+    if(hugetlbOn.load()){
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(p != MAP_FAILED){
+            hugetlbBytes += len;
+            bindNode(p, len, node);
+            return p;
+        }
+        hugetlbFail++;
+    }
+
+    // no reserved pool or not wanted, ask for transparent hugepages; 2MB alignment lets khugepaged back all of it
+    p = mmap(NULL, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED){
+        throw std::bad_alloc();
+    }
+    uintptr_t start = (uintptr_t)p;
+    uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    if(aligned > start){
+        munmap(p, aligned - start);
+    }
+    munmap((void *)(aligned + len), start + HUGE_PAGE_SIZE - aligned);
+    p = (void *)aligned;
+
+    if(madvise(p, len, MADV_HUGEPAGE) == 0){
+        thpBytes += len;
+    }else{
+        smallBytes += len;
+    }
+    bindNode(p, len, node);
+    return p;
+}
+
+void hugeFree(void *p, size_t bytes){
+    if(p == NULL){
+        return;
+    }
+    if(bytes < HUGE_MIN_BYTES){
+        free(p);
+        return;
+    }
+    munmap(p, roundUp(bytes));
+}
+
+void hugeUseHugetlb(bool use){
+    hugetlbOn.store(use);
+}
+
+uint64_t hugeHugetlbBytes(){
+    return hugetlbBytes.load();
+}
+
+// AnonHugePages of the process, what the kernel actually backed with transparent hugepages
+static uint64_t anonHugeKb(){
+    uint64_t kb = 0;
+    FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+    if(fp == NULL){
+        return 0;
+    }
+    char line[256];
+    while(fgets(line, sizeof(line), fp)){
+        if(strncmp(line, "AnonHugePages:", 14) == 0){
+            kb = strtoull(line + 14, NULL, 10);
+            break;
+        }
+    }
+    fclose(fp);
+    return kb;
+}
+
+void hugeReport(){
+    LOG_INFO("memory hugetlb %lu MB transparent huge %lu MB (backed %lu MB) small %lu MB numa nodes %u placed %lu MB%s\n",
+        hugetlbBytes.load() >> 20, thpBytes.load() >> 20, anonHugeKb() >> 10, smallBytes.load() >> 20,
+        numaNodeNum(), boundBytes.load() >> 20, hugetlbFail.load() ? ", no hugetlbfs pages reserved" : "");
+}
+
+//=================================================================================
+HugeArena::HugeArena(int node){
+    this->node = node;
+    cur = NULL;
+    left = 0;
+    memset(freeList, 0, sizeof(freeList));
+}
+
+HugeArena::~HugeArena(){
+    for(auto block : blocks){
+        hugeFree(block, HUGE_PAGE_SIZE);
+    }
+}
+
+void *HugeArena::alloc(size_t bytes){
+    size_t size = (bytes + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if(size > ARENA_MAX_OBJECT){
+        return ::operator new(bytes);
+    }
+    void *&head = freeList[size / ARENA_ALIGN];
+    if(head){
+        void *p = head;
+        head = *(void **)p;
+        return p;
+    }
+    if(left < size){
+        // the tail of the old block is not worth a free list
+        cur = (char *)hugeAlloc(HUGE_PAGE_SIZE, node);
+        left = HUGE_PAGE_SIZE;
+        blocks.push_back(cur);
+    }
+    void *p = cur;
+    cur += size;
+    left -= size;
+    return p;
+}
+
+void HugeArena::free(void *p, size_t bytes){
+    size_t size = (bytes + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if(size > ARENA_MAX_OBJECT){
+        ::operator delete(p);
+        return;
+    }
+    *(void **)p = freeList[size / ARENA_ALIGN];
+    freeList[size / ARENA_ALIGN] = p;
+}
@@ -0,0 +1,250 @@
+#ifndef HUGE_MEM_H
+#define HUGE_MEM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <vector>
+
+// 大页和 NUMA 感知的内存分配
+//   大块 (>= HUGE_MIN_BYTES) 按 2MB 对齐 mmap: 先试 hugetlbfs 预留的大页 (MAP_HUGETLB),
+//   没有预留时退回透明大页 (madvise MADV_HUGEPAGE), 再不行就是普通页, 调用方无感知
+//   hugetlbfs 的页在 mmap 时就从预留池里扣掉; 透明大页和普通页第一次写入时才分配物理页
+//   node >= 0 时用 mbind 优先放在该 NUMA 节点上
+//
+//   fork 之后 (会话 checkpoint) hugetlbfs 的私有映射写时复制按 2MB 整页拷贝, 抓包线程会卡住,
+//   预留池不够时子进程还会收到 SIGBUS; 透明大页写时复制只拷 4KB
+//   所以要 fork 的进程在第一次分配前调用 hugeUseHugetlb(false), 之后只用透明大页
+//   小块走普通堆; 会话表这类大量小对象从 HugeArena 的 2MB 块里切, 定长的会话结构用 SlabPool
+
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+const size_t HUGE_MIN_BYTES = 1 << 20;          // smaller blocks stay on the heap
+const size_t ARENA_ALIGN = 16;
+const size_t ARENA_MAX_OBJECT = 1024;           // larger objects are not carved from arena blocks
+
+// numa nodes of the machine, 1 when not numa or unknown
+uint32_t numaNodeNum();
+
+// node of the cpu, -1 when unknown
+int numaNodeOfCpu(int cpu);
+
+// zeroed memory, node -1 for no placement; never NULL, throws like new
+void *hugeAlloc(size_t bytes, int node = -1);
+
+// bytes as passed to hugeAlloc
+void hugeFree(void *p, size_t bytes);
+
+// whether later hugeAlloc calls try hugetlbfs first, on by default;
+// off for processes that fork() with the tables live, blocks already mapped keep their pages
+void hugeUseHugetlb(bool use);
+
+// bytes mapped from hugetlbfs so far, 0 means a fork() copies on write in 4KB pages
+uint64_t hugeHugetlbBytes();
+
+// log what is backed by hugetlbfs, transparent hugepages and small pages
+void hugeReport();
+
+template<typename T>
+T *hugeNewArray(size_t n, int node = -1){
+    T *a = (T *)hugeAlloc(n * sizeof(T), node);
+    for(size_t i = 0; i < n; i++){
+        new(&a[i]) T();
+    }
+    return a;
+}
+
+template<typename T>
+void hugeDeleteArray(T *a, size_t n){
+    if(a == NULL){
+        return;
+    }
+    for(size_t i = 0; i < n; i++){
+        a[i].~T();
+    }
+    hugeFree(a, n * sizeof(T));
+}
+
+/*
+ *@brief 小对象分配器, 从大页块中按 16 字节分级切分, 释放的对象按级挂空闲链, 单线程使用
+ */
+class HugeArena{
+public:
+    HugeArena(int node = -1);
+
+    // every block goes back at once, objects still in use must not be touched afterwards
+    ~HugeArena();
+
+    void *alloc(size_t bytes);
+
+    void free(void *p, size_t bytes);
+
+    int getNode() const{
+        return node;
+    }
+
+private:
+    HugeArena(const HugeArena &);
+    HugeArena &operator=(const HugeArena &);
+
+    int node;
+    std::vector<char *> blocks;
+    char *cur;                                  // free space in the last block
+    size_t left;
+    void *freeList[ARENA_MAX_OBJECT / ARENA_ALIGN + 1];
+};
+
+/*
+ *@brief 定长对象池, 对象从大页 slab 中切出, 释放的对象挂空闲链, 创建和销毁只是出入链表, 单线程使用
+ *  reserve 一次映射 n 个对象, hugetlbfs 的页当场占用, 其余物理页第一次用到时才分配; 用完后每次再加一个 2MB 的 slab
+ */
+template<typename T>
+class SlabPool{
+public:
+    SlabPool(int node = -1){
+        this->node = node;
+        freeList = NULL;
+        cur = NULL;
+        left = 0;
+        inUse = 0;
+        peak = 0;
+        capacity = 0;
+    }
+
+    // objects still in use must not be touched afterwards
+    ~SlabPool(){
+        for(auto &slab : slabs){
+            hugeFree(slab.first, slab.second);
+        }
+    }
+
+    // room for n more objects without going back to the system
+    void reserve(size_t n){
+        addSlab(n);
+    }
+
+    template<typename... Args>
+    T *create(Args&&... args){
+        return new(take()) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T *p){
+        if(p == NULL){
+            return;
+        }
+        p->~T();
+        *(void **)p = freeList;
+        freeList = p;
+        inUse--;
+    }
+
+    size_t getInUse() const{
+        return inUse;
+    }
+
+    size_t getPeak() const{
+        return peak;
+    }
+
+    size_t getCapacity() const{
+        return capacity;
+    }
+
+private:
+    SlabPool(const SlabPool &);
+    SlabPool &operator=(const SlabPool &);
+
+    // 16 bytes or the type's own alignment, e.g. a cache line
+    static const size_t ALIGN = (alignof(T) > ARENA_ALIGN) ? alignof(T) : ARENA_ALIGN;
+
+    // at least a pointer for the free list
+    static const size_t SIZE = ((sizeof(T) > sizeof(void *) ? sizeof(T) : sizeof(void *)) + ALIGN - 1) & ~(ALIGN - 1);
+
+    void addSlab(size_t n){
+        if(n == 0){
+            return;
+        }
+        // small slabs come from the heap at 16 bytes, room to align the first object
+        size_t bytes = n * SIZE + ALIGN - ARENA_ALIGN;
+        char *slab = (char *)hugeAlloc(bytes, node);
+        slabs.push_back(std::make_pair(slab, bytes));
+        // the tail of the old slab is not worth a free list
+        cur = (char *)(((uintptr_t)slab + ALIGN - 1) & ~(uintptr_t)(ALIGN - 1));
+        left = n;
+        capacity += n;
+    }
+
+    void *take(){
+        void *p = freeList;
+        if(p){
+            freeList = *(void **)p;
+        }else{
+            if(left == 0){
+                addSlab(HUGE_PAGE_SIZE / SIZE > 0 ? HUGE_PAGE_SIZE / SIZE : 1);
+            }
+            p = cur;
+            cur += SIZE;
+            left--;
+        }
+        if(++inUse > peak){
+            peak = inUse;
+        }
+        return p;
+    }
+
+    int node;
+    std::vector<std::pair<char *, size_t> > slabs;
+    void *freeList;
+    char *cur;                                  // never used objects of the last slab
+    size_t left;
+    size_t inUse;
+    size_t peak;
+    size_t capacity;
+};
+
+/*
+ *@brief std 容器的分配器, 单个节点从 HugeArena 取, 数组走普通堆
+ */
+template<typename T>
+class ArenaAllocator{
+public:
+    typedef T value_type;
+
+    ArenaAllocator(HugeArena *arena = NULL){
+        this->arena = arena;
+    }
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other){
+        arena = other.arena;
+    }
+
+    T *allocate(size_t n){
+        if(arena && n == 1 && sizeof(T) <= ARENA_MAX_OBJECT){
+            return (T *)arena->alloc(sizeof(T));
+        }
+        return (T *)::operator new(n * sizeof(T));
+    }
+
+    void deallocate(T *p, size_t n){
+        if(arena && n == 1 && sizeof(T) <= ARENA_MAX_OBJECT){
+            arena->free(p, sizeof(T));
+        }else{
+            ::operator delete(p);
+        }
+    }
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U> &other) const{
+        return arena == other.arena;
+    }
+
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const{
+        return arena != other.arena;
+    }
+
+    HugeArena *arena;
+};
+
+#endif //HUGE_MEM_H
@@ -0,0 +1,302 @@
+#include "IpfixExporter.h"
+#include "Log.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+struct IpfixField{
+    uint16_t id;
+    uint16_t len;
+};
+
+// IANA information elements, in record order
+static const IpfixField IPFIX_FIELDS[] = {
+    {8,   4},       // sourceIPv4Address
+    {12,  4},       // destinationIPv4Address
+    {7,   2},       // sourceTransportPort
+    {11,  2},       // destinationTransportPort
+    {4,   1},       // protocolIdentifier
+    {6,   2},       // tcpControlBits
+    {152, 8},       // flowStartMilliseconds
+    {153, 8},       // flowEndMilliseconds
+    {231, 8},       // initiatorOctets
+    {232, 8},       // responderOctets
+    {298, 8},       // initiatorPackets
+    {299, 8},       // responderPackets
+};
+static const uint32_t IPFIX_FIELD_NUM = sizeof(IPFIX_FIELDS) / sizeof(IPFIX_FIELDS[0]);
+static const uint32_t IPFIX_RECORD_LEN = 63;
+static const uint32_t IPFIX_HEADER_LEN = 16;
+static const uint32_t IPFIX_SET_HEADER_LEN = 4;
+static const uint16_t IPFIX_TEMPLATE_SET_ID = 2;
+
+static uint64_t nowUs(){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void put16(uint8_t *p, uint16_t v){
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void put32(uint8_t *p, uint32_t v){
+    put16(p, v >> 16);
+    put16(p + 2, v);
+}
+
+static void put64(uint8_t *p, uint64_t v){
+    put32(p, v >> 32);
+    put32(p + 4, v);
+}
+
+IpfixExporter::IpfixExporter(uint32_t producers, uint32_t domainId){
+    producerNum = (producers > 0) ? producers : 1;
+    domain = domainId;
+    sock = -1;
+    for(uint32_t i = 0; i < producerNum; i++){
+        rings.push_back(new SpscRing<FlowRecord>(IPFIX_RING_SIZE));
+        dropped.push_back(new std::atomic<uint64_t>(0));
+    }
+    running.store(false);
+    pThreads = NULL;
+    batchNum = 0;
+    cur = 0;
+    setStart = 0;
+    curRecords = 0;
+    curStartUs = 0;
+    sequence = 0;
+    lastTemplateUs = 0;
+    pktsSinceTemplate = 0;
+    records = 0;
+    packets = 0;
+    sendErrors = 0;
+    sendDropped = 0;
+}
+
+IpfixExporter::~IpfixExporter(){
+    stop();
+    for(auto ring : rings){
+        delete ring;
+    }
+    for(auto counter : dropped){
+        delete counter;
+    }
+}
+
+int IpfixExporter::start(const char *collector){
+    collectorName = collector;
+    std::string host = collector;
+    std::string port = "4739";
+    size_t colon = host.rfind(':');
+    if(colon != std::string::npos){
+        port = host.substr(colon + 1);
+        host = host.substr(0, colon);
+    }
+
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    if(getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || res == NULL){
+        LOG_ERROR("ipfix collector %s not resolved\n", collector);
+        return -1;
+    }
+    sock = socket(res->ai_family, SOCK_DGRAM, 0);
+    if(sock < 0 || connect(sock, res->ai_addr, res->ai_addrlen) != 0){
+        LOG_ERROR("ipfix socket to %s fail\n", collector);
+        if(sock >= 0){
+            close(sock);
+            sock = -1;
+        }
+        freeaddrinfo(res);
+        return -1;
+    }
+    freeaddrinfo(res);
+
+    running.store(true);
+    worker = std::thread(&IpfixExporter::run, this);
+    LOG_INFO("ipfix exporting to %s\n", collector);
+    return 0;
+}
+
+void IpfixExporter::stop(){
+    if(!running.load()){
+        return;
+    }
+    running.store(false);
+    worker.join();
+    close(sock);
+    sock = -1;
+
+    uint64_t queueDropped = 0;
+    for(auto counter : dropped){
+        queueDropped += counter->load();
+    }
+    LOG_INFO("ipfix %s records %lu datagrams %lu queue dropped %lu send errors %lu send dropped %lu\n",
+        collectorName.c_str(), records, packets, queueDropped, sendErrors, sendDropped);
+}
+
+bool IpfixExporter::submit(uint32_t producer, const FlowRecord &rec, bool wait){
+    if(!running.load(std::memory_order_relaxed)){
+        return false;
+    }
+    if(rings[producer]->push(rec)){
+        return true;
+    }
+    if(wait){
+        rings[producer]->pushWait(rec);
+        return true;
+    }
+    dropped[producer]->fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void IpfixExporter::run(){
+    uint32_t tid = pThreads ? pThreads->attach(THREAD_EXPORT, 0, "ipfix") : 0;
+    while(true){
+        // read the flag first so records submitted before stop() are drained
+        bool stopping = !running.load();
+        uint32_t n = drain();
+        uint64_t now = nowUs();
+        if(cur > 0 && (stopping || now - curStartUs >= IPFIX_FLUSH_US)){
+            finishDatagram(true);
+        }else if(n == 0 && batchNum > 0 && cur == 0){
+            // the datagram being built sits behind the batch, never send under it
+            sendBatch();
+        }
+        if(stopping){
+            break;
+        }
+        if(n == 0){
+            usleep(1000);
+        }
+    }
+    if(pThreads){
+        pThreads->detach(tid);
+    }
+}
+
+uint32_t IpfixExporter::drain(){
+    uint32_t n = 0;
+    FlowRecord rec;
+    uint64_t now = nowUs();
+    for(auto ring : rings){
+        for(uint32_t k = 0; k < 256 && ring->pop(rec); k++){
+            appendRecord(rec, now);
+            n++;
+        }
+    }
+    return n;
+}
+
+void IpfixExporter::beginDatagram(uint64_t now){
+    uint8_t *p = datagrams[batchNum];
+    // length and sequence are filled in when the datagram is finished
+    put16(p, IPFIX_VERSION);
+    put32(p + 4, now / 1000000);
+    put32(p + 12, domain);
+    cur = IPFIX_HEADER_LEN;
+
+    if(lastTemplateUs == 0 || now - lastTemplateUs >= IPFIX_TEMPLATE_US || pktsSinceTemplate >= IPFIX_TEMPLATE_PKTS){
+        uint32_t len = IPFIX_SET_HEADER_LEN + 4 + IPFIX_FIELD_NUM * 4;
+        put16(p + cur, IPFIX_TEMPLATE_SET_ID);
+        put16(p + cur + 2, len);
+        put16(p + cur + 4, IPFIX_TEMPLATE_ID);
+        put16(p + cur + 6, IPFIX_FIELD_NUM);
+        uint8_t *f = p + cur + 8;
+        for(uint32_t i = 0; i < IPFIX_FIELD_NUM; i++){
+            put16(f, IPFIX_FIELDS[i].id);
+            put16(f + 2, IPFIX_FIELDS[i].len);
+            f += 4;
+        }
+        cur += len;
+        lastTemplateUs = now;
+        pktsSinceTemplate = 0;
+    }
+
+    setStart = cur;
+    put16(p + cur, IPFIX_TEMPLATE_ID);
+    cur += IPFIX_SET_HEADER_LEN;
+    curRecords = 0;
+    curStartUs = now;
+}
+
+void IpfixExporter::appendRecord(const FlowRecord &rec, uint64_t now){
+    if(cur > 0 && cur + IPFIX_RECORD_LEN > IPFIX_MAX_DATAGRAM){
+        finishDatagram(false);
+    }
+    if(cur == 0){
+        beginDatagram(now);
+    }
+    uint8_t *p = datagrams[batchNum] + cur;
+    put32(p, rec.saddr);
+    put32(p + 4, rec.daddr);
+    put16(p + 8, rec.sport);
+    put16(p + 10, rec.dport);
+    p[12] = rec.proto;
+    put16(p + 13, rec.tcpFlags);
+    put64(p + 15, rec.firstUs / 1000);
+    put64(p + 23, rec.lastUs / 1000);
+    put64(p + 31, rec.cliBytes);
+    put64(p + 39, rec.serBytes);
+    put64(p + 47, rec.cliPkts);
+    put64(p + 55, rec.serPkts);
+    cur += IPFIX_RECORD_LEN;
+    curRecords++;
+}
+
+void IpfixExporter::finishDatagram(bool force){
+    if(cur > 0){
+        uint8_t *p = datagrams[batchNum];
+        put16(p + setStart + 2, cur - setStart);
+        put16(p + 2, cur);
+        put32(p + 8, sequence);
+        sequence += curRecords;
+        records += curRecords;
+        lens[batchNum] = cur;
+        recs[batchNum] = curRecords;
+        batchNum++;
+        pktsSinceTemplate++;
+        cur = 0;
+        setStart = 0;
+        curRecords = 0;
+    }
+    if(batchNum == IPFIX_BATCH || (force && batchNum > 0)){
+        sendBatch();
+    }
+}
+
+void IpfixExporter::sendBatch(){
+    struct mmsghdr msgs[IPFIX_BATCH];
+    struct iovec iovs[IPFIX_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for(uint32_t i = 0; i < batchNum; i++){
+        iovs[i].iov_base = datagrams[i];
+        iovs[i].iov_len = lens[i];
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    uint32_t sent = 0;
+    while(sent < batchNum){
+        int n = sendmmsg(sock, msgs + sent, batchNum - sent, 0);
+        if(n <= 0){
+            // collector down (ECONNREFUSED) or buffer full, the rest of the batch is lost
+            sendErrors++;
+            for(uint32_t i = sent; i < batchNum; i++){
+                sendDropped += recs[i];
+            }
+            break;
+        }
+        sent += n;
+    }
+    packets += sent;
+    batchNum = 0;
+}
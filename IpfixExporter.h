@@ -0,0 +1,98 @@
+#ifndef IPFIX_EXPORTER_H
+#define IPFIX_EXPORTER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#include "FlowColumn.h"
+#include "SpscRing.h"
+#include "ThreadManager.h"
+
+// IPFIX (RFC 7011) 导出: 会话结束后的 FlowRecord 经无锁队列交给独立线程,
+// 打包成数据报用 sendmmsg 批量发出; 队列满时直接丢弃并计数, 不阻塞包处理
+//
+//   SessMgr 0 --ring 0-->
+//   SessMgr 1 --ring 1--> exporter thread -> template + data sets -> sendmmsg
+//   ...       --ring n-->
+
+const uint16_t IPFIX_VERSION = 10;
+const uint16_t IPFIX_TEMPLATE_ID = 256;
+const uint32_t IPFIX_RING_SIZE = 16384;         // records per producer, power of 2
+const uint32_t IPFIX_MAX_DATAGRAM = 1400;       // stays under a 1500 mtu
+const uint32_t IPFIX_BATCH = 32;                // datagrams per sendmmsg
+const uint64_t IPFIX_FLUSH_US = 100000;         // partial datagrams leave after this
+const uint64_t IPFIX_TEMPLATE_US = 30000000;    // udp collectors need the template resent
+const uint32_t IPFIX_TEMPLATE_PKTS = 1000;      // or every this many datagrams
+
+class IpfixExporter{
+public:
+    // producers is the number of threads calling submit, each with its own index
+    IpfixExporter(uint32_t producers, uint32_t domainId);
+
+    ~IpfixExporter();
+
+    // the exporter thread attaches to manager as an export thread, call before start
+    void setThreads(ThreadManager *manager){
+        pThreads = manager;
+    }
+
+    // "host:port", 0 on success, starts the exporter thread
+    int start(const char *collector);
+
+    // drain the queues, send what is left and join the thread
+    void stop();
+
+    // never blocks unless wait is set; a full queue drops the record and counts it
+    // rec.app must stay valid, it is read by the exporter thread
+    bool submit(uint32_t producer, const FlowRecord &rec, bool wait = false);
+
+private:
+    void run();
+
+    // records waiting in the rings, appended to the current datagram
+    uint32_t drain();
+
+    void beginDatagram(uint64_t nowUs);
+
+    void appendRecord(const FlowRecord &rec, uint64_t nowUs);
+
+    // close the current datagram, send the batch when full or force
+    void finishDatagram(bool force);
+
+    void sendBatch();
+
+    uint32_t producerNum;
+    uint32_t domain;
+    int sock;
+    std::string collectorName;
+
+    std::vector<SpscRing<FlowRecord> *> rings;
+    std::vector<std::atomic<uint64_t> *> dropped;   // per producer, queue full
+
+    std::thread worker;
+    std::atomic<bool> running;
+    ThreadManager *pThreads;
+
+    // exporter thread only
+    uint8_t datagrams[IPFIX_BATCH][IPFIX_MAX_DATAGRAM];
+    uint32_t lens[IPFIX_BATCH];
+    uint32_t recs[IPFIX_BATCH];
+    uint32_t batchNum;
+    uint32_t cur;                   // length of the datagram being built, 0 when none
+    uint32_t setStart;              // data set header offset, 0 when no set is open
+    uint32_t curRecords;
+    uint64_t curStartUs;
+    uint32_t sequence;              // data records sent so far, IPFIX header field
+    uint64_t lastTemplateUs;
+    uint32_t pktsSinceTemplate;
+
+    uint64_t records;
+    uint64_t packets;
+    uint64_t sendErrors;
+    uint64_t sendDropped;           // records lost in failed sends
+};
+
+#endif //IPFIX_EXPORTER_H
@@ -7,8 +7,14 @@ Packet::Packet(const Byte *newdata,uint32_t packetlen){
     tcp = NULL;
     udp = NULL;
     direct = Cli2Ser;
+    ts.tv_sec = 0;
+    ts.tv_usec = 0;
 
     datalen = packetlen;
+    wirelen = packetlen;
+    l4Off = 0;
+    ipEnd = 0;
+    sampleRate = 1;
     data = new Byte[packetlen];
     memcpy(data,newdata,packetlen);        // memory copy
     parse();
@@ -22,20 +28,34 @@ Packet::~Packet(){
 
 // must have prepare data and datalen
 void Packet::parse(){
+    if(datalen < ETH_HEADER_LENGTH + IP_HEADER_LENGTH){
+        return;
+    }
     ethernet=(eth_hdr *)data;
     if(ntohs(ethernet->eth_type)==0x0800){
-        ip=(ip_hdr *)(data+ETH_HEADER_LENGTH);
+        const Byte *iph = data + ETH_HEADER_LENGTH;
+        uint32_t ihl = (iph[0] & 0x0F) * 4;
+        uint32_t totlen = (iph[2] << 8) | iph[3];
+        if(ihl < IP_HEADER_LENGTH || datalen < ETH_HEADER_LENGTH + ihl){
+            return;
+        }
+        ip=(ip_hdr *)iph;
         tuple5.saddr = ntohl(*(uint32_t *)ip->sourceIP);
         tuple5.daddr = ntohl(*(uint32_t *)ip->destIP);
+        // short frames are padded to 60 bytes, the padding is not payload
+        l4Off = ETH_HEADER_LENGTH + ihl;
+        totlen = (totlen > ihl) ? totlen : ihl;
+        ipEnd = (totlen < datalen - ETH_HEADER_LENGTH) ? ETH_HEADER_LENGTH + totlen : datalen;
 
-        if(ip->protocol==TCP_PROTOCOL_ID){
-            tcp=(tcp_hdr *)(data+ETH_HEADER_LENGTH+IP_HEADER_LENGTH);
+        if(ip->protocol==TCP_PROTOCOL_ID && ipEnd >= l4Off + TCP_HEADER_LENGTH
+            && (data[l4Off + 12] >> 4) * 4 >= TCP_HEADER_LENGTH){
+            tcp=(tcp_hdr *)(data+l4Off);
             tuple5.sport = ntohs(tcp->sport);
             tuple5.dport = ntohs(tcp->dport);
             tuple5.tranType = TranType_TCP;
         }
-        else if(ip->protocol==UDP_PROTOCOL_ID){
-            udp=(udp_hdr *)(data+ETH_HEADER_LENGTH+IP_HEADER_LENGTH);
+        else if(ip->protocol==UDP_PROTOCOL_ID && ipEnd >= l4Off + UDP_HEADER_LENGTH){
+            udp=(udp_hdr *)(data+l4Off);
             tuple5.sport = ntohs(udp->sport);
             tuple5.dport = ntohs(udp->dport);
             tuple5.tranType = TranType_UDP;
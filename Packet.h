@@ -55,8 +55,16 @@ public:
         return ntohs(tcp->check_sum);
     }
 
+    // tcp payload length from the ip total length, ethernet padding and an uncaptured tail left out
     uint32_t getDatalen(){
-        return datalen - (34 + getHeadlen()*4);
+        assert(tcp);
+        uint32_t off = l4Off + getHeadlen()*4;
+        return (ipEnd > off) ? ipEnd - off : 0;
+    }
+
+    // tcp payload, getDatalen() bytes
+    const Byte *getTcpData(){
+        return data + l4Off + getHeadlen()*4;
     }
 
     bool isAck(){
@@ -74,6 +82,30 @@ public:
         return (tcp->flags&SYN_FLAG);
     }
 
+    bool isRst(){
+        assert(tcp);
+        return (tcp->flags&RST_FLAG);
+    }
+
+    // udp payload, bounded by the captured length
+    const Byte *getUdpData(){
+        assert(udp);
+        return data + l4Off + UDP_HEADER_LENGTH;
+    }
+
+    uint32_t getUdpDatalen(){
+        assert(udp);
+        uint32_t hdrlen = l4Off + UDP_HEADER_LENGTH;
+        uint32_t len = ntohs(udp->tot_len);
+        len = (len > UDP_HEADER_LENGTH) ? len - UDP_HEADER_LENGTH : 0;
+        return (len < ipEnd - hdrlen) ? len : ipEnd - hdrlen;
+    }
+
+    // capture time in microseconds
+    uint64_t getTsUs(){
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_usec;
+    }
+
     Byte *data;
     uint32_t datalen;
     eth_hdr *ethernet;
@@ -82,6 +114,11 @@ public:
     udp_hdr *udp;
     NetTuple5 tuple5;
     Direct direct;
+    struct timeval ts;
+    uint32_t wirelen;           // length on the wire, datalen is what was captured
+    uint32_t l4Off;             // tcp/udp header offset, after the ip options
+    uint32_t ipEnd;             // end of the ip datagram within datalen, ethernet padding follows
+    uint32_t sampleRate;        // the flow stands for this many flows, 1 when not sampled
 };
 
 #endif
\ No newline at end of file
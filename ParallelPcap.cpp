@@ -0,0 +1,383 @@
+#include "ParallelPcap.h"
+#include "PcapDir.h"
+#include "Log.h"
+
+#include <sys/time.h>
+#include <algorithm>
+
+static uint64_t nowUs(){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static uint64_t mix64(uint64_t x){
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+ParallelPcap::ParallelPcap(uint32_t threads, uint32_t hashnum, ThreadManager *manager){
+    readerNum = shardNum = (threads > 0) ? threads : 1;
+    pThreads = manager;
+    merger = new ShardMerger(shardNum);
+    cubeMerger = NULL;
+    pcapFlusher = NULL;
+    // each shard's tables and inbound rings on its node: the node of its pinned core,
+    // or spread over the nodes when shards float
+    for(uint32_t s = 0; s < shardNum; s++){
+        int core = pThreads ? pThreads->getCore(THREAD_WORKER, s) : -1;
+        int node = (core >= 0) ? numaNodeOfCpu(core) : (int)(s % numaNodeNum());
+        shardNode.push_back(numaNodeNum() > 1 ? node : -1);
+        SessMgr *mgr = new SessMgr(hashnum, shardNode[s]);
+        mgr->setMerger(merger, s);
+        mgrs.push_back(mgr);
+    }
+    for(uint32_t i = 0; i < readerNum * shardNum; i++){
+        rings.push_back(new SpscRing<PktRef>(PARALLEL_RING_SIZE, shardNode[i % shardNum]));
+    }
+    finished = false;
+    buildIndex = false;
+    filesDone = 0;
+    filter = NULL;
+    snapData = false;
+    checkpointWanted.store(false);
+    lastCheckpointUs = 0;
+    checkpointChunk = 0;
+    checkpointSeq = 0;
+    shardCheckpointSeq.assign(shardNum, 0);
+    shardChunk.assign(shardNum, 0);
+    readerPkts.assign(readerNum, 0);
+    readerFiltered.assign(readerNum, 0);
+}
+
+ParallelPcap::~ParallelPcap(){
+    // shards hand their last intervals to the merger while being destroyed
+    for(auto mgr : mgrs){
+        delete mgr;
+    }
+    delete merger;
+    // shards closed their cubes above
+    delete cubeMerger;
+    // and their pcap writers, every buffer is back
+    delete pcapFlusher;
+    for(auto ring : rings){
+        delete ring;
+    }
+    for(auto &state : files){
+        delete state.index;
+        delete state.file;
+    }
+}
+
+void ParallelPcap::setExporter(IpfixExporter *exporter){
+    for(uint32_t s = 0; s < shardNum; s++){
+        mgrs[s]->setExporter(exporter, s);
+    }
+}
+
+void ParallelPcap::setMatcher(const PatternMatcher *matcher, const RegexSet *rules){
+    for(uint32_t s = 0; s < shardNum; s++){
+        mgrs[s]->setMatcher(matcher, rules);
+    }
+}
+
+void ParallelPcap::setCube(const CubeSpec &spec){
+    delete cubeMerger;
+    cubeMerger = new CubeMerger(shardNum, spec);
+    cubeMerger->setThreads(pThreads);
+    cubeMerger->start();
+    for(uint32_t s = 0; s < shardNum; s++){
+        mgrs[s]->setCube(spec, cubeMerger);
+    }
+}
+
+void ParallelPcap::setFlowPcap(uint32_t maxOpen){
+    // split so the whole process stays under maxOpen
+    uint32_t perShard = maxOpen / shardNum;
+    perShard = (perShard > PCAP_MIN_OPEN) ? perShard : PCAP_MIN_OPEN;
+    delete pcapFlusher;
+    pcapFlusher = new PcapFlusher(shardNum, FlowPcapWriter::bufNum(perShard));
+    pcapFlusher->setThreads(pThreads);
+    pcapFlusher->start();
+    for(uint32_t s = 0; s < shardNum; s++){
+        mgrs[s]->setFlowPcap(perShard, pcapFlusher);
+    }
+}
+
+void ParallelPcap::setTruncPolicy(const TruncPolicy *policy){
+    for(uint32_t s = 0; s < shardNum; s++){
+        mgrs[s]->setTruncPolicy(policy);
+    }
+}
+
+void ParallelPcap::setDedup(uint64_t windowUs){
+    for(uint32_t s = 0; s < shardNum; s++){
+        mgrs[s]->setDedup(windowUs);
+    }
+}
+
+std::string ParallelPcap::shardSnapPath(uint32_t shard) const{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%u", shard);
+    return snapPath + suffix;
+}
+
+void ParallelPcap::setCheckpoint(const char *path, bool withData){
+    snapPath = path;
+    snapData = withData;
+    for(uint32_t s = 0; s < shardNum; s++){
+        mgrs[s]->restore(shardSnapPath(s).c_str());
+    }
+    lastCheckpointUs = nowUs();
+}
+
+bool ParallelPcap::checkpointDue(uint32_t shard, uint32_t idx){
+    if(snapPath.empty()){
+        return false;
+    }
+    bool timer = nowUs() - lastCheckpointUs >= SNAPSHOT_INTERVAL_US;
+    if((timer || checkpointWanted.load()) && shardCheckpointSeq[shard] == checkpointSeq){
+        // past the chunk any shard may be in, the cut is the same for all
+        checkpointWanted.store(false);
+        lastCheckpointUs = nowUs();
+        checkpointChunk = *std::max_element(shardChunk.begin(), shardChunk.end()) + 1;
+        checkpointSeq++;
+    }
+    if(shardCheckpointSeq[shard] != checkpointSeq && idx >= checkpointChunk){
+        shardCheckpointSeq[shard] = checkpointSeq;
+        return true;
+    }
+    return false;
+}
+
+void ParallelPcap::addFile(const char *filename){
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending.push_back(filename);
+    cond.notify_all();
+}
+
+void ParallelPcap::addFiles(std::vector<std::string> names){
+    sortPcapFiles(names);
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending.insert(pending.end(), names.begin(), names.end());
+    cond.notify_all();
+}
+
+void ParallelPcap::finish(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished = true;
+    cond.notify_all();
+}
+
+bool ParallelPcap::openNext(){
+    while(!pending.empty()){
+        std::string filename = pending.front();
+        pending.pop_front();
+
+        PcapFile *file = new PcapFile();
+        if(file->open(filename.c_str()) != 0){
+            delete file;
+            continue;
+        }
+        std::vector<PcapChunk> part;
+        splitPcapFile(file, readerNum, part);
+        LOG_INFO("%s size %lu split into %lu chunks\n", filename.c_str(), file->size, part.size());
+
+        FileState state;
+        state.file = file;
+        state.index = NULL;
+        state.chunksLeft = part.size();
+        if(buildIndex){
+            state.index = new FlowIndexBuilder();
+            if(state.index->init(filename.c_str(), readerNum) != 0){
+                delete state.index;
+                state.index = NULL;
+            }
+        }
+        files.push_back(state);
+        for(auto &chunk : part){
+            chunks.push_back(chunk);
+            chunkFile.push_back(files.size() - 1);
+            chunkShards.push_back(0);
+        }
+        cond.notify_all();
+        return true;
+    }
+    return false;
+}
+
+bool ParallelPcap::waitChunk(uint32_t idx, PcapChunk &chunk, FlowIndexBuilder *&index, uint32_t shard, bool &checkpoint){
+    std::unique_lock<std::mutex> lock(mutex_);
+    if(shard < shardNum){
+        shardChunk[shard] = idx;
+    }
+    while(idx >= chunks.size()){
+        if(openNext()){
+            continue;
+        }
+        if(finished){
+            return false;
+        }
+        cond.wait(lock);
+    }
+    chunk = chunks[idx];
+    index = files[chunkFile[idx]].index;
+    checkpoint = (shard < shardNum) && checkpointDue(shard, idx);
+    return true;
+}
+
+void ParallelPcap::chunkDone(uint32_t idx){
+    PcapFile *file = NULL;
+    FlowIndexBuilder *index = NULL;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(++chunkShards[idx] < shardNum){
+            return;
+        }
+        FileState &state = files[chunkFile[idx]];
+        if(--state.chunksLeft > 0){
+            return;
+        }
+        file = state.file;
+        index = state.index;
+        state.file = NULL;
+        state.index = NULL;
+        filesDone++;
+    }
+    // no packet of the file is referenced any more
+    if(index){
+        index->finish();
+        delete index;
+    }
+    LOG_INFO("%s done\n", file->path.c_str());
+    delete file;
+}
+
+uint32_t ParallelPcap::flowShard(const u_char *data, uint32_t caplen, uint32_t shards){
+    if(shards <= 1){
+        return 0;
+    }
+    // tags skipped as PktDedup does, a tagged and an untagged mirror copy meet on one shard
+    uint32_t off = ipv4Offset(data, caplen);
+    if(off == 0){
+        return 0;
+    }
+    const u_char *ip = data + off;
+    uint32_t ihl = (ip[0] & 0x0F) * 4;
+    uint8_t proto = ip[9];
+    uint32_t saddr, daddr;
+    memcpy(&saddr, ip + 12, 4);
+    memcpy(&daddr, ip + 16, 4);
+    uint32_t ports = 0;
+    if((proto == TCP_PROTOCOL_ID || proto == UDP_PROTOCOL_ID) && caplen >= off + ihl + 4){
+        uint16_t sport, dport;
+        memcpy(&sport, ip + ihl, 2);
+        memcpy(&dport, ip + ihl + 2, 2);
+        ports = sport ^ dport;
+    }
+    // xor keeps both directions on the same shard
+    uint64_t h = mix64(((uint64_t)(saddr ^ daddr) << 32) | (ports << 8) | proto);
+    return (uint32_t)(h % shards);
+}
+
+void ParallelPcap::readerLoop(uint32_t reader){
+    uint32_t tid = pThreads ? pThreads->attach(THREAD_CAPTURE, reader, "reader") : 0;
+    PcapChunk chunk;
+    FlowIndexBuilder *index;
+    bool checkpoint;            // readers pass shardNum, never set
+    for(uint32_t idx = reader; waitChunk(idx, chunk, index, shardNum, checkpoint); idx += readerNum){
+        const PcapFile *file = chunk.file;
+        uint64_t off = chunk.begin;
+        PktRef ref;
+        uint64_t next;
+        while(off < chunk.end && file->readRecord(off, ref.hdr, ref.data, next)){
+            if(index){
+                index->add(reader, ref.data, ref.hdr.caplen, (uint64_t)ref.hdr.ts.tv_sec * 1000000 + ref.hdr.ts.tv_usec, off);
+            }
+            // the index still covers every record, flowquery reads the raw file
+            if(filter && !filter->match(&ref.hdr, ref.data)){
+                readerFiltered[reader]++;
+                off = next;
+                continue;
+            }
+            uint32_t shard = flowShard(ref.data, ref.hdr.caplen, shardNum);
+            getRing(reader, shard)->pushWait(ref);
+            readerPkts[reader]++;
+            off = next;
+        }
+        // chunks are cut at records the split walked to, a reader ending anywhere else read garbage
+        if(off > chunk.end){
+            LOG_ERROR("%s record at %lu crosses the chunk end %lu\n", file->path.c_str(), off, chunk.end);
+        }else if(off < chunk.end && chunk.end < file->size){
+            LOG_ERROR("%s bad record at offset %lu inside chunk ending at %lu\n", file->path.c_str(), off, chunk.end);
+        }else if(off < chunk.end){
+            LOG_WARN("%s bad record at offset %lu, rest of file skipped\n", file->path.c_str(), off);
+        }
+        // end of chunk marker for every shard
+        ref.data = NULL;
+        for(uint32_t s = 0; s < shardNum; s++){
+            getRing(reader, s)->pushWait(ref);
+        }
+    }
+    if(pThreads){
+        pThreads->detach(tid);
+    }
+}
+
+void ParallelPcap::shardLoop(uint32_t shard){
+    uint32_t tid = pThreads ? pThreads->attach(THREAD_WORKER, shard, "shard") : 0;
+    PcapChunk chunk;
+    FlowIndexBuilder *index;
+    SessMgr *mgr = mgrs[shard];
+    bool checkpoint = false;
+    std::string path = snapPath.empty() ? "" : shardSnapPath(shard);
+    // chunks are consumed strictly in order, so is every flow
+    for(uint32_t idx = 0; waitChunk(idx, chunk, index, shard, checkpoint); idx++){
+        if(checkpoint){
+            mgr->checkpoint(path.c_str(), snapData);
+        }
+        SpscRing<PktRef> *ring = getRing(idx % readerNum, shard);
+        PktRef ref;
+        while(true){
+            ring->popWait(ref);
+            if(ref.data == NULL){
+                break;
+            }
+            mgr->feedPkt(&ref.hdr, ref.data);
+        }
+        chunkDone(idx);
+    }
+    // the last checkpoint carries the open sessions to the next start
+    if(!path.empty()){
+        mgr->checkpoint(path.c_str(), snapData, false);
+        mgr->setCarryOver(true);
+    }
+    if(pThreads){
+        pThreads->detach(tid);
+    }
+}
+
+void ParallelPcap::run(){
+    std::vector<std::thread> threads;
+    for(uint32_t s = 0; s < shardNum; s++){
+        threads.push_back(std::thread(&ParallelPcap::shardLoop, this, s));
+    }
+    for(uint32_t r = 0; r < readerNum; r++){
+        threads.push_back(std::thread(&ParallelPcap::readerLoop, this, r));
+    }
+    for(auto &t : threads){
+        t.join();
+    }
+
+    uint64_t total = 0, filtered = 0;
+    for(uint32_t r = 0; r < readerNum; r++){
+        total += readerPkts[r];
+        filtered += readerFiltered[r];
+    }
+    LOG_INFO("parallel readers %u shards %u files %u chunks %lu packets %lu filtered %lu\n", readerNum, shardNum, filesDone, chunks.size(), total, filtered);
+    hugeReport();
+}
@@ -0,0 +1,169 @@
+#ifndef PARALLEL_PCAP_H
+#define PARALLEL_PCAP_H
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <pcap.h>
+
+#include "FlowIndex.h"
+#include "PcapChunk.h"
+#include "PktFilter.h"
+#include "SessMgr.h"
+#include "ShardMerger.h"
+#include "SpscRing.h"
+#include "ThreadManager.h"
+
+// pcap 的并行处理:
+// reader 线程各自解析一段记录, 按流哈希把包分发给对应的 SessMgr shard,
+// shard 按段的顺序消费, 同一条流的包顺序不变, 跨段的会话也能正确拼接
+//
+//   chunk0 -> reader0 --ring[0][s]--> shard s (chunk0, chunk1, chunk2 ...)
+//   chunk1 -> reader1 --ring[1][s]-->
+//   chunk2 -> reader0 ...
+//
+// 多个文件排队依次切段, 段号全局连续, 所以跨文件的会话同样能接上;
+// 文件在用到时才打开, 所有 shard 都消费完后立即关闭, 同时打开的文件数有上限
+
+const uint32_t PARALLEL_RING_SIZE = 16384;      // packets per reader->shard ring, power of 2
+
+/*
+ *@brief ring 中传递的包, data 指向 mmap 的文件, NULL 表示段结束
+ */
+struct PktRef{
+    struct pcap_pkthdr hdr;
+    const u_char *data;
+};
+
+class ParallelPcap{
+public:
+    // threads readers and threads shards, each shard owns a SessMgr of hashnum slots;
+    // readers are capture threads and shards worker threads of manager, which may be NULL
+    ParallelPcap(uint32_t threads, uint32_t hashnum, ThreadManager *manager = NULL);
+
+    ~ParallelPcap();
+
+    // also write a flow index next to every file added afterwards
+    void setBuildIndex(bool on){
+        buildIndex = on;
+    }
+
+    // export finished sessions, shard s uses producer s
+    void setExporter(IpfixExporter *exporter);
+
+    // payload matching in every shard, patterns and rules are shared read only
+    void setMatcher(const PatternMatcher *matcher, const RegexSet *rules);
+
+    // payload truncation in every shard, policy is shared read only; before setCheckpoint
+    void setTruncPolicy(const TruncPolicy *policy);
+
+    // every shard drops its own duplicates, both copies hash to the same shard
+    void setDedup(uint64_t windowUs);
+
+    // aggregation cube in every shard, merged by a cube merger thread
+    void setCube(const CubeSpec &spec);
+
+    // every session to its own pcap, maxOpen files open across the shards, one flusher thread
+    void setFlowPcap(uint32_t maxOpen);
+
+    // frames not matching are dropped by the readers before hashing, filter is shared read only
+    void setFilter(const PktFilter *pktFilter){
+        filter = pktFilter;
+    }
+
+    // restore every shard from path.<shard> and checkpoint there from now on, the last
+    // checkpoint is written at the end and carries the sessions still open
+    void setCheckpoint(const char *path, bool withData);
+
+    // all shards checkpoint before the same next chunk, safe to call from a signal handler
+    void requestCheckpoint(){
+        checkpointWanted.store(true);
+    }
+
+    // queue a file, it is mapped and split once the chunks before it are handed out
+    void addFile(const char *filename);
+
+    // queue files in order of their first packet
+    void addFiles(std::vector<std::string> files);
+
+    // no more files will be added
+    void finish();
+
+    // process every chunk, returns when finish() was called and all chunks are done
+    void run();
+
+    // shard owning the flow of a raw ethernet frame, same for both directions
+    static uint32_t flowShard(const u_char *data, uint32_t caplen, uint32_t shards);
+
+private:
+    void readerLoop(uint32_t reader);
+
+    void shardLoop(uint32_t shard);
+
+    // block until chunk idx exists, false when there will be none;
+    // shards also learn whether to checkpoint before the chunk
+    bool waitChunk(uint32_t idx, PcapChunk &chunk, FlowIndexBuilder *&index, uint32_t shard, bool &checkpoint);
+
+    // a checkpoint is due before chunk idx, mutex_ held
+    bool checkpointDue(uint32_t shard, uint32_t idx);
+
+    std::string shardSnapPath(uint32_t shard) const;
+
+    // map the next queued file that opens, mutex_ held; false when none is left
+    bool openNext();
+
+    // a shard is past chunk idx, closes its file when every shard is
+    void chunkDone(uint32_t idx);
+
+    SpscRing<PktRef> *getRing(uint32_t reader, uint32_t shard){
+        return rings[reader * shardNum + shard];
+    }
+
+    uint32_t readerNum;
+    uint32_t shardNum;
+    ThreadManager *pThreads;
+    std::vector<SessMgr *> mgrs;
+    std::vector<int> shardNode;                 // numa node of each shard, -1 when not numa
+    std::vector<SpscRing<PktRef> *> rings;
+    ShardMerger *merger;
+    CubeMerger *cubeMerger;                     // NULL when not aggregating
+    PcapFlusher *pcapFlusher;                   // NULL when sessions are not written as pcaps
+
+    struct FileState{
+        PcapFile *file;
+        FlowIndexBuilder *index;
+        uint32_t chunksLeft;
+    };
+
+    std::mutex mutex_;
+    std::condition_variable cond;
+    std::deque<std::string> pending;
+    std::vector<FileState> files;
+    std::vector<PcapChunk> chunks;
+    std::vector<uint32_t> chunkFile;            // files position of each chunk
+    std::vector<uint32_t> chunkShards;          // shards done with each chunk
+    bool finished;
+    bool buildIndex;
+    uint32_t filesDone;
+    const PktFilter *filter;
+
+    // checkpoints: every shard stops before chunk checkpointChunk, none has started it yet
+    std::vector<uint32_t> shardChunk;           // last chunk each shard asked for
+    std::string snapPath;
+    bool snapData;
+    std::atomic<bool> checkpointWanted;
+    uint64_t lastCheckpointUs;
+    uint32_t checkpointChunk;
+    uint32_t checkpointSeq;
+    std::vector<uint32_t> shardCheckpointSeq;
+
+    std::vector<uint64_t> readerPkts;
+    std::vector<uint64_t> readerFiltered;
+};
+
+#endif //PARALLEL_PCAP_H
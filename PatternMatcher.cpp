@@ -0,0 +1,163 @@
+#include "PatternMatcher.h"
+#include "Log.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <deque>
+
+PatternMatcher::PatternMatcher(){
+    memset(byteClass, 0, sizeof(byteClass));
+    classNum = 1;
+    stateNum = 1;
+    // an empty matcher stays in the root
+    delta.assign(1, 0);
+    outStart.assign(2, 0);
+}
+
+PatternMatcher::~PatternMatcher(){
+}
+
+// "GET |0d 0a|" -> bytes, false on a bad hex block
+static bool parseContent(const char *text, std::string &bytes){
+    bool hex = false;
+    for(const char *p = text; *p; p++){
+        if(*p == '|'){
+            hex = !hex;
+        }else if(!hex){
+            bytes.push_back(*p);
+        }else if(*p != ' '){
+            char pair[3] = {p[0], p[1], 0};
+            char *end;
+            if(p[1] == 0 || p[1] == '|'){
+                return false;
+            }
+            long v = strtol(pair, &end, 16);
+            if(*end != 0){
+                return false;
+            }
+            bytes.push_back((char)v);
+            p++;
+        }
+    }
+    return !hex;
+}
+
+int PatternMatcher::load(const char *path){
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL){
+        LOG_ERROR("pattern file %s open fail\n", path);
+        return -1;
+    }
+    char line[4096];
+    uint32_t lineNo = 0;
+    while(fgets(line, sizeof(line), fp)){
+        lineNo++;
+        line[strcspn(line, "\r\n")] = 0;
+        char *name = line + strspn(line, " \t");
+        if(*name == 0 || *name == '#'){
+            continue;
+        }
+        char *content = name + strcspn(name, " \t");
+        if(*content){
+            *content++ = 0;
+            content += strspn(content, " \t");
+        }
+        std::string bytes;
+        if(!parseContent(content, bytes) || bytes.empty() || bytes.size() > MATCH_MAX_PATTERN_LEN){
+            LOG_WARN("%s:%u bad pattern skipped\n", path, lineNo);
+            continue;
+        }
+        add(name, bytes);
+    }
+    fclose(fp);
+    build();
+    LOG_INFO("%s: %u patterns, %u states, %u byte classes\n", path, getPatternNum(), stateNum, classNum);
+    return 0;
+}
+
+void PatternMatcher::add(const std::string &name, const std::string &bytes){
+    PatternInfo info;
+    info.name = name;
+    info.len = bytes.size();
+    patterns.push_back(info);
+    contents.push_back(bytes);
+}
+
+void PatternMatcher::build(){
+    // bytes no pattern uses all share class 0, the table shrinks to the alphabet in use
+    memset(byteClass, 0, sizeof(byteClass));
+    classNum = 1;
+    for(auto &bytes : contents){
+        for(unsigned char c : bytes){
+            if(byteClass[c] == 0){
+                byteClass[c] = classNum++;
+            }
+        }
+    }
+
+    // trie, 0 is the root and also "no edge" since nothing points back to it
+    std::vector<uint32_t> next(classNum, 0);
+    std::vector<std::vector<uint32_t> > own(1);
+    for(uint32_t id = 0; id < contents.size(); id++){
+        uint32_t s = 0;
+        for(unsigned char c : contents[id]){
+            uint32_t &edge = next[s * classNum + byteClass[c]];
+            if(edge == 0){
+                edge = own.size();
+                own.push_back(std::vector<uint32_t>());
+                next.resize(next.size() + classNum, 0);
+            }
+            s = next[s * classNum + byteClass[c]];
+        }
+        own[s].push_back(id);
+    }
+    stateNum = own.size();
+    contents.clear();
+
+    // breadth first: failure links, missing edges filled from the failure state, outputs inherited
+    std::vector<uint32_t> fail(stateNum, 0);
+    std::vector<uint32_t> order;
+    std::deque<uint32_t> queue;
+    for(uint32_t c = 0; c < classNum; c++){
+        if(next[c]){
+            queue.push_back(next[c]);
+        }
+    }
+    while(!queue.empty()){
+        uint32_t u = queue.front();
+        queue.pop_front();
+        order.push_back(u);
+        for(uint32_t c = 0; c < classNum; c++){
+            uint32_t &v = next[u * classNum + c];
+            if(v){
+                fail[v] = next[fail[u] * classNum + c];
+                queue.push_back(v);
+            }else{
+                v = next[fail[u] * classNum + c];
+            }
+        }
+    }
+
+    outStart.assign(stateNum + 1, 0);
+    outputs.clear();
+    std::vector<std::vector<uint32_t> > all(stateNum);
+    for(uint32_t u : order){
+        all[u] = own[u];
+        all[u].insert(all[u].end(), all[fail[u]].begin(), all[fail[u]].end());
+    }
+    for(uint32_t s = 0; s < stateNum; s++){
+        outStart[s] = outputs.size();
+        outputs.insert(outputs.end(), all[s].begin(), all[s].end());
+    }
+    outStart[stateNum] = outputs.size();
+
+    if((uint64_t)stateNum * classNum >= MATCH_FLAG){
+        LOG_ERROR("pattern automaton too large, %u states %u classes\n", stateNum, classNum);
+        abort();
+    }
+    delta.resize((size_t)stateNum * classNum);
+    for(size_t i = 0; i < delta.size(); i++){
+        uint32_t v = next[i];
+        delta[i] = v * classNum | (all[v].empty() ? 0 : MATCH_FLAG);
+    }
+}
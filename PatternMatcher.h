@@ -0,0 +1,83 @@
+#ifndef PATTERN_MATCHER_H
+#define PATTERN_MATCHER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// 重组后 tcp 流的多模式匹配 (Aho-Corasick)
+//   建好后是一张完全展开的 DFA: 字节先映射到等价类, 每个字节一次查表, 没有回溯
+//   状态只有一个 uint32, 存在 AssemableInfo 里, 段与段之间接着匹配, 跨段的模式也能命中
+//   转移表里直接存 "状态号 * 类数", 并用最高位标记有输出的状态, 热循环里没有乘法和额外判断
+//
+// 模式文件每行: name content, content 中 |0d 0a| 为十六进制字节 (snort 写法), # 开头为注释
+
+const uint32_t MATCH_FLAG = 0x80000000;         // state has outputs
+const uint32_t MATCH_MAX_PATTERN_LEN = 1024;
+
+struct PatternInfo{
+    std::string name;
+    uint32_t len;
+};
+
+/*
+ *@brief 编译后只读, 所有 shard 共用一份
+ */
+class PatternMatcher{
+public:
+    PatternMatcher();
+
+    ~PatternMatcher();
+
+    // pattern file, 0 on success; build() is called
+    int load(const char *path);
+
+    // raw bytes, before build()
+    void add(const std::string &name, const std::string &bytes);
+
+    void build();
+
+    uint32_t getPatternNum() const{
+        return patterns.size();
+    }
+
+    uint32_t getStateNum() const{
+        return stateNum;
+    }
+
+    const PatternInfo &getPattern(uint32_t id) const{
+        return patterns[id];
+    }
+
+    // continue from state (0 at stream start) over data, onMatch(patternId, end) for every hit
+    // where end is the offset in data just past the match; returns the state to continue from
+    template<typename F>
+    uint32_t scan(uint32_t state, const u_char *data, uint32_t len, F onMatch) const{
+        const uint32_t *d = delta.data();
+        const uint8_t *cls = byteClass;
+        for(uint32_t i = 0; i < len; i++){
+            state = d[(state & ~MATCH_FLAG) + cls[data[i]]];
+            if(state & MATCH_FLAG){
+                uint32_t s = (state & ~MATCH_FLAG) / classNum;
+                for(uint32_t k = outStart[s]; k < outStart[s + 1]; k++){
+                    onMatch(outputs[k], i + 1);
+                }
+            }
+        }
+        return state;
+    }
+
+private:
+    std::vector<PatternInfo> patterns;
+    std::vector<std::string> contents;          // until build()
+
+    uint8_t byteClass[256];
+    uint32_t classNum;
+    uint32_t stateNum;
+    std::vector<uint32_t> delta;                // stateNum x classNum, next state * classNum | MATCH_FLAG
+    std::vector<uint32_t> outStart;             // stateNum + 1
+    std::vector<uint32_t> outputs;              // pattern ids, suffix matches included
+};
+
+#endif //PATTERN_MATCHER_H
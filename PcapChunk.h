@@ -0,0 +1,66 @@
+#ifndef PCAP_CHUNK_H
+#define PCAP_CHUNK_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <pcap.h>
+
+// pcap 文件 mmap 后按记录边界切成多段, 每段可以被不同线程独立解析
+
+const uint32_t PCAP_FILE_HEADER_LENGTH = 24;
+const uint32_t PCAP_RECORD_HEADER_LENGTH = 16;
+const uint32_t PCAP_MAX_CAPLEN = 262144;
+
+/*
+ *@brief 只读映射的经典 pcap 文件, 支持大小端和纳秒格式
+ */
+class PcapFile{
+public:
+    PcapFile();
+
+    ~PcapFile();
+
+    // 0 on success
+    int open(const char *filename);
+
+    void close();
+
+    // record at off, next is the offset after it; false at eof or on a bad header
+    bool readRecord(uint64_t off, struct pcap_pkthdr &hdr, const u_char *&data, uint64_t &next) const;
+
+    uint64_t getFirstTsUs() const{
+        return firstTsUs;
+    }
+
+    std::string path;
+    const u_char *base;
+    uint64_t size;
+    uint32_t snaplen;
+    uint32_t linktype;
+
+private:
+    uint32_t read32(uint64_t off) const;
+
+    int fd;
+    bool swapped;
+    bool nano;
+    uint64_t firstTsUs;
+};
+
+/*
+ *@brief [begin, end) 字节区间, 两端都在记录边界上
+ */
+struct PcapChunk{
+    PcapFile *file;
+    uint64_t begin;
+    uint64_t end;
+};
+
+// timestamp of the first record without mapping the file
+bool pcapFirstTsUs(const char *filename, uint64_t &tsUs);
+
+// split the whole file into at most num chunks of about equal size, at real record starts
+void splitPcapFile(PcapFile *file, uint32_t num, std::vector<PcapChunk> &chunks);
+
+#endif //PCAP_CHUNK_H
@@ -0,0 +1,163 @@
+#include "PcapDir.h"
+#include "PcapChunk.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <glob.h>
+#include <poll.h>
+#include <algorithm>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+static std::string joinPath(const std::string &dir, const char *name){
+    if(!dir.empty() && dir[dir.size() - 1] == '/'){
+        return dir + name;
+    }
+    return dir + "/" + name;
+}
+
+static bool isRegular(const std::string &path){
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// index files and friends written next to the captures
+static bool isSideCar(const char *name){
+    const char *dot = strrchr(name, '.');
+    if(dot == NULL){
+        return false;
+    }
+    return strcmp(dot, ".fidx") == 0 || strcmp(dot, ".tmp") == 0 || strcmp(dot, ".part") == 0;
+}
+
+bool isDirectory(const char *input){
+    struct stat st;
+    return stat(input, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool isGlobPattern(const char *input){
+    return strpbrk(input, "*?[") != NULL;
+}
+
+int listPcapFiles(const char *input, std::vector<std::string> &files){
+    if(isDirectory(input)){
+        DIR *dir = opendir(input);
+        if(dir == NULL){
+            LOG_ERROR("path %s open error\n", input);
+            return -1;
+        }
+        struct dirent *ptr;
+        while((ptr = readdir(dir)) != NULL){
+            // 不是隐藏文件
+            if(ptr->d_name[0] == '.' || isSideCar(ptr->d_name)){
+                continue;
+            }
+            std::string path = joinPath(input, ptr->d_name);
+            if(isRegular(path)){
+                files.push_back(path);
+            }
+        }
+        closedir(dir);
+        return 0;
+    }
+
+    glob_t g;
+    int ret = glob(input, 0, NULL, &g);
+    if(ret == GLOB_NOMATCH){
+        return 0;
+    }
+    if(ret != 0){
+        LOG_ERROR("glob %s fail\n", input);
+        return -1;
+    }
+    for(size_t i = 0; i < g.gl_pathc; i++){
+        if(!isSideCar(g.gl_pathv[i]) && isRegular(g.gl_pathv[i])){
+            files.push_back(g.gl_pathv[i]);
+        }
+    }
+    globfree(&g);
+    return 0;
+}
+
+void sortPcapFiles(std::vector<std::string> &files){
+    std::vector<std::pair<uint64_t, std::string> > keyed;
+    for(auto &name : files){
+        uint64_t ts;
+        if(!pcapFirstTsUs(name.c_str(), ts)){
+            ts = UINT64_MAX;
+        }
+        keyed.push_back(std::make_pair(ts, name));
+    }
+    std::sort(keyed.begin(), keyed.end());
+    files.clear();
+    for(auto &kv : keyed){
+        files.push_back(kv.second);
+    }
+}
+
+DirWatcher::DirWatcher(){
+    fd = -1;
+    wd = -1;
+}
+
+DirWatcher::~DirWatcher(){
+    if(fd >= 0){
+        close(fd);
+    }
+}
+
+int DirWatcher::open(const char *dir){
+    path = dir;
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd < 0){
+        LOG_ERROR("inotify_init fail\n");
+        return -1;
+    }
+    wd = inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if(wd < 0){
+        LOG_ERROR("inotify watch %s fail\n", dir);
+        close(fd);
+        fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void DirWatcher::wait(int timeoutMs, std::vector<std::string> &files){
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if(poll(&pfd, 1, timeoutMs) <= 0){
+        return;
+    }
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool overflow = false;
+    while(true){
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if(len <= 0){
+            break;
+        }
+        for(char *p = buf; p < buf + len; ){
+            struct inotify_event *event = (struct inotify_event *)p;
+            if(event->mask & IN_Q_OVERFLOW){
+                overflow = true;
+            }
+            if(event->len > 0 && event->name[0] != '.' && !isSideCar(event->name)){
+                std::string file = joinPath(path, event->name);
+                if(isRegular(file)){
+                    files.push_back(file);
+                }
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    if(overflow){
+        // events were lost, the caller drops the files it already has
+        LOG_WARN("inotify queue overflow on %s, rescanning\n", path.c_str());
+        listPcapFiles(path.c_str(), files);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef PCAP_DIR_H
+#define PCAP_DIR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// 目录 / 通配符输入: 列出待处理的 pcap, 以及用 inotify 监视目录中新写完的文件
+
+// regular non hidden files of a directory, or the matches of a glob pattern
+int listPcapFiles(const char *input, std::vector<std::string> &files);
+
+// sort by the timestamp of the first record, unreadable files go last
+void sortPcapFiles(std::vector<std::string> &files);
+
+// true when input names a directory
+bool isDirectory(const char *input);
+
+// true when input contains glob characters
+bool isGlobPattern(const char *input);
+
+/*
+ *@brief 监视目录, 文件写完 (close_write) 或移入 (rename) 后才报告,
+ *       避免读到采集程序还在写的文件
+ */
+class DirWatcher{
+public:
+    DirWatcher();
+
+    ~DirWatcher();
+
+    // 0 on success
+    int open(const char *dir);
+
+    // wait up to timeoutMs, append finished files to files
+    void wait(int timeoutMs, std::vector<std::string> &files);
+
+private:
+    int fd;
+    int wd;
+    std::string path;
+};
+
+#endif //PCAP_DIR_H
@@ -0,0 +1,540 @@
+#include "PcapChunk.h"
+#include "SessMgr.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <vector>
+
+// pcap 回放, 给探针做压测
+//   pcapreplay -i veth0 [-x speed | -r pps | -g gbps | -T] [-l loops] [-R] file.pcap ...
+//   pcapreplay -n [-x speed | -r pps | -g gbps | -T] [-l loops] file.pcap ...
+//
+// 发送: AF_PACKET 原始套接字, sendmmsg 批量发送, 报文直接指向 mmap 的文件不拷贝;
+//   -R 改用 TPACKET_V2 发送环, 一次 send 把环里排好的帧全部发出
+//   -n 不走网络, 在进程内直接喂给 SessMgr::feedPkt, 测的是整个处理路径
+// 节奏: 原始时间间隔 (可按倍速), 固定 pps, 固定速率, 或者不限速;
+//   离目标时间远时先 nanosleep, 最后一段忙等 CLOCK_MONOTONIC, 误差在微秒级
+
+const uint32_t REPLAY_BATCH = 64;               // frames per sendmmsg
+const uint32_t REPLAY_RING_FRAMES = 4096;       // TPACKET_V2 tx ring
+const uint32_t REPLAY_FRAME_SIZE = 2048;        // tx ring frame, longer frames are skipped
+const uint64_t REPLAY_SPIN_NS = 100000;         // busy wait at most this long, sleep before
+const int REPLAY_SNDBUF = 4 << 20;
+const int REPLAY_WAIT_MS = 1;                   // poll for room when the socket or device queue is full
+
+enum PaceMode{
+    PACE_ORIGINAL,              // capture timing, divided by speed
+    PACE_PPS,
+    PACE_BPS,
+    PACE_TOP,                   // as fast as the sink takes it
+};
+
+enum SinkKind{
+    SINK_MMSG,
+    SINK_RING,
+    SINK_FEED,
+};
+
+static volatile sig_atomic_t gStop = 0;
+
+static void onSignal(int sig){
+    gStop = 1;
+}
+
+static uint64_t monoNs(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t recordTsUs(const struct pcap_pkthdr &hdr){
+    return (uint64_t)hdr.ts.tv_sec * 1000000 + hdr.ts.tv_usec;
+}
+
+/*
+ *@brief 每个包的发送时刻, 相对回放开始的纳秒数
+ */
+class Pacer{
+public:
+    Pacer(){
+        mode = PACE_ORIGINAL;
+        speed = 1.0;
+        rate = 0;
+        startNs = 0;
+        firstTsUs = 0;
+        lastRelUs = 0;
+        loopOffsetUs = 0;
+        pkts = 0;
+        bits = 0;
+        lateSumNs = 0;
+        lateMaxNs = 0;
+        lateNum = 0;
+    }
+
+    void start(){
+        startNs = monoNs();
+    }
+
+    // due time of the next packet; also the timestamp it is replayed with, loops keep going forward
+    uint64_t next(struct pcap_pkthdr &hdr){
+        uint64_t ts = recordTsUs(hdr);
+        if(firstTsUs == 0){
+            firstTsUs = ts;
+        }
+        // files out of order, or a clock step in the capture: do not wait backwards
+        uint64_t rel = (ts > firstTsUs) ? ts - firstTsUs : 0;
+        if(rel < lastRelUs){
+            rel = lastRelUs;
+        }
+        lastRelUs = rel;
+        rel += loopOffsetUs;
+        uint64_t shifted = firstTsUs + rel;
+        hdr.ts.tv_sec = shifted / 1000000;
+        hdr.ts.tv_usec = shifted % 1000000;
+
+        uint64_t due = 0;
+        switch(mode){
+        case PACE_ORIGINAL:
+            due = (uint64_t)(rel * 1000 / speed);
+            break;
+        case PACE_PPS:
+            due = (uint64_t)(pkts * 1e9 / rate);
+            break;
+        case PACE_BPS:
+            due = (uint64_t)(bits * 1e9 / rate);
+            break;
+        default:
+            break;
+        }
+        pkts++;
+        bits += (uint64_t)hdr.caplen * 8;
+        return due;
+    }
+
+    // the input starts over, timestamps continue after the last one
+    void loop(){
+        loopOffsetUs += lastRelUs + 1;
+        lastRelUs = 0;
+    }
+
+    bool isPaced() const{
+        return mode != PACE_TOP;
+    }
+
+    uint64_t elapsedNs() const{
+        return monoNs() - startNs;
+    }
+
+    // false when due already passed
+    bool isAhead(uint64_t due) const{
+        return mode != PACE_TOP && due > elapsedNs();
+    }
+
+    void waitUntil(uint64_t due){
+        uint64_t now = elapsedNs();
+        if(due > now + REPLAY_SPIN_NS){
+            uint64_t sleep = due - now - REPLAY_SPIN_NS;
+            struct timespec ts;
+            ts.tv_sec = sleep / 1000000000;
+            ts.tv_nsec = sleep % 1000000000;
+            nanosleep(&ts, NULL);
+        }
+        while(elapsedNs() < due){
+        }
+    }
+
+    // how late the packet due at due goes out
+    void sent(uint64_t due){
+        if(mode == PACE_TOP){
+            return;
+        }
+        uint64_t now = elapsedNs();
+        uint64_t late = (now > due) ? now - due : 0;
+        lateSumNs += late;
+        lateNum++;
+        if(late > lateMaxNs){
+            lateMaxNs = late;
+        }
+    }
+
+    PaceMode mode;
+    double speed;
+    double rate;                // pps or bits per second
+    uint64_t startNs;
+    uint64_t firstTsUs;
+    uint64_t lastRelUs;
+    uint64_t loopOffsetUs;
+    uint64_t pkts;
+    uint64_t bits;
+    uint64_t lateSumNs;
+    uint64_t lateMaxNs;
+    uint64_t lateNum;
+};
+
+/*
+ *@brief 回放的出口: 原始套接字, 发送环, 或者进程内的 SessMgr
+ */
+class ReplaySink{
+public:
+    ReplaySink(){
+        kind = SINK_MMSG;
+        sock = -1;
+        ring = NULL;
+        ringBytes = 0;
+        ringPos = 0;
+        ringQueued = 0;
+        batchNum = 0;
+        mgr = NULL;
+        sentPkts = 0;
+        sentBytes = 0;
+        errors = 0;
+        skipped = 0;
+        dropped = 0;
+        memset(msgs, 0, sizeof(msgs));
+    }
+
+    ~ReplaySink(){
+        if(ring){
+            munmap(ring, ringBytes);
+        }
+        if(sock >= 0){
+            close(sock);
+        }
+        delete mgr;
+    }
+
+    // iface for the socket kinds, 0 on success
+    int open(SinkKind sinkKind, const char *iface){
+        kind = sinkKind;
+        if(kind == SINK_FEED){
+            mgr = new SessMgr(100000);
+            return 0;
+        }
+
+        int ifindex = if_nametoindex(iface);
+        if(ifindex == 0){
+            fprintf(stderr, "no interface %s\n", iface);
+            return -1;
+        }
+        // protocol 0: transmit only, nothing is queued for receive
+        sock = socket(AF_PACKET, SOCK_RAW, 0);
+        if(sock < 0){
+            fprintf(stderr, "raw socket: %s, needs CAP_NET_RAW\n", strerror(errno));
+            return -1;
+        }
+        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &REPLAY_SNDBUF, sizeof(REPLAY_SNDBUF));
+
+        if(kind == SINK_RING){
+            int version = TPACKET_V2;
+            struct tpacket_req req;
+            memset(&req, 0, sizeof(req));
+            req.tp_block_size = REPLAY_FRAME_SIZE * 32;
+            req.tp_frame_size = REPLAY_FRAME_SIZE;
+            req.tp_block_nr = REPLAY_RING_FRAMES / 32;
+            req.tp_frame_nr = REPLAY_RING_FRAMES;
+            if(setsockopt(sock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0 ||
+                setsockopt(sock, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) != 0){
+                fprintf(stderr, "tx ring: %s\n", strerror(errno));
+                return -1;
+            }
+            ringBytes = (size_t)req.tp_block_size * req.tp_block_nr;
+            ring = (char *)mmap(NULL, ringBytes, PROT_READ | PROT_WRITE, MAP_SHARED, sock, 0);
+            if(ring == MAP_FAILED){
+                ring = NULL;
+                fprintf(stderr, "tx ring mmap: %s\n", strerror(errno));
+                return -1;
+            }
+        }
+
+        struct sockaddr_ll addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sll_family = AF_PACKET;
+        addr.sll_protocol = 0;
+        addr.sll_ifindex = ifindex;
+        if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+            fprintf(stderr, "bind %s: %s\n", iface, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    // data must stay valid until flush, it points into the mapped file
+    void add(const struct pcap_pkthdr &hdr, const u_char *data){
+        switch(kind){
+        case SINK_FEED:
+            mgr->feedPkt(&hdr, data);
+            sentPkts++;
+            sentBytes += hdr.caplen;
+            return;
+        case SINK_RING:
+            addRing(hdr, data);
+            return;
+        default:
+            break;
+        }
+        iovs[batchNum].iov_base = (void *)data;
+        iovs[batchNum].iov_len = hdr.caplen;
+        msgs[batchNum].msg_hdr.msg_iov = &iovs[batchNum];
+        msgs[batchNum].msg_hdr.msg_iovlen = 1;
+        batchNum++;
+        if(batchNum == REPLAY_BATCH){
+            flush();
+        }
+    }
+
+    // everything queued goes out now
+    void flush(){
+        if(kind == SINK_MMSG){
+            uint32_t done = 0;
+            while(done < batchNum){
+                if(gStop){
+                    // interrupted while the device was full, the rest of the batch never goes out
+                    dropped += batchNum - done;
+                    break;
+                }
+                int n = sendmmsg(sock, msgs + done, batchNum - done, 0);
+                if(n <= 0){
+                    if(errno == EINTR){
+                        continue;
+                    }
+                    if(errno == ENOBUFS || errno == EAGAIN){
+                        // queue full: wait for room instead of spinning on the syscall;
+                        // ENOBUFS may still poll writable, the timeout is the back-off then
+                        waitRoom(errno == ENOBUFS);
+                        continue;
+                    }
+                    // a frame the device refuses (too long, down) is dropped, the rest goes on
+                    errors++;
+                    done++;
+                    continue;
+                }
+                for(int i = 0; i < n; i++){
+                    sentBytes += iovs[done + i].iov_len;
+                }
+                sentPkts += n;
+                done += n;
+            }
+            batchNum = 0;
+        }else if(kind == SINK_RING && ringQueued > 0){
+            if(send(sock, NULL, 0, 0) < 0 && errno != ENOBUFS && errno != EAGAIN){
+                errors++;
+            }
+            ringQueued = 0;
+        }
+    }
+
+    // after the last flush, wait until the kernel took every ring frame
+    void drain(){
+        if(kind != SINK_RING){
+            return;
+        }
+        for(uint32_t i = 0; i < REPLAY_RING_FRAMES; i++){
+            struct tpacket2_hdr *frame = (struct tpacket2_hdr *)(ring + (size_t)i * REPLAY_FRAME_SIZE);
+            while(!gStop && (frame->tp_status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))){
+                send(sock, NULL, 0, 0);
+                waitRoom(false);
+            }
+        }
+    }
+
+    uint64_t sentPkts;
+    uint64_t sentBytes;
+    uint64_t errors;
+    uint64_t skipped;           // longer than a ring frame
+    uint64_t dropped;           // queued but not sent when stopped
+
+private:
+    // room in the socket, at most REPLAY_WAIT_MS; backOff also sleeps when poll says writable
+    void waitRoom(bool backOff){
+        struct pollfd pfd;
+        pfd.fd = sock;
+        pfd.events = POLLOUT;
+        if(poll(&pfd, 1, REPLAY_WAIT_MS) > 0 && backOff){
+            usleep(REPLAY_WAIT_MS * 1000);
+        }
+    }
+
+    void addRing(const struct pcap_pkthdr &hdr, const u_char *data){
+        const uint32_t offset = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+        if(hdr.caplen > REPLAY_FRAME_SIZE - offset){
+            skipped++;
+            return;
+        }
+        struct tpacket2_hdr *frame = (struct tpacket2_hdr *)(ring + (size_t)ringPos * REPLAY_FRAME_SIZE);
+        // ring full: kick the kernel and wait for the frame to come back
+        while(frame->tp_status != TP_STATUS_AVAILABLE){
+            if(frame->tp_status == TP_STATUS_WRONG_FORMAT){
+                errors++;
+                break;
+            }
+            if(gStop){
+                dropped++;
+                return;
+            }
+            flush();
+            waitRoom(false);
+        }
+        memcpy((char *)frame + offset, data, hdr.caplen);
+        frame->tp_len = hdr.caplen;
+        __sync_synchronize();
+        frame->tp_status = TP_STATUS_SEND_REQUEST;
+        ringPos = (ringPos + 1) % REPLAY_RING_FRAMES;
+        ringQueued++;
+        sentPkts++;
+        sentBytes += hdr.caplen;
+        if(ringQueued == REPLAY_BATCH){
+            flush();
+        }
+    }
+
+    SinkKind kind;
+    int sock;
+    char *ring;
+    size_t ringBytes;
+    uint32_t ringPos;
+    uint32_t ringQueued;
+    struct mmsghdr msgs[REPLAY_BATCH];
+    struct iovec iovs[REPLAY_BATCH];
+    uint32_t batchNum;
+    SessMgr *mgr;
+};
+
+static void usage(const char *prog){
+    fprintf(stderr, "usage: %s -i iface [-R] | -n  [-x speed | -r pps | -g gbps | -T] [-l loops] file.pcap ...\n", prog);
+    fprintf(stderr, "  -i iface  send on a veth or nic through a raw socket, sendmmsg batches of %u\n", REPLAY_BATCH);
+    fprintf(stderr, "  -R  use a TPACKET_V2 tx ring instead, frames up to %u bytes\n", REPLAY_FRAME_SIZE);
+    fprintf(stderr, "  -n  feed an in-process SessMgr instead of the network, output/ as demo\n");
+    fprintf(stderr, "  -x speed  capture timing, speed times faster; the default is 1\n");
+    fprintf(stderr, "  -r pps  fixed packet rate\n");
+    fprintf(stderr, "  -g gbps  fixed bit rate of the captured frames\n");
+    fprintf(stderr, "  -T  no pacing, as fast as the sink takes it\n");
+    fprintf(stderr, "  -l loops  replay the files this many times, 0 until interrupted\n");
+}
+
+int main(int argc, char *argv[]){
+    const char *iface = NULL;
+    SinkKind kind = SINK_MMSG;
+    bool feed = false;
+    uint64_t loops = 1;
+    Pacer pacer;
+    int opt;
+    while((opt = getopt(argc, argv, "i:Rnx:r:g:Tl:")) != -1){
+        switch(opt){
+        case 'i':
+            iface = optarg;
+            break;
+        case 'R':
+            kind = SINK_RING;
+            break;
+        case 'n':
+            feed = true;
+            break;
+        case 'x':
+            pacer.mode = PACE_ORIGINAL;
+            pacer.speed = atof(optarg);
+            break;
+        case 'r':
+            pacer.mode = PACE_PPS;
+            pacer.rate = atof(optarg);
+            break;
+        case 'g':
+            pacer.mode = PACE_BPS;
+            pacer.rate = atof(optarg) * 1e9;
+            break;
+        case 'T':
+            pacer.mode = PACE_TOP;
+            break;
+        case 'l':
+            loops = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(optind >= argc || (feed == (iface != NULL)) || (pacer.mode == PACE_ORIGINAL && pacer.speed <= 0) ||
+        ((pacer.mode == PACE_PPS || pacer.mode == PACE_BPS) && pacer.rate <= 0)){
+        usage(argv[0]);
+        return 1;
+    }
+    if(feed){
+        kind = SINK_FEED;
+    }
+
+    // every file is mapped up front, nothing is read from disk while pacing
+    std::vector<PcapFile *> files;
+    for(int i = optind; i < argc; i++){
+        PcapFile *file = new PcapFile();
+        if(file->open(argv[i]) != 0){
+            fprintf(stderr, "open %s fail\n", argv[i]);
+            return 1;
+        }
+        if(file->linktype != DLT_EN10MB && !feed){
+            fprintf(stderr, "%s is not ethernet, linktype %u\n", argv[i], file->linktype);
+            return 1;
+        }
+        madvise((void *)file->base, file->size, MADV_SEQUENTIAL | MADV_WILLNEED);
+        files.push_back(file);
+    }
+
+    ReplaySink sink;
+    if(sink.open(kind, iface) != 0){
+        return 1;
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    pacer.start();
+    for(uint64_t round = 0; (loops == 0 || round < loops) && !gStop; round++){
+        if(round > 0){
+            pacer.loop();
+        }
+        for(auto file : files){
+            struct pcap_pkthdr hdr;
+            const u_char *data;
+            uint64_t off = PCAP_FILE_HEADER_LENGTH;
+            uint64_t next;
+            while(!gStop && file->readRecord(off, hdr, data, next)){
+                off = next;
+                uint64_t due = pacer.next(hdr);
+                if(pacer.isAhead(due)){
+                    // what is due already leaves before the wait
+                    sink.flush();
+                    pacer.waitUntil(due);
+                }
+                pacer.sent(due);
+                sink.add(hdr, data);
+            }
+        }
+    }
+    sink.flush();
+    sink.drain();
+
+    double sec = pacer.elapsedNs() / 1e9;
+    printf("%lu packets %lu bytes in %.3f s, %.0f pps %.3f Gbps\n", sink.sentPkts, sink.sentBytes, sec,
+        sec > 0 ? sink.sentPkts / sec : 0.0, sec > 0 ? sink.sentBytes * 8 / sec / 1e9 : 0.0);
+    if(pacer.lateNum > 0){
+        printf("pacing late avg %.1f us max %.1f us\n", pacer.lateSumNs / 1e3 / pacer.lateNum, pacer.lateMaxNs / 1e3);
+    }
+    if(sink.errors || sink.skipped || sink.dropped){
+        printf("send errors %lu, frames too long for the ring %lu, dropped at stop %lu\n", sink.errors, sink.skipped,
+            sink.dropped);
+    }
+
+    for(auto file : files){
+        delete file;
+    }
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "PktDedup.h"
+#include "HugeMem.h"
+#include "StructDefine.h"
+
+#include <string.h>
+
+// 64 bit FNV-1a, one pass over a few dozen bytes
+static uint64_t fnv1a(uint64_t h, const u_char *p, uint32_t len){
+    for(uint32_t i = 0; i < len; i++){
+        h ^= p[i];
+        h *= 0x100000001B3ULL;
+    }
+    return h;
+}
+
+// hash of what a router leaves alone, 0 when the frame is not ipv4
+static uint64_t invariantHash(const u_char *data, uint32_t caplen){
+    // the mirror may tag one copy and not the other
+    uint32_t off = ipv4Offset(data, caplen);
+    if(off == 0){
+        return 0;
+    }
+    const u_char *ip = data + off;
+    uint32_t ihl = (ip[0] & 0x0F) * 4;
+    if(ihl < IP_HEADER_LENGTH || caplen < off + ihl){
+        return 0;
+    }
+
+    uint64_t h = 0xCBF29CE484222325ULL;
+    h = fnv1a(h, ip, 8);                    // version, tos, total length, id, fragment
+    h = fnv1a(h, ip + 9, 1);                // protocol, ttl and checksum skipped
+    h = fnv1a(h, ip + 12, ihl - 12);        // addresses and options
+
+    const u_char *l4 = ip + ihl;
+    uint32_t rest = caplen - off - ihl;
+    uint32_t csum = 0;                      // checksum offset in the transport header
+    if(ip[9] == TCP_PROTOCOL_ID && rest >= 20){
+        csum = 16;
+    }else if(ip[9] == UDP_PROTOCOL_ID && rest >= 8){
+        csum = 6;
+    }
+    if(csum > 0){
+        h = fnv1a(h, l4, csum);
+        l4 += csum + 2;
+        rest -= csum + 2;
+    }
+    return fnv1a(h, l4, rest < DEDUP_PAYLOAD_BYTES ? rest : DEDUP_PAYLOAD_BYTES) | 1;
+}
+
+PktDedup::PktDedup(uint64_t windowUs, int numaNode){
+    window = windowUs;
+    // 4MB probed at random, zeroed by hugeAlloc
+    table = (Entry *)hugeAlloc(sizeof(Entry) * DEDUP_BUCKETS * DEDUP_WAYS, numaNode);
+    duplicates = 0;
+}
+
+PktDedup::~PktDedup(){
+    hugeFree(table, sizeof(Entry) * DEDUP_BUCKETS * DEDUP_WAYS);
+}
+
+bool PktDedup::isDuplicate(const struct pcap_pkthdr *hdr, const u_char *data){
+    uint64_t h = invariantHash(data, hdr->caplen);
+    if(h == 0){
+        return false;
+    }
+    uint64_t ts = (uint64_t)hdr->ts.tv_sec * 1000000 + hdr->ts.tv_usec;
+    Entry *bucket = table + (h >> 32 & (DEDUP_BUCKETS - 1)) * DEDUP_WAYS;
+
+    Entry *victim = bucket;
+    for(uint32_t w = 0; w < DEDUP_WAYS; w++){
+        Entry &e = bucket[w];
+        if(e.hash == h){
+            // copies may reach the capture slightly out of order
+            uint64_t gap = (ts >= e.tsUs) ? ts - e.tsUs : e.tsUs - ts;
+            if(gap <= window){
+                // the first copy stays the reference, a third copy is a duplicate too
+                duplicates++;
+                return true;
+            }
+            e.tsUs = ts;
+            return false;
+        }
+        if(e.tsUs < victim->tsUs){
+            victim = &e;
+        }
+    }
+    victim->hash = h;
+    victim->tsUs = ts;
+    return false;
+}
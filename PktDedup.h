@@ -0,0 +1,40 @@
+#ifndef PKT_DEDUP_H
+#define PKT_DEDUP_H
+
+#include <stdint.h>
+#include <pcap.h>
+
+// SPAN 口的重复包过滤: ingress 和 egress 都被镜像时同一个包会出现两次
+// 对 ip/tcp/udp 中转发时不变的字段做哈希 (跳过 mac, vlan, ttl, 校验和),
+// 窗口内哈希相同即为重复; 固定大小的组相联表, 每包 O(1), 旧条目按时间淘汰
+
+const uint32_t DEDUP_BUCKETS = 1 << 16;         // power of 2
+const uint32_t DEDUP_WAYS = 4;
+const uint32_t DEDUP_PAYLOAD_BYTES = 64;        // payload hashed, ip id, seq and length tell the rest apart
+
+class PktDedup{
+public:
+    // copies more than windowUs apart are both kept
+    PktDedup(uint64_t windowUs, int numaNode = -1);
+
+    ~PktDedup();
+
+    // true when the same packet was seen within the window, remembers it otherwise
+    bool isDuplicate(const struct pcap_pkthdr *hdr, const u_char *data);
+
+    uint64_t getDuplicates() const{
+        return duplicates;
+    }
+
+private:
+    struct Entry{
+        uint64_t hash;              // 0 for an empty way
+        uint64_t tsUs;
+    };
+
+    uint64_t window;
+    Entry *table;                   // DEDUP_BUCKETS x DEDUP_WAYS
+    uint64_t duplicates;
+};
+
+#endif //PKT_DEDUP_H
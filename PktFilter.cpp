@@ -0,0 +1,39 @@
+#include "PktFilter.h"
+#include "Log.h"
+
+PktFilter::PktFilter(){
+    prog.bf_len = 0;
+    prog.bf_insns = NULL;
+    compiled = false;
+}
+
+PktFilter::~PktFilter(){
+    if(compiled){
+        pcap_freecode(&prog);
+    }
+}
+
+int PktFilter::compile(const char *text, int linktype, int snaplen){
+    // a dead handle is enough for the compiler, no device or file needed
+    pcap_t *dead = pcap_open_dead(linktype, snaplen);
+    if(dead == NULL){
+        LOG_ERROR("bpf compile %s: no pcap handle\n", text);
+        return -1;
+    }
+    struct bpf_program code;
+    if(pcap_compile(dead, &code, text, 1, PCAP_NETMASK_UNKNOWN) != 0){
+        LOG_ERROR("bpf compile %s: %s\n", text, pcap_geterr(dead));
+        pcap_close(dead);
+        return -1;
+    }
+    pcap_close(dead);
+
+    if(compiled){
+        pcap_freecode(&prog);
+    }
+    prog = code;
+    compiled = true;
+    expr = text;
+    LOG_INFO("bpf filter \"%s\" %u instructions\n", text, prog.bf_len);
+    return 0;
+}
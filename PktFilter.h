@@ -0,0 +1,42 @@
+#ifndef PKT_FILTER_H
+#define PKT_FILTER_H
+
+#include <stdint.h>
+#include <string>
+#include <pcap.h>
+
+// BPF 预过滤: 表达式只编译一次, 在回调里对原始字节求值,
+// 不匹配的帧在拷贝, 解析, 哈希之前就被丢掉 (如备份 vlan, 已知噪声网段)
+
+/*
+ *@brief 编译好的 bpf 程序, 编译后只读, 多个线程可以同时 match
+ */
+class PktFilter{
+public:
+    PktFilter();
+
+    ~PktFilter();
+
+    // tcpdump syntax, 0 on success; the parser only knows ethernet frames
+    int compile(const char *expr, int linktype = DLT_EN10MB, int snaplen = 262144);
+
+    bool isSet() const{
+        return compiled;
+    }
+
+    // true when the frame is kept, always true without an expression
+    bool match(const struct pcap_pkthdr *hdr, const u_char *data) const{
+        return !compiled || pcap_offline_filter(&prog, hdr, data) != 0;
+    }
+
+    const std::string &getExpr() const{
+        return expr;
+    }
+
+private:
+    struct bpf_program prog;
+    bool compiled;
+    std::string expr;
+};
+
+#endif //PKT_FILTER_H
@@ -0,0 +1,145 @@
+#ifndef PROTO_HANDLER_H
+#define PROTO_HANDLER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "Packet.h"
+#include "StructDefine.h"
+
+// 协议处理器链, 编译期组装, 没有虚函数 (对比 virtualtest 里的虚函数实验)
+//   每个处理器以 CRTP 继承 ProtoHandler<Self>, 只需要覆盖关心的钩子, 其余钩子是基类的空函数
+//   HandlerChain<A, B, C> 依次调用每个处理器, 调用目标编译期确定, 整条路径可以内联;
+//   链里没有的协议连同它的会话状态一起不参与编译
+//
+// 处理器约定:
+//   struct State               有处理器要的会话一份, 从 SessPool 分配, 必须可以按字节复制 (会话快照)
+//   static bool wants(tuple)   这条会话是否归它处理, 其余钩子只在返回 true 时调用
+//   onPacket / onData / onEnd / app / report, 见 ProtoHandler
+
+/*
+ *@brief 处理器基类, Derived 覆盖同名函数即可, 不需要 virtual
+ */
+template<typename Derived>
+class ProtoHandler{
+public:
+    // handlers without per-session state keep this one
+    struct State{
+    };
+
+    static bool wants(const NetTuple5 &tuple){
+        return false;
+    }
+
+    // the defaults take any State, so a handler overrides only what it uses
+
+    // every packet of the session, before reassembly
+    template<typename S>
+    void onPacket(S &state, const NetTuple5 &tuple, Packet *pkt){
+    }
+
+    // new in order bytes of a reassembled tcp stream
+    template<typename S>
+    void onData(S &state, const NetTuple5 &tuple, Direct direct, const u_char *data, uint32_t len){
+    }
+
+    // the session ends
+    template<typename S>
+    void onEnd(S &state, const NetTuple5 &tuple){
+    }
+
+    // application label for the flow record, NULL when the handler did not recognise the session
+    template<typename S>
+    const char *app(const S &state) const{
+        return NULL;
+    }
+
+    // totals of this handler instance, once at the end
+    void report(const char *name) const{
+    }
+};
+
+/*
+ *@brief 编译期处理器链, 递归展开
+ */
+template<typename... Handlers>
+class HandlerChain;
+
+template<>
+class HandlerChain<>{
+public:
+    struct State{
+    };
+
+    static bool wantsAny(const NetTuple5 &tuple){
+        return false;
+    }
+
+    void onPacket(State &state, const NetTuple5 &tuple, Packet *pkt){
+    }
+
+    void onData(State &state, const NetTuple5 &tuple, Direct direct, const u_char *data, uint32_t len){
+    }
+
+    void onEnd(State &state, const NetTuple5 &tuple){
+    }
+
+    const char *app(const State &state, const NetTuple5 &tuple) const{
+        return NULL;
+    }
+
+    void report(const char *name) const{
+    }
+};
+
+template<typename Head, typename... Tail>
+class HandlerChain<Head, Tail...>{
+public:
+    struct State{
+        typename Head::State head;
+        typename HandlerChain<Tail...>::State tail;
+    };
+
+    // some handler of the chain takes the session, it needs a State then
+    static bool wantsAny(const NetTuple5 &tuple){
+        return Head::wants(tuple) || HandlerChain<Tail...>::wantsAny(tuple);
+    }
+
+    void onPacket(State &state, const NetTuple5 &tuple, Packet *pkt){
+        if(Head::wants(tuple)){
+            head.onPacket(state.head, tuple, pkt);
+        }
+        tail.onPacket(state.tail, tuple, pkt);
+    }
+
+    void onData(State &state, const NetTuple5 &tuple, Direct direct, const u_char *data, uint32_t len){
+        if(Head::wants(tuple)){
+            head.onData(state.head, tuple, direct, data, len);
+        }
+        tail.onData(state.tail, tuple, direct, data, len);
+    }
+
+    void onEnd(State &state, const NetTuple5 &tuple){
+        if(Head::wants(tuple)){
+            head.onEnd(state.head, tuple);
+        }
+        tail.onEnd(state.tail, tuple);
+    }
+
+    // the first handler that recognised the session names it
+    const char *app(const State &state, const NetTuple5 &tuple) const{
+        const char *name = Head::wants(tuple) ? head.app(state.head) : NULL;
+        return name ? name : tail.app(state.tail, tuple);
+    }
+
+    void report(const char *name) const{
+        head.report(name);
+        tail.report(name);
+    }
+
+private:
+    Head head;
+    HandlerChain<Tail...> tail;
+};
+
+#endif //PROTO_HANDLER_H
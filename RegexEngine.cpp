@@ -0,0 +1,742 @@
+#include "RegexEngine.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+/*
+ *@brief 递归下降解析一条规则, 直接生成 NFA
+ *  先解析成语法树, 再从后往前编译: compile(node, next) 返回进入 node 的状态, node 结束后到 next
+ *  {m,n} 需要把子树复制多份, 有语法树比拼接片段简单
+ */
+class RegexParser{
+public:
+    RegexParser(RegexSet *set, const std::string &text, bool nocase)
+        :pSet(set), text(text), pos(0), nocase(nocase){
+    }
+
+    // start state of the rule, false with err on a syntax error
+    bool compile(uint32_t rule, uint32_t &start, std::string &err);
+
+private:
+    enum NodeType{
+        RE_SET = 0,             // one byte of set
+        RE_CAT,
+        RE_ALT,
+        RE_REPEAT,              // kids[0] min to max times, max UINT32_MAX for unbounded
+    };
+
+    struct Node{
+        uint8_t type;
+        uint32_t set;
+        uint32_t min;
+        uint32_t max;
+        std::vector<uint32_t> kids;
+    };
+
+    uint32_t newNode(uint8_t type){
+        Node node;
+        node.type = type;
+        node.set = 0;
+        node.min = node.max = 0;
+        nodes.push_back(node);
+        return nodes.size() - 1;
+    }
+
+    // both cases of a letter when nocase
+    void fold(std::bitset<256> &bits);
+
+    uint32_t newSet(std::bitset<256> bits);
+
+    bool more() const{
+        return pos < text.size();
+    }
+
+    bool parseAlt(uint32_t &node);
+    bool parseCat(uint32_t &node);
+    bool parseRepeat(uint32_t &node);
+    bool parseAtom(uint32_t &node);
+    bool parseClass(uint32_t &node);
+    bool parseNumber(uint32_t &value);
+
+    // escape after the backslash into bits, false when unknown
+    bool parseEscape(std::bitset<256> &bits);
+
+    bool emit(uint32_t node, uint32_t next, uint32_t &start);
+
+    // match reachable from start through splits only
+    bool matchesEmpty(uint32_t start, uint32_t match);
+
+    bool fail(const char *why){
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%s at %zu", why, pos);
+        err = buf;
+        return false;
+    }
+
+    RegexSet *pSet;
+    std::string text;
+    size_t pos;
+    bool nocase;
+    std::string err;
+    std::vector<Node> nodes;
+};
+
+void RegexParser::fold(std::bitset<256> &bits){
+    if(nocase){
+        for(int c = 'a'; c <= 'z'; c++){
+            if(bits[c] || bits[toupper(c)]){
+                bits[c] = bits[toupper(c)] = true;
+            }
+        }
+    }
+}
+
+uint32_t RegexParser::newSet(std::bitset<256> bits){
+    fold(bits);
+    uint32_t node = newNode(RE_SET);
+    nodes[node].set = pSet->sets.size();
+    pSet->sets.push_back(bits);
+    return node;
+}
+
+bool RegexParser::compile(uint32_t rule, uint32_t &start, std::string &error){
+    uint32_t root;
+    bool ok = parseAlt(root);
+    if(ok && more()){
+        ok = fail(text[pos] == ')' ? "unbalanced )" : "unexpected character");
+    }
+    if(ok){
+        uint32_t match = pSet->newState(RegexSet::NFA_MATCH, 0, 0, rule);
+        ok = emit(root, match, start);
+        // it would fire on every stream at the first byte
+        if(ok && matchesEmpty(start, match)){
+            pos = 0;
+            ok = fail("matches the empty string");
+        }
+    }
+    if(!ok){
+        error = err;
+    }
+    return ok;
+}
+
+bool RegexParser::parseAlt(uint32_t &node){
+    uint32_t first;
+    if(!parseCat(first)){
+        return false;
+    }
+    if(!more() || text[pos] != '|'){
+        node = first;
+        return true;
+    }
+    node = newNode(RE_ALT);
+    nodes[node].kids.push_back(first);
+    while(more() && text[pos] == '|'){
+        pos++;
+        uint32_t kid;
+        if(!parseCat(kid)){
+            return false;
+        }
+        nodes[node].kids.push_back(kid);
+    }
+    return true;
+}
+
+bool RegexParser::parseCat(uint32_t &node){
+    node = newNode(RE_CAT);
+    while(more() && text[pos] != '|' && text[pos] != ')'){
+        uint32_t kid;
+        if(!parseRepeat(kid)){
+            return false;
+        }
+        nodes[node].kids.push_back(kid);
+    }
+    return true;
+}
+
+bool RegexParser::parseNumber(uint32_t &value){
+    if(!more() || !isdigit((unsigned char)text[pos])){
+        return false;
+    }
+    value = 0;
+    while(more() && isdigit((unsigned char)text[pos])){
+        value = value * 10 + (text[pos++] - '0');
+        if(value > REGEX_REPEAT_MAX){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RegexParser::parseRepeat(uint32_t &node){
+    if(!parseAtom(node)){
+        return false;
+    }
+    while(more()){
+        uint32_t min, max;
+        char c = text[pos];
+        if(c == '*'){
+            min = 0;
+            max = UINT32_MAX;
+        }else if(c == '+'){
+            min = 1;
+            max = UINT32_MAX;
+        }else if(c == '?'){
+            min = 0;
+            max = 1;
+        }else if(c == '{'){
+            pos++;
+            if(!parseNumber(min)){
+                return fail("bad repeat count");
+            }
+            max = min;
+            if(more() && text[pos] == ','){
+                pos++;
+                max = UINT32_MAX;
+                if(more() && text[pos] != '}' && (!parseNumber(max) || max < min)){
+                    return fail("bad repeat count");
+                }
+            }
+            if(!more() || text[pos] != '}'){
+                return fail("missing }");
+            }
+        }else{
+            break;
+        }
+        pos++;
+        // lazy and greedy are the same thing without submatches
+        if(more() && text[pos] == '?'){
+            pos++;
+        }
+        uint32_t rep = newNode(RE_REPEAT);
+        nodes[rep].min = min;
+        nodes[rep].max = max;
+        nodes[rep].kids.push_back(node);
+        node = rep;
+    }
+    return true;
+}
+
+bool RegexParser::parseAtom(uint32_t &node){
+    char c = text[pos++];
+    std::bitset<256> bits;
+    switch(c){
+    case '(':
+        if(text.compare(pos, 2, "?:") == 0){
+            pos += 2;
+        }
+        if(!parseAlt(node)){
+            return false;
+        }
+        if(!more() || text[pos] != ')'){
+            return fail("missing )");
+        }
+        pos++;
+        return true;
+    case '[':
+        return parseClass(node);
+    case '.':
+        bits.set();
+        bits[(unsigned char)'\n'] = false;
+        node = newSet(bits);
+        return true;
+    case '\\':
+        if(!parseEscape(bits)){
+            return false;
+        }
+        node = newSet(bits);
+        return true;
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+        pos--;
+        return fail("nothing to repeat");
+    case '^':
+    case '$':
+        pos--;
+        return fail("anchor only allowed at the rule start");
+    default:
+        bits[(unsigned char)c] = true;
+        node = newSet(bits);
+        return true;
+    }
+}
+
+bool RegexParser::parseEscape(std::bitset<256> &bits){
+    if(!more()){
+        return fail("trailing backslash");
+    }
+    char c = text[pos++];
+    switch(c){
+    case 'd':
+    case 'D':
+        for(int i = '0'; i <= '9'; i++){
+            bits[i] = true;
+        }
+        break;
+    case 'w':
+    case 'W':
+        for(int i = 0; i < 256; i++){
+            bits[i] = isalnum(i) || i == '_';
+        }
+        break;
+    case 's':
+    case 'S':
+        for(const char *p = " \t\r\n\f\v"; *p; p++){
+            bits[(unsigned char)*p] = true;
+        }
+        break;
+    case 'n':
+        bits['\n'] = true;
+        return true;
+    case 'r':
+        bits['\r'] = true;
+        return true;
+    case 't':
+        bits['\t'] = true;
+        return true;
+    case 'x':{
+        if(pos + 2 > text.size() || !isxdigit((unsigned char)text[pos]) || !isxdigit((unsigned char)text[pos + 1])){
+            return fail("bad \\x escape");
+        }
+        bits[strtol(text.substr(pos, 2).c_str(), NULL, 16)] = true;
+        pos += 2;
+        return true;
+    }
+    default:
+        if(isalnum((unsigned char)c)){
+            pos--;
+            return fail("unknown escape");
+        }
+        bits[(unsigned char)c] = true;
+        return true;
+    }
+    if(isupper((unsigned char)c)){
+        bits.flip();
+    }
+    return true;
+}
+
+bool RegexParser::parseClass(uint32_t &node){
+    std::bitset<256> bits;
+    bool negate = false;
+    if(more() && text[pos] == '^'){
+        negate = true;
+        pos++;
+    }
+    bool first = true;
+    while(more() && (text[pos] != ']' || first)){
+        first = false;
+        std::bitset<256> one;
+        int lo = -1;
+        if(text[pos] == '\\'){
+            pos++;
+            if(!parseEscape(one)){
+                return false;
+            }
+            if(one.count() == 1){
+                for(lo = 0; !one[lo]; lo++){
+                }
+            }
+        }else{
+            lo = (unsigned char)text[pos++];
+            one[lo] = true;
+        }
+        // a-z, a single byte on both ends
+        if(lo >= 0 && pos + 1 < text.size() && text[pos] == '-' && text[pos + 1] != ']'){
+            pos++;
+            int hi = (unsigned char)text[pos++];
+            if(hi == '\\'){
+                std::bitset<256> end;
+                if(!parseEscape(end) || end.count() != 1){
+                    return fail("bad range");
+                }
+                for(hi = 0; !end[hi]; hi++){
+                }
+            }
+            if(hi < lo){
+                return fail("bad range");
+            }
+            for(int i = lo; i <= hi; i++){
+                one[i] = true;
+            }
+        }
+        bits |= one;
+    }
+    if(!more()){
+        return fail("missing ]");
+    }
+    pos++;
+    // [^a] with (?i) leaves out A too
+    fold(bits);
+    if(negate){
+        bits.flip();
+    }
+    node = newSet(bits);
+    return true;
+}
+
+bool RegexParser::matchesEmpty(uint32_t start, uint32_t match){
+    std::vector<uint32_t> stack(1, start);
+    std::vector<bool> seen(pSet->nfa.size(), false);
+    while(!stack.empty()){
+        uint32_t s = stack.back();
+        stack.pop_back();
+        if(s == match){
+            return true;
+        }
+        if(seen[s]){
+            continue;
+        }
+        seen[s] = true;
+        if(pSet->nfa[s].type == RegexSet::NFA_SPLIT){
+            stack.push_back(pSet->nfa[s].out);
+            stack.push_back(pSet->nfa[s].out1);
+        }
+    }
+    return false;
+}
+
+bool RegexParser::emit(uint32_t node, uint32_t next, uint32_t &start){
+    if(pSet->nfa.size() >= REGEX_NFA_MAX){
+        return fail("rule set too large");
+    }
+    Node &n = nodes[node];
+    switch(n.type){
+    case RE_SET:
+        start = pSet->newState(RegexSet::NFA_CHAR, next, 0, n.set);
+        return true;
+    case RE_CAT:
+        // right to left, each piece continues into the one after it
+        start = next;
+        for(size_t i = n.kids.size(); i > 0; i--){
+            if(!emit(nodes[node].kids[i - 1], start, start)){
+                return false;
+            }
+        }
+        return true;
+    case RE_ALT:{
+        std::vector<uint32_t> kids = n.kids;
+        uint32_t alt;
+        if(!emit(kids.back(), next, alt)){
+            return false;
+        }
+        for(size_t i = kids.size() - 1; i > 0; i--){
+            uint32_t kid;
+            if(!emit(kids[i - 1], next, kid)){
+                return false;
+            }
+            alt = pSet->newState(RegexSet::NFA_SPLIT, kid, alt, 0);
+        }
+        start = alt;
+        return true;
+    }
+    case RE_REPEAT:{
+        uint32_t kid = n.kids[0];
+        uint32_t min = n.min, max = n.max;
+        uint32_t tail = next;
+        if(max == UINT32_MAX){
+            // x*: split loops back after every x
+            uint32_t loop = pSet->newState(RegexSet::NFA_SPLIT, 0, next, 0);
+            uint32_t body;
+            if(!emit(kid, loop, body)){
+                return false;
+            }
+            pSet->nfa[loop].out = body;
+            tail = loop;
+        }else{
+            // x{0,k}: nested optionals
+            for(uint32_t i = min; i < max; i++){
+                uint32_t body;
+                if(!emit(kid, tail, body)){
+                    return false;
+                }
+                tail = pSet->newState(RegexSet::NFA_SPLIT, body, next, 0);
+            }
+        }
+        for(uint32_t i = 0; i < min; i++){
+            if(!emit(kid, tail, tail)){
+                return false;
+            }
+        }
+        start = tail;
+        return true;
+    }
+    default:
+        return fail("bad node");
+    }
+}
+
+//=================================================================================
+RegexSet::RegexSet(){
+    memset(byteClass, 0, sizeof(byteClass));
+    classNum = 1;
+}
+
+RegexSet::~RegexSet(){
+}
+
+uint32_t RegexSet::newState(uint8_t type, uint32_t out, uint32_t out1, uint32_t arg){
+    NfaState state;
+    state.type = type;
+    state.out = out;
+    state.out1 = out1;
+    state.arg = arg;
+    nfa.push_back(state);
+    return nfa.size() - 1;
+}
+
+bool RegexSet::add(const std::string &name, const std::string &regex, std::string &err){
+    std::string text = regex;
+    bool nocase = false;
+    bool anchor = false;
+    // prefixes in either order
+    while(true){
+        if(text.compare(0, 4, "(?i)") == 0){
+            nocase = true;
+            text = text.substr(4);
+        }else if(!text.empty() && text[0] == '^'){
+            anchor = true;
+            text = text.substr(1);
+        }else{
+            break;
+        }
+    }
+
+    // a failed rule leaves nothing behind
+    size_t nfaNum = nfa.size(), setNum = sets.size();
+    RegexParser parser(this, text, nocase);
+    uint32_t start;
+    if(!parser.compile(names.size(), start, err)){
+        nfa.resize(nfaNum);
+        sets.resize(setNum);
+        return false;
+    }
+    names.push_back(name);
+    (anchor ? anchored : floating).push_back(start);
+    return true;
+}
+
+int RegexSet::load(const char *path){
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL){
+        LOG_ERROR("rule file %s open fail\n", path);
+        return -1;
+    }
+    char line[4096];
+    uint32_t lineNo = 0;
+    while(fgets(line, sizeof(line), fp)){
+        lineNo++;
+        line[strcspn(line, "\r\n")] = 0;
+        char *name = line + strspn(line, " \t");
+        if(*name == 0 || *name == '#'){
+            continue;
+        }
+        char *regex = name + strcspn(name, " \t");
+        if(*regex){
+            *regex++ = 0;
+            regex += strspn(regex, " \t");
+        }
+        std::string err;
+        if(*regex == 0 || !add(name, regex, err)){
+            LOG_WARN("%s:%u rule %s skipped: %s\n", path, lineNo, name, *regex ? err.c_str() : "empty");
+        }
+    }
+    fclose(fp);
+    build();
+    LOG_INFO("%s: %u rules, %lu nfa states, %u byte classes\n", path, getRuleNum(), nfa.size(), classNum);
+    return 0;
+}
+
+void RegexSet::build(){
+    // split the bytes by every set until each class is inside or outside of all of them
+    memset(byteClass, 0, sizeof(byteClass));
+    classNum = 1;
+    for(auto &bits : sets){
+        std::vector<int> inside(classNum, -1), outside(classNum, -1);
+        uint32_t num = 0;
+        for(int c = 0; c < 256; c++){
+            std::vector<int> &to = bits[c] ? inside : outside;
+            if(to[byteClass[c]] < 0){
+                to[byteClass[c]] = num++;
+            }
+            byteClass[c] = to[byteClass[c]];
+        }
+        classNum = num;
+    }
+
+    setHas.assign(sets.size() * classNum, 0);
+    for(uint32_t s = 0; s < sets.size(); s++){
+        for(int c = 0; c < 256; c++){
+            if(sets[s][c]){
+                setHas[s * classNum + byteClass[c]] = 1;
+            }
+        }
+    }
+    sets.clear();
+}
+
+//=================================================================================
+LazyDfa::LazyDfa(const RegexSet *set, uint64_t budgetBytes){
+    pSet = set;
+    budget = budgetBytes;
+    used = 0;
+    generation = 0;
+    mark.assign(pSet->nfa.size(), 0);
+    stamp = 0;
+    built = 0;
+    flushes = 0;
+    restarts = 0;
+
+    // the floating starts are in every state, so they are left out of the sets
+    // and their step on each byte class is done once here
+    std::vector<uint32_t> starts;
+    isFloating.assign(pSet->nfa.size(), 0);
+    stamp++;
+    for(uint32_t n : pSet->floating){
+        closure(n, starts);
+    }
+    for(uint32_t n : starts){
+        isFloating[n] = 1;
+    }
+    floatStep.resize(pSet->classNum);
+    for(uint32_t c = 0; c < pSet->classNum; c++){
+        stamp++;
+        step(starts, c, floatStep[c]);
+    }
+    flush();
+    flushes = 0;
+}
+
+void LazyDfa::step(const std::vector<uint32_t> &from, uint32_t c, std::vector<uint32_t> &to){
+    for(uint32_t n : from){
+        const RegexSet::NfaState &state = pSet->nfa[n];
+        if(state.type == RegexSet::NFA_CHAR && pSet->setHas[state.arg * pSet->classNum + c]){
+            closure(state.out, to);
+        }
+    }
+}
+
+LazyDfa::~LazyDfa(){
+}
+
+void LazyDfa::closure(uint32_t n, std::vector<uint32_t> &set){
+    stack.push_back(n);
+    while(!stack.empty()){
+        uint32_t s = stack.back();
+        stack.pop_back();
+        if(mark[s] == stamp){
+            continue;
+        }
+        mark[s] = stamp;
+        const RegexSet::NfaState &state = pSet->nfa[s];
+        if(state.type == RegexSet::NFA_SPLIT){
+            stack.push_back(state.out1);
+            stack.push_back(state.out);
+        }else if(!isFloating[s]){
+            // split states never need to be in a set, only what they lead to
+            set.push_back(s);
+        }
+    }
+}
+
+void LazyDfa::flush(){
+    previous.clear();
+    for(auto &state : states){
+        previous.push_back(std::vector<uint32_t>());
+        previous.back().swap(state.nfa);
+    }
+    states.clear();
+    trans.clear();
+    index.clear();
+    used = 0;
+    generation++;
+    flushes++;
+
+    // state 0: the start of a stream, the anchored rules on top of the floating ones
+    std::vector<uint32_t> start;
+    stamp++;
+    for(uint32_t n : pSet->anchored){
+        closure(n, start);
+    }
+    std::sort(start.begin(), start.end());
+    intern(start);
+}
+
+uint32_t LazyDfa::intern(std::vector<uint32_t> &set){
+    std::string key((const char *)set.data(), set.size() * sizeof(uint32_t));
+    auto it = index.find(key);
+    if(it != index.end()){
+        return it->second;
+    }
+    uint32_t id = states.size();
+    states.push_back(DfaState());
+    DfaState &state = states.back();
+    for(uint32_t n : set){
+        if(pSet->nfa[n].type == RegexSet::NFA_MATCH){
+            state.accepts.push_back(pSet->nfa[n].arg);
+        }
+    }
+    state.nfa.swap(set);
+    trans.resize(trans.size() + pSet->classNum, DFA_UNKNOWN);
+    index[key] = id;
+    used += key.size() * 2 + pSet->classNum * sizeof(uint32_t) + sizeof(DfaState) + 64;
+    built++;
+    return id;
+}
+
+uint32_t LazyDfa::resume(const RegexCursor &cursor){
+    // state 0 is the same nfa set in every generation
+    if(cursor.state == 0 || cursor.generation == generation){
+        return cursor.state;
+    }
+    std::vector<uint32_t> set;
+    if(cursor.generation + 1 == generation && cursor.state < previous.size()){
+        set = previous[cursor.state];
+    }else{
+        // two flushes since the stream was last seen, whatever it was in the middle of is lost;
+        // the stream is past its start, so only the floating rules go on, the empty set
+        restarts++;
+    }
+    return intern(set);
+}
+
+uint32_t LazyDfa::compute(uint32_t s, uint32_t c){
+    std::vector<uint32_t> next;
+    stamp++;
+    step(states[s].nfa, c, next);
+    // unanchored: the floating starts stepped too
+    for(uint32_t n : floatStep[c]){
+        if(mark[n] != stamp){
+            mark[n] = stamp;
+            next.push_back(n);
+        }
+    }
+    std::sort(next.begin(), next.end());
+
+    // past the budget: drop the cache, s is not needed any more
+    bool flushed = false;
+    if(used >= budget){
+        flush();
+        flushed = true;
+    }
+    uint32_t id = intern(next);
+    uint32_t value = id | (states[id].accepts.empty() ? 0 : DFA_ACCEPT);
+    if(!flushed){
+        trans[(size_t)s * pSet->classNum + c] = value;
+    }
+    return value;
+}
+
+void regexCursorFree(RegexCursor *cursor){
+    delete cursor;
+}
+
+void LazyDfa::report() const{
+    LOG_INFO("regex dfa states %lu built %lu cache %lu KB flushes %lu restarts %lu\n",
+        states.size(), built, used >> 10, flushes, restarts);
+}
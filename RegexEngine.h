@@ -0,0 +1,198 @@
+#ifndef REGEX_ENGINE_H
+#define REGEX_ENGINE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <bitset>
+#include <algorithm>
+#include <unordered_map>
+
+// 流式正则规则引擎
+//   所有规则编译进一个 Thompson NFA, 匹配时按需构造 DFA 状态 (lazy DFA), 不回溯
+//   每字节一次查表, 与规则数量无关; 未构造的转移第一次走到时才做子集构造
+//   每条流每个方向一个 RegexCursor, 第一次扫描时分配, 命中规则后才再分配已报告规则表
+//   DFA 缓存有内存上限, 超过后整体清空重建, 上一代状态的 NFA 集合保留一代, 流可以接着匹配
+//   每个 shard 一个 LazyDfa, RegexSet 编译后只读共用
+//
+// 规则文件每行: name regex, (?i) 前缀忽略大小写, ^ 开头锚定在流的起点
+// 支持 . [] [^] \d \w \s \xHH | () (?:) * + ? {m,n}, 不支持反向引用和 $
+
+const uint32_t REGEX_NFA_MAX = 1 << 20;         // nfa states of the whole set
+const uint32_t REGEX_REPEAT_MAX = 1000;         // {m,n} bound
+const uint64_t REGEX_CACHE_BYTES = 8 << 20;     // dfa cache per LazyDfa
+const uint32_t DFA_UNKNOWN = 0xffffffff;        // transition not built yet
+const uint32_t DFA_ACCEPT = 0x80000000;         // next state reports rules
+
+/*
+ *@brief 编译后的规则集, 只读
+ */
+class RegexSet{
+public:
+    RegexSet();
+
+    ~RegexSet();
+
+    // rule file, 0 on success; build() is called
+    int load(const char *path);
+
+    // false with err set when the regex does not parse
+    bool add(const std::string &name, const std::string &regex, std::string &err);
+
+    // byte classes, call once after the last add
+    void build();
+
+    uint32_t getRuleNum() const{
+        return names.size();
+    }
+
+    const std::string &getName(uint32_t rule) const{
+        return names[rule];
+    }
+
+private:
+    friend class LazyDfa;
+    friend class RegexParser;
+
+    enum NfaType{
+        NFA_CHAR = 0,           // one byte of set, then out
+        NFA_SPLIT,              // out and out1
+        NFA_MATCH,              // rule matched
+    };
+
+    struct NfaState{
+        uint8_t type;
+        uint32_t out;
+        uint32_t out1;
+        uint32_t arg;           // set for NFA_CHAR, rule for NFA_MATCH
+    };
+
+    uint32_t newState(uint8_t type, uint32_t out, uint32_t out1, uint32_t arg);
+
+    std::vector<std::string> names;
+    std::vector<NfaState> nfa;
+    std::vector<uint32_t> floating;             // rule starts tried at every byte
+    std::vector<uint32_t> anchored;             // rule starts tried at stream offset 0 only
+    std::vector<std::bitset<256> > sets;        // until build()
+
+    uint8_t byteClass[256];
+    uint32_t classNum;
+    std::vector<uint8_t> setHas;                // sets x classNum
+};
+
+/*
+ *@brief 一个方向的流的匹配位置, 放在 AssemableInfo 里
+ */
+struct RegexCursor{
+    RegexCursor(){
+        state = 0;
+        generation = 0;
+        fired = NULL;
+    }
+
+    ~RegexCursor(){
+        delete fired;
+    }
+
+    uint32_t state;
+    uint32_t generation;                        // LazyDfa cache generation state belongs to
+    std::vector<uint32_t> *fired;               // rules already reported for this stream, sorted
+};
+
+/*
+ *@brief 按需构造的 DFA, 单线程使用
+ */
+class LazyDfa{
+public:
+    LazyDfa(const RegexSet *set, uint64_t budget = REGEX_CACHE_BYTES);
+
+    ~LazyDfa();
+
+    // continue the stream from cursor over data, onMatch(rule, end) once per rule and stream,
+    // end is the offset in data just past the first match of the rule
+    template<typename F>
+    void scan(RegexCursor &cursor, const uint8_t *data, uint32_t len, F onMatch){
+        uint32_t s = resume(cursor);
+        for(uint32_t i = 0; i < len; i++){
+            uint32_t c = pSet->byteClass[data[i]];
+            uint32_t nx = trans[(size_t)s * pSet->classNum + c];
+            if(nx == DFA_UNKNOWN){
+                nx = compute(s, c);
+            }
+            s = nx & ~DFA_ACCEPT;
+            if(nx & DFA_ACCEPT){
+                report(cursor, s, i + 1, onMatch);
+            }
+        }
+        cursor.state = s;
+        cursor.generation = generation;
+    }
+
+    uint32_t getStateNum() const{
+        return states.size();
+    }
+
+    // log cache counters
+    void report() const;
+
+private:
+    struct DfaState{
+        std::vector<uint32_t> nfa;              // sorted nfa state set, floating starts implied
+        std::vector<uint32_t> accepts;          // rules matched in this state
+    };
+
+    // dfa state the cursor stands for in the current generation
+    uint32_t resume(const RegexCursor &cursor);
+
+    // fill the transition of s on byte class c, may flush the cache
+    uint32_t compute(uint32_t s, uint32_t c);
+
+    // id of the dfa state for the nfa set, built when new
+    uint32_t intern(std::vector<uint32_t> &set);
+
+    // add the epsilon closure of nfa state n to set, floating starts left out
+    void closure(uint32_t n, std::vector<uint32_t> &set);
+
+    // closures of what the states of from go to on byte class c
+    void step(const std::vector<uint32_t> &from, uint32_t c, std::vector<uint32_t> &to);
+
+    void flush();
+
+    template<typename F>
+    void report(RegexCursor &cursor, uint32_t s, uint32_t end, F onMatch){
+        for(uint32_t rule : states[s].accepts){
+            if(cursor.fired == NULL){
+                cursor.fired = new std::vector<uint32_t>();
+            }
+            std::vector<uint32_t> &fired = *cursor.fired;
+            auto it = std::lower_bound(fired.begin(), fired.end(), rule);
+            if(it != fired.end() && *it == rule){
+                continue;
+            }
+            fired.insert(it, rule);
+            onMatch(rule, end);
+        }
+    }
+
+    const RegexSet *pSet;
+    uint64_t budget;
+    uint64_t used;                              // bytes of states and transitions
+    uint32_t generation;
+
+    std::vector<DfaState> states;               // 0 is the stream start
+    std::vector<uint32_t> trans;                // states x classNum, next | DFA_ACCEPT
+    std::unordered_map<std::string, uint32_t> index;
+    std::vector<std::vector<uint32_t> > previous;   // nfa sets of the last generation
+
+    std::vector<uint8_t> isFloating;            // nfa states in every dfa state, implicit
+    std::vector<std::vector<uint32_t> > floatStep;  // per byte class, step of the floating starts
+    std::vector<uint32_t> mark;                 // closure visit stamps
+    uint32_t stamp;
+    std::vector<uint32_t> stack;
+
+    uint64_t built;
+    uint64_t flushes;
+    uint64_t restarts;                          // streams older than the last generation
+};
+
+#endif //REGEX_ENGINE_H
@@ -0,0 +1,264 @@
+#include "RtpAnalyzer.h"
+#include "Log.h"
+
+#include <stdlib.h>
+
+// clock rate of the static payload types (RFC 3551), 0 for dynamic ones
+static uint32_t staticClockRate(uint8_t pt){
+    switch(pt){
+    case 0: case 3: case 4: case 5: case 7: case 8:
+    case 9: case 12: case 13: case 15: case 18:
+        return 8000;
+    case 6:
+        return 16000;
+    case 10: case 11:
+        return 44100;
+    case 16:
+        return 11025;
+    case 17:
+        return 22050;
+    case 14: case 25: case 26: case 28: case 31: case 32: case 33: case 34:
+        return 90000;
+    default:
+        return 0;
+    }
+}
+
+RtpAnalyzer::RtpAnalyzer(){
+    state = RTP_UNKNOWN;
+    payloadType = 0;
+    transitValid = 0;
+    maxSeq = 0;
+    ssrc = 0;
+    probation = 0;
+    detectPkt = 0;
+    cycles = 0;
+    baseSeq = 0;
+    badSeq = 0;
+    received = 0;
+    reordered = 0;
+    clockRate = 0;
+    firstRtpTs = 0;
+    lastRtpTs = 0;
+    lastTransit = 0;
+    jitter = 0;
+    maxJitter = 0;
+    bytes = 0;
+    firstUs = 0;
+    lastUs = 0;
+}
+
+bool RtpAnalyzer::looksLikeRtp(const Byte *payload, uint32_t len){
+    if(len < RTP_HEADER_LENGTH){
+        return false;
+    }
+    const rtp_hdr *hdr = (const rtp_hdr *)payload;
+    if((hdr->vpxcc >> 6) != 2){
+        return false;
+    }
+    // 72-76 with marker set is RTCP (SR/RR/SDES/BYE/APP)
+    uint8_t pt = hdr->mpt & 0x7F;
+    if(pt >= 72 && pt <= 76){
+        return false;
+    }
+    uint32_t cc = hdr->vpxcc & 0x0F;
+    return RTP_HEADER_LENGTH + cc * 4 <= len;
+}
+
+void RtpAnalyzer::process(const Byte *payload, uint32_t len, uint64_t tsUs){
+    if(state == RTP_NOT_RTP){
+        return;
+    }
+    if(!looksLikeRtp(payload, len)){
+        if(state != RTP_ACTIVE && ++detectPkt >= RTP_DETECT_LIMIT){
+            state = RTP_NOT_RTP;
+        }
+        return;
+    }
+
+    const rtp_hdr *hdr = (const rtp_hdr *)payload;
+    uint16_t seq = ntohs(hdr->seq);
+    uint32_t rtpTs = ntohl(hdr->ts);
+    uint32_t pktSsrc = ntohl(hdr->ssrc);
+
+    if(state == RTP_UNKNOWN || (state == RTP_PROBATION && pktSsrc != ssrc)){
+        if(state == RTP_PROBATION && ++detectPkt >= RTP_DETECT_LIMIT){
+            state = RTP_NOT_RTP;
+            return;
+        }
+        state = RTP_PROBATION;
+        ssrc = pktSsrc;
+        payloadType = hdr->mpt & 0x7F;
+        clockRate = staticClockRate(payloadType);
+        initSeq(seq);
+        maxSeq = seq - 1;
+        probation = RTP_MIN_SEQUENTIAL;
+    }else if(pktSsrc != ssrc){
+        // another source muxed on the same 5-tuple, not tracked
+        return;
+    }
+
+    if(!updateSeq(seq)){
+        if(state == RTP_PROBATION && ++detectPkt >= RTP_DETECT_LIMIT){
+            state = RTP_NOT_RTP;
+        }
+        return;
+    }
+
+    if(state == RTP_PROBATION){
+        state = RTP_ACTIVE;
+        firstUs = tsUs;
+        firstRtpTs = rtpTs;
+    }
+    bytes += len;
+    lastUs = tsUs;
+
+    if(clockRate == 0){
+        guessClockRate(rtpTs, tsUs);
+    }
+    if(clockRate != 0){
+        updateJitter(rtpTs, tsUs);
+    }
+    lastRtpTs = rtpTs;
+}
+
+void RtpAnalyzer::initSeq(uint16_t seq){
+    baseSeq = seq;
+    maxSeq = seq;
+    badSeq = RTP_SEQ_MOD + 1;
+    cycles = 0;
+    received = 0;
+}
+
+bool RtpAnalyzer::updateSeq(uint16_t seq){
+    uint16_t udelta = seq - maxSeq;
+
+    if(probation){
+        // packets must be in sequence before the stream is accepted
+        if(seq == (uint16_t)(maxSeq + 1)){
+            probation--;
+            maxSeq = seq;
+            if(probation == 0){
+                initSeq(seq);
+                received++;
+                return true;
+            }
+        }else{
+            probation = RTP_MIN_SEQUENTIAL - 1;
+            maxSeq = seq;
+        }
+        return false;
+    }else if(udelta < RTP_MAX_DROPOUT){
+        // in order, with permissible gap
+        if(seq < maxSeq){
+            cycles += RTP_SEQ_MOD;
+        }
+        maxSeq = seq;
+    }else if(udelta <= RTP_SEQ_MOD - RTP_MAX_MISORDER){
+        // very large jump, accept only if the sender restarted
+        if(seq == badSeq){
+            initSeq(seq);
+            transitValid = 0;
+        }else{
+            badSeq = (seq + 1) & (RTP_SEQ_MOD - 1);
+            return false;
+        }
+    }else{
+        // duplicate or reordered packet
+        reordered++;
+    }
+    received++;
+    return true;
+}
+
+// RFC 3550 A.8
+void RtpAnalyzer::updateJitter(uint32_t rtpTs, uint64_t tsUs){
+    // relative to the stream start: epoch microseconds times a 90kHz clock overflow 64 bits,
+    // the offset cancels out in the transit difference
+    int64_t sinceUs = (int64_t)(tsUs - firstUs);
+    uint32_t arrival = (uint32_t)(sinceUs * (int64_t)clockRate / 1000000);
+    int32_t transit = (int32_t)(arrival - rtpTs);
+    if(!transitValid){
+        lastTransit = transit;
+        transitValid = 1;
+        return;
+    }
+    int32_t d = transit - lastTransit;
+    lastTransit = transit;
+    if(d < 0){
+        d = -d;
+    }
+    jitter += d - ((jitter + 8) >> 4);
+    if(jitter > maxJitter){
+        maxJitter = jitter;
+    }
+}
+
+// dynamic payload types do not tell the clock, derive it from timestamp progress
+void RtpAnalyzer::guessClockRate(uint32_t rtpTs, uint64_t tsUs){
+    static const uint32_t rates[] = {8000, 16000, 24000, 32000, 44100, 48000, 90000};
+    if(received < RTP_RATE_SAMPLES || tsUs <= firstUs){
+        return;
+    }
+    double rate = (double)(uint32_t)(rtpTs - firstRtpTs) * 1000000.0 / (tsUs - firstUs);
+    uint32_t best = rates[0];
+    for(uint32_t i = 1; i < sizeof(rates) / sizeof(rates[0]); i++){
+        if(abs((int)(rate - rates[i])) < abs((int)(rate - best))){
+            best = rates[i];
+        }
+    }
+    clockRate = best;
+}
+
+uint32_t RtpAnalyzer::getExpected() const{
+    if(state != RTP_ACTIVE){
+        return 0;
+    }
+    return cycles + maxSeq - baseSeq + 1;
+}
+
+uint32_t RtpAnalyzer::getLost() const{
+    uint32_t expected = getExpected();
+    // duplicates can make received exceed expected
+    return (expected > received) ? expected - received : 0;
+}
+
+double RtpAnalyzer::getJitterMs() const{
+    if(clockRate == 0){
+        return 0;
+    }
+    return (double)(jitter >> 4) * 1000.0 / clockRate;
+}
+
+// simplified ITU-T G.107 E-model, one way delay is unknown so only jitter and loss count
+double RtpAnalyzer::getMos() const{
+    uint32_t expected = getExpected();
+    if(expected == 0){
+        return 0;
+    }
+    double lossPct = (double)getLost() * 100.0 / expected;
+    double latency = getJitterMs() * 2 + 10;
+    double r = 93.2;
+    if(latency < 160){
+        r -= latency / 40;
+    }else{
+        r -= (latency - 120) / 10;
+    }
+    r -= lossPct * 2.5;
+    if(r < 0){
+        r = 0;
+    }else if(r > 100){
+        r = 100;
+    }
+    return 1 + 0.035 * r + 0.000007 * r * (r - 60) * (100 - r);
+}
+
+void RtpAnalyzer::report(const char *name, const char *dir) const{
+    if(state != RTP_ACTIVE){
+        return;
+    }
+    double maxJitterMs = clockRate ? (double)(maxJitter >> 4) * 1000.0 / clockRate : 0;
+    LOG_INFO("rtp %s %s ssrc %08x pt %u rate %u packets %u expected %u lost %u reordered %u bytes %lu jitter %.2fms max %.2fms mos %.2f duration %.1fs\n",
+        name, dir, ssrc, payloadType, clockRate, received, getExpected(), getLost(), reordered, bytes,
+        getJitterMs(), maxJitterMs, getMos(), (lastUs - firstUs) / 1000000.0);
+}
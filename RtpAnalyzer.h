@@ -0,0 +1,100 @@
+#ifndef RTP_ANALYZER_H
+#define RTP_ANALYZER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "Packet.h"
+#include "StructDefine.h"
+
+// RTP 语音流质量分析: 丢包, 抖动(RFC 3550), 乱序, MOS 估计
+// 每个方向一个固定大小的状态, 按包增量计算
+
+const uint32_t RTP_MIN_SEQUENTIAL = 2;      // consecutive packets before a stream is valid
+const uint32_t RTP_MAX_DROPOUT = 3000;
+const uint32_t RTP_MAX_MISORDER = 100;
+const uint32_t RTP_SEQ_MOD = 1 << 16;
+const uint32_t RTP_DETECT_LIMIT = 8;        // give up on non RTP flows after this many packets
+const uint32_t RTP_RATE_SAMPLES = 50;       // packets used to guess dynamic payload clock rate
+
+#pragma pack(1)
+typedef struct rtp_hdr{
+    u_char      vpxcc;                  // version:2 padding:1 extension:1 csrc count:4
+    u_char      mpt;                    // marker:1 payload type:7
+    u_short     seq;
+    u_int       ts;
+    u_int       ssrc;
+}__attribute__((packed)) rtp_hdr;
+#pragma pack()
+
+const u_int RTP_HEADER_LENGTH = sizeof(struct rtp_hdr);
+
+enum RTP_STATE{
+    RTP_UNKNOWN,
+    RTP_PROBATION,
+    RTP_ACTIVE,
+    RTP_NOT_RTP
+};
+
+/*
+ *@brief 单方向 RTP 流状态
+ */
+class RtpAnalyzer{
+public:
+    RtpAnalyzer();
+
+    // one udp payload of this direction
+    void process(const Byte *payload, uint32_t len, uint64_t tsUs);
+
+    bool isActive() const{
+        return state == RTP_ACTIVE;
+    }
+
+    uint32_t getExpected() const;
+
+    uint32_t getLost() const;
+
+    // interarrival jitter in milliseconds
+    double getJitterMs() const;
+
+    double getMos() const;
+
+    void report(const char *name, const char *dir) const;
+
+    // payload header sanity check, no state
+    static bool looksLikeRtp(const Byte *payload, uint32_t len);
+
+private:
+    void initSeq(uint16_t seq);
+
+    // RFC 3550 A.1, return false when the packet is not counted
+    bool updateSeq(uint16_t seq);
+
+    void updateJitter(uint32_t rtpTs, uint64_t tsUs);
+
+    void guessClockRate(uint32_t rtpTs, uint64_t tsUs);
+
+    uint8_t state;
+    uint8_t payloadType;
+    uint8_t transitValid;
+    uint16_t maxSeq;
+    uint32_t ssrc;
+    uint32_t probation;
+    uint32_t detectPkt;
+    uint32_t cycles;
+    uint32_t baseSeq;
+    uint32_t badSeq;
+    uint32_t received;
+    uint32_t reordered;
+    uint32_t clockRate;
+    uint32_t firstRtpTs;
+    uint32_t lastRtpTs;
+    int32_t lastTransit;
+    uint32_t jitter;            // RFC 3550 A.8, scaled by 16, timestamp units
+    uint32_t maxJitter;
+    uint64_t bytes;
+    uint64_t firstUs;
+    uint64_t lastUs;
+};
+
+#endif //RTP_ANALYZER_H
@@ -0,0 +1,33 @@
+#ifndef RTP_HANDLER_H
+#define RTP_HANDLER_H
+
+#include "ProtoHandler.h"
+#include "RtpAnalyzer.h"
+
+// udp 会话的 RTP 质量分析, 接到处理器链上
+
+class RtpHandler : public ProtoHandler<RtpHandler>{
+public:
+    struct State{
+        RtpAnalyzer dir[2];     // indexed by Direct
+    };
+
+    static bool wants(const NetTuple5 &tuple){
+        return tuple.tranType == TranType_UDP;
+    }
+
+    void onPacket(State &state, const NetTuple5 &tuple, Packet *pkt){
+        state.dir[pkt->direct].process(pkt->getUdpData(), pkt->getUdpDatalen(), pkt->getTsUs());
+    }
+
+    void onEnd(State &state, const NetTuple5 &tuple){
+        state.dir[Cli2Ser].report(tuple.getName().c_str(), "===>");
+        state.dir[Ser2Cli].report(tuple.getName().c_str(), "<===");
+    }
+
+    const char *app(const State &state) const{
+        return (state.dir[Cli2Ser].isActive() || state.dir[Ser2Cli].isActive()) ? "rtp" : NULL;
+    }
+};
+
+#endif //RTP_HANDLER_H
@@ -0,0 +1,15 @@
+#ifndef SESS_HANDLERS_H
+#define SESS_HANDLERS_H
+
+#include "ProtoHandler.h"
+#include "HttpHandler.h"
+#include "TlsHandler.h"
+#include "RtpHandler.h"
+
+// 会话路径上的协议处理器, 每个 SessMgr 一条链
+// 从列表里去掉一个处理器, 它的代码和每个会话上的状态就都不存在了
+// dns 不在这里: 它不建会话, 在 SessMgr::feedPkt 里直接交给 DnsAnalyzer
+
+typedef HandlerChain<HttpHandler, TlsHandler, RtpHandler> SessHandlers;
+
+#endif //SESS_HANDLERS_H
@@ -4,65 +4,546 @@
 #include <stdio.h>
 #include <pcap.h>
 #include <assert.h>
+#include <errno.h>
+#include <sys/wait.h>
 
 
-SessMgr::SessMgr(uint32_t hashnum){
+SessMgr::SessMgr(uint32_t hashnum, int numaNode):numaNode(numaNode),pArena(new HugeArena(numaNode)),
+    pool(hashnum, pArena),TCPSessMap(SessMap::allocator_type(pArena)),UDPSessMap(SessMap::allocator_type(pArena)),dnsAnalyzer(numaNode){
     hashCalc.Init(hashnum);
     allPktnum = 0;
     tcpPktNum = 0;
     udpPktNum = 0;
+    dnsPktNum = 0;
     tcpSession = 0;
     otherPktNum = 0;
     noethNum = 0;
+    pSketch = new FlowSketch();
+    pSrcPerDst = new CardinalityTracker("dst", CARD_DST_ALERT);
+    pDstPerSrc = new CardinalityTracker("src", CARD_SRC_ALERT);
+    pRecords = new FlowColumnWriter();
+    recordPath = FLOW_RECORD_FILE;
+    pExporter = NULL;
+    exportProducer = 0;
+    pDedup = NULL;
+    pCube = NULL;
+    pPcap = NULL;
+    pScanner = NULL;
+    shardId = -1;
+    shardNum = 1;
+    snapPid = 0;
+    carryOver = false;
+    sweepTick = 0;
+    sweepKey[0] = sweepKey[1] = 0;
+    expiredNum = 0;
+    keptBytes = 0;
+    streamBytes = 0;
 }
 
 SessMgr::~SessMgr(){
-    LOG_DEBUG("all packet %d\nno eth num %d\ntcp packet %d\nudp packet num %d\nother packet %d\n",allPktnum,noethNum,tcpPktNum,udpPktNum,otherPktNum);
+    LOG_DEBUG("all packet %d\nno eth num %d\ntcp packet %d\nudp packet num %d\ndns packet num %d\nother packet %d\n",allPktnum,noethNum,tcpPktNum,udpPktNum,dnsPktNum,otherPktNum);
+
+    reapSnapshot(true);
+    if(!carryOver){
+        writeRecords(TCPSessMap);
+        writeRecords(UDPSessMap);
+    }
+    pRecords->close();
+    delete pRecords;
+    if(pDedup){
+        LOG_INFO("%s duplicate packets dropped %lu\n", recordPath.c_str(), pDedup->getDuplicates());
+        delete pDedup;
+    }
+    if(pPcap){
+        pPcap->close();
+        delete pPcap;
+    }
 
     int numOfNode=0;
     int numTcpPkt=0;
     for(auto i : TCPSessMap){
         numOfNode+=i.second->numNode;
         numTcpPkt+=i.second->numPkt;
-        delete i.second;
+        for(auto node : i.second->nodelist){
+            countKept(node);
+        }
+        pool.slots.destroy(i.second);
     }
     LOG_DEBUG("tcp session %d\ntcp session node %d\ntcp packet %d\n",tcpSession,numOfNode,numTcpPkt);
+    LOG_INFO("%s sessions closed while capturing %lu\n", recordPath.c_str(), expiredNum);
+    if(pool.trunc){
+        LOG_INFO("%s truncation \"%s\" kept %lu of %lu tcp payload bytes\n", recordPath.c_str(),
+            pool.trunc->getSpec().c_str(), keptBytes, streamBytes);
+    }
     for(auto i : UDPSessMap){
-        delete i.second;
+        pool.slots.destroy(i.second);
+    }
+    pool.report(recordPath.c_str());
+    // map nodes live in the arena
+    TCPSessMap.clear();
+    UDPSessMap.clear();
+    delete pArena;
+    handlers.report(recordPath.c_str());
+    delete pScanner;
+
+    pSketch->close();
+    if(pCube){
+        pCube->close();
+        delete pCube;
+    }
+    pSrcPerDst->close();
+    pDstPerSrc->close();
+    delete pSketch;
+    delete pSrcPerDst;
+    delete pDstPerSrc;
+}
+
+void SessMgr::setMerger(ShardMerger *merger, uint32_t shard){
+    pSketch->setMerger(merger, shard);
+    pSrcPerDst->setMerger(merger, shard, 0);
+    pDstPerSrc->setMerger(merger, shard, 1);
+
+    // one record file per shard, no locking on the write path
+    shardId = shard;
+    shardNum = merger->getShardNum();
+    char path[64];
+    snprintf(path, sizeof(path), "output/flows_%u.fcol", shard);
+    recordPath = path;
+}
+
+void SessMgr::setExporter(IpfixExporter *exporter, uint32_t producer){
+    pExporter = exporter;
+    exportProducer = producer;
+}
+
+void SessMgr::setMatcher(const PatternMatcher *matcher, const RegexSet *rules){
+    std::string path = MATCH_REPORT_FILE;
+    if(shardId >= 0){
+        char name[64];
+        snprintf(name, sizeof(name), "output/matches_%d.out", shardId);
+        path = name;
+    }
+    delete pScanner;
+    pScanner = new ContentScanner(matcher, rules, path.c_str());
+}
+
+void SessMgr::setDedup(uint64_t windowUs){
+    delete pDedup;
+    pDedup = new PktDedup(windowUs, numaNode);
+}
+
+void SessMgr::setCube(const CubeSpec &spec, CubeMerger *merger){
+    delete pCube;
+    pCube = new TrafficCube(spec, numaNode);
+    if(merger){
+        pCube->setMerger(merger, (shardId >= 0) ? shardId : 0);
+    }
+}
+
+void SessMgr::setFlowPcap(uint32_t maxOpen, PcapFlusher *flusher){
+    delete pPcap;
+    pPcap = new FlowPcapWriter(maxOpen, flusher, (shardId >= 0) ? shardId : 0, numaNode);
+    // the pcap holds the payload too, and one fd per session is what the pcaps avoid
+    pool.payloadFiles = false;
+}
+
+void SessMgr::writeRecords(SessMap &sessMap){
+    for(auto i : sessMap){
+        for(auto node : i.second->nodelist){
+            // end of capture, not the packet path: wait rather than drop
+            writeRecord(node, true);
+        }
+    }
+}
+
+void SessMgr::writeRecord(SessionNode *node, bool wait){
+    if(!pRecords->isOpen()){
+        pRecords->open(recordPath.c_str());
+    }
+    FlowRecord rec;
+    node->fillRecord(rec);
+    pRecords->append(rec);
+    if(pExporter){
+        pExporter->submit(exportProducer, rec, wait);
+    }
+}
+
+void SessMgr::countKept(SessionNode *node){
+    if(node->_tuple.tranType != TranType_TCP){
+        return;
+    }
+    for(uint32_t d = 0; d < 2; d++){
+        uint32_t count = node->stream[d].count;
+        streamBytes += count;
+        keptBytes += (count < node->keepBytes) ? count : node->keepBytes;
+    }
+}
+
+void SessMgr::closeSession(SessionNode *node){
+    // the packet path: a full export queue drops the record and counts it
+    writeRecord(node, false);
+    countKept(node);
+    if(pPcap && node->pcapFile){
+        pPcap->finish(node->pcapFile);
+    }
+    expiredNum++;
+    // reports the tcp metrics, handler state, metrics and cold part go back to the pool
+    pool.nodes.destroy(node);
+}
+
+void SessMgr::sweep(SessMap &sessMap, uint32_t &cursor, uint64_t nowUs){
+    auto it = sessMap.lower_bound(cursor);
+    uint32_t steps = (sessMap.size() < SESS_SWEEP_SLOTS) ? sessMap.size() : SESS_SWEEP_SLOTS;
+    for(uint32_t n = 0; n < steps && !sessMap.empty(); n++){
+        if(it == sessMap.end()){
+            it = sessMap.begin();
+        }
+        HashSlot *slot = it->second;
+        for(auto node = slot->nodelist.begin(); node != slot->nodelist.end(); ){
+            if((*node)->isExpired(nowUs)){
+                closeSession(*node);
+                node = slot->nodelist.erase(node);
+            }else{
+                ++node;
+            }
+        }
+        if(slot->nodelist.empty()){
+            pool.slots.destroy(slot);
+            it = sessMap.erase(it);
+        }else{
+            ++it;
+        }
+    }
+    cursor = (it == sessMap.end()) ? 0 : it->first;
+}
+
+int SessMgr::checkpoint(const char *path, bool withData, bool background){
+    // one child at a time, the next checkpoint comes soon enough
+    if(!reapSnapshot(!background)){
+        LOG_WARN("%s checkpoint still being written, skipped\n", snapPath.c_str());
+        return -1;
+    }
+    snapPath = path;
+    std::string tmp = snapPath + ".tmp";
+
+    if(!background){
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0 || !writeSnapshot(fd, withData) || rename(tmp.c_str(), path) != 0){
+            LOG_ERROR("%s checkpoint fail\n", path);
+            if(fd >= 0){
+                close(fd);
+            }
+            return -1;
+        }
+        close(fd);
+        LOG_INFO("%s checkpoint written\n", path);
+        return 0;
+    }
+
+    if(hugeHugetlbBytes()){
+        // see HugeMem.h, each first write to a hugetlbfs page stalls us for a 2MB copy
+        LOG_WARN("%s checkpoint forks with %lu MB of hugetlbfs pages\n", path, hugeHugetlbBytes() >> 20);
+    }
+    // the child sees the tables as of now, copy on write keeps them so while we go on
+    pid_t pid = fork();
+    if(pid < 0){
+        LOG_ERROR("%s checkpoint fork fail\n", path);
+        return -1;
+    }
+    if(pid == 0){
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = fd >= 0 && writeSnapshot(fd, withData) && fsync(fd) == 0;
+        ok = ok && close(fd) == 0 && rename(tmp.c_str(), path) == 0;
+        _exit(ok ? 0 : 1);
+    }
+    snapPid = pid;
+    return 0;
+}
+
+bool SessMgr::reapSnapshot(bool wait){
+    if(snapPid == 0){
+        return true;
+    }
+    int status = 0;
+    pid_t pid = waitpid(snapPid, &status, wait ? 0 : WNOHANG);
+    if(pid == 0){
+        return false;
+    }
+    if(pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        LOG_ERROR("%s checkpoint fail\n", snapPath.c_str());
+    }else{
+        LOG_INFO("%s checkpoint written\n", snapPath.c_str());
+    }
+    snapPid = 0;
+    return true;
+}
+
+bool SessMgr::writeSnapshot(int fd, bool withData){
+    SnapWriter out(fd);
+    SnapHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAP_MAGIC, sizeof(header.magic));
+    header.version = SNAP_VERSION;
+    header.flags = withData ? SNAP_FLAG_DATA : 0;
+    header.shard = (shardId >= 0) ? shardId : 0;
+    header.shardNum = shardNum;
+    header.tupleSize = sizeof(NetTuple5);
+    header.tcpMetricsSize = sizeof(TcpMetrics);
+    header.stateSize = sizeof(SessHandlers::State);
+    hashCalc.GetKey(header.hashKey);
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    header.createdUs = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    out.write(&header, sizeof(header));
+
+    for(auto sessMap : {&TCPSessMap, &UDPSessMap}){
+        for(auto i : *sessMap){
+            for(auto node : i.second->nodelist){
+                writeSnapNode(out, node, withData);
+                header.nodes++;
+            }
+        }
+    }
+    return out.rewrite(&header, sizeof(header));
+}
+
+void SessMgr::writeSnapNode(SnapWriter &out, SessionNode *node, bool withData){
+    // value-initialized: zero first, so the snapshot bytes carry no stack garbage
+    SnapNode rec = SnapNode();
+    rec.tuple = node->_tuple;
+    rec.numberPkt = node->numberPkt;
+    rec.datalen = node->datalen;
+    rec.firstTsUs = node->firstTsUs;
+    rec.lastTsUs = node->lastTsUs;
+    rec.pkts[Cli2Ser] = node->pkts[Cli2Ser];
+    rec.pkts[Ser2Cli] = node->pkts[Ser2Cli];
+    rec.bytes[Cli2Ser] = node->bytes[Cli2Ser];
+    rec.bytes[Ser2Cli] = node->bytes[Ser2Cli];
+    rec.tcpFlags = node->tcpFlags;
+    rec.sampleRate = node->sampleRate;
+    rec.asmMask = node->asmMask;
+    out.write(&rec, sizeof(rec));
+
+    if(node->pMetrics){
+        out.write(node->pMetrics, sizeof(TcpMetrics));
+    }
+    if(node->pState){
+        out.write(node->pState, sizeof(SessHandlers::State));
+    }
+
+    for(uint32_t d = 0; d < 2; d++){
+        if(!(node->asmMask & (1 << d))){
+            continue;
+        }
+        const AsmHot &hot = node->stream[d];
+        // no cold part yet, nothing buffered or matched
+        const AssemableInfo *info = node->pCold ? &node->pCold->asmInfo[d] : NULL;
+        SnapAsm state;
+        state.tcpState = hot.tcpState;
+        state.seq = hot.seq;
+        state.ackSeq = hot.ack_seq;
+        state.firstDataSeq = hot.first_data_seq;
+        state.count = hot.count;
+        state.offset = info ? info->offset : hot.count;
+        state.matchState = info ? info->matchState : 0;
+        // a truncated stream has buffered up to the limit only
+        uint32_t end = (hot.count < node->keepBytes) ? hot.count : node->keepBytes;
+        state.dataLen = (withData && info && info->data && end > info->offset) ? end - info->offset : 0;
+        out.write(&state, sizeof(state));
+        if(state.dataLen){
+            out.write(info->data, state.dataLen);
+        }
     }
 }
 
+int SessMgr::restore(const char *path){
+    SnapReader in;
+    if(in.open(path) != 0){
+        LOG_INFO("%s no checkpoint, cold start\n", path);
+        return -1;
+    }
+    SnapHeader header;
+    if(!in.read(&header, sizeof(header)) || memcmp(header.magic, SNAP_MAGIC, sizeof(header.magic)) != 0
+        || header.version != SNAP_VERSION){
+        LOG_ERROR("%s is not a session checkpoint\n", path);
+        return -1;
+    }
+    // raw structs only load into the layout that wrote them
+    if(header.tupleSize != sizeof(NetTuple5) || header.tcpMetricsSize != sizeof(TcpMetrics)
+        || header.stateSize != sizeof(SessHandlers::State)){
+        LOG_ERROR("%s written by another build, cold start\n", path);
+        return -1;
+    }
+    uint32_t shard = (shardId >= 0) ? shardId : 0;
+    if(header.shardNum != shardNum || header.shard != shard){
+        LOG_ERROR("%s is shard %u of %u, this is shard %u of %u, cold start\n", path,
+            header.shard, header.shardNum, shard, shardNum);
+        return -1;
+    }
+
+    // same keys, same slots and output file names as before the restart
+    hashCalc.SetKey(header.hashKey);
+    bool withData = header.flags & SNAP_FLAG_DATA;
+    for(uint64_t n = 0; n < header.nodes; n++){
+        if(!readSnapNode(in, withData)){
+            LOG_ERROR("%s truncated after %lu of %lu sessions\n", path, n, header.nodes);
+            return -1;
+        }
+    }
+    LOG_INFO("%s restored %lu sessions, checkpoint %lu s old\n", path, header.nodes,
+        (uint64_t)time(NULL) - header.createdUs / 1000000);
+    return 0;
+}
+
+bool SessMgr::readSnapNode(SnapReader &in, bool withData){
+    SnapNode rec;
+    if(!in.read(&rec, sizeof(rec))){
+        return false;
+    }
+    SessMap &sessMap = (rec.tuple.tranType == TranType_TCP) ? TCPSessMap : UDPSessMap;
+    uint32_t hashkey = rec.tuple.iHashValue;
+    if(sessMap.find(hashkey) == sessMap.end()){
+        if(rec.tuple.tranType == TranType_TCP){
+            tcpSession++;
+        }
+        sessMap[hashkey] = pool.slots.create(&pool);
+    }
+    HashSlot *slot = sessMap[hashkey];
+    SessionNode *node = pool.nodes.create(rec.tuple, &pool, &handlers, (rec.tuple.tranType == TranType_TCP) ? pScanner : NULL);
+    slot->nodelist.push_back(node);
+    slot->numNode++;
+    slot->numPkt += rec.numberPkt;
+
+    node->numberPkt = rec.numberPkt;
+    node->datalen = rec.datalen;
+    node->firstTsUs = rec.firstTsUs;
+    node->lastTsUs = rec.lastTsUs;
+    node->pkts[Cli2Ser] = rec.pkts[Cli2Ser];
+    node->pkts[Ser2Cli] = rec.pkts[Ser2Cli];
+    node->bytes[Cli2Ser] = rec.bytes[Cli2Ser];
+    node->bytes[Ser2Cli] = rec.bytes[Ser2Cli];
+    node->tcpFlags = rec.tcpFlags;
+    node->sampleRate = rec.sampleRate;
+    bool ok = true;
+    // the node was built from the tuple, so it has the same parts the writer had
+    if(node->pMetrics){
+        ok = in.read(node->pMetrics, sizeof(TcpMetrics));
+    }
+    if(node->pState){
+        ok = ok && in.read(node->pState, sizeof(SessHandlers::State));
+    }
+
+    for(uint32_t d = 0; ok && d < 2; d++){
+        if(!(rec.asmMask & (1 << d))){
+            continue;
+        }
+        SnapAsm state;
+        if(!in.read(&state, sizeof(state))){
+            return false;
+        }
+        AsmHot &hot = node->stream[d];
+        node->asmMask |= 1 << d;
+        hot.tcpState = state.tcpState;
+        hot.seq = state.seq;
+        hot.ack_seq = state.ackSeq;
+        hot.first_data_seq = state.firstDataSeq;
+        hot.count = state.count;
+        if(node->pCold){
+            // made for the client direction before this count was known
+            node->pCold->asmInfo[d].offset = hot.count;
+        }
+        if(state.matchState == 0 && (!withData || state.dataLen == 0)){
+            // nothing matched or buffered yet, the cold part waits for the next payload
+            continue;
+        }
+        // the regex cursor names a dfa state of the old process, the stream restarts its rules
+        AssemableInfo *info = &node->getCold()->asmInfo[d];
+        info->matchState = state.matchState;
+        if(withData && state.dataLen > 0){
+            info->offset = state.offset;
+            info->bufsize = state.dataLen;
+            info->data = new char[state.dataLen];
+            ok = in.read(info->data, state.dataLen);
+        }
+    }
+    return ok;
+}
+
 uint32_t SessMgr::getMapCount() const{
     return 0;
 }
 
-void SessMgr::feedPkt(const struct pcap_pkthdr *packet_header, const unsigned char *packet_content){
+void SessMgr::countProbe(Packet *packet){
+    // tcp: only the opening syn, answers and established traffic say nothing about who probes whom
+    if(packet->tcp && !(packet->isSyn() && !packet->isAck())){
+        return;
+    }
+    // tuple5 has the low port as server, the sender is whoever the packet came from
+    const NetTuple5 &t = packet->tuple5;
+    bool fromCli = (packet->direct == Cli2Ser);
+    uint32_t src = fromCli ? t.saddr : t.daddr;
+    uint32_t dst = fromCli ? t.daddr : t.saddr;
+    uint16_t dstPort = fromCli ? t.dport : t.sport;
+    pSrcPerDst->update(dst, src, packet->getTsUs());
+    pDstPerSrc->update(src, ((uint64_t)dst << 16) | dstPort, packet->getTsUs());
+}
+
+void SessMgr::feedPkt(const struct pcap_pkthdr *packet_header, const unsigned char *packet_content, uint32_t sampleRate){
+    // a mirrored copy would be reassembled twice and counted as a retransmission
+    if(pDedup && pDedup->isDuplicate(packet_header, packet_content)){
+        return;
+    }
     allPktnum++;
     LOG_DEBUG("\n\n",allPktnum);
     LOG_DEBUG("No.%d\n",allPktnum);
     // parse Packet
     Packet *packet = new Packet(packet_content,packet_header->caplen);
     if(packet){
+        packet->ts = packet_header->ts;
+        packet->wirelen = packet_header->len;
+        packet->sampleRate = sampleRate;
         auto hashkey = hashCalc.CalcHashValue(packet->tuple5);
         packet->tuple5.iHashValue = hashkey;
+        if(packet->tuple5.tranType != TranType_NULL){
+            pSketch->update(packet->tuple5, packet_header->len, packet->getTsUs());
+            if(pCube){
+                pCube->update(packet->tuple5, packet_header->len, packet->getTsUs());
+            }
+            countProbe(packet);
+        }
 
         if(packet->tuple5.tranType == TranType_TCP){
             tcpPktNum++;
             if(TCPSessMap.find(hashkey) == TCPSessMap.end()){
                 tcpSession++;
-                TCPSessMap[hashkey] = new HashSlot();
+                TCPSessMap[hashkey] = pool.slots.create(&pool);
             }
-            TCPSessMap[hashkey]->process(packet);
+            SessionNode *node = TCPSessMap[hashkey]->process(packet, &handlers, pScanner);
+            if(pPcap && node){
+                pPcap->write(node->pcapFile, node->_tuple, packet_header, packet_content, node->frameKeep(packet));
+            }
+        }else if(packet->tuple5.tranType == TranType_UDP && DnsAnalyzer::isDns(packet)){
+            // one SessionNode per dns 5-tuple does not scale, transactions are matched in place
+            udpPktNum++;
+            dnsPktNum++;
+            dnsAnalyzer.process(packet);
         }else if(packet->tuple5.tranType == TranType_UDP){
             udpPktNum++;
             if(UDPSessMap.find(hashkey) == UDPSessMap.end()){
-                UDPSessMap[hashkey] = new HashSlot();
+                UDPSessMap[hashkey] = pool.slots.create(&pool);
+            }
+            SessionNode *node = UDPSessMap[hashkey]->process(packet, &handlers);
+            if(pPcap && node){
+                pPcap->write(node->pcapFile, node->_tuple, packet_header, packet_content, node->frameKeep(packet));
             }
-            UDPSessMap[hashkey]->process(packet);
         }else{
             otherPktNum++;
         }
 
+        if(++sweepTick % SESS_SWEEP_PKTS == 0){
+            sweep(TCPSessMap, sweepKey[0], packet->getTsUs());
+            sweep(UDPSessMap, sweepKey[1], packet->getTsUs());
+        }
         delete packet;
     }else{
         LOG_DEBUG("create new Packet fail\n");
@@ -104,23 +585,56 @@ static void printPacket(Packet *packet){
     }
 }
 
-SessionNode::SessionNode(Packet *pkt):_tuple(pkt->tuple5),numberPkt(0),datalen(0){
-    fd = fopen(_tuple.getName().c_str(),"a");
-    if(fd == NULL){
-        LOG_DEBUG("fd create fail\n");
-    }
+SessionNode::SessionNode(Packet *pkt, SessPool *pool, SessHandlers *handlers, ContentScanner *scanner):_tuple(pkt->tuple5),numberPkt(0),datalen(0){
+    tcpFlags = 0;
+    asmMask = 0;
+    // a scan or syn flood carries no payload and gets no cold part
+    pCold = NULL;
+    firstTsUs = lastTsUs = pkt->getTsUs();
+    pkts[Cli2Ser] = pkts[Ser2Cli] = 0;
+    bytes[Cli2Ser] = bytes[Ser2Cli] = 0;
+    sampleRate = pkt->sampleRate;
+    pcapFile = 0;
+    keepBytes = pool->trunc ? pool->trunc->lookup(_tuple) : TRUNC_UNLIMITED;
+    pScanner = scanner;
+    pHandlers = handlers;
+    pPool = pool;
+    pState = SessHandlers::wantsAny(_tuple) ? pool->states.create() : NULL;
+    pMetrics = (_tuple.tranType == TranType_TCP) ? pool->metrics.create() : NULL;
+}
 
-    // judge client and server
-    pSessAsmInfo = new SessAsmInfo();
+SessionNode::SessionNode(const NetTuple5 &tuple, SessPool *pool, SessHandlers *handlers, ContentScanner *scanner):_tuple(tuple),numberPkt(0),datalen(0){
+    tcpFlags = 0;
+    asmMask = 0;
+    // the file of the session before the restart is appended to with the next payload
+    pCold = NULL;
+    firstTsUs = lastTsUs = 0;
+    pkts[Cli2Ser] = pkts[Ser2Cli] = 0;
+    bytes[Cli2Ser] = bytes[Ser2Cli] = 0;
+    sampleRate = 1;
+    pcapFile = 0;
+    keepBytes = pool->trunc ? pool->trunc->lookup(_tuple) : TRUNC_UNLIMITED;
+    pScanner = scanner;
+    pHandlers = handlers;
+    pPool = pool;
+    pState = SessHandlers::wantsAny(_tuple) ? pool->states.create() : NULL;
+    pMetrics = (_tuple.tranType == TranType_TCP) ? pool->metrics.create() : NULL;
 }
 
 SessionNode::~SessionNode(){
-    fclose(fd);
-
-    if(pSessAsmInfo){
-        delete pSessAsmInfo;
-        pSessAsmInfo = NULL;
+    if(pState){
+        pHandlers->onEnd(*pState, _tuple);
+        pPool->states.destroy(pState);
+        pState = NULL;
+    }
+    if(pMetrics){
+        pMetrics->report(_tuple.getName().c_str());
+        pPool->metrics.destroy(pMetrics);
+        pMetrics = NULL;
     }
+    // closes the file and frees the reassembly buffers
+    pPool->colds.destroy(pCold);
+    pCold = NULL;
 }
 
 bool SessionNode::match(NetTuple5 tuple){
@@ -131,40 +645,138 @@ bool SessionNode::match(NetTuple5 tuple){
 }
 
 void SessionNode::process(Packet *pkt){
-    assert(pSessAsmInfo != NULL);
     if(!pkt){
         return;
     }
 
-    if(pkt->isSyn()){
+    if(pkt->tcp && pkt->isSyn()){
         LOG_DEBUG("SYN Package\n");
     }
 
     printPacket(pkt);
     numberPkt++;
+    lastTsUs = pkt->getTsUs();
+    pkts[pkt->direct]++;
+    bytes[pkt->direct] += pkt->wirelen;
+    if(pkt->tcp){
+        tcpFlags |= pkt->tcp->flags;
+    }
 
     // first package
-    if( (pkt->direct == Cli2Ser && pSessAsmInfo->pClientAsmInfo == NULL) ||
-        (pkt->direct == Ser2Cli && pSessAsmInfo->pServerAsmInfo == NULL) ){
+    if(!(asmMask & (1 << pkt->direct))){
         CreateAsmInfo(pkt);
     }
 
+    // resolved at compile time, handlers not wanting the tuple cost a compare
+    if(pState){
+        pHandlers->onPacket(*pState, _tuple, pkt);
+    }
     if(_tuple.tranType == TranType_TCP){
+        pMetrics->onPacket(pkt);
         AssembPacket(pkt);
-    }else if(_tuple.tranType == TranType_UDP){
-        // fwrite(pkt->data,1,pkt->datalen,fd);
+    }else if(pkt->udp){
+        // not reassembled, counted for the truncation limit
+        stream[pkt->direct].count += pkt->getUdpDatalen();
     }
 }
 
-void SessionNode::CreateAsmInfo(Packet *packet){
-    AssemableInfo *info = NULL;
-    if(packet->direct == Cli2Ser){
-        pSessAsmInfo->pClientAsmInfo = new AssemableInfo();
-        info = pSessAsmInfo->pClientAsmInfo;
+uint32_t SessionNode::frameKeep(Packet *pkt){
+    if(keepBytes == TRUNC_UNLIMITED){
+        return UINT32_MAX;
+    }
+    uint32_t payload;
+    uint32_t before;            // stream bytes ahead of this packet's payload
+    if(pkt->tcp){
+        payload = pkt->getDatalen();
+        // a retransmission is placed by its seq, a first packet without syn may start below
+        int32_t off = (int32_t)(pkt->getSeq() - stream[pkt->direct].first_data_seq);
+        before = (off > 0) ? off : 0;
+    }else if(pkt->udp){
+        payload = pkt->getUdpDatalen();
+        before = stream[pkt->direct].count - payload;
     }else{
-        pSessAsmInfo->pServerAsmInfo = new AssemableInfo();
-        info = pSessAsmInfo->pServerAsmInfo;
+        return UINT32_MAX;
+    }
+    uint32_t head = pkt->datalen - payload;
+    uint32_t keep = (before < keepBytes) ? keepBytes - before : 0;
+    return head + ((payload < keep) ? payload : keep);
+}
+
+// application label from the server port, when no handler recognised the session
+static const char *sessionApp(const NetTuple5 &tuple){
+    switch(tuple.dport){
+    case 21:
+        return "ftp";
+    case 22:
+        return "ssh";
+    case 25:
+        return "smtp";
+    case 80:
+    case 8080:
+        return "http";
+    case 443:
+        return "tls";
+    case 445:
+        return "smb";
+    case 3306:
+        return "mysql";
+    default:
+        return (tuple.tranType == TranType_TCP) ? "tcp" : "udp";
+    }
+}
+
+void SessionNode::fillRecord(FlowRecord &rec){
+    rec.saddr = _tuple.saddr;
+    rec.daddr = _tuple.daddr;
+    rec.sport = _tuple.sport;
+    rec.dport = _tuple.dport;
+    rec.proto = _tuple.tranType;
+    rec.tcpFlags = tcpFlags;
+    rec.firstUs = firstTsUs;
+    rec.lastUs = lastTsUs;
+    rec.cliPkts = pkts[Cli2Ser];
+    rec.serPkts = pkts[Ser2Cli];
+    rec.cliBytes = bytes[Cli2Ser];
+    rec.serBytes = bytes[Ser2Cli];
+    if(_tuple.tranType == TranType_TCP){
+        rec.retrans = pMetrics->getRetransPkts();
+        rec.rttUs = pMetrics->getHandshakeRttUs();
+    }
+    rec.sampleRate = sampleRate;
+    rec.app = pState ? pHandlers->app(*pState, _tuple) : NULL;
+    if(rec.app == NULL){
+        rec.app = sessionApp(_tuple);
+    }
+}
+
+bool SessionNode::isExpired(uint64_t nowUs) const{
+    bool closed = (tcpFlags & RST_FLAG) || (stream[Cli2Ser].tcpState == TCP_FIN && stream[Ser2Cli].tcpState == TCP_FIN);
+    if(_tuple.tranType == TranType_TCP && closed){
+        return nowUs > lastTsUs + SESS_CLOSE_LINGER_US;
+    }
+    return nowUs > lastTsUs + ((_tuple.tranType == TranType_TCP) ? SESS_TCP_IDLE_US : SESS_UDP_IDLE_US);
+}
+
+SessCold *SessionNode::getCold(){
+    if(pCold){
+        return pCold;
+    }
+    pCold = pPool->colds.create();
+    // buffers start at the bytes still to come
+    pCold->asmInfo[Cli2Ser].offset = stream[Cli2Ser].count;
+    pCold->asmInfo[Ser2Cli].offset = stream[Ser2Cli].count;
+    if(pPool->payloadFiles){
+        pCold->fd = fopen(_tuple.getName().c_str(),"a");
+        if(pCold->fd == NULL){
+            LOG_DEBUG("fd create fail\n");
+        }
     }
+    return pCold;
+}
+
+void SessionNode::CreateAsmInfo(Packet *packet){
+    AsmHot *info = &stream[packet->direct];
+    asmMask |= 1 << packet->direct;
 
     // info could be clientInfo or serverInfo, set [first seq、 seq 、 ack]
     if( packet->tcp ){
@@ -189,14 +801,8 @@ void SessionNode::CreateAsmInfo(Packet *packet){
 int SessionNode::AssembPacket(Packet *packet){
     assert(packet->tuple5.tranType == TranType_TCP);
 
-    AssemableInfo *sender = NULL;
-    if(packet->direct == Cli2Ser){
-        assert(pSessAsmInfo->pClientAsmInfo);
-        sender = pSessAsmInfo->pClientAsmInfo;
-    }else{
-        assert(pSessAsmInfo->pServerAsmInfo);
-        sender = pSessAsmInfo->pServerAsmInfo;
-    }
+    assert(asmMask & (1 << packet->direct));
+    AsmHot *sender = &stream[packet->direct];
 
     // update TCP ack
     if(packet->getAck() > sender->ack_seq){
@@ -223,44 +829,70 @@ int SessionNode::AssembPacket(Packet *packet){
             // ! 判断数据包中是否有新的数据,去除重传数据,有可能出现负数
             int newDataLen = packet->getDatalen() - iReTranPktBufLen;
 	        if(newDataLen > 0){
-                if(newDataLen + sender->count - sender->offset > sender->bufsize){
-                    // not enough buffer
-                    uint32_t iAssembleBufLen = 0;
-                    if(!sender->data){
-                        if(newDataLen < 8192)	// 新的数据是否小于 8192 = 4K
-                        {
-                            iAssembleBufLen = 24576;	// 24576 = 8192*3
+                // past the truncation limit the bytes are only counted: no buffer, no copy, no match
+                int keep = 0;
+                if(sender->count < keepBytes){
+                    keep = ((uint32_t)newDataLen < keepBytes - sender->count) ? newDataLen : keepBytes - sender->count;
+                }
+                if(keep > 0){
+                    // buffers live in the cold part, only flows with payload get one
+                    AssemableInfo *buf = &getCold()->asmInfo[packet->direct];
+                    if(keep + sender->count - buf->offset > buf->bufsize){
+                        // not enough buffer
+                        uint32_t iAssembleBufLen = 0;
+                        if(!buf->data){
+                            if(keep < 8192)	// 新的数据是否小于 8192 = 4K
+                            {
+                                iAssembleBufLen = 24576;	// 24576 = 8192*3
+                            }else{
+                                iAssembleBufLen = keep * 3;
+                            }
                         }else{
-                            iAssembleBufLen = newDataLen * 3;
+                            //当前拼包缓存已经分配空间,但缓存空间不够,需要扩大缓存空间
+                            if ((uint32_t)keep < buf->bufsize)
+                            {
+                                iAssembleBufLen = 3 * (buf->bufsize);
+                            }else{
+                                iAssembleBufLen = (buf->bufsize) + 3*keep;
+                            }
+                        }
+                        // never more than the policy keeps
+                        if(keepBytes != TRUNC_UNLIMITED && iAssembleBufLen > keepBytes - buf->offset){
+                            iAssembleBufLen = keepBytes - buf->offset;
                         }
-                        sender->data = new char[iAssembleBufLen];		//预申请拼包缓存空间
-                        sender->bufsize = iAssembleBufLen;				//更新缓冲区长度
-                    }else{
-                        //当前拼包缓存已经分配空间,但缓存空间不够,需要扩大缓存空间
-                        if (newDataLen < sender->bufsize)
-                        {
-                            iAssembleBufLen = 3 * (sender->bufsize);
+                        if(!buf->data){
+                            buf->data = new char[iAssembleBufLen];		//预申请拼包缓存空间
                         }else{
-                            iAssembleBufLen = (sender->bufsize) + 3*newDataLen;
+                            // new 创建的内存不足，使用realloc重新创建可能会有问题
+                            char *tmpData = new char[iAssembleBufLen];
+                            memcpy(tmpData,buf->data,sender->count - buf->offset);    // copy origin data
+                            delete []buf->data;
+                            buf->data = tmpData;
                         }
-                        // new 创建的内存不足，使用realloc重新创建可能会有问题
-                        char *tmpData = new char[iAssembleBufLen];
-                        memcpy(tmpData,sender->data,sender->count - sender->offset);    // copy origin data
-                        delete []sender->data;
-                        sender->data = tmpData;
-                        sender->bufsize = iAssembleBufLen;
+                        buf->bufsize = iAssembleBufLen;				//更新缓冲区长度
                     }
+                    LOG_DEBUG("new data [%d]\n",keep);
+                    // payload, not the frame: the copy used to start at the ethernet header
+                    const Byte *newData = packet->getTcpData() + iReTranPktBufLen;
+                    memcpy(buf->data+sender->count-buf->offset, newData, keep);//根据seq偏移,进行报文拼包
+                    if(pScanner){
+                        // only new in order bytes, the automaton state carries over to the next segment
+                        pScanner->scan(_tuple, packet->direct, buf, sender->count, newData, keep);
+                    }
+                    if(pState){
+                        pHandlers->onData(*pState, _tuple, packet->direct, newData, keep);
+                    }
+                    buf->count_new = keep;     //最新增加的数据长度
                 }
-                LOG_DEBUG("new data [%d]\n",newDataLen);
-                memcpy(sender->data+sender->count-sender->offset, packet->data+iReTranPktBufLen, newDataLen);//根据seq偏移,进行报文拼包
-                sender->count_new = newDataLen;     //最新增加的数据长度
                 sender->count += newDataLen;
+                pMetrics->onNewData(packet, newDataLen);
             }else{
                 // TODO 重传数据包
-
+                pMetrics->onRetrans(packet);
             }
         }else{
             // TODO get disorder pkg
+            pMetrics->onDisorder(packet);
             LOG_DEBUG("GET disorder package seq[%u] but expect seq[%u]\n",packet->getSeq(),sender->getExcept());
         }
     }else{
@@ -270,29 +902,31 @@ int SessionNode::AssembPacket(Packet *packet){
 }
 
 //=================================================================================
-HashSlot::HashSlot(){
+HashSlot::HashSlot(SessPool *pool):nodelist(NodeList::allocator_type(pool->arena)){
     numNode = 0;
     numPkt = 0;
+    pPool = pool;
 }
 
 HashSlot::~HashSlot(){
     for(auto node: nodelist){
-        delete node;
+        pPool->nodes.destroy(node);
     }
 }
 
 // packet into the right hashkey Session process
-void HashSlot::process(Packet *packet){
+SessionNode *HashSlot::process(Packet *packet, SessHandlers *handlers, ContentScanner *scanner){
     numPkt++;
     auto node = match(packet->tuple5);   // traverse to find correct Session Node
     if(node == NULL){
         // can't find node, create new one and put into nodelist
-        node = createSessionNode(packet);
+        node = createSessionNode(packet, handlers, scanner);
     }
     // process pkt and delete
     if(node){
         node->process(packet);
     }
+    return node;
 }
 
 SessionNode *HashSlot::match(NetTuple5 tuple){
@@ -304,9 +938,9 @@ SessionNode *HashSlot::match(NetTuple5 tuple){
     return NULL;
 }
 
-SessionNode *HashSlot::createSessionNode(Packet *pkt){
+SessionNode *HashSlot::createSessionNode(Packet *pkt, SessHandlers *handlers, ContentScanner *scanner){
     numNode++;
-    auto node = new SessionNode(pkt);
+    auto node = pPool->nodes.create(pkt, pPool, handlers, scanner);
     if(node){
         nodelist.push_back(node);
     }else{
@@ -314,3 +948,21 @@ SessionNode *HashSlot::createSessionNode(Packet *pkt){
     }
     return node;
 }
+
+//=================================================================================
+SessPool::SessPool(uint32_t capacity, HugeArena *arena):arena(arena),slots(arena->getNode()),nodes(arena->getNode()),
+    colds(arena->getNode()),metrics(arena->getNode()),states(arena->getNode()){
+    payloadFiles = true;
+    trunc = NULL;
+    // hugetlbfs pages are taken from the pool here, other pages only as sessions arrive
+    slots.reserve(capacity);
+    nodes.reserve(capacity);
+    colds.reserve(capacity);
+    metrics.reserve(capacity);
+}
+
+void SessPool::report(const char *name) const{
+    LOG_INFO("%s session pool peak %lu of %lu nodes, %lu with payload, %lu tcp, %lu with handler state, %lu of %lu slots\n",
+        name, nodes.getPeak(), nodes.getCapacity(), colds.getPeak(), metrics.getPeak(), states.getPeak(), slots.getPeak(),
+        slots.getCapacity());
+}
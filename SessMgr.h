@@ -5,6 +5,21 @@
 #include <list>
 
 #include "HashCalc.h"
+#include "CardinalityTracker.h"
+#include "DnsAnalyzer.h"
+#include "FlowColumn.h"
+#include "FlowPcap.h"
+#include "FlowSketch.h"
+#include "HugeMem.h"
+#include "IpfixExporter.h"
+#include "ContentScanner.h"
+#include "PktDedup.h"
+#include "SessSnapshot.h"
+#include "ShardMerger.h"
+#include "SessHandlers.h"
+#include "TcpMetrics.h"
+#include "TrafficCube.h"
+#include "TruncPolicy.h"
 #include "Packet.h"
 #include "Log.h"
 #include "StructDefine.h"
@@ -13,12 +28,40 @@
 //        1:n     1:n
 //    std::map   std::list
 
+class HashSlot;
+class SessionNode;
+struct SessPool;
+
+// session tables, map and list nodes come from the SessMgr's hugepage arena
+typedef std::map<uint32_t, HashSlot *, std::less<uint32_t>, ArenaAllocator<std::pair<const uint32_t, HashSlot *> > > SessMap;
+typedef std::list<SessionNode *, ArenaAllocator<SessionNode *> > NodeList;
+
 // packet process flow
 // SessMgr::feedPkt -> HashSlot::process -> SessionNode::process
 
-class SessionNode{
+// 会话在抓包过程中就结束: 双向 FIN 或 RST 后静默 SESS_CLOSE_LINGER_US, 或空闲超时 (包时间),
+// 写出流记录, 不等待地交给 exporter, 输出 TCP 指标, 结构还给 SessPool;
+// feedPkt 每 SESS_SWEEP_PKTS 个包从上次的位置往后看 SESS_SWEEP_SLOTS 个哈希槽
+const uint64_t SESS_TCP_IDLE_US = 300000000;
+const uint64_t SESS_UDP_IDLE_US = 60000000;
+const uint64_t SESS_CLOSE_LINGER_US = 2000000;      // the last ack and stray retransmissions still land in the session
+const uint32_t SESS_SWEEP_PKTS = 64;
+const uint32_t SESS_SWEEP_SLOTS = 128;
+
+// SessionNode 按访问频率排布, 对象从 SlabPool 里按 cache line 对齐切出:
+//   热区   第一个 cache line, 五元组和两个方向的序号, 匹配和每个包都只碰这一行
+//   温区   计数器和时间戳, 紧跟在后面
+//   冷区   输出文件和拼包缓存, 第一个载荷到来时才从池里分配
+//   协议处理器状态和 TCP 指标按协议单独从池里分配, UDP 没有 TCP 指标, 没有处理器要的流没有处理器状态
+const uint32_t SESS_HOT_BYTES = 64;
+
+class alignas(SESS_HOT_BYTES) SessionNode{
 public:
-    SessionNode(Packet *pkt);
+    // pool: the SessMgr's session structures, handlers: its protocol handler chain
+    SessionNode(Packet *pkt, SessPool *pool, SessHandlers *handlers, ContentScanner *scanner = NULL);
+
+    // restored from a snapshot, counters are filled in by the caller
+    SessionNode(const NetTuple5 &tuple, SessPool *pool, SessHandlers *handlers, ContentScanner *scanner);
 
     ~SessionNode();
 
@@ -28,54 +71,206 @@ public:
 
     void CreateAsmInfo(Packet *packet);
 
+    // cold part, allocated and the file opened on first use
+    SessCold *getCold();
+
     int AssembPacket(Packet *packet);
 
-    SessAsmInfo *pSessAsmInfo;
-    uint32_t numberPkt;
+    // frame bytes of pkt worth keeping: its headers and the payload within keepBytes; after process
+    uint32_t frameKeep(Packet *pkt);
+
+    // summary row for the flow record file
+    void fillRecord(FlowRecord &rec);
+
+    // closed and quiet for the linger, or idle; nowUs is packet time
+    bool isExpired(uint64_t nowUs) const;
+
+    // hot
     NetTuple5 _tuple;
+    AsmHot stream[2];           // indexed by Direct
+    uint8_t tcpFlags;
+    uint8_t asmMask;            // 1 client stream started, 2 server
+    SessCold *pCold;            // NULL until the first payload
+
+    // warm
+    uint32_t numberPkt;
     uint32_t datalen;
-    FILE *fd;                   // for saving packet data into file
+    uint64_t firstTsUs;
+    uint64_t lastTsUs;
+    uint32_t pkts[2];           // indexed by Direct
+    uint64_t bytes[2];          // wire bytes, indexed by Direct
+    uint32_t sampleRate;        // of the first packet
+    uint32_t pcapFile;          // FlowPcapWriter file, 0 until the first packet is written
+    uint32_t keepBytes;         // payload kept per direction, the rest is only counted
+    ContentScanner *pScanner;   // not owned, NULL when payloads are not matched
+    SessHandlers *pHandlers;    // not owned
+    SessPool *pPool;            // not owned
+    SessHandlers::State *pState;        // one part per protocol handler, NULL when no handler wants the session
+    TcpMetrics *pMetrics;       // tcp only, NULL otherwise
 };
 
+static_assert(sizeof(NetTuple5) + 2 * sizeof(AsmHot) + 2 + sizeof(SessCold *) <= SESS_HOT_BYTES,
+    "SessionNode hot fields outgrew the first cache line");
+
 // session use to recombine TCP stream
 class HashSlot{
 public:
-    HashSlot();
+    HashSlot(SessPool *pool);
 
     ~HashSlot();
 
-    // packet into the right hashkey Session process
-    void process(Packet *packet);
+    // packet into the right hashkey Session process, returns the session that took it
+    SessionNode *process(Packet *packet, SessHandlers *handlers, ContentScanner *scanner = NULL);
 
     SessionNode *match(NetTuple5 tuple);
 
-    SessionNode *createSessionNode(Packet *pkt);
+    SessionNode *createSessionNode(Packet *pkt, SessHandlers *handlers, ContentScanner *scanner);
     
     uint32_t numNode;
     uint32_t numPkt;
-    std::list<SessionNode *> nodelist;
+    NodeList nodelist;
+    SessPool *pPool;            // not owned
+};
+
+/*
+ *@brief 每个 SessMgr 一套会话结构的对象池, 新建流只是从空闲链取对象, 扫描和 SYN 洪水不再打到 malloc 上
+ *  按会话表容量预留地址空间, 超出后按 slab 增长
+ */
+struct SessPool{
+    SessPool(uint32_t capacity, HugeArena *arena);
+
+    // peak use against the reservation, once at the end
+    void report(const char *name) const;
+
+    HugeArena *arena;           // not owned, NodeList nodes
+    SlabPool<HashSlot> slots;
+    SlabPool<SessionNode> nodes;
+    SlabPool<SessCold> colds;           // sessions that carried payload
+    SlabPool<TcpMetrics> metrics;       // tcp sessions
+    SlabPool<SessHandlers::State> states;   // sessions some protocol handler wants
+    bool payloadFiles;                  // the per-session .out file, off when sessions go to pcaps
+    const TruncPolicy *trunc;           // not owned, NULL keeps every payload byte
 };
 
 class SessMgr{
 public:
-    SessMgr(uint32_t hashnum);
+    // numaNode: tables are placed on it, -1 for anywhere
+    SessMgr(uint32_t hashnum, int numaNode = -1);
 
     ~SessMgr();
 
-    void feedPkt(const struct pcap_pkthdr *packet_header, const unsigned char *packet_content);
+    // sampleRate: the flow was kept by FlowSampler at 1 in sampleRate
+    void feedPkt(const struct pcap_pkthdr *packet_header, const unsigned char *packet_content, uint32_t sampleRate = 1);
 
     uint32_t getMapCount() const;
 
+    // sharded mode, interval statistics are merged across shards
+    void setMerger(ShardMerger *merger, uint32_t shard);
+
+    // finished sessions are also exported, producer is this SessMgr's queue
+    void setExporter(IpfixExporter *exporter, uint32_t producer);
+
+    // match reassembled tcp payload against patterns and regex rules, either may be NULL,
+    // both are shared read only
+    void setMatcher(const PatternMatcher *matcher, const RegexSet *rules);
+
+    // drop mirrored copies of a packet seen within windowUs, before any parsing
+    void setDedup(uint64_t windowUs);
+
+    // bytes and packets per time bin and spec's dimensions; sharded cubes go to merger
+    void setCube(const CubeSpec &spec, CubeMerger *merger = NULL);
+
+    // every session's packets to its own pcap, at most maxOpen files open at once;
+    // sharded writers share flusher, producer is the shard
+    void setFlowPcap(uint32_t maxOpen, PcapFlusher *flusher = NULL);
+
+    // keep only the payload bytes policy allows per session direction, shared read only
+    void setTruncPolicy(const TruncPolicy *policy){
+        pool.trunc = policy;
+    }
+
+    // live sessions to path, written by a forked child so capture goes on; background false
+    // writes in place. withData also saves the reassembly buffers. 0 when written or started
+    int checkpoint(const char *path, bool withData, bool background = true);
+
+    // sessions of a snapshot taken by the same build, before the first packet; 0 on success
+    int restore(const char *path);
+
+    // sessions still open at destruction are carried by the last snapshot, no flow record for them
+    void setCarryOver(bool on){
+        carryOver = on;
+    }
+
+    // heavy hitters of the current interval, valid while capturing
+    FlowSketch *getSketch() const{
+        return pSketch;
+    }
+
 private:
-    std::map<uint32_t,HashSlot *> TCPSessMap;
-    std::map<uint32_t,HashSlot *> UDPSessMap;
+    // sessions of the map end, one flow record each to the file and the exporter
+    void writeRecords(SessMap &sessMap);
+
+    // flow record of node to the file and the exporter; wait: block on a full export queue
+    void writeRecord(SessionNode *node, bool wait);
+
+    // the next SESS_SWEEP_SLOTS slots of sessMap after cursor, expired sessions are closed
+    void sweep(SessMap &sessMap, uint32_t &cursor, uint64_t nowUs);
+
+    // an ended session while capturing: record without waiting, then back to the pool
+    void closeSession(SessionNode *node);
+
+    // truncation totals of a tcp session
+    void countKept(SessionNode *node);
+
+    // scan and flood cardinalities, by the real sender and receiver of the packet
+    void countProbe(Packet *packet);
+
+    // snapshot body, runs in the forked child: no malloc, no log
+    bool writeSnapshot(int fd, bool withData);
+
+    void writeSnapNode(SnapWriter &out, SessionNode *node, bool withData);
+
+    bool readSnapNode(SnapReader &in, bool withData);
+
+    // collect the snapshot child, false while it is still writing
+    bool reapSnapshot(bool wait);
+
+    int numaNode;
+    HugeArena *pArena;              // before the maps, they allocate from it
+    SessPool pool;                  // HashSlot, SessionNode and their reassembly state
+    SessMap TCPSessMap;
+    SessMap UDPSessMap;
 
     HashCalc hashCalc;
+    DnsAnalyzer dnsAnalyzer;        // dns does not go through UDPSessMap
+    SessHandlers handlers;          // protocol handlers of this shard's sessions
+    FlowSketch *pSketch;            // top-K bytes per flow/server/client
+    CardinalityTracker *pSrcPerDst; // distinct sources per destination, syn flood
+    CardinalityTracker *pDstPerSrc; // distinct destination ip:port per source, scan
+    FlowColumnWriter *pRecords;     // columnar flow records, opened with the first row
+    std::string recordPath;
+    IpfixExporter *pExporter;       // not owned, NULL when not exporting
+    uint32_t exportProducer;
+    PktDedup *pDedup;               // NULL when duplicates are kept
+    TrafficCube *pCube;             // NULL when not aggregating
+    FlowPcapWriter *pPcap;          // NULL when sessions are not written as pcaps
+    ContentScanner *pScanner;       // NULL when payloads are not matched
+    int shardId;                    // -1 unless sharded
+    uint32_t shardNum;
+    pid_t snapPid;                  // checkpoint child, 0 when none
+    std::string snapPath;
+    bool carryOver;
+    uint32_t sweepTick;
+    uint32_t sweepKey[2];           // next slot to look at, tcp and udp
+    uint64_t expiredNum;
+    uint64_t keptBytes;             // tcp payload bytes kept and seen, of closed sessions
+    uint64_t streamBytes;
 
     int allPktnum;
     int noethNum;
     int tcpPktNum;
     int udpPktNum;
+    int dnsPktNum;
     int otherPktNum;
     int tcpSession;
     int tcpSessionNode;
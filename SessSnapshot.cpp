@@ -0,0 +1,74 @@
+#include "SessSnapshot.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+SnapWriter::SnapWriter(int fd){
+    this->fd = fd;
+    ok = true;
+    used = 0;
+}
+
+void SnapWriter::write(const void *data, uint32_t len){
+    const char *p = (const char *)data;
+    while(len > 0){
+        if(used == SNAP_BUF_SIZE){
+            flush();
+        }
+        uint32_t n = SNAP_BUF_SIZE - used;
+        if(n > len){
+            n = len;
+        }
+        memcpy(buf + used, p, n);
+        used += n;
+        p += n;
+        len -= n;
+    }
+}
+
+bool SnapWriter::flush(){
+    uint32_t done = 0;
+    while(ok && done < used){
+        ssize_t n = ::write(fd, buf + done, used - done);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            ok = false;
+            break;
+        }
+        done += n;
+    }
+    used = 0;
+    return ok;
+}
+
+bool SnapWriter::rewrite(const void *data, uint32_t len){
+    if(!flush()){
+        return false;
+    }
+    if(pwrite(fd, data, len, 0) != (ssize_t)len){
+        ok = false;
+    }
+    return ok;
+}
+
+SnapReader::SnapReader(){
+    fp = NULL;
+}
+
+SnapReader::~SnapReader(){
+    if(fp){
+        fclose(fp);
+    }
+}
+
+int SnapReader::open(const char *path){
+    fp = fopen(path, "rb");
+    return fp ? 0 : -1;
+}
+
+bool SnapReader::read(void *data, uint32_t len){
+    return len == 0 || fread(data, len, 1, fp) == 1;
+}
@@ -0,0 +1,107 @@
+#ifndef SESS_SNAPSHOT_H
+#define SESS_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#include "StructDefine.h"
+
+// 会话表快照: 活动会话的五元组, TCP 状态, 序号, 计数器和可选的拼包缓存
+// 写在 fork 出的子进程里, 父子进程共享写时复制的内存, 抓包路径不暂停;
+// 先写 path.tmp 再 rename, 中途退出不会留下半个快照
+//
+//   SnapHeader | SnapNode [TcpMetrics] [SessHandlers::State] [SnapAsm [data]] x2 | ...
+//   TcpMetrics 只有 TCP 会话有, 处理器状态只有有处理器要的会话有, 都由五元组决定
+//
+// 字段按本机字节序原样保存, 只给同一个程序的下次启动用, 结构大小不符时拒绝加载
+
+const char SNAP_MAGIC[8] = {'S', 'E', 'S', 'S', 'N', 'A', 'P', '1'};
+const uint32_t SNAP_VERSION = 3;
+const uint32_t SNAP_BUF_SIZE = 65536;           // write buffer, on the child's stack
+const uint32_t SNAP_FLAG_DATA = 1;              // reassembly buffers saved
+const uint64_t SNAPSHOT_INTERVAL_US = 60000000; // periodic checkpoint
+
+#pragma pack(1)
+
+struct SnapHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t shard;
+    uint32_t shardNum;
+    uint32_t tupleSize;
+    uint32_t tcpMetricsSize;
+    uint32_t stateSize;         // protocol handler state per session
+    uint8_t hashKey[24];
+    uint64_t createdUs;
+    uint64_t nodes;             // rewritten once every node is out
+};
+
+struct SnapNode{
+    NetTuple5 tuple;
+    uint32_t numberPkt;
+    uint32_t datalen;
+    uint64_t firstTsUs;
+    uint64_t lastTsUs;
+    uint32_t pkts[2];
+    uint64_t bytes[2];
+    uint8_t tcpFlags;
+    uint32_t sampleRate;
+    uint8_t asmMask;            // 1 client AssemableInfo follows, 2 server
+};
+
+struct SnapAsm{
+    uint8_t tcpState;
+    uint32_t seq;
+    uint32_t ackSeq;
+    uint32_t firstDataSeq;
+    uint32_t count;
+    uint32_t offset;
+    uint32_t matchState;
+    uint32_t dataLen;           // buffered bytes that follow, 0 without SNAP_FLAG_DATA
+};
+
+#pragma pack()
+
+/*
+ *@brief 快照输出, 只用 write(2), 不分配内存也不写日志, fork 后的子进程可以安全使用
+ */
+class SnapWriter{
+public:
+    SnapWriter(int fd);
+
+    void write(const void *data, uint32_t len);
+
+    // false when any write failed
+    bool flush();
+
+    // header again at the front once the node count is known
+    bool rewrite(const void *data, uint32_t len);
+
+private:
+    int fd;
+    bool ok;
+    uint32_t used;
+    char buf[SNAP_BUF_SIZE];
+};
+
+/*
+ *@brief 快照读取, 在启动时使用
+ */
+class SnapReader{
+public:
+    SnapReader();
+
+    ~SnapReader();
+
+    int open(const char *path);
+
+    // false on a short read
+    bool read(void *data, uint32_t len);
+
+private:
+    FILE *fp;
+};
+
+#endif //SESS_SNAPSHOT_H
@@ -0,0 +1,98 @@
+#include "ShardMerger.h"
+#include <assert.h>
+#include "Log.h"
+
+ShardMerger::ShardMerger(uint32_t shards){
+    shardNum = shards;
+    sketchDone.assign(shards, 0);
+    for(uint32_t i = 0; i < MERGER_CARD_SLOTS; i++){
+        cardDone[i].assign(shards, 0);
+    }
+    sketchFd = NULL;
+}
+
+ShardMerger::~ShardMerger(){
+    flush();
+    if(sketchFd){
+        fclose(sketchFd);
+    }
+}
+
+uint64_t ShardMerger::minDone(const std::vector<uint64_t> &done){
+    uint64_t low = done[0];
+    for(uint32_t i = 1; i < done.size(); i++){
+        if(done[i] < low){
+            low = done[i];
+        }
+    }
+    return low;
+}
+
+void ShardMerger::addSketch(uint32_t shard, uint64_t startUs, const FlowSketch &sketch){
+    std::lock_guard<std::mutex> lock(mutex_);
+    FlowSketch *&acc = sketchPending[startUs];
+    if(acc == NULL){
+        acc = new FlowSketch();
+    }
+    acc->merge(sketch);
+    sketchDone[shard] = startUs;
+
+    // a shard that stopped seeing packets must not hold reports back forever
+    uint64_t upto = minDone(sketchDone);
+    if(sketchPending.size() > MERGER_MAX_PENDING){
+        upto = sketchPending.rbegin()->first - 1;
+    }
+    reportSketch(upto);
+}
+
+void ShardMerger::addCardinality(uint32_t shard, uint32_t slot, uint64_t startUs, const CardinalityTracker &tracker){
+    assert(slot < MERGER_CARD_SLOTS);
+    std::lock_guard<std::mutex> lock(mutex_);
+    CardinalityTracker *&acc = cardPending[slot][startUs];
+    if(acc == NULL){
+        acc = new CardinalityTracker(tracker.getName(), tracker.getThreshold());
+    }
+    acc->merge(tracker);
+    cardDone[slot][shard] = startUs;
+
+    uint64_t upto = minDone(cardDone[slot]);
+    if(cardPending[slot].size() > MERGER_MAX_PENDING){
+        upto = cardPending[slot].rbegin()->first - 1;
+    }
+    reportCardinality(slot, upto);
+}
+
+void ShardMerger::reportSketch(uint64_t upto){
+    while(!sketchPending.empty() && sketchPending.begin()->first <= upto){
+        FlowSketch *acc = sketchPending.begin()->second;
+        if(sketchFd == NULL){
+            sketchFd = fopen(SKETCH_REPORT_FILE, "a");
+            if(sketchFd == NULL){
+                LOG_DEBUG("fd create fail\n");
+            }
+        }
+        if(sketchFd){
+            acc->write(sketchFd);
+        }
+        delete acc;
+        sketchPending.erase(sketchPending.begin());
+    }
+}
+
+void ShardMerger::reportCardinality(uint32_t slot, uint64_t upto){
+    std::map<uint64_t, CardinalityTracker *> &pending = cardPending[slot];
+    while(!pending.empty() && pending.begin()->first <= upto){
+        CardinalityTracker *acc = pending.begin()->second;
+        acc->checkAlerts();
+        delete acc;
+        pending.erase(pending.begin());
+    }
+}
+
+void ShardMerger::flush(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    reportSketch(UINT64_MAX);
+    for(uint32_t i = 0; i < MERGER_CARD_SLOTS; i++){
+        reportCardinality(i, UINT64_MAX);
+    }
+}
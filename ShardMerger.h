@@ -0,0 +1,56 @@
+#ifndef SHARD_MERGER_H
+#define SHARD_MERGER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "CardinalityTracker.h"
+#include "FlowSketch.h"
+
+// 多个 SessMgr shard 的统计合并: 每个 shard 结束一个区间后把 sketch 交过来,
+// 所有 shard 都越过该区间后合并结果统一输出
+
+const uint32_t MERGER_CARD_SLOTS = 2;           // cardinality trackers per shard
+const uint32_t MERGER_MAX_PENDING = 16;         // intervals kept waiting for idle shards
+
+class ShardMerger{
+public:
+    explicit ShardMerger(uint32_t shards);
+
+    ~ShardMerger();
+
+    // shard finished the sketch interval starting at startUs
+    void addSketch(uint32_t shard, uint64_t startUs, const FlowSketch &sketch);
+
+    // shard finished the cardinality window starting at startUs
+    void addCardinality(uint32_t shard, uint32_t slot, uint64_t startUs, const CardinalityTracker &tracker);
+
+    // report every pending interval, shards must be done
+    void flush();
+
+    uint32_t getShardNum() const{
+        return shardNum;
+    }
+
+private:
+    void reportSketch(uint64_t upto);
+
+    void reportCardinality(uint32_t slot, uint64_t upto);
+
+    static uint64_t minDone(const std::vector<uint64_t> &done);
+
+    std::mutex mutex_;
+    uint32_t shardNum;
+
+    std::vector<uint64_t> sketchDone;                   // per shard, last interval handed in
+    std::map<uint64_t, FlowSketch *> sketchPending;
+    FILE *sketchFd;
+
+    std::vector<uint64_t> cardDone[MERGER_CARD_SLOTS];
+    std::map<uint64_t, CardinalityTracker *> cardPending[MERGER_CARD_SLOTS];
+};
+
+#endif //SHARD_MERGER_H
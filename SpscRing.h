@@ -0,0 +1,79 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <atomic>
+#include <sched.h>
+
+#include "HugeMem.h"
+
+// 单生产者单消费者无锁环形队列, 容量必须是 2 的幂
+template<typename T>
+class SpscRing{
+public:
+    // node: numa node of the consumer, -1 for anywhere
+    explicit SpscRing(uint32_t capacity, int node = -1){
+        mask = capacity - 1;
+        buf = hugeNewArray<T>(capacity, node);
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    ~SpscRing(){
+        hugeDeleteArray(buf, mask + 1);
+    }
+
+    bool push(const T &item){
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) > mask){
+            return false;
+        }
+        buf[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item){
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if(h == tail.load(std::memory_order_acquire)){
+            return false;
+        }
+        item = buf[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // spin a little, then give the cpu away
+    void pushWait(const T &item){
+        uint32_t spin = 0;
+        while(!push(item)){
+            if(++spin > 64){
+                sched_yield();
+            }
+        }
+    }
+
+    void popWait(T &item){
+        uint32_t spin = 0;
+        while(!pop(item)){
+            if(++spin > 64){
+                sched_yield();
+            }
+        }
+    }
+
+    uint32_t size() const{
+        return (uint32_t)(tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire));
+    }
+
+private:
+    SpscRing(const SpscRing &);
+    SpscRing &operator=(const SpscRing &);
+
+    T *buf;
+    uint32_t mask;
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+};
+
+#endif //SPSC_RING_H
@@ -6,6 +6,12 @@
 #include "Log.h"
 #include "Tool.h"
 
+// RegexEngine.h, only the pointer lives here
+struct RegexCursor;
+
+// delete of a cursor, NULL is fine; in RegexEngine.cpp
+void regexCursorFree(RegexCursor *cursor);
+
 #pragma pack(1)
 
 enum TCP_STATE{
@@ -70,6 +76,23 @@ const u_int IP_HEADER_LENGTH = sizeof(struct ip_hdr);
 const u_int TCP_HEADER_LENGTH = sizeof(struct tcp_hdr);
 const u_int UDP_HEADER_LENGTH = sizeof(struct udp_hdr);
 
+// 802.1Q, 802.1ad and the old QinQ type, a mirror may add or strip them
+static inline bool isVlanType(uint16_t type){
+    return type == 0x8100 || type == 0x88a8 || type == 0x9100;
+}
+
+// offset of the ipv4 header past any vlan tags, 0 when the frame is not ipv4 or too short
+static inline uint32_t ipv4Offset(const u_char *data, uint32_t caplen){
+    uint32_t off = ETH_HEADER_LENGTH - 2;
+    while(caplen >= off + 2 && isVlanType((data[off] << 8) | data[off + 1])){
+        off += 4;
+    }
+    if(caplen < off + 2 + IP_HEADER_LENGTH || ((data[off] << 8) | data[off + 1]) != 0x0800){
+        return 0;
+    }
+    return off + 2;
+}
+
 const u_char TCP_PROTOCOL_ID = 6;
 const u_char UDP_PROTOCOL_ID = 17;
 
@@ -144,7 +167,7 @@ struct NetTuple5{
         return true;
     }
 
-    std::string getName(){
+    std::string getName() const{
         char name[120]={0};
         sprintf(name,"output/%s_%s_%s_%d_%d_%d.out", tranType==TranType_TCP?"TCP":"UDP" ,TransferToIp(saddr).c_str(),
             TransferToIp(daddr).c_str(),sport,dport,iHashValue);
@@ -189,26 +212,50 @@ struct DisorderNode{
     bool fin;
 };
 
+/*
+ *@brief 一个方向的拼包状态中每个包都要读写的部分, 放在 SessionNode 的第一个 cache line 里
+ */
+struct AsmHot{
+
+    AsmHot(){
+        tcpState = TCP_ESTABLED;
+        seq = 0;
+        ack_seq = 0;
+        first_data_seq = 0;
+        count = 0;
+    }
+
+    uint32_t getExcept() const{
+        return (first_data_seq + count);
+    }
+
+    uint32_t seq;
+    uint32_t ack_seq;
+    uint32_t first_data_seq;
+    uint32_t count;             // 累计接收的数据
+    uint8_t tcpState;           // TCP_STATE
+};
+
+/*
+ *@brief 一个方向的拼包缓存和匹配状态, 有载荷时才用到
+ */
 struct AssemableInfo{
 
     AssemableInfo(){
-        tcpState = TCP_ESTABLED;
         data = NULL;
         offset = 0;
-        count = 0;
         count_new = 0;
         bufsize = 0;
         disOrderPktNum = 0;
-        seq = 0;
-        ack_seq = 0;
-        first_data_seq = 0;
+        matchState = 0;
+        pRegex = NULL;
         pDisorderNodeListHead = NULL;
         pDisorderNodeListTail = NULL;
     }
 
     ~AssemableInfo(){
         if(data != NULL){
-            LOG_DEBUG("data count [%u]\n",count);
+            LOG_DEBUG("data bufsize [%u]\n",bufsize);
             delete []data;
             data = NULL;
         }
@@ -220,34 +267,25 @@ struct AssemableInfo{
             delete pDisorderNodeListHead;
             pDisorderNodeListHead = ptmp;
         }
+        regexCursorFree(pRegex);
 
-        tcpState = TCP_ESTABLED;
         offset = 0;
-        count = 0;
         count_new = 0;
         bufsize = 0;
         disOrderPktNum = 0;
-        seq = 0;
-        ack_seq = 0;
-        first_data_seq = 0;
+        matchState = 0;
+        pRegex = NULL;
         pDisorderNodeListHead = NULL;
         pDisorderNodeListTail = NULL;
     }
 
-    uint32_t getExcept(){
-        return (first_data_seq + count);
-    }
-
-    TCP_STATE tcpState;
-    char *data;                 // must allocate with char[NUM]
+    char *data;                 // must allocate with char[NUM], stream bytes offset..count
     uint32_t offset;
-    uint32_t count;             // 累计接收的数据
     uint32_t count_new;         // 最新数据包增加的数据
     uint32_t bufsize;
     uint32_t disOrderPktNum;
-    uint32_t seq;
-    uint32_t ack_seq;
-    uint32_t first_data_seq;
+    uint32_t matchState;        // PatternMatcher state after the last in order byte
+    RegexCursor *pRegex;        // created with the first scanned byte when rules are loaded
 
     DisorderNode *pDisorderNodeListHead;
     DisorderNode *pDisorderNodeListTail;
@@ -255,37 +293,27 @@ struct AssemableInfo{
 
 
 /*
- *@brief 会话的拼包信息结构体
+ *@brief 会话的冷数据: 输出文件和两个方向的拼包缓存
+ *  第一个载荷到来时才分配, 扫描和只有 SYN 的流没有这一块
  */
-struct SessAsmInfo
+struct SessCold
 {
-    SessAsmInfo()
-    {
-        pClientAsmInfo = NULL;
-        pServerAsmInfo = NULL;
-    }
-    
-    ~SessAsmInfo()
+    SessCold()
     {
-        Clear();
+        fd = NULL;
     }
-    
-    void Clear()
+
+    ~SessCold()
     {
-        if(pClientAsmInfo != NULL)
-        {
-            delete pClientAsmInfo;
-            pClientAsmInfo = NULL;
-        }
-        if(pServerAsmInfo != NULL)
+        if(fd != NULL)
         {
-            delete pServerAsmInfo;
-            pServerAsmInfo = NULL;
+            fclose(fd);
+            fd = NULL;
         }
     }
-    
-    AssemableInfo *pClientAsmInfo;         // 客户端节点
-    AssemableInfo *pServerAsmInfo;         // 服务端节点
+
+    FILE *fd;                           // for saving packet data into file
+    AssemableInfo asmInfo[2];           // indexed by Direct
 };
 
 #pragma pack()
@@ -0,0 +1,123 @@
+#include "TcpMetrics.h"
+#include "Log.h"
+
+// a >= b in sequence space
+static bool seqGE(uint32_t a, uint32_t b){
+    return (int32_t)(a - b) >= 0;
+}
+
+TcpMetrics::TcpMetrics(){
+    synUs = 0;
+    synAckUs = 0;
+    ackUs = 0;
+    synDir = Cli2Ser;
+}
+
+void TcpMetrics::onPacket(Packet *pkt){
+    assert(pkt->tcp);
+    TcpDirMetrics &m = dir[pkt->direct];
+    TcpDirMetrics &peer = dir[1 - pkt->direct];
+    uint64_t now = pkt->getTsUs();
+
+    if(m.firstUs == 0){
+        m.firstUs = now;
+    }
+    m.lastUs = now;
+    m.packets++;
+    m.bytes += pkt->getDatalen();
+
+    // handshake, a retransmitted SYN restarts the measurement
+    if(pkt->isSyn() && !pkt->isAck()){
+        if(synAckUs == 0){
+            synUs = now;
+            synDir = pkt->direct;
+        }
+    }else if(pkt->isSyn()){
+        if(synUs != 0 && synAckUs == 0){
+            synAckUs = now;
+        }
+    }else if(pkt->isAck() && synAckUs != 0 && ackUs == 0 && pkt->direct == synDir){
+        ackUs = now;
+    }
+
+    // peer's timed segment is acknowledged
+    if(pkt->isAck() && peer.timing && seqGE(pkt->getAck(), peer.timedSeqEnd)){
+        addRttSample(peer, now - peer.timedUs);
+        peer.timing = false;
+    }
+
+    if(!pkt->isRst() && !pkt->isSyn()){
+        if(pkt->getWinsize() == 0){
+            if(!m.inZeroWin){
+                m.zeroWin++;
+                m.inZeroWin = true;
+            }
+        }else{
+            m.inZeroWin = false;
+        }
+    }
+}
+
+void TcpMetrics::onNewData(Packet *pkt, uint32_t newLen){
+    TcpDirMetrics &m = dir[pkt->direct];
+    m.goodBytes += newLen;
+    if(!m.timing){
+        m.timing = true;
+        m.timedSeqEnd = pkt->getSeq() + pkt->getDatalen();
+        m.timedUs = pkt->getTsUs();
+    }
+}
+
+void TcpMetrics::onRetrans(Packet *pkt){
+    TcpDirMetrics &m = dir[pkt->direct];
+    m.retransPkts++;
+    m.retransBytes += pkt->getDatalen();
+    // Karn: an ack can no longer be tied to the original transmission
+    if(m.timing && !seqGE(pkt->getSeq(), m.timedSeqEnd)){
+        m.timing = false;
+    }
+}
+
+void TcpMetrics::onDisorder(Packet *pkt){
+    dir[pkt->direct].oooPkts++;
+}
+
+// RFC 6298 2.2 / 2.3
+void TcpMetrics::addRttSample(TcpDirMetrics &m, uint64_t sampleUs){
+    uint32_t r = (sampleUs > 0xFFFFFFFFULL) ? 0xFFFFFFFFU : (uint32_t)sampleUs;
+    if(m.rttSamples == 0){
+        m.srttUs = r;
+        m.rttvarUs = r / 2;
+        m.minRttUs = r;
+        m.maxRttUs = r;
+    }else{
+        uint32_t delta = (m.srttUs > r) ? m.srttUs - r : r - m.srttUs;
+        m.rttvarUs = (m.rttvarUs * 3 + delta) / 4;
+        m.srttUs = (uint32_t)(((uint64_t)m.srttUs * 7 + r) / 8);
+        if(r < m.minRttUs){
+            m.minRttUs = r;
+        }
+        if(r > m.maxRttUs){
+            m.maxRttUs = r;
+        }
+    }
+    m.rttSamples++;
+}
+
+void TcpMetrics::report(const char *name) const{
+    if(synAckUs != 0){
+        LOG_INFO("tcp %s handshake syn->synack %luus synack->ack %luus\n", name,
+            synAckUs - synUs, ackUs ? ackUs - synAckUs : 0);
+    }
+    for(int i = 0; i < 2; i++){
+        const TcpDirMetrics &m = dir[i];
+        if(m.packets == 0){
+            continue;
+        }
+        uint64_t durUs = m.lastUs - m.firstUs;
+        uint64_t goodput = durUs ? m.goodBytes * 8 * 1000000 / durUs : 0;
+        LOG_INFO("tcp %s %s packets %u bytes %lu good %lu retrans %u/%lu ooo %u zerowin %u rtt samples %u srtt %uus rttvar %uus min %uus max %uus goodput %lubps\n",
+            name, (i == Cli2Ser) ? "===>" : "<===", m.packets, m.bytes, m.goodBytes, m.retransPkts, m.retransBytes,
+            m.oooPkts, m.zeroWin, m.rttSamples, m.srttUs, m.rttvarUs, m.minRttUs, m.maxRttUs, goodput);
+    }
+}
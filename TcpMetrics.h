@@ -0,0 +1,104 @@
+#ifndef TCP_METRICS_H
+#define TCP_METRICS_H
+
+#include <stdint.h>
+
+#include "Packet.h"
+#include "StructDefine.h"
+
+// TCP 性能指标: 握手 RTT, 数据/ACK RTT, 重传, 乱序, 零窗口, goodput
+// 每个包 O(1), 状态大小固定, 会话关闭时输出
+
+/*
+ *@brief 单方向统计, 以发送方为视角
+ */
+struct TcpDirMetrics{
+    TcpDirMetrics(){
+        packets = 0;
+        bytes = 0;
+        goodBytes = 0;
+        retransPkts = 0;
+        retransBytes = 0;
+        oooPkts = 0;
+        zeroWin = 0;
+        inZeroWin = false;
+        timing = false;
+        timedSeqEnd = 0;
+        timedUs = 0;
+        rttSamples = 0;
+        srttUs = 0;
+        rttvarUs = 0;
+        minRttUs = 0;
+        maxRttUs = 0;
+        firstUs = 0;
+        lastUs = 0;
+    }
+
+    uint32_t packets;
+    uint64_t bytes;             // payload bytes, retransmissions included
+    uint64_t goodBytes;         // new in-order payload bytes
+    uint32_t retransPkts;
+    uint64_t retransBytes;
+    uint32_t oooPkts;
+    uint32_t zeroWin;           // times this side advertised a zero window
+    bool inZeroWin;
+
+    // one timed segment at a time, answered by the peer's ack (Karn)
+    bool timing;
+    uint32_t timedSeqEnd;
+    uint64_t timedUs;
+
+    uint32_t rttSamples;
+    uint32_t srttUs;            // RFC 6298 smoothed rtt
+    uint32_t rttvarUs;
+    uint32_t minRttUs;
+    uint32_t maxRttUs;
+
+    uint64_t firstUs;
+    uint64_t lastUs;
+};
+
+class TcpMetrics{
+public:
+    TcpMetrics();
+
+    // every tcp packet of the session, before reassembly
+    void onPacket(Packet *pkt);
+
+    // reassembly accepted newLen bytes of fresh data
+    void onNewData(Packet *pkt, uint32_t newLen);
+
+    // segment carried only already received data
+    void onRetrans(Packet *pkt);
+
+    // segment beyond the expected sequence
+    void onDisorder(Packet *pkt);
+
+    void report(const char *name) const;
+
+    uint32_t getRetransPkts() const{
+        return dir[Cli2Ser].retransPkts + dir[Ser2Cli].retransPkts;
+    }
+
+    const TcpDirMetrics &getDir(Direct d) const{
+        return dir[d];
+    }
+
+    // syn to the handshake ack, 0 when the handshake was not seen
+    uint32_t getHandshakeRttUs() const{
+        return (ackUs != 0) ? ackUs - synUs : 0;
+    }
+
+private:
+    void addRttSample(TcpDirMetrics &m, uint64_t sampleUs);
+
+    TcpDirMetrics dir[2];       // indexed by Direct
+
+    // handshake timestamps, 0 when not seen
+    uint64_t synUs;
+    uint64_t synAckUs;
+    uint64_t ackUs;
+    Direct synDir;
+};
+
+#endif //TCP_METRICS_H
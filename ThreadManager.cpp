@@ -0,0 +1,159 @@
+#include "ThreadManager.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+
+static uint64_t nowUs(){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static const char *ROLE_NAMES[THREAD_ROLE_NUM] = {"capture", "worker", "export"};
+
+ThreadManager::ThreadManager(){
+    fifoPriority = 0;
+}
+
+const char *ThreadManager::roleName(ThreadRole role){
+    return ROLE_NAMES[role];
+}
+
+int ThreadManager::configure(const char *spec){
+    const char *eq = strchr(spec, '=');
+    if(eq == NULL){
+        LOG_ERROR("thread cores \"%s\" is not role=cpus\n", spec);
+        return -1;
+    }
+    std::string name(spec, eq - spec);
+    int role = -1;
+    for(int r = 0; r < THREAD_ROLE_NUM; r++){
+        if(name == ROLE_NAMES[r]){
+            role = r;
+        }
+    }
+    if(role < 0){
+        LOG_ERROR("unknown thread role %s, capture worker or export\n", name.c_str());
+        return -1;
+    }
+
+    // "2-5,8"
+    std::vector<int> list;
+    const char *p = eq + 1;
+    while(*p){
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if(end == p || first < 0 || first >= CPU_SETSIZE){
+            LOG_ERROR("bad cpu list %s\n", eq + 1);
+            return -1;
+        }
+        p = end;
+        if(*p == '-'){
+            last = strtol(p + 1, &end, 10);
+            if(end == p + 1 || last < first || last >= CPU_SETSIZE){
+                LOG_ERROR("bad cpu list %s\n", eq + 1);
+                return -1;
+            }
+            p = end;
+        }
+        for(long c = first; c <= last; c++){
+            list.push_back(c);
+        }
+        if(*p == ','){
+            p++;
+        }else if(*p){
+            LOG_ERROR("bad cpu list %s\n", eq + 1);
+            return -1;
+        }
+    }
+    cores[role] = list;
+    return 0;
+}
+
+int ThreadManager::getCore(ThreadRole role, uint32_t index) const{
+    if(cores[role].empty()){
+        return -1;
+    }
+    return cores[role][index % cores[role].size()];
+}
+
+uint32_t ThreadManager::attach(ThreadRole role, uint32_t index, const char *name){
+    ThreadStat stat;
+    char full[64];
+    snprintf(full, sizeof(full), "%s%u", name, index);
+    stat.name = full;
+    stat.role = role;
+    stat.core = getCore(role, index);
+    stat.thread = pthread_self();
+    stat.running = true;
+    stat.startUs = nowUs();
+    stat.wallUs = 0;
+    stat.cpuUs = 0;
+
+    // also shows up in top -H and perf; the main thread keeps the process name
+    if(syscall(SYS_gettid) != getpid()){
+        pthread_setname_np(stat.thread, full);
+    }
+    if(stat.core >= 0){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(stat.core, &set);
+        if(pthread_setaffinity_np(stat.thread, sizeof(set), &set) != 0){
+            LOG_WARN("%s not pinned to cpu %d\n", full, stat.core);
+            stat.core = -1;
+        }
+    }
+    if(role == THREAD_CAPTURE && fifoPriority > 0){
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = fifoPriority;
+        // needs CAP_SYS_NICE, the thread keeps running under the normal scheduler otherwise
+        if(pthread_setschedparam(stat.thread, SCHED_FIFO, &param) != 0){
+            LOG_WARN("%s SCHED_FIFO %d refused, normal scheduling\n", full, fifoPriority);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.push_back(stat);
+    return stats.size() - 1;
+}
+
+void ThreadManager::detach(uint32_t id){
+    uint64_t cpu = threadCpuUs(pthread_self());
+    std::lock_guard<std::mutex> lock(mutex_);
+    ThreadStat &stat = stats[id];
+    stat.cpuUs = cpu;
+    stat.wallUs = nowUs() - stat.startUs;
+    stat.running = false;
+}
+
+uint64_t ThreadManager::threadCpuUs(pthread_t thread){
+    clockid_t clock;
+    struct timespec ts;
+    if(pthread_getcpuclockid(thread, &clock) != 0 || clock_gettime(clock, &ts) != 0){
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void ThreadManager::report(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t now = nowUs();
+    for(auto &stat : stats){
+        uint64_t wall = stat.running ? now - stat.startUs : stat.wallUs;
+        uint64_t cpu = stat.running ? threadCpuUs(stat.thread) : stat.cpuUs;
+        char core[16] = "any";
+        if(stat.core >= 0){
+            snprintf(core, sizeof(core), "%d", stat.core);
+        }
+        LOG_INFO("thread %s %s cpu %s busy %.1f%% cpu time %.3fs wall %.3fs\n", stat.name.c_str(),
+            roleName(stat.role), core, wall ? 100.0 * cpu / wall : 0.0, cpu / 1e6, wall / 1e6);
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef THREAD_MANAGER_H
+#define THREAD_MANAGER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <pthread.h>
+
+// 线程绑核: 每类线程配置一组 cpu, 第 i 个线程绑到第 i % n 个 cpu 上, 不再在核之间迁移
+// 抓包线程可选 SCHED_FIFO, 配合 isolcpus 隔离出来的核使用, 否则会饿死同核的其他线程
+// 同时记录每个线程的 cpu 时间, 结束时输出利用率
+
+enum ThreadRole{
+    THREAD_CAPTURE = 0,         // pcap_loop, or the parallel readers that also dispatch to shards
+    THREAD_WORKER,              // SessMgr shards
+    THREAD_EXPORT,              // ipfix exporter
+    THREAD_ROLE_NUM,
+};
+
+class ThreadManager{
+public:
+    ThreadManager();
+
+    // "role=cpus" with role capture|worker|export and cpus like "2-5,8", 0 on success
+    int configure(const char *spec);
+
+    // SCHED_FIFO at priority for capture threads, 0 keeps the normal scheduler
+    void setFifo(int priority){
+        fifoPriority = priority;
+    }
+
+    // cpu the index-th thread of the role is pinned to, -1 when the role is not pinned
+    int getCore(ThreadRole role, uint32_t index) const;
+
+    // called by the thread itself when it starts: pin, raise priority, start accounting; returns its id
+    uint32_t attach(ThreadRole role, uint32_t index, const char *name);
+
+    // called by the thread itself before it returns, its cpu clock is gone afterwards
+    void detach(uint32_t id);
+
+    // cpu utilisation of every attached thread so far
+    void report();
+
+    static const char *roleName(ThreadRole role);
+
+private:
+    struct ThreadStat{
+        std::string name;
+        ThreadRole role;
+        int core;
+        pthread_t thread;
+        bool running;
+        uint64_t startUs;
+        uint64_t wallUs;        // set by detach
+        uint64_t cpuUs;
+    };
+
+    static uint64_t threadCpuUs(pthread_t thread);
+
+    std::vector<int> cores[THREAD_ROLE_NUM];
+    int fifoPriority;
+
+    std::mutex mutex_;
+    std::vector<ThreadStat> stats;
+};
+
+#endif //THREAD_MANAGER_H
@@ -0,0 +1,216 @@
+#include "TlsHandler.h"
+#include "Log.h"
+
+#include <string.h>
+
+static const uint8_t TLS_CONTENT_HANDSHAKE = 22;
+static const uint8_t TLS_CLIENT_HELLO = 1;
+static const uint16_t TLS_EXT_SERVER_NAME = 0;
+static const uint16_t TLS_EXT_SUPPORTED_VERSIONS = 43;
+static const uint16_t TLS_VERSION_13 = 0x0304;
+
+TlsHandler::TlsHandler(){
+    hellos = 0;
+    withSni = 0;
+    offered13 = 0;
+}
+
+void TlsHandler::expect(State &state, uint8_t step, uint32_t n){
+    state.step = step;
+    state.need = n;
+    state.value = 0;
+}
+
+// fields whose bytes are not needed, skipped in one go
+static bool isSkipped(uint8_t step){
+    switch(step){
+    case TlsHandler::TLS_RECORD_HEADER:
+    case TlsHandler::TLS_HS_LENGTH:
+    case TlsHandler::TLS_RANDOM:
+    case TlsHandler::TLS_SESSION_ID:
+    case TlsHandler::TLS_CIPHERS:
+    case TlsHandler::TLS_COMPRESSION:
+    case TlsHandler::TLS_EXT_BODY:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void TlsHandler::parse(State &state, const u_char *data, uint32_t len){
+    uint32_t i = 0;
+    if(state.step == TLS_RECORD_TYPE && state.need == 0){
+        // zeroed state of a new session
+        expect(state, TLS_RECORD_TYPE, 1);
+    }
+    while(i < len && state.step != TLS_DONE){
+        uint32_t n = (state.need < len - i) ? state.need : len - i;
+        if(state.step == TLS_SNI_NAME){
+            uint32_t room = TLS_SNI_LEN - 1 - state.sniLen;
+            uint32_t copy = (n < room) ? n : room;
+            memcpy(state.sni + state.sniLen, data + i, copy);
+            state.sniLen += copy;
+        }else if(!isSkipped(state.step)){
+            for(uint32_t k = 0; k < n; k++){
+                state.value = (state.value << 8) | data[i + k];
+            }
+        }
+        if(state.step >= TLS_EXT_TYPE){
+            state.extLeft -= (n < state.extLeft) ? n : state.extLeft;
+        }
+        state.need -= n;
+        i += n;
+        if(state.need == 0){
+            next(state);
+        }
+    }
+}
+
+void TlsHandler::next(State &state){
+    uint32_t value = state.value;
+    switch(state.step){
+    case TLS_RECORD_TYPE:
+        if(value != TLS_CONTENT_HANDSHAKE){
+            state.step = TLS_DONE;
+            return;
+        }
+        expect(state, TLS_RECORD_HEADER, 4);
+        return;
+    case TLS_RECORD_HEADER:
+        expect(state, TLS_HS_TYPE, 1);
+        return;
+    case TLS_HS_TYPE:
+        if(value != TLS_CLIENT_HELLO){
+            state.step = TLS_DONE;
+            return;
+        }
+        expect(state, TLS_HS_LENGTH, 3);
+        return;
+    case TLS_HS_LENGTH:
+        expect(state, TLS_CLIENT_VERSION, 2);
+        return;
+    case TLS_CLIENT_VERSION:
+        state.clientVersion = value;
+        state.hello = 1;
+        hellos++;
+        expect(state, TLS_RANDOM, 32);
+        return;
+    case TLS_RANDOM:
+        expect(state, TLS_SESSION_ID_LEN, 1);
+        return;
+    case TLS_SESSION_ID_LEN:
+        if(value > 0){
+            expect(state, TLS_SESSION_ID, value);
+            return;
+        }
+        // fall through
+    case TLS_SESSION_ID:
+        expect(state, TLS_CIPHERS_LEN, 2);
+        return;
+    case TLS_CIPHERS_LEN:
+        if(value > 0){
+            expect(state, TLS_CIPHERS, value);
+            return;
+        }
+        // fall through
+    case TLS_CIPHERS:
+        expect(state, TLS_COMPRESSION_LEN, 1);
+        return;
+    case TLS_COMPRESSION_LEN:
+        if(value > 0){
+            expect(state, TLS_COMPRESSION, value);
+            return;
+        }
+        // fall through
+    case TLS_COMPRESSION:
+        expect(state, TLS_EXTENSIONS_LEN, 2);
+        return;
+    case TLS_EXTENSIONS_LEN:
+        state.extLeft = value;
+        if(value == 0){
+            state.step = TLS_DONE;
+            return;
+        }
+        expect(state, TLS_EXT_TYPE, 2);
+        return;
+    case TLS_EXT_TYPE:
+        state.extType = value;
+        expect(state, TLS_EXT_LEN, 2);
+        return;
+    case TLS_EXT_LEN:
+        if(state.extType == TLS_EXT_SERVER_NAME && value >= 5){
+            state.extBodyLeft = value - 3;
+            expect(state, TLS_SNI_HEADER, 3);
+        }else if(state.extType == TLS_EXT_SUPPORTED_VERSIONS && value >= 1){
+            state.extBodyLeft = value - 1;
+            expect(state, TLS_VERSIONS_LEN, 1);
+        }else if(value > 0){
+            state.extBodyLeft = 0;
+            expect(state, TLS_EXT_BODY, value);
+        }else{
+            state.extBodyLeft = 0;
+            break;
+        }
+        return;
+    case TLS_SNI_HEADER:
+        if(state.extBodyLeft >= 2){
+            state.extBodyLeft -= 2;
+            expect(state, TLS_SNI_LEN_FIELD, 2);
+            return;
+        }
+        break;
+    case TLS_SNI_LEN_FIELD:
+        value = (value < state.extBodyLeft) ? value : state.extBodyLeft;
+        if(value > 0){
+            state.extBodyLeft -= value;
+            expect(state, TLS_SNI_NAME, value);
+            return;
+        }
+        break;
+    case TLS_SNI_NAME:
+        state.sni[state.sniLen] = 0;
+        withSni++;
+        break;
+    case TLS_VERSIONS:
+        if(value == TLS_VERSION_13 && !state.tls13){
+            state.tls13 = 1;
+            offered13++;
+        }
+        // fall through
+    case TLS_VERSIONS_LEN:
+        if(state.extBodyLeft >= 2){
+            state.extBodyLeft -= 2;
+            expect(state, TLS_VERSIONS, 2);
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+
+    // the rest of the extension, then the next one
+    if(state.extBodyLeft > 0){
+        uint32_t rest = state.extBodyLeft;
+        state.extBodyLeft = 0;
+        expect(state, TLS_EXT_BODY, rest);
+    }else if(state.extLeft > 0){
+        expect(state, TLS_EXT_TYPE, 2);
+    }else{
+        state.step = TLS_DONE;
+    }
+}
+
+void TlsHandler::onEnd(State &state, const NetTuple5 &tuple){
+    if(!state.hello){
+        return;
+    }
+    LOG_INFO("tls %s client version %04x%s sni %s\n", tuple.getName().c_str(), state.clientVersion,
+        state.tls13 ? " offers 1.3" : "", state.sniLen ? state.sni : "-");
+}
+
+void TlsHandler::report(const char *name) const{
+    if(hellos == 0){
+        return;
+    }
+    LOG_INFO("%s tls client hellos %lu with sni %lu offering 1.3 %lu\n", name, hellos, withSni, offered13);
+}
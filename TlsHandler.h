@@ -0,0 +1,87 @@
+#ifndef TLS_HANDLER_H
+#define TLS_HANDLER_H
+
+#include "ProtoHandler.h"
+
+// TLS ClientHello 解析, 取 SNI 和客户端版本
+//   逐字节的状态机, 不缓存报文, ClientHello 跨多少个段都可以;
+//   客户端方向第一个字节不是 handshake 记录就放弃, 解析完或失败后不再看这条流
+
+const uint32_t TLS_SNI_LEN = 64;            // longer names are cut
+
+class TlsHandler : public ProtoHandler<TlsHandler>{
+public:
+    enum Step{
+        TLS_RECORD_TYPE = 0,
+        TLS_RECORD_HEADER,          // version and length, skipped
+        TLS_HS_TYPE,
+        TLS_HS_LENGTH,
+        TLS_CLIENT_VERSION,
+        TLS_RANDOM,
+        TLS_SESSION_ID_LEN,
+        TLS_SESSION_ID,
+        TLS_CIPHERS_LEN,
+        TLS_CIPHERS,
+        TLS_COMPRESSION_LEN,
+        TLS_COMPRESSION,
+        TLS_EXTENSIONS_LEN,
+        TLS_EXT_TYPE,
+        TLS_EXT_LEN,
+        TLS_EXT_BODY,               // skipped
+        TLS_SNI_HEADER,             // list length and name type
+        TLS_SNI_LEN_FIELD,
+        TLS_SNI_NAME,
+        TLS_VERSIONS_LEN,
+        TLS_VERSIONS,
+        TLS_DONE,                   // parsed, or not tls
+    };
+
+    struct State{
+        uint8_t step;
+        uint8_t hello;              // a ClientHello was seen
+        uint8_t tls13;              // client offered 1.3 in supported_versions
+        uint8_t sniLen;
+        uint16_t need;              // bytes left in the current field
+        uint16_t extType;
+        uint32_t value;             // field read so far, big endian
+        uint32_t extLeft;           // bytes left in the extensions block
+        uint16_t extBodyLeft;       // bytes of the current extension not consumed by a sub-step
+        uint16_t clientVersion;
+        char sni[TLS_SNI_LEN];
+    };
+
+    TlsHandler();
+
+    static bool wants(const NetTuple5 &tuple){
+        return tuple.tranType == TranType_TCP;
+    }
+
+    void onData(State &state, const NetTuple5 &tuple, Direct direct, const u_char *data, uint32_t len){
+        if(direct == Cli2Ser && state.step != TLS_DONE){
+            parse(state, data, len);
+        }
+    }
+
+    void onEnd(State &state, const NetTuple5 &tuple);
+
+    const char *app(const State &state) const{
+        return state.hello ? "tls" : NULL;
+    }
+
+    void report(const char *name) const;
+
+private:
+    void parse(State &state, const u_char *data, uint32_t len);
+
+    // the field of the current step is complete, pick the next step
+    void next(State &state);
+
+    // read or skip n bytes in step
+    static void expect(State &state, uint8_t step, uint32_t n);
+
+    uint64_t hellos;
+    uint64_t withSni;
+    uint64_t offered13;
+};
+
+#endif //TLS_HANDLER_H
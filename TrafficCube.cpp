@@ -0,0 +1,465 @@
+#include "TrafficCube.h"
+#include "HugeMem.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <algorithm>
+
+static const char *DIM_NAMES[] = {"server", "port", "proto", "client"};
+static const uint32_t DIM_NUM = 4;
+
+int CubeSpec::parse(const char *spec){
+    std::string text(spec);
+    size_t slash = text.find('/');
+    if(slash != std::string::npos){
+        char *end;
+        long sec = strtol(text.c_str() + slash + 1, &end, 10);
+        if(*end != 0 || sec <= 0){
+            LOG_ERROR("bad cube bin \"%s\", seconds after /\n", spec);
+            return -1;
+        }
+        binUs = (uint64_t)sec * 1000000;
+        text.resize(slash);
+    }
+
+    dims = 0;
+    size_t pos = 0;
+    while(pos <= text.size()){
+        size_t comma = text.find(',', pos);
+        std::string name = text.substr(pos, (comma == std::string::npos) ? std::string::npos : comma - pos);
+        uint32_t dim = 0;
+        for(uint32_t i = 0; i < DIM_NUM; i++){
+            if(name == DIM_NAMES[i]){
+                dim = 1 << i;
+            }
+        }
+        if(dim == 0){
+            LOG_ERROR("unknown cube dimension \"%s\", client server port or proto\n", name.c_str());
+            return -1;
+        }
+        dims |= dim;
+        if(comma == std::string::npos){
+            break;
+        }
+        pos = comma + 1;
+    }
+    return 0;
+}
+
+SketchKey CubeSpec::makeKey(const NetTuple5 &tuple) const{
+    // tuple is normalized, daddr:dport is the server side
+    SketchKey key;
+    if(dims & CUBE_SERVER){
+        key.daddr = tuple.daddr;
+    }
+    if(dims & CUBE_PORT){
+        key.dport = tuple.dport;
+    }
+    if(dims & CUBE_PROTO){
+        key.proto = tuple.tranType;
+    }
+    if(dims & CUBE_CLIENT){
+        key.saddr = tuple.saddr;
+    }
+    return key;
+}
+
+std::string CubeSpec::keyString(const SketchKey &key) const{
+    std::string out;
+    char buf[32];
+    if(dims & CUBE_SERVER){
+        out += " server=" + TransferToIp(key.daddr);
+    }
+    if(dims & CUBE_PORT){
+        snprintf(buf, sizeof(buf), " port=%u", key.dport);
+        out += buf;
+    }
+    if(dims & CUBE_PROTO){
+        snprintf(buf, sizeof(buf), " proto=%u", key.proto);
+        out += buf;
+    }
+    if(dims & CUBE_CLIENT){
+        out += " client=" + TransferToIp(key.saddr);
+    }
+    return out;
+}
+
+//=================================================================================
+CubeBin::CubeBin(int node){
+    this->node = node;
+    startUs = 0;
+    cells = (CubeCell *)hugeAlloc(CUBE_TABLE_SIZE * sizeof(CubeCell), node);
+    used = (uint32_t *)hugeAlloc(CUBE_MAX_KEYS * sizeof(uint32_t), node);
+    usedNum = 0;
+    overflowBytes = 0;
+    overflowPkts = 0;
+    totalBytes = 0;
+    totalPkts = 0;
+}
+
+CubeBin::~CubeBin(){
+    hugeFree(cells, CUBE_TABLE_SIZE * sizeof(CubeCell));
+    hugeFree(used, CUBE_MAX_KEYS * sizeof(uint32_t));
+}
+
+void CubeBin::add(const SketchKey &key, uint64_t keyHash, uint64_t bytes, uint64_t pkts){
+    totalBytes += bytes;
+    totalPkts += pkts;
+
+    uint32_t mask = CUBE_TABLE_SIZE - 1;
+    uint32_t i = keyHash & mask;
+    while(cells[i].pkts != 0){
+        if(cells[i].keyHash == keyHash && cells[i].key == key){
+            cells[i].bytes += bytes;
+            cells[i].pkts += pkts;
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+
+    if(usedNum >= CUBE_MAX_KEYS){
+        // cardinality explosion, only the heavy keys are tracked from here on
+        overflow.add(key, keyHash, bytes);
+        overflowBytes += bytes;
+        overflowPkts += pkts;
+        return;
+    }
+    cells[i].key = key;
+    cells[i].keyHash = keyHash;
+    cells[i].bytes = bytes;
+    cells[i].pkts = pkts;
+    used[usedNum++] = i;
+}
+
+void CubeBin::merge(const CubeBin &other){
+    for(uint32_t n = 0; n < other.usedNum; n++){
+        const CubeCell &cell = other.cells[other.used[n]];
+        add(cell.key, cell.keyHash, cell.bytes, cell.pkts);
+    }
+    overflow.merge(other.overflow);
+    overflowBytes += other.overflowBytes;
+    overflowPkts += other.overflowPkts;
+    totalBytes += other.overflowBytes;
+    totalPkts += other.overflowPkts;
+    if(startUs == 0){
+        startUs = other.startUs;
+    }
+}
+
+void CubeBin::write(FILE *out, const CubeSpec &spec, bool late) const{
+    if(empty()){
+        return;
+    }
+    // the mark goes with the second, so every row of a late bin carries it
+    char sec[32];
+    snprintf(sec, sizeof(sec), late ? "%lu late" : "%lu", startUs / 1000000);
+    fprintf(out, "%s total keys %u bytes %lu pkts %lu\n", sec, usedNum, totalBytes, totalPkts);
+
+    std::vector<uint32_t> order(used, used + usedNum);
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b){
+        return cells[a].bytes > cells[b].bytes;
+    });
+    for(auto i : order){
+        fprintf(out, "%s%s bytes %lu pkts %lu\n", sec, spec.keyString(cells[i].key).c_str(), cells[i].bytes, cells[i].pkts);
+    }
+
+    if(overflowPkts == 0){
+        return;
+    }
+    fprintf(out, "%s overflow bytes %lu pkts %lu\n", sec, overflowBytes, overflowPkts);
+    std::vector<SketchEntry> top;
+    overflow.topN(CUBE_OVERFLOW_REPORT, top);
+    for(auto &entry : top){
+        fprintf(out, "%s%s bytes %lu min %lu approx\n", sec, spec.keyString(entry.key).c_str(), entry.count,
+            entry.count - entry.error);
+    }
+}
+
+void CubeBin::clear(){
+    for(uint32_t n = 0; n < usedNum; n++){
+        cells[used[n]].pkts = 0;
+    }
+    usedNum = 0;
+    overflow.clear();
+    overflowBytes = 0;
+    overflowPkts = 0;
+    totalBytes = 0;
+    totalPkts = 0;
+    startUs = 0;
+}
+
+//=================================================================================
+TrafficCube::TrafficCube(const CubeSpec &spec, int node):spec(spec){
+    this->node = node;
+    for(uint32_t i = 0; i < CUBE_OPEN_BINS; i++){
+        open[i] = NULL;
+    }
+    owned = 0;
+    late = 0;
+    fd = NULL;
+    merger = NULL;
+    shard = 0;
+}
+
+TrafficCube::~TrafficCube(){
+    // bins handed to the merger are its to free
+    for(uint32_t i = 0; i < CUBE_OPEN_BINS; i++){
+        delete open[i];
+    }
+    for(auto bin : spare){
+        delete bin;
+    }
+    if(fd){
+        fclose(fd);
+    }
+}
+
+void TrafficCube::setMerger(CubeMerger *merger, uint32_t shard){
+    this->merger = merger;
+    this->shard = shard;
+}
+
+CubeBin *TrafficCube::takeBin(uint64_t start){
+    CubeBin *bin = NULL;
+    if(!spare.empty()){
+        bin = spare.back();
+        spare.pop_back();
+    }else if(merger == NULL || owned < CUBE_SHARD_BINS){
+        bin = new CubeBin(node);
+        owned++;
+    }else{
+        // every bin is with the merger, it gives them back within a millisecond or so
+        uint32_t spin = 0;
+        while((bin = merger->reclaim(shard)) == NULL){
+            if(++spin > 64){
+                sched_yield();
+            }
+        }
+    }
+    bin->startUs = start;
+    return bin;
+}
+
+void TrafficCube::finish(CubeBin *bin){
+    if(merger){
+        merger->submit(shard, bin);
+        // pick up what came back meanwhile, no waiting
+        CubeBin *back;
+        while((back = merger->reclaim(shard)) != NULL){
+            spare.push_back(back);
+        }
+        return;
+    }
+    if(fd == NULL){
+        fd = fopen(CUBE_REPORT_FILE, "a");
+        if(fd == NULL){
+            LOG_DEBUG("fd create fail\n");
+        }
+    }
+    if(fd){
+        bin->write(fd, spec);
+        fflush(fd);
+    }
+    bin->clear();
+    spare.push_back(bin);
+}
+
+void TrafficCube::update(const NetTuple5 &tuple, uint32_t bytes, uint64_t tsUs){
+    // bins are aligned so that shards agree on them
+    uint64_t start = tsUs - tsUs % spec.binUs;
+    CubeBin *bin = NULL;
+    if(open[0] == NULL){
+        bin = open[0] = takeBin(start);
+    }else if(start == open[0]->startUs){
+        bin = open[0];
+    }else if(start > open[0]->startUs){
+        // the previous bin is complete; so is the current one when a whole bin went by empty
+        if(open[1]){
+            finish(open[1]);
+            open[1] = NULL;
+        }
+        if(start - open[0]->startUs > spec.binUs){
+            finish(open[0]);
+        }else{
+            open[1] = open[0];
+        }
+        bin = open[0] = takeBin(start);
+    }else if(open[1] && start == open[1]->startUs){
+        bin = open[1];
+    }else{
+        late++;
+        return;
+    }
+
+    SketchKey key = spec.makeKey(tuple);
+    bin->add(key, key.hash(), bytes, 1);
+}
+
+void TrafficCube::close(){
+    if(open[1]){
+        finish(open[1]);
+        open[1] = NULL;
+    }
+    if(open[0]){
+        finish(open[0]);
+        open[0] = NULL;
+    }
+    if(merger){
+        merger->submit(shard, NULL);
+        merger = NULL;
+    }
+    if(late > 0){
+        LOG_INFO("cube %lu packets older than the open bins not counted\n", late);
+    }
+}
+
+//=================================================================================
+CubeMerger::CubeMerger(uint32_t shards, const CubeSpec &spec):spec(spec){
+    shardNum = shards;
+    for(uint32_t s = 0; s < shardNum; s++){
+        full.push_back(new SpscRing<CubeBin *>(CUBE_RING_SIZE));
+        empty.push_back(new SpscRing<CubeBin *>(CUBE_RING_SIZE));
+    }
+    done.assign(shardNum, 0);
+    running.store(false);
+    pThreads = NULL;
+    fd = NULL;
+    written = 0;
+    bins = 0;
+    lateBins = 0;
+}
+
+CubeMerger::~CubeMerger(){
+    stop();
+    // every bin is back: pending and spare are the merger's, the rings hold the shards' ones
+    for(auto &item : pending){
+        delete item.second;
+    }
+    for(auto bin : spare){
+        delete bin;
+    }
+    for(uint32_t s = 0; s < shardNum; s++){
+        CubeBin *bin;
+        while(full[s]->pop(bin)){
+            delete bin;
+        }
+        while(empty[s]->pop(bin)){
+            delete bin;
+        }
+        delete full[s];
+        delete empty[s];
+    }
+    if(fd){
+        fclose(fd);
+    }
+}
+
+void CubeMerger::start(){
+    running.store(true);
+    worker = std::thread(&CubeMerger::run, this);
+}
+
+void CubeMerger::stop(){
+    if(!running.load()){
+        return;
+    }
+    running.store(false);
+    worker.join();
+    LOG_INFO("cube %lu merged bins written to %s, %lu of them late additions\n", bins, CUBE_REPORT_FILE, lateBins);
+}
+
+void CubeMerger::submit(uint32_t shard, CubeBin *bin){
+    // at most CUBE_SHARD_BINS per shard are around, the ring never fills
+    full[shard]->pushWait(bin);
+}
+
+CubeBin *CubeMerger::reclaim(uint32_t shard){
+    CubeBin *bin = NULL;
+    empty[shard]->pop(bin);
+    return bin;
+}
+
+uint32_t CubeMerger::drain(){
+    uint32_t n = 0;
+    for(uint32_t s = 0; s < shardNum; s++){
+        CubeBin *bin;
+        while(full[s]->pop(bin)){
+            n++;
+            if(bin == NULL){
+                // the shard is closed, nothing holds the later bins back
+                done[s] = UINT64_MAX;
+                continue;
+            }
+            CubeBin *&acc = pending[bin->startUs];
+            if(acc == NULL){
+                if(spare.empty()){
+                    acc = new CubeBin();
+                }else{
+                    acc = spare.back();
+                    spare.pop_back();
+                }
+            }
+            acc->merge(*bin);
+            done[s] = bin->startUs;
+            bin->clear();
+            empty[s]->push(bin);
+        }
+    }
+    return n;
+}
+
+void CubeMerger::report(uint64_t upto){
+    while(!pending.empty() && pending.begin()->first <= upto){
+        CubeBin *acc = pending.begin()->second;
+        if(fd == NULL){
+            fd = fopen(CUBE_REPORT_FILE, "a");
+            if(fd == NULL){
+                LOG_DEBUG("fd create fail\n");
+            }
+        }
+        // a shard's bin that came after its second was forced out
+        bool late = bins > 0 && acc->startUs <= written;
+        if(fd){
+            acc->write(fd, spec, late);
+            fflush(fd);
+        }
+        bins++;
+        if(late){
+            lateBins++;
+        }else{
+            written = acc->startUs;
+        }
+        acc->clear();
+        spare.push_back(acc);
+        pending.erase(pending.begin());
+    }
+}
+
+void CubeMerger::run(){
+    uint32_t tid = pThreads ? pThreads->attach(THREAD_EXPORT, 1, "cube") : 0;
+    while(true){
+        // read the flag first so bins submitted before stop() are merged
+        bool stopping = !running.load();
+        uint32_t n = drain();
+        // a shard that stopped seeing packets must not hold bins back forever
+        uint64_t upto = *std::min_element(done.begin(), done.end());
+        if(stopping){
+            upto = UINT64_MAX;
+        }else if(pending.size() > CUBE_MAX_PENDING){
+            upto = pending.rbegin()->first - 1;
+        }
+        report(upto);
+        if(stopping){
+            break;
+        }
+        if(n == 0){
+            usleep(1000);
+        }
+    }
+    if(pThreads){
+        pThreads->detach(tid);
+    }
+}
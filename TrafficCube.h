@@ -0,0 +1,214 @@
+#ifndef TRAFFIC_CUBE_H
+#define TRAFFIC_CUBE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#include "FlowSketch.h"
+#include "SpscRing.h"
+#include "ThreadManager.h"
+#include "StructDefine.h"
+
+// 按时间分桶的流量聚合: 每 10 秒一个桶, 按可配置的维度 (服务端 ip, 端口, 协议 ...) 累加字节数和包数
+//   每个桶是固定大小的开放寻址表, 内存有上限; 表满以后新出现的键只进 space-saving top-N,
+//   其余记在 other 里, 总量不丢
+//   最近两个桶同时打开, 稍微乱序的包还能计入前一个桶
+//
+// 多 shard 时各 shard 只写自己的桶, 桶写完经无锁队列交给合并线程, 合并后的桶统一输出,
+// 空桶再经另一条队列还给 shard 复用:
+//
+//   shard 0 --full 0-->               --empty 0--> shard 0
+//   shard 1 --full 1--> cube merger   --empty 1--> shard 1
+//   ...                     |
+//                     output/cube.out
+//
+// 某个 shard 一直没有交桶时, 合并线程等满 CUBE_MAX_PENDING 个桶就先写出最老的;
+// 之后才到的同一时间的桶单独合并, 每行在秒数后面带 late, 是对前面同一秒的行的补充, 要加上去
+
+const uint64_t CUBE_BIN_US = 10000000;          // default bin
+const uint32_t CUBE_MAX_KEYS = 32768;           // exact keys per bin, the rest goes to the top-N
+const uint32_t CUBE_TABLE_SIZE = CUBE_MAX_KEYS * 2;     // power of 2, half full at most
+const uint32_t CUBE_OPEN_BINS = 2;              // current and previous
+const uint32_t CUBE_SHARD_BINS = 4;             // bins a shard may own, open or queued
+const uint32_t CUBE_RING_SIZE = 8;              // power of 2, >= CUBE_SHARD_BINS
+const uint32_t CUBE_MAX_PENDING = 4;            // merged bins kept waiting for idle shards
+const uint32_t CUBE_OVERFLOW_REPORT = 20;       // top-N rows of the keys that did not fit
+
+#define CUBE_REPORT_FILE "output/cube.out"
+
+enum CubeDim{
+    CUBE_SERVER = 1,            // server ip
+    CUBE_PORT = 2,              // server port
+    CUBE_PROTO = 4,
+    CUBE_CLIENT = 8,            // client ip
+};
+
+/*
+ *@brief 聚合维度和桶宽, 从 "server,port,proto/10" 这样的字符串解析
+ */
+struct CubeSpec{
+    CubeSpec(){
+        dims = CUBE_SERVER | CUBE_PORT | CUBE_PROTO;
+        binUs = CUBE_BIN_US;
+    }
+
+    // dims among client server port proto, optional /seconds; 0 on success
+    int parse(const char *spec);
+
+    // the tuple reduced to the configured dimensions, unused fields 0
+    SketchKey makeKey(const NetTuple5 &tuple) const;
+
+    // "server=1.2.3.4 port=443 proto=6"
+    std::string keyString(const SketchKey &key) const;
+
+    uint32_t dims;
+    uint64_t binUs;
+};
+
+struct CubeCell{
+    SketchKey key;
+    uint64_t keyHash;
+    uint64_t bytes;
+    uint64_t pkts;              // 0 is an empty cell
+};
+
+/*
+ *@brief 一个时间桶
+ */
+class CubeBin{
+public:
+    // node: numa node of the owning shard, -1 for anywhere
+    CubeBin(int node = -1);
+
+    ~CubeBin();
+
+    void add(const SketchKey &key, uint64_t keyHash, uint64_t bytes, uint64_t pkts);
+
+    // fold in another shard's bin of the same start
+    void merge(const CubeBin &other);
+
+    // late: the bin's second was written before, every row is marked as an addition to it
+    void write(FILE *out, const CubeSpec &spec, bool late = false) const;
+
+    // ready for another interval, only the used cells are touched
+    void clear();
+
+    bool empty() const{
+        return totalPkts == 0;
+    }
+
+    uint64_t startUs;
+
+private:
+    CubeBin(const CubeBin &);
+    CubeBin &operator=(const CubeBin &);
+
+    int node;
+    CubeCell *cells;            // CUBE_TABLE_SIZE
+    uint32_t *used;             // positions of the used cells, in insertion order
+    uint32_t usedNum;
+    SpaceSaving overflow;       // bytes of the keys that found the table full
+    uint64_t overflowBytes;
+    uint64_t overflowPkts;
+    uint64_t totalBytes;
+    uint64_t totalPkts;
+};
+
+class CubeMerger;
+
+/*
+ *@brief 每个 SessMgr 一个, 在 feedPkt 里更新, 单线程使用
+ */
+class TrafficCube{
+public:
+    TrafficCube(const CubeSpec &spec, int node = -1);
+
+    ~TrafficCube();
+
+    // hand finished bins to the merger instead of writing them
+    void setMerger(CubeMerger *merger, uint32_t shard);
+
+    // every parsed packet, bytes on the wire
+    void update(const NetTuple5 &tuple, uint32_t bytes, uint64_t tsUs);
+
+    // finish the open bins, a merged shard is done afterwards
+    void close();
+
+private:
+    // a bin for start, reused or allocated within CUBE_SHARD_BINS
+    CubeBin *takeBin(uint64_t start);
+
+    // the bin is complete
+    void finish(CubeBin *bin);
+
+    CubeSpec spec;
+    int node;
+    CubeBin *open[CUBE_OPEN_BINS];  // [0] current, [1] previous, NULL when not open
+    std::vector<CubeBin *> spare;
+    uint32_t owned;             // bins allocated by this cube, merger mode
+    uint64_t late;              // packets older than the previous bin
+    FILE *fd;
+    CubeMerger *merger;
+    uint32_t shard;
+};
+
+/*
+ *@brief shard 间的合并, 独立线程, 与 shard 之间只有单生产者单消费者队列
+ */
+class CubeMerger{
+public:
+    CubeMerger(uint32_t shards, const CubeSpec &spec);
+
+    // stops when still running and frees every bin handed in
+    ~CubeMerger();
+
+    // the merger thread attaches to manager as an export thread, call before start
+    void setThreads(ThreadManager *manager){
+        pThreads = manager;
+    }
+
+    void start();
+
+    // write what is pending and join, the shards must be closed
+    void stop();
+
+    // shard side: a finished bin, NULL when the shard is done
+    void submit(uint32_t shard, CubeBin *bin);
+
+    // shard side: a bin given back for reuse, NULL when none is back yet
+    CubeBin *reclaim(uint32_t shard);
+
+private:
+    void run();
+
+    // bins waiting in the rings, merged into pending; returns the number taken
+    uint32_t drain();
+
+    // write and recycle the merged bins starting at or before upto
+    void report(uint64_t upto);
+
+    uint32_t shardNum;
+    CubeSpec spec;
+    std::vector<SpscRing<CubeBin *> *> full;    // shard -> merger
+    std::vector<SpscRing<CubeBin *> *> empty;   // merger -> shard
+
+    std::thread worker;
+    std::atomic<bool> running;
+    ThreadManager *pThreads;
+
+    // merger thread only
+    std::vector<uint64_t> done;                 // per shard, start of the last bin handed in
+    std::map<uint64_t, CubeBin *> pending;
+    std::vector<CubeBin *> spare;
+    FILE *fd;
+    uint64_t written;                           // start of the newest bin written, later ones at or before it are late
+    uint64_t bins;
+    uint64_t lateBins;
+};
+
+#endif //TRAFFIC_CUBE_H
@@ -0,0 +1,109 @@
+#include "TruncPolicy.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+TruncPolicy::TruncPolicy(){
+}
+
+// "4096", "4k", "1m" or "all"
+static bool parseBytes(const std::string &text, uint32_t &bytes){
+    if(text == "all"){
+        bytes = TRUNC_UNLIMITED;
+        return true;
+    }
+    char *end;
+    unsigned long long n = strtoull(text.c_str(), &end, 10);
+    if(end == text.c_str()){
+        return false;
+    }
+    if(*end == 'k' || *end == 'K'){
+        n <<= 10;
+        end++;
+    }else if(*end == 'm' || *end == 'M'){
+        n <<= 20;
+        end++;
+    }
+    if(*end != 0 || n >= TRUNC_UNLIMITED){
+        return false;
+    }
+    bytes = n;
+    return true;
+}
+
+// "tcp", "udp" or ""
+static bool parseProto(const std::string &text, uint32_t &proto){
+    if(text == "tcp"){
+        proto = TranType_TCP;
+    }else if(text == "udp"){
+        proto = TranType_UDP;
+    }else{
+        return false;
+    }
+    return true;
+}
+
+int TruncPolicy::parse(const char *text){
+    rules.clear();
+    spec = text;
+    size_t pos = 0;
+    while(pos <= spec.size()){
+        size_t comma = spec.find(',', pos);
+        std::string item = spec.substr(pos, (comma == std::string::npos) ? std::string::npos : comma - pos);
+        size_t eq = item.find('=');
+        std::string sel = item.substr(0, eq);
+        uint32_t bytes = 0;
+        if(eq == std::string::npos || !parseBytes(item.substr(eq + 1), bytes)){
+            LOG_ERROR("bad truncation rule \"%s\", sel=bytes like tcp/443=4k\n", item.c_str());
+            return -1;
+        }
+
+        uint32_t proto = 0;
+        uint32_t port = 0;
+        size_t slash = sel.find('/');
+        std::string portText = sel;
+        if(slash != std::string::npos){
+            portText = sel.substr(slash + 1);
+            if(!parseProto(sel.substr(0, slash), proto)){
+                LOG_ERROR("bad truncation protocol in \"%s\", tcp or udp\n", item.c_str());
+                return -1;
+            }
+        }else if(sel == "*"){
+            portText = "";
+        }else if(parseProto(sel, proto)){
+            portText = "";
+        }
+        if(!portText.empty()){
+            char *end;
+            long n = strtol(portText.c_str(), &end, 10);
+            if(*end != 0 || n <= 0 || n > 65535){
+                LOG_ERROR("bad truncation port in \"%s\"\n", item.c_str());
+                return -1;
+            }
+            port = n;
+        }
+        rules[makeKey(proto, port)] = bytes;
+        if(comma == std::string::npos){
+            break;
+        }
+        pos = comma + 1;
+    }
+    return 0;
+}
+
+uint32_t TruncPolicy::lookup(const NetTuple5 &tuple) const{
+    if(rules.empty()){
+        return TRUNC_UNLIMITED;
+    }
+    // most specific first
+    const uint32_t keys[] = {makeKey(tuple.tranType, tuple.dport), makeKey(0, tuple.dport),
+        makeKey(tuple.tranType, 0), makeKey(0, 0)};
+    for(uint32_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++){
+        auto it = rules.find(keys[i]);
+        if(it != rules.end()){
+            return it->second;
+        }
+    }
+    return TRUNC_UNLIMITED;
+}
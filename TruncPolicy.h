@@ -0,0 +1,47 @@
+#ifndef TRUNC_POLICY_H
+#define TRUNC_POLICY_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+
+#include "StructDefine.h"
+
+// 载荷截断策略: 按协议/服务端口配置每个方向保留的字节数, 超过以后只计数不拷贝
+//   "tcp/443=4k,80=16k,udp=512,*=8k"
+//   tcp/端口 > 端口 > 协议 > *, 没有配置的会话不截断; all 表示不截断, 0 表示只计数
+// 保留的部分照常拼包, 匹配和协议解析; 超出的部分不分配缓存, 不拷贝, 不匹配,
+// 每流 pcap 里也只写报文头
+
+const uint32_t TRUNC_UNLIMITED = UINT32_MAX;
+
+class TruncPolicy{
+public:
+    TruncPolicy();
+
+    // comma separated sel=bytes, sel one of proto/port, port, proto or *, bytes with an
+    // optional k or m, or all; 0 on success
+    int parse(const char *spec);
+
+    bool isSet() const{
+        return !rules.empty();
+    }
+
+    // payload bytes kept per direction of the session, tuple is normalized: dport is the server
+    uint32_t lookup(const NetTuple5 &tuple) const;
+
+    const std::string &getSpec() const{
+        return spec;
+    }
+
+private:
+    // proto 0 for any, port 0 for any
+    static uint32_t makeKey(uint32_t proto, uint32_t port){
+        return (proto << 16) | port;
+    }
+
+    std::map<uint32_t, uint32_t> rules;
+    std::string spec;
+};
+
+#endif //TRUNC_POLICY_H
@@ -1,39 +1,404 @@
 #include "SessMgr.h"
+#include "ParallelPcap.h"
+#include "FlowIndex.h"
+#include "PcapDir.h"
+#include "IpfixExporter.h"
+#include "PktFilter.h"
+#include "FlowSampler.h"
+#include "PatternMatcher.h"
+#include "RegexEngine.h"
+#include "HugeMem.h"
+#include "ThreadManager.h"
 #include "Log.h"
 
 #include <pcap.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <set>
+#include <thread>
 
 
 // HashCalc hashCalc;
 // std::map<uint32_t,uint32_t> SessMap;
 SessMgr *gSessmgr;
+FlowIndexBuilder *gIndex;
+uint64_t gOffset;              // file offset of the record being processed
+PktFilter *gFilter;
+uint64_t gFiltered;
+FlowSampler *gSampler;
+volatile sig_atomic_t gStop;
+const char *gSnapPath;         // session checkpoint, NULL when off
+bool gSnapData;
+volatile sig_atomic_t gCheckpoint;
+uint64_t gLastCheckpointUs;
+uint32_t gSincePoll;
+ParallelPcap *gParallel;
+
+static void onSignal(int sig){
+    gStop = 1;
+}
+
+static void onCheckpointSignal(int sig){
+    if(gParallel){
+        gParallel->requestCheckpoint();
+    }else{
+        gCheckpoint = 1;
+    }
+}
+
+static uint64_t wallUs(){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
 
 // const struct pcap_pkthdr *packet_header  传入数据包的pcap头
 // const unsigned char *packet_content      传入数据包的实际内容
 void parse_callback(unsigned char *arg, const struct pcap_pkthdr *packet_header, const unsigned char *packet_content){
    
-    // input
-    gSessmgr->feedPkt(packet_header, packet_content);
+    // input, uninteresting frames are dropped before any parsing
+    uint32_t rate = 1;
+    if(gFilter && !gFilter->match(packet_header, packet_content)){
+        gFiltered++;
+    }else if(gSampler == NULL || gSampler->admit(packet_header, packet_content, rate)){
+        gSessmgr->feedPkt(packet_header, packet_content, rate);
+    }
+
+    // on SIGUSR1 and every SNAPSHOT_INTERVAL_US, the clock is read once per 4096 packets
+    if(gSnapPath && (gCheckpoint || (++gSincePoll & 4095) == 0)){
+        uint64_t now = wallUs();
+        if(gCheckpoint || now - gLastCheckpointUs >= SNAPSHOT_INTERVAL_US){
+            gCheckpoint = 0;
+            gLastCheckpointUs = now;
+            gSessmgr->checkpoint(gSnapPath, gSnapData);
+        }
+    }
+
+    // classic pcap records are laid out back to back
+    if(gIndex){
+        gIndex->add(0, packet_content, packet_header->caplen,
+            (uint64_t)packet_header->ts.tv_sec * 1000000 + packet_header->ts.tv_usec, gOffset);
+    }
+    gOffset += PCAP_RECORD_HEADER_LENGTH + packet_header->caplen;
+}
+
+static void usage(const char *prog){
+    fprintf(stderr, "usage: %s [-j threads] [-x] [-w] [-e collector] [-f 'bpf'] [-s lagms] [-d us] [-m patterns] [-r rules] [-c snapshot [-k]] [-a dims[/sec]] [-o files] [-t policy] [-p role=cpus]... [-P prio] file.pcap|dir|'glob'\n", prog);
+    fprintf(stderr, "  dir and glob inputs are processed in order of their first packet\n");
+    fprintf(stderr, "  -w  keep watching dir for new files until interrupted\n");
+    fprintf(stderr, "  -e host[:port]  export finished sessions as IPFIX over udp, port 4739 by default\n");
+    fprintf(stderr, "  -f expr  only process frames matching the tcpdump style filter\n");
+    fprintf(stderr, "  -s ms  when processing falls this far behind the packet clock, keep only a sample of new flows\n");
+    fprintf(stderr, "  -d us  drop copies of a packet seen again within us, for span/mirror ports\n");
+    fprintf(stderr, "  -m file  match reassembled tcp payload against the patterns, one 'name content' per line\n");
+    fprintf(stderr, "  -r file  match reassembled tcp payload against regex rules, one 'name regex' per line\n");
+    fprintf(stderr, "  -c file  restore open sessions from file, checkpoint them there on SIGUSR1, every %lus\n", SNAPSHOT_INTERVAL_US / 1000000);
+    fprintf(stderr, "           and at exit; sessions still open then are left to the next start, file.<shard> per shard\n");
+    fprintf(stderr, "  -k  also checkpoint the reassembly buffers\n");
+    fprintf(stderr, "  -a dims[/sec]  bytes and packets per time bin, %lus by default, and per client,server,port,proto\n", CUBE_BIN_US / 1000000);
+    fprintf(stderr, "                 dimensions, written to %s\n", CUBE_REPORT_FILE);
+    fprintf(stderr, "  -o files  every session's packets to its own pcap under %s instead of the payload .out\n", FLOW_PCAP_DIR);
+    fprintf(stderr, "            files, at most files open at once, 0 for %u\n", PCAP_MAX_OPEN);
+    fprintf(stderr, "  -t policy  payload bytes kept per session direction, then only counted, like\n");
+    fprintf(stderr, "             tcp/443=4k,80=16k,udp=512,*=8k; proto/port over port over proto over *\n");
+    fprintf(stderr, "  -p role=cpus  pin capture, worker or export threads to cpus like 2-5,8, repeatable\n");
+    fprintf(stderr, "  -P prio  SCHED_FIFO for capture threads, for isolated cores only\n");
+    fprintf(stderr, "  -x  write a flow index file.pcap%s for flowquery\n", FLOW_INDEX_SUFFIX);
 }
 
 int main(int argc, char *argv[]){
-    SessMgr mgr(100000);
-    gSessmgr=&mgr;
-    
+    uint32_t threads = 1;
+    bool buildIndex = false;
+    bool watch = false;
+    const char *collector = NULL;
+    const char *filterExpr = NULL;
+    uint32_t maxLagMs = 0;
+    uint64_t dedupUs = 0;
+    const char *patternFile = NULL;
+    const char *ruleFile = NULL;
+    const char *snapFile = NULL;
+    bool snapData = false;
+    CubeSpec cubeSpec;
+    bool cube = false;
+    bool flowPcap = false;
+    TruncPolicy truncPolicy;
+    uint32_t pcapMaxOpen = PCAP_MAX_OPEN;
+    ThreadManager threadMgr;
+    int opt;
+    while((opt = getopt(argc, argv, "j:xwe:f:s:d:m:r:c:ka:o:t:p:P:")) != -1){
+        switch(opt){
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'x':
+            buildIndex = true;
+            break;
+        case 'w':
+            watch = true;
+            break;
+        case 'e':
+            collector = optarg;
+            break;
+        case 'f':
+            filterExpr = optarg;
+            break;
+        case 's':
+            maxLagMs = atoi(optarg);
+            break;
+        case 'd':
+            dedupUs = strtoull(optarg, NULL, 10);
+            break;
+        case 'm':
+            patternFile = optarg;
+            break;
+        case 'r':
+            ruleFile = optarg;
+            break;
+        case 'c':
+            snapFile = optarg;
+            break;
+        case 'k':
+            snapData = true;
+            break;
+        case 'a':
+            if(cubeSpec.parse(optarg) != 0){
+                return 1;
+            }
+            cube = true;
+            break;
+        case 'o':
+            flowPcap = true;
+            if(atoi(optarg) > 0){
+                pcapMaxOpen = atoi(optarg);
+            }
+            break;
+        case 't':
+            if(truncPolicy.parse(optarg) != 0){
+                return 1;
+            }
+            break;
+        case 'p':
+            if(threadMgr.configure(optarg) != 0){
+                return 1;
+            }
+            break;
+        case 'P':
+            threadMgr.setFifo(atoi(optarg));
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(optind >= argc){
+        usage(argv[0]);
+        return 1;
+    }
+    const char *filename = argv[optind];
+    if(snapFile){
+        // checkpoints fork with the session tables live, hugetlbfs pages would be copied 2MB at a time
+        hugeUseHugetlb(false);
+    }
+
     LOG_DEBUG("PCAP start...\n");
+
+    bool multi = isDirectory(filename) || isGlobPattern(filename);
+    if(watch && !isDirectory(filename)){
+        usage(argv[0]);
+        return 1;
+    }
+
+    // compiled once, shared by every reader
+    PktFilter filter;
+    if(filterExpr && filter.compile(filterExpr) != 0){
+        exit(1);
+    }
+
+    PatternMatcher matcher;
+    if(patternFile && matcher.load(patternFile) != 0){
+        exit(1);
+    }
+    RegexSet rules;
+    if(ruleFile && rules.load(ruleFile) != 0){
+        exit(1);
+    }
+
+    // one export queue per SessMgr, outlives them
+    IpfixExporter *exporter = NULL;
+    if(collector){
+        exporter = new IpfixExporter(threads > 0 ? threads : 1, 0);
+        exporter->setThreads(&threadMgr);
+        if(exporter->start(collector) != 0){
+            delete exporter;
+            exit(1);
+        }
+    }
+
+    // 多线程或多文件: 文件按记录边界切段并行解析, 按流分到各个 SessMgr
+    if(threads > 1 || multi){
+        if(maxLagMs > 0){
+            LOG_WARN("-s ignored, parallel readers wait on full rings instead of dropping\n");
+        }
+        ParallelPcap *parallel = new ParallelPcap(threads, 100000, &threadMgr);
+        parallel->setBuildIndex(buildIndex);
+        if(filter.isSet()){
+            parallel->setFilter(&filter);
+        }
+        if(exporter){
+            parallel->setExporter(exporter);
+        }
+        if(dedupUs > 0){
+            parallel->setDedup(dedupUs);
+        }
+        if(cube){
+            parallel->setCube(cubeSpec);
+        }
+        if(flowPcap){
+            parallel->setFlowPcap(pcapMaxOpen);
+        }
+        if(truncPolicy.isSet()){
+            parallel->setTruncPolicy(&truncPolicy);
+        }
+        if(patternFile || ruleFile){
+            parallel->setMatcher(patternFile ? &matcher : NULL, ruleFile ? &rules : NULL);
+        }
+        // after setMatcher, restored tcp sessions scan with the shard's scanner
+        if(snapFile){
+            parallel->setCheckpoint(snapFile, snapData);
+            gParallel = parallel;
+            signal(SIGUSR1, onCheckpointSignal);
+        }
+
+        // watch before listing so no file slips in between
+        DirWatcher watcher;
+        if(watch && watcher.open(filename) != 0){
+            exit(1);
+        }
+        std::vector<std::string> files;
+        if(multi){
+            listPcapFiles(filename, files);
+        }else{
+            files.push_back(filename);
+        }
+        std::set<std::string> seen(files.begin(), files.end());
+        parallel->addFiles(files);
+        LOG_INFO("%lu files queued from %s\n", files.size(), filename);
+
+        std::thread worker(&ParallelPcap::run, parallel);
+        if(watch){
+            signal(SIGINT, onSignal);
+            signal(SIGTERM, onSignal);
+            while(!gStop){
+                std::vector<std::string> fresh, added;
+                watcher.wait(500, fresh);
+                for(auto &name : fresh){
+                    if(seen.insert(name).second){
+                        added.push_back(name);
+                    }
+                }
+                if(!added.empty()){
+                    parallel->addFiles(added);
+                }
+            }
+            LOG_INFO("watch on %s stopped\n", filename);
+        }
+        parallel->finish();
+        worker.join();
+        gParallel = NULL;
+        delete parallel;
+        delete exporter;
+        threadMgr.report();
+        return 0;
+    }
+
+    // the main thread captures, its tables go where it is pinned
+    uint32_t captureId = threadMgr.attach(THREAD_CAPTURE, 0, "capture");
+    int core = threadMgr.getCore(THREAD_CAPTURE, 0);
+    SessMgr *mgr = new SessMgr(100000, (core >= 0 && numaNodeNum() > 1) ? numaNodeOfCpu(core) : -1);
+    gSessmgr = mgr;
+    if(exporter){
+        mgr->setExporter(exporter, 0);
+    }
+    if(dedupUs > 0){
+        mgr->setDedup(dedupUs);
+    }
+    if(cube){
+        mgr->setCube(cubeSpec);
+    }
+    if(flowPcap){
+        mgr->setFlowPcap(pcapMaxOpen);
+    }
+    if(truncPolicy.isSet()){
+        mgr->setTruncPolicy(&truncPolicy);
+    }
+    if(patternFile || ruleFile){
+        mgr->setMatcher(patternFile ? &matcher : NULL, ruleFile ? &rules : NULL);
+    }
+    if(snapFile){
+        mgr->restore(snapFile);
+        gSnapPath = snapFile;
+        gSnapData = snapData;
+        gLastCheckpointUs = wallUs();
+        signal(SIGUSR1, onCheckpointSignal);
+    }
+
     char errBuf[PCAP_ERRBUF_SIZE];
 
-    pcap_t *device = pcap_open_offline(argv[1],errBuf);
+    pcap_t *device = pcap_open_offline(filename,errBuf);
   
     if(!device){
         LOG_DEBUG("error: pcap_open_offline(): %s\n", errBuf);
         exit(1);
     }
 
+    if(filter.isSet()){
+        gFilter = &filter;
+    }
+    // only the single consumer of pcap_loop can fall behind, parallel readers wait on full rings
+    if(maxLagMs > 0){
+        gSampler = new FlowSampler((uint64_t)maxLagMs * 1000);
+    }
+
+    FlowIndexBuilder index;
+    if(buildIndex && index.init(filename, 1) == 0){
+        gIndex = &index;
+    }
+    gOffset = PCAP_FILE_HEADER_LENGTH;
+
     /* wait loop forever */
     pcap_loop(device, -1, parse_callback, NULL);
   
     pcap_close(device);
+    if(gFilter){
+        LOG_INFO("bpf \"%s\" filtered %lu packets\n", filter.getExpr().c_str(), gFiltered);
+    }
+    if(gSampler){
+        gSampler->report();
+        delete gSampler;
+        gSampler = NULL;
+    }
+
+    if(gIndex){
+        gIndex->finish();
+        gIndex = NULL;
+    }
+
+    // while the tables are still mapped
+    hugeReport();
+
+    // open sessions go to the checkpoint instead of the flow records
+    if(gSnapPath){
+        mgr->checkpoint(gSnapPath, gSnapData, false);
+        mgr->setCarryOver(true);
+        gSnapPath = NULL;
+    }
 
+    // sessions are exported while the SessMgr goes away
+    delete mgr;
+    threadMgr.detach(captureId);
+    delete exporter;
+    threadMgr.report();
     return 0;
 }
@@ -0,0 +1,25 @@
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <stdio.h>
+
+// 测试用的断言: 失败只计数并打印位置, 跑完所有检查再由 testResult 给出退出码
+
+static int gChecks = 0;
+static int gFailures = 0;
+
+#define CHECK(cond) do{ \
+        gChecks++; \
+        if(!(cond)){ \
+            gFailures++; \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        } \
+    }while(0)
+
+// exit code of the test program
+static int testResult(const char *name){
+    printf("%s: %d checks, %d failed\n", name, gChecks, gFailures);
+    return gFailures ? 1 : 0;
+}
+
+#endif //TEST_CHECK_H
@@ -0,0 +1,46 @@
+#include "CardinalityTracker.h"
+#include "TestCheck.h"
+
+#include <math.h>
+
+// HyperLogLog 的估计在标准误差的几倍以内, 重复值不计数, 分 shard 合并和一次统计结果一样
+
+static void testHyperLogLog(){
+    const uint64_t ts = 1700000000ULL * 1000000;
+    const uint32_t distinct = 20000;
+    CardinalityTracker *all = new CardinalityTracker("all", UINT32_MAX);
+    CardinalityTracker *a = new CardinalityTracker("a", UINT32_MAX);
+    CardinalityTracker *b = new CardinalityTracker("b", UINT32_MAX);
+    for(uint32_t v = 0; v < distinct; v++){
+        all->update(7, v, ts);
+        ((v & 1) ? a : b)->update(7, v, ts);
+    }
+    double est = all->estimate(7);
+    double stdErr = 1.04 / sqrt(HLL_REGISTERS);
+    CHECK(fabs(est - distinct) <= 3 * stdErr * distinct);
+
+    // duplicates do not count
+    for(uint32_t v = 0; v < distinct; v += 3){
+        all->update(7, v, ts);
+    }
+    CHECK(all->estimate(7) == est);
+
+    // registers merge by max, the union estimate is the same as counting once
+    a->merge(*b);
+    CHECK(a->estimate(7) == est);
+
+    // small counts use linear counting and are close to exact
+    all->update(9, 1, ts);
+    all->update(9, 2, ts);
+    all->update(9, 3, ts);
+    CHECK(fabs(all->estimate(9) - 3) < 0.5);
+    CHECK(all->estimate(12345) == 0);
+    delete all;
+    delete a;
+    delete b;
+}
+
+int main(int argc, char *argv[]){
+    testHyperLogLog();
+    return testResult("cardinality");
+}
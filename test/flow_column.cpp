@@ -0,0 +1,168 @@
+#include "FlowColumn.h"
+#include "TestCheck.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+// 列存流记录: 写进去的每一行都能原样读回, 跨多个 block; 尾部被截断或 footer 偏移损坏的文件打开时拒绝
+
+static const char *APPS[] = {"http", "tls", "dns", "ssh"};
+
+static FlowRecord makeRecord(uint32_t i){
+    FlowRecord rec;
+    rec.saddr = 0x0a000000 + i;
+    rec.daddr = 0xc0a80001 + i % 7;
+    rec.sport = 1024 + i;
+    rec.dport = (i % 3) ? 443 : 80;
+    rec.proto = 6;
+    rec.tcpFlags = 0x1b;
+    rec.firstUs = 1700000000000000ULL + (uint64_t)i * 1000;
+    rec.lastUs = rec.firstUs + i % 5000;
+    rec.cliPkts = i % 100;
+    rec.serPkts = i % 77;
+    rec.cliBytes = (uint64_t)i * 1500;
+    rec.serBytes = (uint64_t)i * 40;
+    rec.retrans = i % 4;
+    rec.rttUs = i % 900;
+    rec.sampleRate = 1;
+    rec.app = APPS[i % 4];
+    return rec;
+}
+
+static bool same(const FlowColumnReader &reader, const FlowColBatch &batch, uint32_t row, const FlowRecord &rec){
+    return batch.value(reader.findColumn("saddr"), row) == rec.saddr
+        && batch.value(reader.findColumn("daddr"), row) == rec.daddr
+        && batch.value(reader.findColumn("sport"), row) == rec.sport
+        && batch.value(reader.findColumn("dport"), row) == rec.dport
+        && batch.value(reader.findColumn("first_us"), row) == rec.firstUs
+        && batch.value(reader.findColumn("last_us"), row) == rec.lastUs
+        && batch.value(reader.findColumn("cli_bytes"), row) == rec.cliBytes
+        && batch.value(reader.findColumn("ser_pkts"), row) == rec.serPkts
+        && batch.value(reader.findColumn("rtt_us"), row) == rec.rttUs
+        && strcmp(reader.getString(batch.value(reader.findColumn("app"), row)), rec.app) == 0;
+}
+
+static std::string readAll(const char *path){
+    std::string data;
+    FILE *fp = fopen(path, "rb");
+    char buf[65536];
+    size_t n;
+    while(fp && (n = fread(buf, 1, sizeof(buf), fp)) > 0){
+        data.append(buf, n);
+    }
+    if(fp){
+        fclose(fp);
+    }
+    return data;
+}
+
+static void writeAll(const char *path, const std::string &data){
+    FILE *fp = fopen(path, "wb");
+    fwrite(data.data(), 1, data.size(), fp);
+    fclose(fp);
+}
+
+static bool opens(const char *path){
+    FlowColumnReader reader;
+    return reader.open(path) == 0;
+}
+
+static void testRoundTrip(const char *path, uint32_t rows){
+    FlowColumnWriter writer;
+    CHECK(writer.open(path) == 0);
+    for(uint32_t i = 0; i < rows; i++){
+        writer.append(makeRecord(i));
+    }
+    writer.close();
+
+    FlowColumnReader reader;
+    CHECK(reader.open(path) == 0);
+    CHECK(reader.getRows() == rows);
+    CHECK(reader.getBlockNum() == (rows + FLOWCOL_BLOCK_ROWS - 1) / FLOWCOL_BLOCK_ROWS);
+    std::vector<uint32_t> columns;
+    for(uint32_t c = 0; c < FC_COLUMN_NUM; c++){
+        columns.push_back(c);
+    }
+    uint32_t next = 0;
+    bool match = true;
+    uint64_t n = reader.scan(std::vector<FlowColFilter>(), columns, [&](const FlowColBatch &batch){
+        for(uint32_t k = 0; k < batch.selected; k++){
+            match = match && same(reader, batch, batch.sel[k], makeRecord(next++));
+        }
+    });
+    CHECK(n == rows);
+    CHECK(next == rows);
+    CHECK(match);
+
+    // a filter on the port keeps only its rows
+    FlowColFilter filter;
+    filter.column = reader.findColumn("dport");
+    filter.lo = filter.hi = 80;
+    n = reader.scan(std::vector<FlowColFilter>(1, filter), columns, [&](const FlowColBatch &batch){
+    });
+    CHECK(n == (rows + 2) / 3);
+}
+
+static void testCorrupt(const char *path, const char *bad){
+    std::string good = readAll(path);
+    CHECK(good.size() > sizeof(FlowColTrailer));
+    size_t trailerOff = good.size() - sizeof(FlowColTrailer);
+    FlowColTrailer trailer;
+    memcpy(&trailer, good.data() + trailerOff, sizeof(trailer));
+
+    // a writer that did not close: no trailer
+    writeAll(bad, good.substr(0, good.size() / 2));
+    CHECK(!opens(bad));
+
+    // footer cut short, the trailer kept
+    std::string cut = good.substr(0, trailer.footerOff + 8) + good.substr(trailerOff);
+    writeAll(bad, cut);
+    CHECK(!opens(bad));
+
+    // footer offsets that point into the trailer, past the end, into the header
+    uint64_t offsets[] = {trailerOff + 4, good.size() + 100, 3, UINT64_MAX};
+    for(uint64_t off : offsets){
+        std::string data = good;
+        FlowColTrailer t = trailer;
+        t.footerOff = off;
+        memcpy(&data[trailerOff], &t, sizeof(t));
+        writeAll(bad, data);
+        CHECK(!opens(bad));
+    }
+
+    // more blocks than the footer holds, large enough to wrap a multiplication
+    uint64_t blocks[] = {trailer.blockNum + 1, UINT64_MAX / 8};
+    for(uint64_t num : blocks){
+        std::string data = good;
+        FlowColTrailer t = trailer;
+        t.blockNum = num;
+        memcpy(&data[trailerOff], &t, sizeof(t));
+        writeAll(bad, data);
+        CHECK(!opens(bad));
+    }
+
+    // the untouched file still opens
+    writeAll(bad, good);
+    CHECK(opens(bad));
+}
+
+int main(int argc, char *argv[]){
+    char dir[] = "/tmp/flowcolXXXXXX";
+    if(mkdtemp(dir) == NULL){
+        return 2;
+    }
+    std::string path = std::string(dir) + "/flows.fcol";
+    std::string bad = std::string(dir) + "/bad.fcol";
+
+    testRoundTrip(path.c_str(), 1);
+    testRoundTrip(path.c_str(), FLOWCOL_BLOCK_ROWS * 2 + 17);
+    testCorrupt(path.c_str(), bad.c_str());
+
+    unlink(path.c_str());
+    unlink(bad.c_str());
+    rmdir(dir);
+    return testResult("flow_column");
+}
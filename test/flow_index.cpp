@@ -0,0 +1,179 @@
+#include "FlowIndex.h"
+#include "TestCheck.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+
+// 流索引: 两条 lane 各自写入再归并, 每条流按任一方向的 key 都能查到, 偏移按顺序指向该流的每一条记录;
+// 时间桶覆盖区间内的全部记录; pcap 大小变了索引不再打开
+
+static const uint32_t FLOWS = 40;
+static const uint32_t PKTS = 1200;
+static const uint64_t START_SEC = 1700000000;
+
+static void put16(std::string &s, size_t off, uint16_t v){
+    s[off] = v >> 8;
+    s[off + 1] = v & 0xFF;
+}
+
+static void put32(std::string &s, uint32_t v){
+    s.append((const char *)&v, 4);
+}
+
+static uint32_t cliIp(uint32_t flow){
+    return 0x0a000001 + flow;
+}
+
+static const uint32_t SER_IP = 0xc0a80001;
+
+// packet i of a flow, odd ones from the server
+static std::string frame(uint32_t flow, uint32_t i){
+    bool toCli = i % 2;
+    uint8_t proto = (flow % 3) ? 6 : 17;
+    std::string s(14 + 20 + 20 + i % 50, 'x');
+    put16(s, 12, 0x0800);
+    s[14] = 0x45;
+    put16(s, 16, s.size() - 14);
+    s[23] = proto;
+    uint32_t src = htonl(toCli ? SER_IP : cliIp(flow));
+    uint32_t dst = htonl(toCli ? cliIp(flow) : SER_IP);
+    memcpy(&s[26], &src, 4);
+    memcpy(&s[30], &dst, 4);
+    uint16_t cliPort = 30000 + flow;
+    uint16_t serPort = (flow % 2) ? 443 : 53;
+    put16(s, 34, toCli ? serPort : cliPort);
+    put16(s, 36, toCli ? cliPort : serPort);
+    return s;
+}
+
+static std::string arp(){
+    std::string s(42, '\0');
+    put16(s, 12, 0x0806);
+    return s;
+}
+
+struct Rec{
+    uint32_t flow;          // FLOWS for the arp frames
+    uint64_t offset;
+    uint64_t tsUs;
+    std::string data;
+};
+
+static std::vector<Rec> writePcap(const char *path){
+    std::string file;
+    put32(file, 0xa1b2c3d4);
+    file.append("\x02\x00\x04\x00", 4);
+    put32(file, 0);
+    put32(file, 0);
+    put32(file, 65535);
+    put32(file, 1);
+    std::vector<Rec> recs;
+    for(uint32_t n = 0; n < PKTS; n++){
+        Rec r;
+        r.flow = (n % 97 == 0) ? FLOWS : (n * 7) % FLOWS;
+        r.data = (r.flow == FLOWS) ? arp() : frame(r.flow, n);
+        r.tsUs = (START_SEC + n / 100) * 1000000 + (n % 100) * 1000;
+        r.offset = file.size();
+        put32(file, r.tsUs / 1000000);
+        put32(file, r.tsUs % 1000000);
+        put32(file, r.data.size());
+        put32(file, r.data.size());
+        file += r.data;
+        recs.push_back(r);
+    }
+    FILE *fp = fopen(path, "wb");
+    fwrite(file.data(), 1, file.size(), fp);
+    fclose(fp);
+    return recs;
+}
+
+static std::string endpoint(uint32_t ip, uint16_t port){
+    struct in_addr a;
+    a.s_addr = htonl(ip);
+    return std::string(inet_ntoa(a)) + ":" + std::to_string(port);
+}
+
+static void testRoundTrip(const char *path){
+    std::vector<Rec> recs = writePcap(path);
+    uint64_t pcapSize = recs.back().offset + 16 + recs.back().data.size();
+
+    // two lanes like two shards, each with its own run
+    FlowIndexBuilder builder;
+    CHECK(builder.init(path, 2) == 0);
+    for(uint32_t n = 0; n < recs.size(); n++){
+        const Rec &r = recs[n];
+        builder.add(r.flow % 2, (const u_char *)r.data.data(), r.data.size(), r.tsUs, r.offset);
+    }
+    CHECK(builder.finish() == 0);
+
+    std::string index = std::string(path) + FLOW_INDEX_SUFFIX;
+    FlowIndexReader reader;
+    CHECK(reader.open(index.c_str(), pcapSize) == 0);
+    CHECK(reader.header->flowNum == FLOWS);
+
+    bool all = true;
+    for(uint32_t f = 0; f < FLOWS; f++){
+        std::vector<uint64_t> want;
+        for(auto &r : recs){
+            if(r.flow == f){
+                want.push_back(r.offset);
+            }
+        }
+        // either direction names the same flow
+        uint16_t serPort = (f % 2) ? 443 : 53;
+        std::string proto = (f % 3) ? "/6" : "/17";
+        FlowIdxKey fwd, rev;
+        all = all && flowIdxKeyParse((endpoint(cliIp(f), 30000 + f) + "-" + endpoint(SER_IP, serPort) + proto).c_str(), fwd);
+        all = all && flowIdxKeyParse((endpoint(SER_IP, serPort) + "-" + endpoint(cliIp(f), 30000 + f) + proto).c_str(), rev);
+        const FlowIdxFlow *flow = reader.findFlow(fwd);
+        all = all && flow != NULL && flow == reader.findFlow(rev) && flow->count == want.size();
+        if(flow == NULL){
+            continue;
+        }
+        const uint64_t *offsets = reader.getOffsets(flow);
+        for(uint64_t k = 0; k < flow->count && k < want.size(); k++){
+            all = all && offsets[k] == want[k];
+        }
+    }
+    CHECK(all);
+
+    // a port that never talked
+    FlowIdxKey none;
+    CHECK(flowIdxKeyParse(("10.0.0.1:29999-" + endpoint(SER_IP, 53) + "/17").c_str(), none));
+    CHECK(reader.findFlow(none) == NULL);
+
+    // a time range covers every record inside it, arp frames included
+    uint64_t fromUs = (START_SEC + 3) * 1000000, toUs = (START_SEC + 5) * 1000000;
+    uint64_t begin = 0, end = 0;
+    CHECK(reader.timeRange(fromUs, toUs, begin, end));
+    bool covered = true;
+    for(auto &r : recs){
+        if(r.tsUs >= fromUs && r.tsUs < toUs){
+            covered = covered && r.offset >= begin && r.offset + 16 + r.data.size() <= end;
+        }
+    }
+    CHECK(covered);
+    CHECK(!reader.timeRange((START_SEC + 100) * 1000000, (START_SEC + 200) * 1000000, begin, end));
+    reader.close();
+
+    // the pcap grew after indexing
+    FlowIndexReader stale;
+    CHECK(stale.open(index.c_str(), pcapSize + 1) != 0);
+    unlink(index.c_str());
+}
+
+int main(int argc, char *argv[]){
+    char dir[] = "/tmp/flowidxXXXXXX";
+    if(mkdtemp(dir) == NULL){
+        return 2;
+    }
+    std::string path = std::string(dir) + "/cap.pcap";
+    testRoundTrip(path.c_str());
+    unlink(path.c_str());
+    rmdir(dir);
+    return testResult("flow_index");
+}
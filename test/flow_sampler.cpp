@@ -0,0 +1,115 @@
+#include "FlowSampler.h"
+#include "TestCheck.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+// 按流采样: 级别升高后, 之前保留的流即使和大量新流共用表项也整条保留; 新流按 1/2^level 保留,
+// 丢弃的流在级别不变时每个包都丢
+
+static const uint32_t START_SEC = 1700000000;
+
+// udp frame of flow id, either direction
+static std::string frame(uint32_t id, bool reply){
+    std::string s(14 + 20 + 8 + 4, '\0');
+    s[12] = 0x08;
+    s[14] = 0x45;
+    s[17] = 20 + 8 + 4;
+    s[23] = 17;
+    uint32_t cli = 0x0a000000 + id, ser = 0xc0a80001;
+    uint32_t src = reply ? ser : cli, dst = reply ? cli : ser;
+    uint16_t sport = reply ? 53 : 1024 + id % 60000, dport = reply ? 1024 + id % 60000 : 53;
+    for(int k = 0; k < 4; k++){
+        s[26 + k] = src >> (24 - 8 * k);
+        s[30 + k] = dst >> (24 - 8 * k);
+    }
+    s[34] = sport >> 8, s[35] = sport & 0xFF;
+    s[36] = dport >> 8, s[37] = dport & 0xFF;
+    return s;
+}
+
+struct Feeder{
+    FlowSampler sampler;
+    uint64_t pkts;
+
+    // lag limit 0: every check that sees the backlog grow raises the level
+    Feeder():sampler(0), pkts(0){
+    }
+
+    bool admit(uint32_t id, bool reply, uint32_t sec, uint32_t &rate){
+        if(pkts++ % SAMPLER_CHECK_PKTS == 0){
+            // the wall clock moves, the packet clock does not
+            usleep(2000);
+        }
+        std::string s = frame(id, reply);
+        struct pcap_pkthdr hdr;
+        hdr.ts.tv_sec = sec;
+        hdr.ts.tv_usec = 0;
+        hdr.caplen = hdr.len = s.size();
+        rate = 0;
+        return sampler.admit(&hdr, (const u_char *)s.data(), rate);
+    }
+};
+
+static void testWholeFlows(){
+    Feeder f;
+    const uint32_t early = 1000;
+    uint32_t rate;
+    bool allKept = true;
+    for(uint32_t id = 0; id < early; id++){
+        allKept = f.admit(id, false, START_SEC, rate) && rate == 1 && allKept;
+    }
+    CHECK(allKept);
+
+    // a flood of new flows while falling behind, sharing buckets with the early flows
+    uint32_t noise = 200000;
+    uint32_t kept = 0;
+    for(uint32_t id = early; id < early + noise; id++){
+        kept += f.admit(id, false, START_SEC, rate);
+        if(f.sampler.getRate() == 1 << SAMPLER_MAX_LEVEL && id % 50 == 0){
+            // the early flows go on, in both directions
+            for(uint32_t e = id / 50 % early, n = 0; n < 3; n++, e = (e + 1) % early){
+                allKept = f.admit(e, n & 1, START_SEC, rate) && rate == 1 && allKept;
+            }
+        }
+    }
+    CHECK(f.sampler.getRate() == 1 << SAMPLER_MAX_LEVEL);
+    CHECK(allKept);
+    CHECK(kept < noise / 2);
+
+    // every early flow is still kept whole
+    for(uint32_t id = 0; id < early; id++){
+        allKept = f.admit(id, true, START_SEC + 30, rate) && rate == 1 && allKept;
+    }
+    CHECK(allKept);
+
+    // new flows at the top level: about 1 in 128, the same answer for every packet of a flow
+    uint32_t fresh = 20000, first = 0;
+    bool consistent = true;
+    std::vector<bool> decided;
+    for(uint32_t id = 0; id < fresh; id++){
+        bool in = f.admit(2000000 + id, false, START_SEC + 30, rate);
+        consistent = consistent && (!in || rate == 1u << SAMPLER_MAX_LEVEL);
+        decided.push_back(in);
+        first += in;
+    }
+    for(uint32_t id = 0; id < fresh; id++){
+        consistent = consistent && f.admit(2000000 + id, true, START_SEC + 31, rate) == decided[id];
+    }
+    CHECK(consistent);
+    CHECK(first > fresh / 256 && first < fresh / 64);
+
+    // an early flow silent for longer than the idle limit is a new flow again
+    uint32_t back = 0;
+    for(uint32_t id = 0; id < early; id++){
+        back += f.admit(id, false, START_SEC + 31 + SAMPLER_IDLE_SEC + 1, rate);
+    }
+    CHECK(back < early / 16);
+}
+
+int main(int argc, char *argv[]){
+    testWholeFlows();
+    return testResult("flow_sampler");
+}
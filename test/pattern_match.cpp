@@ -0,0 +1,109 @@
+#include "PatternMatcher.h"
+#include "TestCheck.h"
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Aho-Corasick: 重叠和互为后缀的模式都要报出来, 分段扫描和一次扫描结果一样
+
+struct Hit{
+    uint32_t id;
+    uint64_t end;               // stream offset just past the match
+
+    bool operator<(const Hit &x) const{
+        return end != x.end ? end < x.end : id < x.id;
+    }
+
+    bool operator==(const Hit &x) const{
+        return id == x.id && end == x.end;
+    }
+};
+
+// data split into pieces of chunk bytes, the state carried across like AssemableInfo::matchState
+static std::vector<Hit> scanChunked(const PatternMatcher &matcher, const std::string &data, uint32_t chunk){
+    std::vector<Hit> hits;
+    uint32_t state = 0;
+    for(size_t off = 0; off < data.size(); off += chunk){
+        uint32_t len = std::min<size_t>(chunk, data.size() - off);
+        state = matcher.scan(state, (const u_char *)data.data() + off, len, [&](uint32_t id, uint32_t end){
+            Hit hit;
+            hit.id = id;
+            hit.end = off + end;
+            hits.push_back(hit);
+        });
+    }
+    std::sort(hits.begin(), hits.end());
+    return hits;
+}
+
+static uint32_t findPattern(const PatternMatcher &matcher, const char *name){
+    for(uint32_t id = 0; id < matcher.getPatternNum(); id++){
+        if(matcher.getPattern(id).name == name){
+            return id;
+        }
+    }
+    return UINT32_MAX;
+}
+
+static void testOverlap(){
+    // the textbook set: she contains he, hers starts inside she
+    PatternMatcher matcher;
+    matcher.add("he", "he");
+    matcher.add("she", "she");
+    matcher.add("his", "his");
+    matcher.add("hers", "hers");
+    matcher.build();
+
+    std::vector<Hit> hits = scanChunked(matcher, "ushers", 1024);
+    CHECK(hits.size() == 3);
+    if(hits.size() == 3){
+        CHECK(hits[0].end == 4 && hits[1].end == 4 && hits[2].end == 6);
+        std::vector<uint32_t> at4 = {hits[0].id, hits[1].id};
+        std::sort(at4.begin(), at4.end());
+        std::vector<uint32_t> want = {findPattern(matcher, "he"), findPattern(matcher, "she")};
+        std::sort(want.begin(), want.end());
+        CHECK(at4 == want);
+        CHECK(hits[2].id == findPattern(matcher, "hers"));
+    }
+}
+
+static void testRepeats(){
+    // every position of a run matches, overlapping occurrences are not skipped
+    PatternMatcher matcher;
+    matcher.add("aa", "aa");
+    matcher.add("aaa", "aaa");
+    matcher.build();
+    std::vector<Hit> hits = scanChunked(matcher, "aaaaa", 1024);
+    uint32_t aa = 0, aaa = 0;
+    for(auto &hit : hits){
+        (hit.id == findPattern(matcher, "aa") ? aa : aaa)++;
+    }
+    CHECK(aa == 4);
+    CHECK(aaa == 3);
+}
+
+static void testChunked(){
+    // a pattern split across segments is found at the same offset
+    PatternMatcher matcher;
+    matcher.add("host", "Host: ");
+    matcher.add("crlf", "\r\n\r\n");
+    matcher.add("bin", std::string("\x00\xff\x00", 3));
+    matcher.build();
+    std::string data = "GET / HTTP/1.1\r\nHost: example.com\r\n\r\n";
+    data += std::string("\x00\xff\x00\xff\x00", 5);
+
+    std::vector<Hit> whole = scanChunked(matcher, data, data.size());
+    CHECK(whole.size() == 4);
+    for(uint32_t chunk = 1; chunk < 8; chunk++){
+        CHECK(scanChunked(matcher, data, chunk) == whole);
+    }
+}
+
+int main(int argc, char *argv[]){
+    testOverlap();
+    testRepeats();
+    testChunked();
+    return testResult("pattern_match");
+}
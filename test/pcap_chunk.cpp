@@ -0,0 +1,98 @@
+#include "PcapChunk.h"
+#include "TestCheck.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+// pcap 按记录切段: 载荷里藏着一串像记录头的字节, 切出来的每一段仍然从真实记录开始, 在下一段开头结束,
+// 每条记录只被读到一次
+
+static void put32(std::string &s, uint32_t v){
+    s.append((const char *)&v, 4);
+}
+
+static void record(std::string &s, uint32_t sec, const std::string &frame){
+    put32(s, sec);
+    put32(s, 0);
+    put32(s, frame.size());
+    put32(s, frame.size());
+    s += frame;
+}
+
+// an ethernet frame whose payload is a run of plausible records, one id byte at the front
+static std::string fakeFrame(uint32_t id, uint32_t sec){
+    std::string fake;
+    for(int k = 0; k < 6; k++){
+        record(fake, sec, std::string(60, 'f'));
+    }
+    std::string frame(14, '\0');
+    frame[12] = 0x08;
+    put32(frame, id);
+    return frame + fake + std::string(id % 200, 'p');
+}
+
+static void testSplit(const char *path){
+    const uint32_t records = 3000;
+    std::string file;
+    put32(file, 0xa1b2c3d4);
+    file.append("\x02\x00\x04\x00", 4);
+    put32(file, 0);
+    put32(file, 0);
+    put32(file, 65535);
+    put32(file, 1);
+    for(uint32_t i = 0; i < records; i++){
+        record(file, 1700000000 + i / 100, fakeFrame(i, 1700000000 + i / 100));
+    }
+    FILE *fp = fopen(path, "wb");
+    fwrite(file.data(), 1, file.size(), fp);
+    fclose(fp);
+
+    PcapFile pcap;
+    CHECK(pcap.open(path) == 0);
+    for(uint32_t num = 1; num <= 64; num = num * 2 + 1){
+        std::vector<PcapChunk> chunks;
+        splitPcapFile(&pcap, num, chunks);
+        CHECK(chunks.size() == num);
+        CHECK(chunks.front().begin == PCAP_FILE_HEADER_LENGTH && chunks.back().end == pcap.size);
+
+        // read every chunk the way a reader does
+        std::vector<uint32_t> seen;
+        bool exact = true, adjacent = true;
+        for(size_t c = 0; c < chunks.size(); c++){
+            uint64_t off = chunks[c].begin;
+            struct pcap_pkthdr hdr;
+            const u_char *data;
+            uint64_t next;
+            while(off < chunks[c].end && pcap.readRecord(off, hdr, data, next)){
+                uint32_t id;
+                memcpy(&id, data + 14, 4);
+                seen.push_back(hdr.caplen == fakeFrame(id, 0).size() ? id : UINT32_MAX);
+                off = next;
+            }
+            exact = exact && off == chunks[c].end;
+            adjacent = adjacent && (c == 0 || chunks[c].begin == chunks[c - 1].end);
+        }
+        CHECK(exact);
+        CHECK(adjacent);
+        bool inOrder = seen.size() == records;
+        for(uint32_t i = 0; inOrder && i < records; i++){
+            inOrder = seen[i] == i;
+        }
+        CHECK(inOrder);
+    }
+}
+
+int main(int argc, char *argv[]){
+    char dir[] = "/tmp/pcapchunkXXXXXX";
+    if(mkdtemp(dir) == NULL){
+        return 2;
+    }
+    std::string path = std::string(dir) + "/fake.pcap";
+    testSplit(path.c_str());
+    unlink(path.c_str());
+    rmdir(dir);
+    return testResult("pcap_chunk");
+}
@@ -0,0 +1,95 @@
+#include "PktDedup.h"
+#include "StructDefine.h"
+#include "TestCheck.h"
+
+#include <string.h>
+#include <string>
+
+// 镜像重复包: 一份带 vlan 标签一份不带, mac/ttl/校验和不同, 仍是同一个包; 窗口外或内容不同的包保留
+
+static const uint64_t WINDOW_US = 1000;
+
+// ethernet + ipv4 + udp with a short payload
+static std::string frame(uint16_t ipId, uint8_t ttl, uint8_t mac, const char *payload){
+    uint32_t plen = strlen(payload);
+    std::string s(14 + 20 + 8, '\0');
+    memset(&s[0], mac, 12);
+    s[12] = 0x08;
+    s[14] = 0x45;
+    s[16] = (20 + 8 + plen) >> 8;
+    s[17] = (20 + 8 + plen) & 0xFF;
+    s[18] = ipId >> 8;
+    s[19] = ipId & 0xFF;
+    s[22] = ttl;
+    s[23] = UDP_PROTOCOL_ID;
+    s[24] = ttl;                    // checksum follows the ttl
+    s[26] = 10, s[29] = 1;
+    s[30] = 10, s[33] = 2;
+    s[34] = 0x13, s[35] = 0x88;
+    s[36] = 0x13, s[37] = 0x89;
+    s[39] = 8 + plen;
+    s[40] = ttl;                    // udp checksum
+    return s + payload;
+}
+
+// tag of type inserted after the macs
+static std::string tag(const std::string &s, uint16_t type, uint16_t vid){
+    std::string t;
+    t += (char)(type >> 8);
+    t += (char)(type & 0xFF);
+    t += (char)(vid >> 8);
+    t += (char)(vid & 0xFF);
+    return s.substr(0, 12) + t + s.substr(12);
+}
+
+static bool seen(PktDedup &dedup, const std::string &s, uint64_t tsUs){
+    struct pcap_pkthdr hdr;
+    hdr.ts.tv_sec = tsUs / 1000000;
+    hdr.ts.tv_usec = tsUs % 1000000;
+    hdr.caplen = hdr.len = s.size();
+    return dedup.isDuplicate(&hdr, (const u_char *)s.data());
+}
+
+static void testOffset(){
+    std::string plain = frame(1, 64, 0xAA, "hello");
+    CHECK(ipv4Offset((const u_char *)plain.data(), plain.size()) == 14);
+    std::string one = tag(plain, 0x8100, 10);
+    CHECK(ipv4Offset((const u_char *)one.data(), one.size()) == 18);
+    std::string qinq = tag(one, 0x88a8, 200);
+    CHECK(ipv4Offset((const u_char *)qinq.data(), qinq.size()) == 22);
+    // cut inside the ip header, and not ip at all
+    CHECK(ipv4Offset((const u_char *)qinq.data(), 30) == 0);
+    std::string arp = plain;
+    arp[12] = 0x08, arp[13] = 0x06;
+    CHECK(ipv4Offset((const u_char *)arp.data(), arp.size()) == 0);
+}
+
+static void testDedup(){
+    PktDedup dedup(WINDOW_US);
+    uint64_t ts = 1700000000ULL * 1000000;
+    std::string ingress = frame(7, 64, 0xAA, "payload");
+    // the egress copy went through a router: other macs, ttl and checksums, and a vlan tag
+    std::string egress = tag(frame(7, 63, 0xBB, "payload"), 0x8100, 30);
+    std::string qinq = tag(tag(frame(7, 62, 0xCC, "payload"), 0x8100, 30), 0x88a8, 5);
+
+    CHECK(!seen(dedup, ingress, ts));
+    CHECK(seen(dedup, egress, ts + 10));
+    CHECK(seen(dedup, qinq, ts + 20));
+    // tagged first, the untagged copy slightly before it in the capture
+    std::string other = tag(frame(8, 64, 0xAA, "payload"), 0x8100, 30);
+    CHECK(!seen(dedup, other, ts + 100));
+    CHECK(seen(dedup, frame(8, 60, 0xAA, "payload"), ts + 90));
+
+    // another ip id or payload is another packet
+    CHECK(!seen(dedup, frame(9, 64, 0xAA, "payload"), ts + 200));
+    CHECK(!seen(dedup, frame(7, 64, 0xAA, "payloae"), ts + 200));
+    // a resend after the window is kept
+    CHECK(!seen(dedup, egress, ts + 10 + WINDOW_US * 3));
+    CHECK(dedup.getDuplicates() == 3);
+}
+
+int main(int argc, char *argv[]){
+    testOffset();
+    testDedup();
+    return testResult("pkt_dedup");
+}
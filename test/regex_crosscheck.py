@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+# 随机规则和输入, 对比 RegexEngine 和 Python re 的结果
+#   python3 test/regex_crosscheck.py test/regex_engine [rounds] [seed]
+# 每条规则只看第一次命中的结束位置: 最小的 end, 使得某个 start (锚定规则只有 0) 上 data[start:end] 整个匹配
+# 分段大小和 DFA 缓存预算也随机, 缓存预算为 1 时每个新转移都会清空缓存
+
+import os
+import random
+import re
+import subprocess
+import sys
+import tempfile
+
+ALPHABET = b"abcAB1\n"
+
+
+def atom(rnd, depth):
+    kind = rnd.randrange(8 if depth < 2 else 6)
+    if kind <= 1:
+        return rnd.choice("abcAB1")
+    if kind == 2:
+        return rnd.choice(["[ab]", "[^a]", "[a-c1]", "[^\\n]"])
+    if kind == 3:
+        return rnd.choice([".", "\\d", "\\w", "\\s"])
+    if kind == 4:
+        return rnd.choice("abc") + rnd.choice("abc")
+    if kind == 5:
+        return rnd.choice(["\\x61", "\\n"])
+    return "(" + alternation(rnd, depth + 1) + ")"
+
+
+def piece(rnd, depth):
+    text = atom(rnd, depth)
+    roll = rnd.randrange(10)
+    if roll == 0:
+        text += "*"
+    elif roll == 1:
+        text += "+"
+    elif roll == 2:
+        text += "?"
+    elif roll == 3:
+        lo = rnd.randrange(3)
+        text += "{%d,%d}" % (lo, lo + rnd.randrange(3))
+    return text
+
+
+def concat(rnd, depth):
+    return "".join(piece(rnd, depth) for _ in range(rnd.randrange(1, 4)))
+
+
+def alternation(rnd, depth):
+    return "|".join(concat(rnd, depth) for _ in range(rnd.randrange(1, 3)))
+
+
+def make_rule(rnd):
+    while True:
+        body = alternation(rnd, 0)
+        nocase = rnd.random() < 0.3
+        anchored = rnd.random() < 0.3
+        flags = re.IGNORECASE if nocase else 0
+        compiled = re.compile(body.encode(), flags)
+        if compiled.fullmatch(b"") is None:
+            text = ("(?i)" if nocase else "") + ("^" if anchored else "") + body
+            return text, compiled, anchored
+
+
+def first_end(compiled, anchored, data):
+    for end in range(1, len(data) + 1):
+        starts = [0] if anchored else range(end)
+        for start in starts:
+            if compiled.fullmatch(data, start, end):
+                return end
+    return None
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: %s regex_engine [rounds] [seed]" % sys.argv[0])
+        return 2
+    binary = sys.argv[1]
+    rounds = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+    seed = int(sys.argv[3]) if len(sys.argv) > 3 else 1
+    rnd = random.Random(seed)
+    fails = 0
+    with tempfile.TemporaryDirectory() as tmp:
+        rule_path = os.path.join(tmp, "rules.txt")
+        data_path = os.path.join(tmp, "data.bin")
+        for r in range(rounds):
+            rules = [make_rule(rnd) for _ in range(rnd.randrange(1, 6))]
+            with open(rule_path, "w") as fp:
+                for i, (text, _, _) in enumerate(rules):
+                    fp.write("r%d %s\n" % (i, text))
+            data = bytes(rnd.choice(ALPHABET) for _ in range(rnd.randrange(1, 40)))
+            with open(data_path, "wb") as fp:
+                fp.write(data)
+            chunk = rnd.choice([1, 2, 3, 7, len(data)])
+            budget = rnd.choice([1, 8 << 20])
+
+            want = {}
+            for i, (_, compiled, anchored) in enumerate(rules):
+                end = first_end(compiled, anchored, data)
+                if end is not None:
+                    want["r%d" % i] = end
+            out = subprocess.run([binary, rule_path, data_path, str(chunk), str(budget)],
+                                 stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, check=True).stdout
+            got = {}
+            for line in out.decode().splitlines():
+                # the log may share stdout
+                if line.startswith("hit "):
+                    _, name, end = line.split()
+                    got[name] = int(end)
+            if got != want:
+                fails += 1
+                print("round %d chunk %d budget %d data %r" % (r, chunk, budget, data))
+                for i, (text, _, _) in enumerate(rules):
+                    print("  r%d %s want %s got %s" % (i, text, want.get("r%d" % i), got.get("r%d" % i)))
+    print("regex_crosscheck: %d rounds, %d failed" % (rounds, fails))
+    return 1 if fails else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
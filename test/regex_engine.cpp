@@ -0,0 +1,139 @@
+#include "RegexEngine.h"
+#include "TestCheck.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+
+// 流式正则: 锚定规则只在流的起点生效, 缓存清空后也一样; 分段扫描和一次扫描结果一样
+//
+// 带参数时是 regex_crosscheck.py 的驱动: regex_engine rules input [chunk [budget]]
+// 每条命中的规则打印一行 "hit name end", end 是流里第一次命中的结束位置
+
+typedef std::map<std::string, uint64_t> Hits;   // rule -> stream offset past its first match
+
+static Hits scanChunked(LazyDfa &dfa, const RegexSet &set, RegexCursor &cursor, const std::string &data, uint32_t chunk,
+    uint64_t base = 0){
+    Hits hits;
+    for(size_t off = 0; off < data.size(); off += chunk){
+        uint32_t len = (data.size() - off < chunk) ? data.size() - off : chunk;
+        dfa.scan(cursor, (const uint8_t *)data.data() + off, len, [&](uint32_t rule, uint32_t end){
+            hits[set.getName(rule)] = base + off + end;
+        });
+    }
+    return hits;
+}
+
+static Hits scanOnce(const RegexSet &set, const std::string &data, uint32_t chunk, uint64_t budget = REGEX_CACHE_BYTES){
+    LazyDfa dfa(&set, budget);
+    RegexCursor cursor;
+    return scanChunked(dfa, set, cursor, data, chunk);
+}
+
+static void testAnchored(){
+    RegexSet set;
+    std::string err;
+    CHECK(set.add("get", "^GET ", err));
+    CHECK(set.add("abc", "abc", err));
+    set.build();
+
+    Hits hits = scanOnce(set, "GET abc", 64);
+    CHECK(hits.size() == 2 && hits["get"] == 4 && hits["abc"] == 7);
+    // not at the stream start
+    hits = scanOnce(set, "xGET abc", 64);
+    CHECK(hits.size() == 1 && hits.count("abc") == 1);
+    // split before the anchored rule is complete
+    hits = scanOnce(set, "GET abc", 2);
+    CHECK(hits.size() == 2 && hits["get"] == 4);
+}
+
+static void testFlush(){
+    // a one byte budget flushes the cache at every new transition
+    RegexSet set;
+    std::string err;
+    CHECK(set.add("get", "^GET", err));
+    CHECK(set.add("abc", "abc", err));
+    set.build();
+    LazyDfa dfa(&set, 1);
+
+    RegexCursor paused;
+    Hits hits = scanChunked(dfa, set, paused, "xy", 2);
+    CHECK(hits.empty());
+    // other streams push the cache through more than one generation
+    for(int i = 0; i < 3; i++){
+        RegexCursor other;
+        scanChunked(dfa, set, other, "zzzz", 4);
+    }
+    // the paused stream lost its state; it is past its start, the anchored rule must not fire
+    hits = scanChunked(dfa, set, paused, "GETabc", 6, 2);
+    CHECK(hits.size() == 1 && hits["abc"] == 8);
+
+    // a stream that has not started still gets its anchored rules
+    RegexCursor fresh;
+    hits = scanChunked(dfa, set, fresh, "GETabc", 6);
+    CHECK(hits.size() == 2 && hits["get"] == 3 && hits["abc"] == 6);
+}
+
+static void testSyntax(){
+    RegexSet set;
+    std::string err;
+    CHECK(set.add("ua", "(?i)user-agent: *curl", err));
+    CHECK(set.add("digits", "id=\\d{3,5}[^0-9]", err));
+    CHECK(set.add("alt", "(?:cat|dog)s?!", err));
+    CHECK(set.add("hex", "\\x00\\xff", err));
+    CHECK(!set.add("empty", "a*", err));
+    CHECK(!set.add("open", "(abc", err));
+    CHECK(!set.add("count", "a{5,2}", err));
+    CHECK(!set.add("anchor", "a^b", err));
+    set.build();
+    CHECK(set.getRuleNum() == 4);
+
+    std::string data = "USER-AGENT:   Curl/8\nid=12 id=1234;dogs!";
+    data += std::string("\x00\xff", 2);
+    Hits hits = scanOnce(set, data, data.size());
+    CHECK(hits.size() == 4);
+    CHECK(hits["ua"] == 18);
+    CHECK(hits["digits"] == 35);
+    CHECK(hits["alt"] == 40);
+    CHECK(hits["hex"] == 42);
+    // byte by byte and through a flushing cache
+    CHECK(scanOnce(set, data, 1) == hits);
+    CHECK(scanOnce(set, data, 3, 1) == hits);
+}
+
+static bool readFile(const char *path, std::string &out){
+    FILE *fp = fopen(path, "rb");
+    if(fp == NULL){
+        return false;
+    }
+    char buf[4096];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0){
+        out.append(buf, n);
+    }
+    fclose(fp);
+    return true;
+}
+
+int main(int argc, char *argv[]){
+    if(argc >= 3){
+        RegexSet set;
+        std::string data;
+        if(set.load(argv[1]) != 0 || !readFile(argv[2], data)){
+            return 2;
+        }
+        uint32_t chunk = (argc > 3) ? atoi(argv[3]) : data.size() + 1;
+        uint64_t budget = (argc > 4) ? strtoull(argv[4], NULL, 10) : REGEX_CACHE_BYTES;
+        Hits hits = scanOnce(set, data, chunk ? chunk : 1, budget);
+        for(auto &hit : hits){
+            printf("hit %s %lu\n", hit.first.c_str(), hit.second);
+        }
+        return 0;
+    }
+    testAnchored();
+    testFlush();
+    testSyntax();
+    return testResult("regex_engine");
+}
@@ -0,0 +1,137 @@
+#include "RtpAnalyzer.h"
+#include "TestCheck.h"
+
+#include <string>
+#include <vector>
+
+// RTP 质量: 序号起始两个包做试用, 之后丢包按序号缺口计, 乱序和重复不算丢包, 序号回绕不算丢包;
+// 抖动按 RFC 3550 A.8, 到达时间固定偏差 1ms 的 PCMU 流收敛到约 1ms; 非 RTP 载荷几个包后放弃
+
+static const uint32_t PKT_US = 20000;       // 20ms of PCMU, 160 timestamp units at 8kHz
+static const uint64_t START_US = 1700000000000000ULL;
+
+static std::string rtp(uint16_t seq, uint32_t ts, uint32_t ssrc = 0x11223344, uint8_t pt = 0){
+    std::string s(RTP_HEADER_LENGTH + 160, 'x');
+    s[0] = 0x80;
+    s[1] = pt;
+    s[2] = seq >> 8;
+    s[3] = seq & 0xFF;
+    for(int i = 0; i < 4; i++){
+        s[4 + i] = (ts >> (24 - 8 * i)) & 0xFF;
+        s[8 + i] = (ssrc >> (24 - 8 * i)) & 0xFF;
+    }
+    return s;
+}
+
+static void feed(RtpAnalyzer &a, uint16_t seq, uint32_t ts, uint64_t us){
+    std::string p = rtp(seq, ts);
+    a.process((const Byte *)p.data(), p.size(), us);
+}
+
+// packets i of a 20ms stream, ts and arrival both on the grid
+static void feedIndex(RtpAnalyzer &a, uint16_t firstSeq, uint32_t i, uint64_t lateUs = 0){
+    feed(a, firstSeq + i, 5000 + i * 160, START_US + (uint64_t)i * PKT_US + lateUs);
+}
+
+static void testClean(){
+    RtpAnalyzer a;
+    for(uint32_t i = 0; i < 100; i++){
+        feedIndex(a, 1000, i);
+    }
+    CHECK(a.isActive());
+    // the first probation packet is not counted
+    CHECK(a.getExpected() == 99);
+    CHECK(a.getLost() == 0);
+    CHECK(a.getJitterMs() == 0);
+    CHECK(a.getMos() > 4.0);
+}
+
+static void testLoss(){
+    RtpAnalyzer a;
+    for(uint32_t i = 0; i < 100; i++){
+        if(i % 10 != 5){
+            feedIndex(a, 1000, i);
+        }
+    }
+    CHECK(a.getExpected() == 99);
+    CHECK(a.getLost() == 10);
+    RtpAnalyzer clean;
+    for(uint32_t i = 0; i < 100; i++){
+        feedIndex(clean, 1000, i);
+    }
+    CHECK(a.getMos() < clean.getMos());
+}
+
+static void testWrap(){
+    RtpAnalyzer a;
+    for(uint32_t i = 0; i < 100; i++){
+        feedIndex(a, 65500, i);
+    }
+    CHECK(a.getExpected() == 99);
+    CHECK(a.getLost() == 0);
+}
+
+static void testReorderAndDuplicate(){
+    RtpAnalyzer a;
+    for(uint32_t i = 0; i < 50; i++){
+        if(i == 20){
+            feedIndex(a, 1000, 21);
+            feedIndex(a, 1000, 20);
+            i++;
+        }else{
+            feedIndex(a, 1000, i);
+        }
+    }
+    CHECK(a.getExpected() == 49);
+    CHECK(a.getLost() == 0);
+    // a duplicate makes received exceed expected, loss stays at zero
+    feedIndex(a, 1000, 49);
+    CHECK(a.getExpected() == 49);
+    CHECK(a.getLost() == 0);
+}
+
+static void testJitter(){
+    RtpAnalyzer a;
+    for(uint32_t i = 0; i < 300; i++){
+        // every other packet 1ms late: |D| is 8 timestamp units each time
+        feedIndex(a, 1000, i, (i % 2) ? 1000 : 0);
+    }
+    CHECK(a.getLost() == 0);
+    CHECK(a.getJitterMs() > 0.8 && a.getJitterMs() <= 1.0);
+
+    // a constant delay is not jitter
+    RtpAnalyzer late;
+    for(uint32_t i = 0; i < 300; i++){
+        feedIndex(late, 1000, i, 30000);
+    }
+    CHECK(late.getJitterMs() == 0);
+}
+
+static void testNotRtp(){
+    RtpAnalyzer a;
+    std::string junk(100, '\x17');
+    CHECK(!RtpAnalyzer::looksLikeRtp((const Byte *)junk.data(), junk.size()));
+    for(uint32_t i = 0; i < RTP_DETECT_LIMIT; i++){
+        a.process((const Byte *)junk.data(), junk.size(), START_US + i * PKT_US);
+    }
+    // real rtp after the limit is not picked up any more
+    for(uint32_t i = 0; i < 10; i++){
+        feedIndex(a, 1000, i);
+    }
+    CHECK(!a.isActive());
+    CHECK(a.getExpected() == 0);
+
+    // rtcp payload types are not rtp
+    std::string rr = rtp(1, 0, 0x11223344, 0x80 | 73);
+    CHECK(!RtpAnalyzer::looksLikeRtp((const Byte *)rr.data(), rr.size()));
+}
+
+int main(int argc, char *argv[]){
+    testClean();
+    testLoss();
+    testWrap();
+    testReorderAndDuplicate();
+    testJitter();
+    testNotRtp();
+    return testResult("rtp_analyzer");
+}
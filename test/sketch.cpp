@@ -0,0 +1,121 @@
+#include "FlowSketch.h"
+#include "TestCheck.h"
+
+#include <string.h>
+#include <vector>
+#include <map>
+
+// sketch 的误差界: count-min 只会高估, space-saving 的 [count - error, count] 包住真实值且重流都在 top-N 里,
+// 分 shard 合并后也一样
+
+static SketchKey makeKey(uint32_t i){
+    SketchKey key;
+    key.saddr = 0x0a000000 + i;
+    key.daddr = 0xc0a80001;
+    key.sport = 1024 + i % 50000;
+    key.dport = 443;
+    key.proto = 6;
+    return key;
+}
+
+// heavy keys 0..heavy-1 weigh 1000 + i, the light ones 1 each, interleaved
+static void feed(std::map<uint32_t, uint64_t> &truth, uint32_t heavy, uint32_t light, uint32_t from, uint32_t step,
+    CountMinSketch *cms, SpaceSaving *topk){
+    for(uint32_t round = 0; round < 10; round++){
+        for(uint32_t i = from; i < heavy + light; i += step){
+            uint64_t weight = (i < heavy) ? (1000 + i) / 10 : (round == 0);
+            if(weight == 0){
+                continue;
+            }
+            SketchKey key = makeKey(i);
+            if(cms){
+                cms->add(key.hash(), weight);
+            }
+            if(topk){
+                topk->add(key, key.hash(), weight);
+            }
+            truth[i] += weight;
+        }
+    }
+}
+
+static void testCountMin(){
+    CountMinSketch *cms = new CountMinSketch();
+    std::map<uint32_t, uint64_t> truth;
+    feed(truth, 20, 3000, 0, 1, cms, NULL);
+    uint64_t total = 0;
+    for(auto &item : truth){
+        total += item.second;
+    }
+    bool never = true, close = true;
+    for(auto &item : truth){
+        uint64_t est = cms->estimate(makeKey(item.first).hash());
+        never = never && est >= item.second;
+        // e / width of the total per row, with depth rows the bound rarely fails; deterministic here
+        close = close && est <= item.second + total * 3 / CMS_WIDTH;
+    }
+    CHECK(never);
+    CHECK(close);
+    CHECK(cms->estimate(makeKey(999999).hash()) <= total * 3 / CMS_WIDTH);
+    delete cms;
+}
+
+static bool hasHeavy(const std::vector<SketchEntry> &top, uint32_t heavy){
+    std::vector<bool> seen(heavy, false);
+    for(auto &entry : top){
+        uint32_t i = entry.key.saddr - 0x0a000000;
+        if(i < heavy){
+            seen[i] = true;
+        }
+    }
+    for(uint32_t i = 0; i < heavy; i++){
+        if(!seen[i]){
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool bounded(const std::vector<SketchEntry> &top, std::map<uint32_t, uint64_t> &truth){
+    for(auto &entry : top){
+        uint64_t real = truth[entry.key.saddr - 0x0a000000];
+        if(entry.count < real || entry.count - entry.error > real){
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testSpaceSaving(){
+    const uint32_t heavy = 10;
+    SpaceSaving *topk = new SpaceSaving();
+    std::map<uint32_t, uint64_t> truth;
+    feed(truth, heavy, 5000, 0, 1, NULL, topk);
+    std::vector<SketchEntry> top;
+    topk->topN(heavy, top);
+    CHECK(top.size() == heavy);
+    CHECK(hasHeavy(top, heavy));
+    CHECK(bounded(top, truth));
+    topk->topN(TOPK_CAPACITY, top);
+    CHECK(bounded(top, truth));
+
+    // two shards each seeing every other key, merged
+    SpaceSaving *a = new SpaceSaving();
+    SpaceSaving *b = new SpaceSaving();
+    std::map<uint32_t, uint64_t> truthA, truthB;
+    feed(truthA, heavy, 5000, 0, 2, NULL, a);
+    feed(truthB, heavy, 5000, 1, 2, NULL, b);
+    a->merge(*b);
+    a->topN(heavy, top);
+    CHECK(hasHeavy(top, heavy));
+    CHECK(bounded(top, truth));
+    delete topk;
+    delete a;
+    delete b;
+}
+
+int main(int argc, char *argv[]){
+    testCountMin();
+    testSpaceSaving();
+    return testResult("sketch");
+}
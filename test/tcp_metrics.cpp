@@ -0,0 +1,138 @@
+#include "Packet.h"
+#include "TcpMetrics.h"
+#include "TestCheck.h"
+
+#include <string.h>
+#include <string>
+
+// TCP 载荷长度按 ip 总长计算, 以太网填充不算载荷; 握手 RTT, 数据 RTT 和 Karn 规则
+
+static const uint32_t CLI_IP = 0x0a000001;
+static const uint32_t SER_IP = 0x0a000002;
+static const uint16_t CLI_PORT = 40000;
+static const uint16_t SER_PORT = 80;
+
+static void put16(std::string &s, size_t off, uint16_t v){
+    s[off] = v >> 8;
+    s[off + 1] = v & 0xFF;
+}
+
+static void put32(std::string &s, size_t off, uint32_t v){
+    put16(s, off, v >> 16);
+    put16(s, off + 2, v & 0xFFFF);
+}
+
+// ethernet + ipv4 + tcp frame, padded to the 60 byte minimum like a real nic
+static std::string frame(Direct d, uint8_t flags, uint32_t seq, uint32_t ack, uint32_t payload, uint32_t ipOpts = 0){
+    uint32_t ihl = 20 + ipOpts;
+    std::string s(14 + ihl + 20 + payload, 'x');
+    put16(s, 12, 0x0800);
+    s[14] = 0x40 | (ihl / 4);
+    put16(s, 16, ihl + 20 + payload);
+    s[23] = TCP_PROTOCOL_ID;
+    put32(s, 26, (d == Cli2Ser) ? CLI_IP : SER_IP);
+    put32(s, 30, (d == Cli2Ser) ? SER_IP : CLI_IP);
+    size_t t = 14 + ihl;
+    put16(s, t, (d == Cli2Ser) ? CLI_PORT : SER_PORT);
+    put16(s, t + 2, (d == Cli2Ser) ? SER_PORT : CLI_PORT);
+    put32(s, t + 4, seq);
+    put32(s, t + 8, ack);
+    s[t + 12] = 5 << 4;
+    s[t + 13] = flags;
+    put16(s, t + 14, 65535);
+    if(s.size() < 60){
+        s.append(60 - s.size(), '\0');
+    }
+    return s;
+}
+
+static Packet *packet(const std::string &s, uint64_t tsUs, uint32_t caplen = UINT32_MAX){
+    Packet *pkt = new Packet((const Byte *)s.data(), (caplen < s.size()) ? caplen : s.size());
+    pkt->ts.tv_sec = tsUs / 1000000;
+    pkt->ts.tv_usec = tsUs % 1000000;
+    return pkt;
+}
+
+static void testPayloadLen(){
+    // a pure ack padded to 60 bytes carries nothing
+    Packet *pkt = packet(frame(Cli2Ser, ACK_FLAG, 1, 1, 0), 0);
+    CHECK(pkt->datalen == 60);
+    CHECK(pkt->tcp && pkt->getDatalen() == 0);
+    delete pkt;
+
+    // 4 bytes of data, still padded
+    pkt = packet(frame(Cli2Ser, ACK_FLAG | PUSH_FLAG, 1, 1, 4), 0);
+    CHECK(pkt->tcp && pkt->getDatalen() == 4 && memcmp(pkt->getTcpData(), "xxxx", 4) == 0);
+    delete pkt;
+
+    // ip options move the tcp header
+    pkt = packet(frame(Ser2Cli, ACK_FLAG, 7, 1, 100, 8), 0);
+    CHECK(pkt->tcp && pkt->direct == Ser2Cli && pkt->tuple5.dport == SER_PORT);
+    CHECK(pkt->getDatalen() == 100 && pkt->getSeq() == 7);
+    delete pkt;
+
+    // snaplen cut the payload: only the captured bytes
+    pkt = packet(frame(Cli2Ser, ACK_FLAG, 1, 1, 1000), 0, 96);
+    CHECK(pkt->tcp && pkt->getDatalen() == 96 - 54);
+    delete pkt;
+
+    // cut inside the tcp header: not tcp, no underflow
+    pkt = packet(frame(Cli2Ser, ACK_FLAG, 1, 1, 1000), 0, 40);
+    CHECK(pkt->tcp == NULL && pkt->tuple5.tranType == TranType_NULL);
+    delete pkt;
+    pkt = packet(frame(Cli2Ser, ACK_FLAG, 1, 1, 0), 0, 20);
+    CHECK(pkt->ip == NULL);
+    delete pkt;
+}
+
+// the metrics calls SessionNode makes for a packet
+static void feed(TcpMetrics &m, Direct d, uint8_t flags, uint32_t seq, uint32_t ack, uint32_t len, uint64_t tsUs, bool retrans = false){
+    Packet *pkt = packet(frame(d, flags, seq, ack, len), tsUs);
+    m.onPacket(pkt);
+    if(pkt->getDatalen() > 0){
+        if(retrans){
+            m.onRetrans(pkt);
+        }else{
+            m.onNewData(pkt, pkt->getDatalen());
+        }
+    }
+    delete pkt;
+}
+
+static void testRtt(){
+    TcpMetrics m;
+    feed(m, Cli2Ser, SYN_FLAG, 100, 0, 0, 1000);
+    feed(m, Ser2Cli, SYN_FLAG | ACK_FLAG, 500, 101, 0, 1400);
+    feed(m, Cli2Ser, ACK_FLAG, 101, 501, 0, 1500);
+    CHECK(m.getHandshakeRttUs() == 500);
+
+    // data acked 300us later: one sample
+    feed(m, Cli2Ser, ACK_FLAG, 101, 501, 100, 2000);
+    feed(m, Ser2Cli, ACK_FLAG, 501, 201, 0, 2300);
+    const TcpDirMetrics &cli = m.getDir(Cli2Ser);
+    CHECK(cli.rttSamples == 1 && cli.srttUs == 300 && cli.minRttUs == 300);
+
+    // Karn: the timed segment is sent again, its ack is no sample
+    feed(m, Cli2Ser, ACK_FLAG, 201, 501, 100, 3000);
+    feed(m, Cli2Ser, ACK_FLAG, 201, 501, 100, 3500, true);
+    feed(m, Ser2Cli, ACK_FLAG, 501, 301, 0, 3600);
+    CHECK(cli.rttSamples == 1);
+    CHECK(cli.retransPkts == 1 && cli.retransBytes == 100);
+
+    // timing picks up again with the next new segment
+    feed(m, Cli2Ser, ACK_FLAG, 301, 501, 100, 4000);
+    feed(m, Ser2Cli, ACK_FLAG, 501, 401, 0, 4500);
+    CHECK(cli.rttSamples == 2 && cli.maxRttUs == 500);
+    // RFC 6298: srtt = 7/8 * 300 + 1/8 * 500
+    CHECK(cli.srttUs == 325);
+
+    // padded pure acks are no data, goodput counts only the new bytes
+    CHECK(cli.bytes == 400 && cli.goodBytes == 300);
+    CHECK(m.getDir(Ser2Cli).bytes == 0 && m.getRetransPkts() == 1);
+}
+
+int main(int argc, char *argv[]){
+    testPayloadLen();
+    testRtt();
+    return testResult("tcp_metrics");
+}
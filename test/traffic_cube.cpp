@@ -0,0 +1,161 @@
+#include "TrafficCube.h"
+#include "TestCheck.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <set>
+#include <string>
+#include <vector>
+
+// 时间桶合并: 两个 shard 的同一个桶合并后每个键的字节数和包数是两边之和, 总量不丢;
+// 表满以后多出来的键进 overflow, 重的那个还在 top-N 里; clear 之后的桶和新的一样
+
+static const uint64_t START_US = 1700000000ULL * 1000000;
+
+static SketchKey makeKey(uint32_t i){
+    SketchKey key;
+    key.daddr = 0xc0a80000 + i;
+    key.dport = 443;
+    key.proto = TranType_TCP;
+    return key;
+}
+
+static void put(CubeBin &bin, uint32_t i, uint64_t bytes, uint64_t pkts){
+    SketchKey key = makeKey(i);
+    bin.add(key, key.hash(), bytes, pkts);
+}
+
+static std::vector<std::string> rows(const CubeBin &bin, const CubeSpec &spec, bool late = false){
+    FILE *fp = tmpfile();
+    bin.write(fp, spec, late);
+    rewind(fp);
+    std::vector<std::string> lines;
+    char line[256];
+    while(fgets(line, sizeof(line), fp)){
+        lines.push_back(line);
+    }
+    fclose(fp);
+    return lines;
+}
+
+static std::string row(const CubeSpec &spec, uint32_t i, uint64_t bytes, uint64_t pkts){
+    char buf[64];
+    snprintf(buf, sizeof(buf), " bytes %lu pkts %lu\n", bytes, pkts);
+    return std::to_string(START_US / 1000000) + spec.keyString(makeKey(i)) + buf;
+}
+
+static void testMerge(const CubeSpec &spec){
+    // shard 0 saw keys 0..99, shard 1 keys 50..149, twice each
+    CubeBin a, b, merged;
+    a.startUs = b.startUs = START_US;
+    uint64_t bytes = 0;
+    for(uint32_t round = 0; round < 2; round++){
+        for(uint32_t i = 0; i < 100; i++){
+            put(a, i, 100 + i, 1);
+            put(b, i + 50, 1000 + i, 3);
+            bytes += 100 + i + 1000 + i;
+        }
+    }
+    merged.merge(a);
+    merged.merge(b);
+    CHECK(merged.startUs == START_US);
+
+    std::set<std::string> want;
+    for(uint32_t i = 0; i < 150; i++){
+        uint64_t kb = 0, kp = 0;
+        if(i < 100){
+            kb += 2 * (100 + i);
+            kp += 2;
+        }
+        if(i >= 50){
+            kb += 2 * (1000 + i - 50);
+            kp += 6;
+        }
+        want.insert(row(spec, i, kb, kp));
+    }
+    std::vector<std::string> lines = rows(merged, spec);
+    char head[128];
+    snprintf(head, sizeof(head), "%lu total keys 150 bytes %lu pkts 800\n", START_US / 1000000, bytes);
+    CHECK(!lines.empty() && lines[0] == head);
+    CHECK(std::set<std::string>(lines.begin() + 1, lines.end()) == want && lines.size() == 151);
+
+    // a late bin marks every row
+    std::vector<std::string> late = rows(merged, spec, true);
+    bool marked = late.size() == lines.size();
+    std::string mark = std::to_string(START_US / 1000000) + " late";
+    for(auto &l : late){
+        marked = marked && l.compare(0, mark.size(), mark) == 0;
+    }
+    CHECK(marked);
+}
+
+static void testOverflow(const CubeSpec &spec){
+    // each shard fills its table, together they have half as many keys again
+    CubeBin a, b, merged;
+    a.startUs = b.startUs = START_US;
+    const uint32_t half = CUBE_MAX_KEYS / 2;
+    uint64_t total = 0;
+    for(uint32_t i = 0; i < CUBE_MAX_KEYS; i++){
+        put(a, i, 10, 1);
+        put(b, i + half, (i == CUBE_MAX_KEYS - 1) ? 1000000 : 10, 1);
+        total += 20;
+    }
+    total += 1000000 - 10;
+    merged.merge(a);
+    merged.merge(b);
+
+    std::vector<std::string> lines = rows(merged, spec);
+    unsigned keys = 0;
+    unsigned long bytes = 0, pkts = 0;
+    CHECK(sscanf(lines[0].c_str(), "%*u total keys %u bytes %lu pkts %lu", &keys, &bytes, &pkts) == 3);
+    CHECK(keys == CUBE_MAX_KEYS && bytes == total && pkts == 2 * CUBE_MAX_KEYS);
+
+    // exact rows and the overflow add up to the total
+    uint64_t sum = 0, overflow = 0;
+    bool heavy = false;
+    std::string heavyKey = spec.keyString(makeKey(CUBE_MAX_KEYS - 1 + half));
+    for(size_t n = 1; n < lines.size(); n++){
+        unsigned long b = 0;
+        const char *p = strstr(lines[n].c_str(), " bytes ");
+        if(lines[n].find(" approx") != std::string::npos){
+            // space-saving bounds: min <= true bytes <= bytes
+            unsigned long lo = 0;
+            if(lines[n].find(heavyKey + " bytes ") != std::string::npos && sscanf(p, " bytes %lu min %lu", &b, &lo) == 2){
+                heavy = lo <= 1000000 && b >= 1000000;
+            }
+        }else if(lines[n].find(" overflow ") != std::string::npos){
+            sscanf(p, " bytes %lu", &b);
+            overflow += b;
+        }else if(p){
+            sscanf(p, " bytes %lu", &b);
+            sum += b;
+        }
+    }
+    CHECK(overflow > 0 && sum + overflow == total);
+    CHECK(heavy);
+}
+
+static void testClear(const CubeSpec &spec){
+    CubeBin bin;
+    bin.startUs = START_US;
+    for(uint32_t i = 0; i < 1000; i++){
+        put(bin, i, 1, 1);
+    }
+    bin.clear();
+    CHECK(bin.empty() && bin.startUs == 0);
+    CHECK(rows(bin, spec).empty());
+
+    // reused, no cell of the last interval shows up
+    bin.startUs = START_US;
+    put(bin, 7, 5, 1);
+    std::vector<std::string> lines = rows(bin, spec);
+    CHECK(lines.size() == 2 && lines[1] == row(spec, 7, 5, 1));
+}
+
+int main(int argc, char *argv[]){
+    CubeSpec spec;
+    testMerge(spec);
+    testOverflow(spec);
+    testClear(spec);
+    return testResult("traffic_cube");
+}